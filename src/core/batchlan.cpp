@@ -1932,6 +1932,7 @@ bool        _ExecutionList::BuildList   (_String& s, _SimpleList* bc, bool proce
               case HY_HBL_COMMAND_ALIGN_SEQUENCES:
               case HY_HBL_COMMAND_CONSTRUCT_CATEGORY_MATRIX:
               case HY_HBL_COMMAND_KEYWORD_ARGUMENT:
+              case HY_HBL_COMMAND_PARAMETRIC_BOOTSTRAP:
               case HY_HBL_COMMAND_DO_SQL:
               {
                     _ElementaryCommand::ExtractValidateAddHBLCommand (currentLine, prefixTreeCode, pieces, commandExtraInfo, *this);
@@ -2261,6 +2262,7 @@ BaseRef   _ElementaryCommand::toStr      (unsigned long) {
         case HY_HBL_COMMAND_CHOICE_LIST:
         case HY_HBL_COMMAND_SELECT_TEMPLATE_MODEL:
         case HY_HBL_COMMAND_KEYWORD_ARGUMENT:
+        case HY_HBL_COMMAND_PARAMETRIC_BOOTSTRAP:
         case HY_HBL_COMMAND_SIMULATE_DATA_SET: {
             (*string_form) << procedure (code);
         }
@@ -2624,7 +2626,15 @@ void      _ElementaryCommand::ExecuteCase5 (_ExecutionList& chain) {
                     return;
                 }
             }
-            ds = ReadDataSetFile (df,0,nil,nil,chain.nameSpacePrefix?chain.nameSpacePrefix->GetName():nil);
+            // 20261018: SLKP with DATA_FILE_CACHE, a binary cache saved next to the file is loaded instead, if it is up to date
+            bool const use_cache = hy_env::EnvVariableTrue (hy_env::data_file_cache);
+            ds = use_cache ? _DataSet::LoadCache (fName, chain.nameSpacePrefix?chain.nameSpacePrefix->GetName():nil) : nil;
+            if (!ds) {
+                ds = ReadDataSetFile (df,0,nil,nil,chain.nameSpacePrefix?chain.nameSpacePrefix->GetName():nil);
+                if (ds && use_cache) {
+                    ds->SaveCache (fName);
+                }
+            }
             fclose (df);
         }
     }
@@ -3539,6 +3549,9 @@ bool      _ElementaryCommand::Execute    (_ExecutionList& chain) {
     case HY_HBL_COMMAND_KEYWORD_ARGUMENT:
         HandleKeywordArgument (chain);
         break;
+
+    case HY_HBL_COMMAND_PARAMETRIC_BOOTSTRAP:
+        return HandleParametricBootstrap (chain);
           
     case HY_HBL_COMMAND_SET_PARAMETER:
         return HandleSetParameter(chain);
@@ -4335,8 +4348,8 @@ bool    _ElementaryCommand::ConstructDataSet (_String&source, _ExecutionList&tar
 
         } else {
             if (operation_type ==  kReconstructAncestors || operation_type == kSampleAncestors) {
-                if (arguments.countitems()>4UL || arguments.countitems()==1L) {
-                    throw  operation_type.Enquote() & " expects 1-4 parameters: likelihood function ident (mandatory), an matrix expression to specify the list of partition(s) to reconstruct/sample from (optional), and, for ReconstructAncestors, an optional MARGINAL flag, plus an optional DOLEAVES flag.";
+                if (arguments.countitems()>6UL || arguments.countitems()==1L) {
+                    throw  operation_type.Enquote() & " expects 1-5 parameters: likelihood function ident (mandatory), an matrix expression to specify the list of partition(s) to reconstruct/sample from (optional), and, for ReconstructAncestors, an optional MARGINAL flag, plus an optional DOLEAVES flag, and an optional dictionary of options ({\"SAMPLES\" : number of samples to draw, \"FILE\" : file to write the sequences to}).";
                 }
                 _ElementaryCommand * dsc = new _ElementaryCommand (operation_type ==  kReconstructAncestors ? 38 : 50);
                 dsc->parameters << arguments (0) << arguments (1);
@@ -316,7 +316,7 @@ const long cut, const long conditions, const char sep, const bool doTrim, const
     _HY_HBLCommandHelper.Insert    ((BaseRef)HY_HBL_COMMAND_LFCOMPUTE,
                                       (long)_hyInitCommandExtras (_HY_ValidHBLExpressions.Insert ("LFCompute(", HY_HBL_COMMAND_LFCOMPUTE,false),
                                                                   2, 
-                                                                  "LFCompute (<likelihood function/scfg/bgm>,<LF_START_COMPUTE|LF_DONE_COMPUTE|receptacle>)",','));
+                                                                  "LFCompute (<likelihood function/scfg/bgm>,<LF_START_COMPUTE|LF_DONE_COMPUTE|LF_GRADIENT|receptacle>)",','));
 
 
     _HY_HBLCommandHelper.Insert    ((BaseRef)HY_HBL_COMMAND_COVARIANCE_MATRIX, 
@@ -442,6 +442,17 @@ const long cut, const long conditions, const char sep, const bool doTrim, const
                                                                 false,
                                                                 &lengthOptions));
 
+    lengthOptions.Clear();lengthOptions.Populate (2,3,1); // 3 or 4
+    _HY_HBLCommandHelper.Insert    ((BaseRef)HY_HBL_COMMAND_PARAMETRIC_BOOTSTRAP,
+                                    (long)_hyInitCommandExtras (_HY_ValidHBLExpressions.Insert ("ParametricBootstrap(", HY_HBL_COMMAND_PARAMETRIC_BOOTSTRAP,false),
+                                                                -1,
+                                                                "ParametricBootstrap(<receptacle>, <likelihood function>, <number of replicates>, [optional {\"REFIT\" : likelihood function name(s), \"PROCESSES\" : number}])",
+                                                                ',',
+                                                                true,
+                                                                false,
+                                                                false,
+                                                                &lengthOptions));
+
     lengthOptions.Clear();lengthOptions.Populate (2,3,1); // 3 or 4
     _HY_HBLCommandHelper.Insert    ((BaseRef)HY_HBL_COMMAND_GET_STRING, 
                                     (long)_hyInitCommandExtras (_HY_ValidHBLExpressions.Insert ("GetString(", HY_HBL_COMMAND_GET_STRING,false),
@@ -418,6 +418,9 @@ bool      _ElementaryCommand::HandleGetDataInfo (_ExecutionList& current_program
                           kPairwiseCountAmbiguitiesSkip                   ("SKIP_AMBIGUITIES"),
                           kCharacters                                     ("CHARACTERS"),
                           kConsensus                                      ("CONSENSUS"),
+                          kPDistances                                     ("P_DISTANCES"),
+                          kK2PDistances                                   ("K2P_DISTANCES"),
+                          kTN93Distances                                  ("TN93_DISTANCES"),
                           kParameters                                     ("PARAMETERS");
 
 
@@ -494,6 +497,14 @@ bool      _ElementaryCommand::HandleGetDataInfo (_ExecutionList& current_program
                             temp.SetFilter (dataset_source, 1, l1, l2, false);
                             receptacle->SetValue (new _FString (new _String(temp.GenerateConsensusString())), false);
                         }
+                    } else if (argument == kPDistances || argument == kK2PDistances || argument == kTN93Distances) {
+                        // 20261018: SLKP all pairwise distances, computed natively
+                        if (filter_source) {
+                            _hy_dataset_filter_distance_model model = argument == kPDistances ? kDistanceP : (argument == kK2PDistances ? kDistanceK2P : kDistanceTN93);
+                            receptacle->SetValue (filter_source->ComputePairwiseDistances (model, hy_env::EnvVariableTrue(hy_env::harvest_frequencies_gap_options)), false);
+                        } else {
+                            throw (argument.Enquote('\'') & " is only available for DataSetFilter objects");
+                        }
                     }
                 } else {
                     long seqID = _ProcessNumericArgumentWithExceptions (*GetIthParameter(2),current_program.nameSpacePrefix);
@@ -1289,6 +1300,76 @@ bool      _ElementaryCommand::HandleOptimizeCovarianceMatrix (_ExecutionList& cu
 
 //____________________________________________________________________________________
 
+bool      _ElementaryCommand::HandleParametricBootstrap (_ExecutionList& current_program) {
+    /*
+        20261018: SLKP
+        ParametricBootstrap (receptacle, likelihood function, replicates, [options])
+        the receptacle is set to a (replicates x refit likelihood functions) matrix of maximized log-likelihoods;
+        REFIT names the likelihood function (or a dictionary of them) to fit to each replicate (default:
+        the simulating one) and PROCESSES the number of processes to run the replicates in (default: 1)
+    */
+
+    static const _String kRefit     ("REFIT"),
+                         kProcesses ("PROCESSES");
+
+    _Variable * receptacle = nil;
+    current_program.advance();
+
+    try {
+        receptacle = _ValidateStorageVariable (current_program);
+
+        long                  object_type = HY_BL_LIKELIHOOD_FUNCTION,
+                              object_index;
+        _LikelihoodFunction * source      = (_LikelihoodFunction*)_GetHBLObjectByTypeMutable (AppendContainerName (*GetIthParameter(1), current_program.nameSpacePrefix), object_type, &object_index);
+        long                  replicates  = _ProcessNumericArgumentWithExceptions (*GetIthParameter(2), current_program.nameSpacePrefix),
+                              processes   = 1L;
+        _SimpleList           refit;
+
+        if (parameter_count() > 3UL) {
+            _List              dynamic_variable_manager;
+            _AssociativeList * options = (_AssociativeList*)_ProcessAnArgumentByType (*GetIthParameter(3), ASSOCIATIVE_LIST, current_program, &dynamic_variable_manager);
+            HBLObjectRef       refit_names = options->GetByKey (kRefit, STRING|ASSOCIATIVE_LIST);
+
+            processes = _NumericValueFromKey (options, kProcesses, 1.);
+
+            auto add_refit = [&] (HBLObjectRef name) -> void {
+                if (!name || name->ObjectClass() != STRING) {
+                    throw (kRefit.Enquote() & " must be a likelihood function name or a dictionary of them");
+                }
+                long lf_type = HY_BL_LIKELIHOOD_FUNCTION,
+                     lf_index;
+                _GetHBLObjectByTypeMutable (AppendContainerName (((_FString*)name)->get_str(), current_program.nameSpacePrefix), lf_type, &lf_index);
+                refit << lf_index;
+            };
+
+            if (refit_names) {
+                if (refit_names->ObjectClass() == STRING) {
+                    add_refit (refit_names);
+                } else {
+                    _List * keys = ((_AssociativeList*)refit_names)->GetKeys();
+                    dynamic_variable_manager.AppendNewInstance (keys);
+                    keys->ForEach ([&] (BaseRef key, unsigned long) -> void {
+                        add_refit (((_AssociativeList*)refit_names)->GetByKey (*(_String*)key));
+                    });
+                }
+            }
+        }
+
+        if (refit.empty()) {
+            refit << object_index;
+        }
+
+        receptacle->SetValue (source->ParametricBootstrap (replicates, refit, processes), false);
+
+    } catch (const _String& error) {
+        return  _DefaultExceptionHandler (receptacle, error, current_program);
+    }
+
+    return true;
+}
+
+//____________________________________________________________________________________
+
 bool      _ElementaryCommand::HandleReplicateConstraint (_ExecutionList& current_program) {
     // TODO SLKP 20170706 this needs to be reimplemented; legacy code is ugly and buggy
 
@@ -1667,7 +1748,8 @@ bool      _ElementaryCommand::HandleComputeLFFunction (_ExecutionList& current_p
   const static _String kLFStartCompute ("LF_START_COMPUTE"),
                        kLFDoneCompute  ("LF_DONE_COMPUTE"),
                        kLFTrackCache   ("LF_TRACK_CACHE"),
-                       kLFAbandonCache ("LF_ABANDON_CACHE");
+                       kLFAbandonCache ("LF_ABANDON_CACHE"),
+                       kLFGradient     ("LF_GRADIENT");
 
   current_program.advance();
   _Variable * receptacle = nil;
@@ -1693,6 +1775,9 @@ bool      _ElementaryCommand::HandleComputeLFFunction (_ExecutionList& current_p
           source_object->DetermineLocalUpdatePolicy();
         } else if (op_kind == kLFAbandonCache) {
           source_object->FlushLocalUpdatePolicy();
+        } else if (op_kind == kLFGradient) {
+          // 20261018: SLKP; stored in <likelihood function>.gradient, see _LikelihoodFunction::GradientReport
+          CheckReceptacleAndStore (AppendContainerName (*GetIthParameter(0UL), current_program.nameSpacePrefix) & ".gradient", kEmptyString, false, source_object->GradientReport(), false);
         } else {
           receptacle = _ValidateStorageVariable (current_program, 1UL);
           receptacle->SetValue (new _Constant (source_object->Compute()), false);
@@ -2314,6 +2399,40 @@ bool      _ElementaryCommand::HandleSetParameter (_ExecutionList& current_progra
               throw (set_this_attribute.Enquote() & " did not evaluate to a matrix of strings");
             }
           }
+        } else if (object_type == HY_BL_LIKELIHOOD_FUNCTION && set_this_attribute == hy_env::kLFTopologyMove) {
+          static const _String kMoveTree    ("TREE"),
+                               kMoveKind    ("MOVE"),
+                               kMoveSubtree ("SUBTREE"),
+                               kMoveTarget  ("TARGET");
+
+          _AssociativeList * move_spec = (_AssociativeList*)_ProcessAnArgumentByType (*GetIthParameter(2UL), ASSOCIATIVE_LIST, current_program, &dynamic_variable_manager);
+          _FString         * tree_name = (_FString*)move_spec->GetByKey (kMoveTree, STRING),
+                           * move_kind = (_FString*)move_spec->GetByKey (kMoveKind, STRING),
+                           * subtree   = (_FString*)move_spec->GetByKey (kMoveSubtree, STRING),
+                           * target    = (_FString*)move_spec->GetByKey (kMoveTarget, STRING);
+
+          if (!(tree_name && move_kind && subtree && target)) {
+            throw (set_this_attribute.Enquote() & " requires string valued " & kMoveTree.Enquote() & ", " & kMoveKind.Enquote() & ", " & kMoveSubtree.Enquote() & " and " & kMoveTarget.Enquote() & " keys");
+          }
+          if (move_kind->get_str() != _String ("NNI") && move_kind->get_str() != _String ("SPR")) {
+            throw (move_kind->get_str().Enquote() & " is not a supported topology move (NNI or SPR)");
+          }
+
+          _String    tree_id = AppendContainerName (tree_name->get_str(), current_program.nameSpacePrefix);
+          _TheTree * tree    = (_TheTree*)FetchObjectFromVariableByType (&tree_id, TREE);
+          if (!tree) {
+            throw (tree_name->get_str().Enquote() & " is not an existing tree");
+          }
+
+          node<long> * subtree_node = tree->FindNodeByName (&subtree->get_str()),
+                     * target_node  = tree->FindNodeByName (&target->get_str());
+
+          if (!subtree_node || !target_node) {
+            throw (_String ("Node ") & (subtree_node ? target : subtree)->get_str().Enquote() & " is not in the tree " & tree_name->get_str().Enquote());
+          }
+          ((_LikelihoodFunction*)source_object)->ApplyTopologyMove (tree, move_kind->get_str() == _String ("SPR"), subtree_node, target_node);
+        } else if (object_type == HY_BL_LIKELIHOOD_FUNCTION && set_this_attribute == hy_env::kLFUndoTopologyMove) {
+          ((_LikelihoodFunction*)source_object)->UndoTopologyMove ();
         } else {
           _LikelihoodFunction * lkf = (_LikelihoodFunction *) source_object;
           long parameter_index = _ProcessNumericArgumentWithExceptions (set_this_attribute ,current_program.nameSpacePrefix);
@@ -3889,6 +4008,17 @@ bool      _ElementaryCommand::HandleChoiceList (_ExecutionList& current_program)
   //____________________________________________________________________________________
 
 void      _ElementaryCommand::ExecuteCase38 (_ExecutionList& chain, bool sample) {
+  /*
+      20261018: SLKP
+      an optional dictionary argument (after the partition list, if any) sets
+        SAMPLES : the number of ancestral samples to draw (SampleAncestors only; default 1), stacked along the sites
+        FILE    : write the sequences (in FASTA) directly to this file instead of keeping them in memory;
+                  the resulting DataSet is empty
+  */
+  
+  static const _String kSamples ("SAMPLES"),
+                       kFile    ("FILE");
+  
   chain.currentCommand++;
   
   _List local_object_manager;
@@ -3899,21 +4029,53 @@ void      _ElementaryCommand::ExecuteCase38 (_ExecutionList& chain, bool sample)
   long    objectID    = FindLikeFuncName (name2lookup);
   try {
     if (objectID >= 0) {
-      _DataSet     * ds               = new _DataSet;
       _String      * dsName           = new _String (AppendContainerName(*(_String*)parameters(0),chain.nameSpacePrefix));
       _LikelihoodFunction *lf         = ((_LikelihoodFunction*)likeFuncList(objectID));
       
-      local_object_manager < ds < dsName;
+      local_object_manager < dsName;
+      
+      _Matrix           * partitionList = nil;
+      _AssociativeList  * options       = nil;
+      
+      for (unsigned long argument = 2UL; argument < parameters.lLength; argument++) {
+        HBLObjectRef value = _ProcessAnArgumentByType (*GetIthParameter(argument), MATRIX|ASSOCIATIVE_LIST, chain, &local_object_manager);
+        if (value->ObjectClass() == ASSOCIATIVE_LIST) {
+          options = (_AssociativeList*)value;
+        } else {
+          partitionList = (_Matrix*)value;
+        }
+      }
+      
+      unsigned long samples = 1UL;
+      FILE        * spool   = nil;
       
-      _Matrix * partitionList         = nil;
-      if (parameters.lLength>2) {
-        _String  secondArg = *GetIthParameter(2);
-        local_object_manager < (partitionList = (_Matrix*)ProcessAnArgumentByType (&secondArg, chain.nameSpacePrefix, MATRIX));
+      if (options) {
+        hyFloat requested_samples = _NumericValueFromKey (options, kSamples, 1.);
+        if (requested_samples < 1.) {
+          throw (kSamples.Enquote() & " must be a positive number");
+        }
+        samples = requested_samples;
+        
+        _FString * file_name = (_FString*)options->GetByKey (kFile, STRING);
+        if (file_name) {
+          _String spool_file = file_name->get_str();
+          ProcessFileName(spool_file);
+          spool = doFileOpen (spool_file,"w");
+          if (!spool) {
+            throw (_String("Failed to open ") & spool_file.Enquote() & " for writing");
+          }
+        }
       }
+      
+      _DataSet     * ds               = spool ? new _DataSet (spool) : new _DataSet;
+      local_object_manager < ds;
+      
       _SimpleList                     partsToDo;
       
       if (lf->ProcessPartitionList(partsToDo, partitionList)) {
-        lf->ReconstructAncestors(*ds, partsToDo, *dsName,  sample, simpleParameters.Find(-1) >= 0, simpleParameters.Find(-2) >= 0 );
+        lf->ReconstructAncestors(*ds, partsToDo, *dsName,  sample, simpleParameters.Find(-1) >= 0, simpleParameters.Find(-2) >= 0, samples);
+      } else if (spool) {
+        ds->Finalize();
       }
       
       ds->AddAReference();
@@ -555,6 +555,10 @@ bool        _CalcNode::RecomputeMatrix  (long categID, long totalCategs, _Matrix
 
             if (storeRateMatrix) {
                 storeRateMatrix->Duplicate(temp);
+                if (isExplicitForm) {
+                    // a copy made above; MultByFreqs returns a matrix owned by the model
+                    DeleteObject (temp);
+                }
                 return isExplicitForm;
             }
 
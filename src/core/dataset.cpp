@@ -38,6 +38,7 @@
  */
 
 #include <ctype.h>
+#include <stdint.h>
 
 #include "dataset.h"
 #include "translation_table.h"
@@ -45,10 +46,25 @@
 #include "site.h"
 #include "global_object_lists.h"
 
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+#ifdef __UNIX__
+    // FASTA files and data set caches are read from memory maps
+    // (see ReadMappedFASTA and _DataSet::LoadCache)
+    #define _HY_MAPPED_DATA_FILES_
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 using namespace hyphy_global_objects;
 
 
 #define DATA_SET_SWITCH_THRESHOLD 100000
+#define _HY_DATASET_COLUMN_BLOCK  8192L
+#define _HY_DATASET_COLUMN_CHUNK  1048576L
 
 
 _DataSet::_DataSet(void) {
@@ -406,6 +422,228 @@ void _DataSet::SetTranslationTable(_TranslationTable *newTT) {
   }
   theTT = (_TranslationTable *)newTT->makeDynamic();
 }
+//_______________________________________________________________________
+/* 20261018: SLKP
+    unique column patterns of an alignment that is supplied in chunks of
+    columns, as one row of characters per sequence (see _DataSet::Finalize and
+    ReadMappedFASTA): each column gets a 64-bit hash (computed in parallel over
+    column ranges), columns are matched to patterns by hash through an
+    open-addressing table, and the matches are then verified character by
+    character (again in parallel). Only if two different columns share a hash
+    is the chunk matched again with full comparisons. Patterns are numbered in
+    the order of their first occurrence.
+*/
+
+class _ColumnPatternIndex {
+public:
+  _ColumnPatternIndex(unsigned long sequences)
+      : species(sequences), mask(1023UL), table((long)mask + 1L, 0L, 0L) {
+    threads = 1L;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+  }
+
+  void AddColumns(char const **rows, long count);
+  // rows[s][i] is the character of sequence s in column i (0 <= i < count)
+
+  void MoveTo(_List &patterns, _SimpleList &map, _SimpleList &counts);
+  // hand over the patterns (appended as _Site objects), the map from columns
+  // to patterns, and the number of columns with each pattern
+
+private:
+  void Rehash(void);
+
+  unsigned long species, mask;
+  _SimpleList table, // pattern index + 1; 0 = empty
+      hashes,        // the hash of each pattern
+      column_map, frequencies;
+  _List patterns;
+  long threads;
+};
+
+//_______________________________________________________________________
+void _ColumnPatternIndex::Rehash(void) {
+  table.Clear();
+  table.Populate((long)mask + 1L, 0L, 0L);
+  for (unsigned long p = 0UL; p < hashes.lLength; p++) {
+    unsigned long slot = (unsigned long)hashes.list_data[p] & mask;
+    while (table.list_data[slot]) {
+      slot = (slot + 1UL) & mask;
+    }
+    table.list_data[slot] = p + 1L;
+  }
+}
+
+//_______________________________________________________________________
+void _ColumnPatternIndex::AddColumns(char const **rows, long count) {
+  if (count <= 0L) {
+    return;
+  }
+
+  long const block_count =
+                 (count + _HY_DATASET_COLUMN_BLOCK - 1L) / _HY_DATASET_COLUMN_BLOCK,
+             chunk_threads = MAX(1L, MIN(threads, block_count)),
+             first_new = hashes.lLength, first_column = column_map.lLength;
+
+  // 64-bit on every target (unsigned long is 32 bits on LLP64)
+  uint64_t *column_hashes =
+      (uint64_t *)MemAllocate(sizeof(uint64_t) * count);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static) if (chunk_threads > 1) num_threads(chunk_threads)
+#endif
+  for (long block = 0L; block < block_count; block++) {
+    long const from = block * _HY_DATASET_COLUMN_BLOCK,
+               to = MIN(from + _HY_DATASET_COLUMN_BLOCK, count);
+
+    for (long i = from; i < to; i++) {
+      column_hashes[i] = UINT64_C(0xcbf29ce484222325); // FNV-1a
+    }
+    for (unsigned long s = 0UL; s < species; s++) {
+      const unsigned char *row = (const unsigned char *)rows[s];
+      for (long i = from; i < to; i++) {
+        column_hashes[i] = (column_hashes[i] ^ row[i]) * UINT64_C(0x100000001b3);
+      }
+    }
+    for (long i = from; i < to; i++) { // spread the bits over the table
+      uint64_t h = column_hashes[i];
+      h ^= h >> 33;
+      h *= UINT64_C(0xff51afd7ed558ccd);
+      column_hashes[i] = h ^ (h >> 33);
+    }
+  }
+
+  _SimpleList representatives; // the column of each new pattern
+
+  auto column_matches = [&](long pattern, long column) -> bool {
+    if (pattern < first_new) {
+      _Site const *site = (_Site const *)patterns.list_data[pattern];
+      for (unsigned long s = 0UL; s < species; s++) {
+        if (site->char_at(s) != rows[s][column]) {
+          return false;
+        }
+      }
+    } else {
+      long const other = representatives.list_data[pattern - first_new];
+      for (unsigned long s = 0UL; s < species; s++) {
+        if (rows[s][other] != rows[s][column]) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+
+  auto match_columns = [&](bool compare) -> void {
+    for (long i = 0L; i < count; i++) {
+      unsigned long slot = (unsigned long)column_hashes[i] & mask;
+      long pattern = -1L;
+
+      while (table.list_data[slot]) {
+        long const candidate = table.list_data[slot] - 1L;
+        if (hashes.list_data[candidate] == (long)column_hashes[i] &&
+            (!compare || column_matches(candidate, i))) {
+          pattern = candidate;
+          break;
+        }
+        slot = (slot + 1UL) & mask;
+      }
+
+      if (pattern < 0L) {
+        pattern = hashes.lLength;
+        table.list_data[slot] = pattern + 1L;
+        hashes << (long)column_hashes[i];
+        frequencies << 0L;
+        representatives << i;
+        if (hashes.lLength * 2UL > mask) { // keep the load <= 1/2
+          mask = (mask << 1) | 1UL;
+          Rehash();
+        }
+      }
+      column_map << pattern;
+      frequencies.list_data[pattern]++;
+    }
+  };
+
+  match_columns(false);
+
+  bool collision = false;
+  long const *chunk_map = column_map.list_data + first_column;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static) if (chunk_threads > 1) num_threads(chunk_threads) reduction(||:collision)
+#endif
+  for (long block = 0L; block < block_count; block++) {
+    long const from = block * _HY_DATASET_COLUMN_BLOCK,
+               to = MIN(from + _HY_DATASET_COLUMN_BLOCK, count);
+    for (unsigned long s = 0UL; s < species && !collision; s++) {
+      char const *row = rows[s];
+      for (long i = from; i < to; i++) {
+        long const pattern = chunk_map[i];
+        char const expected =
+            pattern < first_new
+                ? ((_Site const *)patterns.list_data[pattern])->char_at(s)
+                : row[representatives.list_data[pattern - first_new]];
+        if (row[i] != expected) {
+          collision = true;
+          break;
+        }
+      }
+    }
+  }
+
+  if (collision) { // undo this chunk, and match it again
+    for (long i = 0L; i < count; i++) {
+      frequencies.list_data[chunk_map[i]]--;
+    }
+    column_map.lLength = first_column;
+    hashes.lLength = first_new;
+    frequencies.lLength = first_new;
+    representatives.Clear();
+    Rehash();
+    match_columns(true);
+  }
+
+  free(column_hashes);
+
+  // one _Site per new pattern
+
+  long const pattern_count = hashes.lLength;
+  for (long p = first_new; p < pattern_count; p++) {
+    patterns.AppendNewInstance(new _Site());
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static) if (chunk_threads > 1 && pattern_count - first_new >= _HY_DATASET_COLUMN_BLOCK) num_threads(chunk_threads)
+#endif
+  for (long p = first_new; p < pattern_count; p++) {
+    _Site *site = (_Site *)patterns.list_data[p];
+    long const column = representatives.list_data[p - first_new];
+    for (unsigned long s = 0UL; s < species; s++) {
+      (*site) << rows[s][column];
+    }
+  }
+}
+
+//_______________________________________________________________________
+void _ColumnPatternIndex::MoveTo(_List &target, _SimpleList &map,
+                                 _SimpleList &counts) {
+  target.RequestSpace(target.lLength + patterns.lLength);
+  for (unsigned long p = 0UL; p < patterns.lLength; p++) {
+    target << patterns.GetItem(p);
+  }
+  map.Clear();
+  map.Duplicate(&column_map);
+  counts.Clear();
+  counts.Duplicate(&frequencies);
+  patterns.Clear();
+  column_map.Clear();
+  frequencies.Clear();
+  hashes.Clear();
+  Rehash();
+}
+
 //_______________________________________________________________________
 void _DataSet::Finalize(void) {
   if (streamThrough) {
@@ -428,36 +666,26 @@ void _DataSet::Finalize(void) {
         return;
       }
 
-      _List dups;
-      _List uniquePats;
-      _AVLListX dupsAVL(&dups);
-
-      long siteCounter = ((_String *)list_data[0])->length();
-
-      for (long i1 = 0L; i1 < siteCounter; i1++) {
-        _Site *tC = new _Site();
+      /* 20261018: SLKP
+          columns are deduplicated in place from the horizontal (one string per
+          sequence) representation, a chunk of columns at a time, without
+          building a _Site for every column (see _ColumnPatternIndex)
+      */
 
-        for (long i2 = 0L; i2 < lLength; i2++) {
-          (*tC) << ((_String *)list_data[i2])->get_char(i1);
-        }
+      long const site_count = ((_String *)list_data[0])->length();
+      char const **rows = (char const **)MemAllocate(sizeof(char const *) * lLength);
+      _ColumnPatternIndex index(lLength);
 
-        long ff = dupsAVL.Find(tC);
-        if (ff < 0) {
-          uniquePats << tC;
-          dupsAVL.Insert(tC, theFrequencies.lLength);
-          theMap << theFrequencies.lLength;
-          theFrequencies << 1;
-        } else {
-          ff = dupsAVL.GetXtra(ff);
-          theMap << ff;
-          theFrequencies.list_data[ff]++;
+      for (long from = 0L; from < site_count; from += _HY_DATASET_COLUMN_CHUNK) {
+        for (long s = 0L; s < lLength; s++) {
+          rows[s] = ((_String *)list_data[s])->get_str() + from;
         }
-
-        DeleteObject(tC);
+        index.AddColumns(rows, MIN(_HY_DATASET_COLUMN_CHUNK, site_count - from));
       }
-      dupsAVL.Clear(false);
+      free(rows);
+
       _List::Clear();
-      _List::Duplicate(&uniquePats);
+      index.MoveTo(*this, theMap, theFrequencies);
     } else {
       long j, k;
 
@@ -1961,6 +2189,197 @@ void    TrimPhylipLine (_String& CurrentLine, _DataSet& ds) {
 }
 
 
+#ifdef _HY_MAPPED_DATA_FILES_
+//_________________________________________________________
+static bool ReadMappedFASTA (FILE* f, FileState& fState, _DataSet& result, _ColumnPatternIndex*& index) {
+    /*
+        20261018: SLKP
+        FASTA files (each name on a line that starts with '>', followed by its sequence on
+        one or more lines) are parsed straight from a memory map of the file: lines are
+        located with memchr, the sequences are scanned in parallel (one taxon per task), and
+        the alignment is fed to a _ColumnPatternIndex a chunk of columns at a time, so that
+        only the unique site patterns (and one chunk) are ever held in memory. Files with
+        anything else (commands, trees, comments, '.' for repeated characters, names without
+        data) are left to the line by line reader; returns false in that case
+    */
+    
+    struct stat file_info;
+    int const   descriptor = fileno (f);
+    
+    if (descriptor < 0 || fstat (descriptor, &file_info) != 0 || !S_ISREG (file_info.st_mode) || file_info.st_size <= 0) {
+        return false;
+    }
+    
+    unsigned long const size    = file_info.st_size;
+    void               *mapping = mmap (nil, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise (mapping, size, MADV_SEQUENTIAL);
+    
+    char const * data = (char const*)mapping,
+               * end  = data + size;
+    
+    // [start, end) offsets of each name and of the text of each sequence
+    _SimpleList name_from, name_to, body_from, body_to;
+    bool        eligible  = true,
+                has_data  = false;
+    
+    for (char const * line = data; line < end && eligible; ) {
+        char const * line_end = (char const*)memchr (line, '\n', end - line);
+        if (!line_end) {
+            line_end = end;
+        }
+        char const * first = line;
+        while (first < line_end && isspace ((unsigned char)*first)) {
+            first ++;
+        }
+        if (first < line_end) {
+            char const c = *first;
+            if (c == '>') {
+                if (body_from.nonempty()) {
+                    if (!has_data) {
+                        eligible = false;
+                        break;
+                    }
+                    body_to << line - data;
+                }
+                char const * name_end = line_end;
+                first ++;
+                while (first < name_end && isspace ((unsigned char)*first)) {
+                    first ++;
+                }
+                while (name_end > first && isspace ((unsigned char)name_end[-1])) {
+                    name_end --;
+                }
+                if (memchr (first, '\r', name_end - first)) {
+                    eligible = false; // bare carriage returns end lines too
+                    break;
+                }
+                name_from << first - data;
+                name_to   << name_end - data;
+                body_from << line_end - data;
+                has_data = false;
+            } else if (c == '$' || c == '(' || c == '#' || (c == '/' && first + 1 < line_end && first[1] == '/') || body_from.empty()) {
+                eligible = false;
+            } else {
+                has_data = true;
+            }
+        }
+        line = line_end + 1;
+    }
+    
+    unsigned long const species = body_from.lLength;
+    
+    if (eligible && (species == 0UL || !has_data)) {
+        eligible = false;
+    }
+    if (eligible) {
+        body_to << size;
+    }
+    
+    // characters are upper-cased, and those that are not in the alphabet are skipped
+    
+    char legal [256];
+    for (long c = 0L; c < 256L; c++) {
+        char const upper = toupper (c);
+        legal[c] = c && fState.translationTable->IsCharLegal (upper) ? upper : 0;
+    }
+    
+    _SimpleList lengths (species, 0L, 0L);
+    long        threads = 1L;
+#ifdef _OPENMP
+    threads = MAX (1L, MIN ((long)omp_get_max_threads(), (long)species));
+#endif
+    
+    if (eligible) {
+#ifdef _OPENMP
+  #pragma omp parallel for default(shared) schedule(dynamic) if (threads > 1) num_threads(threads) reduction(&&:eligible)
+#endif
+        for (unsigned long s = 0UL; s < species; s++) {
+            long length = 0L;
+            for (long k = body_from.list_data[s]; k < body_to.list_data[s]; k++) {
+                char const c = legal[(unsigned char)data[k]];
+                if (c) {
+                    if (c == fState.repeat && s > 0UL) {
+                        eligible = false;
+                        break;
+                    }
+                    length ++;
+                } else if (data[k] == '\r' && k + 1L < (long)size && data[k+1] != '\n') {
+                    eligible = false; // bare carriage returns end lines too
+                    break;
+                }
+            }
+            lengths.list_data[s] = length;
+        }
+    }
+    
+    if (!eligible) {
+        munmap (mapping, size);
+        return false;
+    }
+    
+    fState.fileType             = 0;
+    fState.acceptingCommands    = false;
+    fState.skip                 = fState.translationTable->GetSkipChar();
+    fState.totalSpeciesExpected = fState.totalSpeciesRead = species;
+    
+    for (unsigned long s = 0UL; s < species; s++) {
+        _StringBuffer name (name_to.list_data[s] - name_from.list_data[s] + 1UL);
+        for (long k = name_from.list_data[s]; k < name_to.list_data[s]; k++) {
+            name << data[k];
+        }
+        if (name.empty() || name.char_at (0) == '>' || name.char_at (0) == '#') {
+            result.AddName (_String ("Species") & _String ((long)s + 1L)); // as the line reader does
+        } else {
+            result.AddName (name);
+        }
+    }
+    
+    // the alignment is read in chunks of columns (about 64MB each), all sequences in parallel
+    
+    long const   site_count = lengths.Max(),
+                 chunk      = MIN (MAX (1L, site_count), MAX (256L, (1L << 26) / (long)species));
+    char       * buffer     = (char*)MemAllocate (species * chunk);
+    char const** rows       = (char const**)MemAllocate (sizeof (char const*) * species);
+    _SimpleList  cursors (body_from);
+    
+    index = new _ColumnPatternIndex (species);
+    
+    for (long from = 0L; from < site_count; from += chunk) {
+        long const width = MIN (chunk, site_count - from);
+#ifdef _OPENMP
+  #pragma omp parallel for default(shared) schedule(dynamic) if (threads > 1) num_threads(threads)
+#endif
+        for (unsigned long s = 0UL; s < species; s++) {
+            char * row    = buffer + s * width;
+            long   filled = 0L,
+                   k      = cursors.list_data[s];
+            long const last = body_to.list_data[s];
+            for (; k < last && filled < width; k++) {
+                char const c = legal[(unsigned char)data[k]];
+                if (c) {
+                    row[filled++] = c;
+                }
+            }
+            cursors.list_data[s] = k;
+            for (; filled < width; filled++) {
+                row[filled] = fState.skip;
+            }
+            rows[s] = row;
+        }
+        index->AddColumns (rows, width);
+    }
+    
+    free (buffer);
+    free (rows);
+    munmap (mapping, size);
+    return true;
+}
+#endif
+
 //_________________________________________________________
 _DataSet* ReadDataSetFile (FILE*f, char execBF, _String* theS, _String* bfName, _String* namespaceID, _TranslationTable* dT, _ExecutionList* ex) {
     
@@ -2037,8 +2456,24 @@ _DataSet* ReadDataSetFile (FILE*f, char execBF, _String* theS, _String* bfName,
         
         CurrentLine = kEmptyString;
         
-        ReadNextLine (f,&CurrentLine,&fState);
-        if (CurrentLine.empty()) {
+        bool mapped = false;
+        
+    #ifdef _HY_MAPPED_DATA_FILES_
+        _ColumnPatternIndex * mapped_patterns = nil;
+        if (f && ReadMappedFASTA (f, fState, *result, mapped_patterns)) {
+            mapped_patterns->MoveTo (*result, result->theMap, result->theFrequencies);
+            delete mapped_patterns;
+            mapped = true;
+        }
+    #endif
+        
+        if (!mapped) {
+            ReadNextLine (f,&CurrentLine,&fState);
+        }
+        
+        if (mapped) {
+            // read from the memory map of the file
+        } else if (CurrentLine.empty()) {
             throw _String ("Empty File Encountered By ReadDataSet.");
         } else {
             if (CurrentLine.BeginsWith (kNEXUS,false)) {
@@ -2266,7 +2701,9 @@ _DataSet* ReadDataSetFile (FILE*f, char execBF, _String* theS, _String* bfName,
         
         // make sure interleaved duplications are handled correctly
         
-        result->Finalize();
+        if (!mapped) {
+            result->Finalize();
+        }
         result->noOfSpecies       = fState.totalSpeciesRead;
         result->theTT             = fState.translationTable;
         
@@ -2342,3 +2779,397 @@ _DataSet* ReadDataSetFile (FILE*f, char execBF, _String* theS, _String* bfName,
 }
 
 
+
+//_________________________________________________________
+
+/* 20261018: SLKP
+    binary cache of a finalized data set, saved next to the data file that it was read from
+    (source & kDataSetCacheExtension) and loaded by DataSet = ReadDataFile (...) in place of
+    the data file for as long as the latter keeps the same size and modification time.
+ 
+    layout (native byte order): a _DataSetCacheHeader, followed by the payload
+        translation table : base length, tokensAdded, baseSet, translationsAdded
+                            (absent if the data set uses the default table)
+        tree              : the DATAFILE_TREE string read with the data (absent if none)
+        names             : one length-prefixed string per sequence
+        patterns          : species characters for each unique site pattern
+        theMap            : the pattern index of each site
+        theFrequencies    : the number of sites with each pattern
+    strings are stored as their length followed by their characters; lists as their length
+    followed by their elements; the payload is checked against its FNV-1a hash when loaded
+*/
+
+const _String kDataSetCacheExtension (".hyphy-dset");
+
+#define _HY_DATASET_CACHE_VERSION       2UL
+#define _HY_DATASET_CACHE_BYTE_ORDER    0x0102030405060708UL
+#define _HY_DATASET_CACHE_DEFAULT_TABLE 0x01UL
+#define _HY_DATASET_CACHE_TREE          0x02UL
+
+struct _DataSetCacheHeader {
+    char          magic [8];
+    unsigned long byte_order,
+                  version,
+                  flags,
+                  source_size,
+                  source_seconds,
+                  source_nanoseconds,
+                  species,
+                  sites,
+                  patterns,
+                  reader_settings,
+                  payload_size,
+                  payload_hash;
+};
+
+static const char kDataSetCacheMagic [8] = {'H','Y','P','H','Y','D','S','\0'};
+
+#ifdef _HY_MAPPED_DATA_FILES_
+
+//_________________________________________________________
+static unsigned long DataSetCacheHash (unsigned long hash, char const * data, unsigned long size) {
+    for (unsigned long i = 0UL; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3UL;
+    }
+    return hash;
+}
+
+//_________________________________________________________
+static bool DataSetCacheSourceState (_String const & source, unsigned long & size, unsigned long & seconds, unsigned long & nanoseconds) {
+    struct stat file_info;
+    if (stat (source.get_str(), &file_info) != 0 || !S_ISREG (file_info.st_mode)) {
+        return false;
+    }
+    size        = file_info.st_size;
+    seconds     = file_info.st_mtime;
+#ifdef __APPLE__
+    nanoseconds = file_info.st_mtimespec.tv_nsec;
+#else
+    nanoseconds = file_info.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+//_________________________________________________________
+static unsigned long DataSetCacheReaderSettings (void) {
+    /*
+        a fingerprint of the settings in effect when a file is read (the default translation table, and the
+        default and gap widths of data files); a cache saved under different settings is not loaded
+    */
+    unsigned long hash = 0xcbf29ce484222325UL;
+    long const    base_length = hy_default_translation_table.baseLength;
+    hash = DataSetCacheHash (hash, (char const*)&base_length, sizeof (long));
+    hash = DataSetCacheHash (hash, hy_default_translation_table.tokensAdded.get_str(), hy_default_translation_table.tokensAdded.length());
+    hash = DataSetCacheHash (hash, hy_default_translation_table.baseSet.get_str(), hy_default_translation_table.baseSet.length());
+    hash = DataSetCacheHash (hash, (char const*)hy_default_translation_table.translationsAdded.list_data, hy_default_translation_table.translationsAdded.lLength * sizeof (long));
+    hyFloat const widths [2] = {hy_env::EnvVariableGetNumber (hy_env::data_file_default_width),
+                                 hy_env::EnvVariableGetNumber (hy_env::data_file_gap_width)};
+    return DataSetCacheHash (hash, (char const*)widths, sizeof (widths));
+}
+
+#endif
+
+//_________________________________________________________
+_DataSet * _DataSet::LoadCache (_String const & source, _String * namespace_id) {
+#ifdef _HY_MAPPED_DATA_FILES_
+    _String const cache_path = source & kDataSetCacheExtension;
+    
+    _DataSetCacheHeader header;
+    unsigned long       source_size, source_seconds, source_nanoseconds;
+    struct stat         file_info;
+    
+    if (!DataSetCacheSourceState (source, source_size, source_seconds, source_nanoseconds)) {
+        return nil;
+    }
+    
+    FILE * cache_file = doFileOpen (cache_path.get_str(), "rb");
+    if (!cache_file) {
+        return nil;
+    }
+    
+    int const descriptor = fileno (cache_file);
+    void    * mapping    = MAP_FAILED;
+    
+    if (fstat (descriptor, &file_info) == 0 && (unsigned long)file_info.st_size >= sizeof (_DataSetCacheHeader)) {
+        mapping = mmap (nil, file_info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    fclose (cache_file);
+    
+    if (mapping == MAP_FAILED) {
+        return nil;
+    }
+    
+    unsigned long const mapped_size = file_info.st_size;
+    char const *        data        = (char const*)mapping;
+    
+    memcpy (&header, data, sizeof (_DataSetCacheHeader));
+    
+    if (memcmp (header.magic, kDataSetCacheMagic, sizeof (kDataSetCacheMagic)) || header.byte_order != _HY_DATASET_CACHE_BYTE_ORDER ||
+        header.version != _HY_DATASET_CACHE_VERSION || header.payload_size != mapped_size - sizeof (_DataSetCacheHeader) ||
+        header.source_size != source_size || header.source_seconds != source_seconds || header.source_nanoseconds != source_nanoseconds ||
+        header.reader_settings != DataSetCacheReaderSettings ()) {
+        // not a cache, written by a different version or under different reader settings, or stale
+        munmap (mapping, mapped_size);
+        return nil;
+    }
+    
+    char const * payload = data + sizeof (_DataSetCacheHeader);
+    
+    if (DataSetCacheHash (0xcbf29ce484222325UL, payload, header.payload_size) != header.payload_hash) {
+        munmap (mapping, mapped_size);
+        ReportWarning (_String ("Ignored the damaged data set cache ") & cache_path.Enquote());
+        return nil;
+    }
+    
+    // the payload has been verified, so only the lengths recorded in it need checking
+    
+    unsigned long cursor    = 0UL;
+    bool          truncated = false;
+    
+    auto read = [&] (void * to, unsigned long bytes) -> void {
+        if (truncated || cursor + bytes > header.payload_size) {
+            truncated = true;
+        } else {
+            memcpy (to, payload + cursor, bytes);
+            cursor += bytes;
+        }
+    };
+    
+    auto read_number = [&] (void) -> unsigned long {
+        unsigned long value = 0UL;
+        read (&value, sizeof (unsigned long));
+        return value;
+    };
+    
+    auto read_string = [&] (_StringBuffer & to) -> void {
+        unsigned long const length = read_number ();
+        if (truncated || cursor + length > header.payload_size) {
+            truncated = true;
+        } else {
+            for (unsigned long k = 0UL; k < length; k++) {
+                to << payload[cursor + k];
+            }
+            cursor += length;
+        }
+    };
+    
+    auto read_list = [&] (_SimpleList & to, unsigned long expected) -> void {
+        unsigned long const length = read_number ();
+        if (truncated || length != expected || cursor + length * sizeof (long) > header.payload_size) {
+            truncated = true;
+        } else {
+            to.Clear();
+            to.RequestSpace (length);
+            memcpy (to.list_data, payload + cursor, length * sizeof (long));
+            to.lLength = length;
+            cursor += length * sizeof (long);
+        }
+    };
+    
+    _DataSet * result = new _DataSet;
+    
+    if (!(header.flags & _HY_DATASET_CACHE_DEFAULT_TABLE)) {
+        _TranslationTable * table = new _TranslationTable;
+        _StringBuffer       tokens, base_set;
+        table->baseLength = read_number ();
+        read_string (tokens);
+        read_string (base_set);
+        read_list   (table->translationsAdded, tokens.length());
+        table->tokensAdded = tokens;
+        table->baseSet     = base_set;
+        result->theTT      = table;
+    }
+    
+    _StringBuffer tree;
+    if (header.flags & _HY_DATASET_CACHE_TREE) {
+        read_string (tree);
+    }
+    
+    for (unsigned long s = 0UL; s < header.species && !truncated; s++) {
+        _StringBuffer name;
+        read_string (name);
+        result->AddName (name);
+    }
+    
+    if (truncated || cursor + header.patterns * header.species > header.payload_size) {
+        truncated = true;
+    } else {
+        char const * patterns = payload + cursor;
+        result->RequestSpace (header.patterns);
+        for (unsigned long p = 0UL; p < header.patterns; p++) {
+            result->AppendNewInstance (new _Site ());
+        }
+#ifdef _OPENMP
+  #pragma omp parallel for default(shared) schedule(static) if (header.patterns >= _HY_DATASET_COLUMN_BLOCK)
+#endif
+        for (unsigned long p = 0UL; p < header.patterns; p++) {
+            _Site * site = (_Site*)result->list_data[p];
+            char const * column = patterns + p * header.species;
+            for (unsigned long s = 0UL; s < header.species; s++) {
+                (*site) << column[s];
+            }
+        }
+        cursor += header.patterns * header.species;
+    }
+    
+    read_list (result->theMap, header.sites);
+    read_list (result->theFrequencies, header.patterns);
+    
+    munmap (mapping, mapped_size);
+    
+    // every site must map to a pattern, and the pattern counts must match the map
+    
+    if (!truncated) {
+        _SimpleList counts (header.patterns, 0, 0);
+        for (unsigned long s = 0UL; s < header.sites && !truncated; s++) {
+            long const p = result->theMap.get (s);
+            if (p < 0L || (unsigned long)p >= header.patterns) {
+                truncated = true;
+            } else {
+                counts[p]++;
+            }
+        }
+        truncated = truncated || !counts.Equal (result->theFrequencies);
+    }
+    
+    if (truncated || cursor != header.payload_size) {
+        DeleteObject (result);
+        ReportWarning (_String ("Ignored the malformed data set cache ") & cache_path.Enquote());
+        return nil;
+    }
+    
+    result->noOfSpecies = header.species;
+    
+    // the same side effects on DATAFILE_TREE as reading the data file
+    
+    _String        reset_tree = hy_env::data_file_tree_string & "={{}};";
+    _ExecutionList reset (reset_tree);
+    reset.Execute();
+    hy_env::EnvVariableSet(hy_env::data_file_tree, new HY_CONSTANT_FALSE, false);
+    if (header.flags & _HY_DATASET_CACHE_TREE) {
+        hy_env::EnvVariableSetNamespace(hy_env::data_file_tree, new HY_CONSTANT_TRUE, namespace_id, false);
+        hy_env::EnvVariableSetNamespace(hy_env::data_file_tree_string, new _FString (tree), nil, false);
+    }
+    
+    return result;
+#else
+    return nil;
+#endif
+}
+
+//_________________________________________________________
+bool _DataSet::SaveCache (_String const & source) const {
+    /*
+        must be called right after the data set has been read from 'source'
+        (the tree read with it is taken from DATAFILE_TREE); NEXUS files, which
+        have other side effects (tree and partition matrices, HBL blocks) are not cached
+    */
+#ifdef _HY_MAPPED_DATA_FILES_
+    if (useHorizontalRep || streamThrough || noOfSpecies == 0UL || theMap.empty() || theNames.lLength != noOfSpecies) {
+        return false;
+    }
+    
+    for (unsigned long p = 0UL; p < lLength; p++) {
+        if (((_String*)list_data[p])->length() != noOfSpecies) {
+            return false;
+        }
+    }
+    
+    _DataSetCacheHeader header;
+    memset (&header, 0, sizeof (_DataSetCacheHeader));
+    if (!DataSetCacheSourceState (source, header.source_size, header.source_seconds, header.source_nanoseconds)) {
+        return false;
+    }
+    
+    FILE * source_file = doFileOpen (source.get_str(), "rb");
+    if (!source_file) {
+        return false;
+    }
+    _String const file_start (source_file, 256L);
+    fclose (source_file);
+    long const first_character = file_start.FirstNonSpaceIndex();
+    if (first_character != kNotFound && _String (file_start, first_character, kStringEnd).BeginsWith ("#NEXUS", false)) {
+        return false;
+    }
+    
+    _FString * tree = (_FString*)hy_env::EnvVariableGet (hy_env::data_file_tree_string, STRING);
+    
+    memcpy (header.magic, kDataSetCacheMagic, sizeof (kDataSetCacheMagic));
+    header.byte_order   = _HY_DATASET_CACHE_BYTE_ORDER;
+    header.version      = _HY_DATASET_CACHE_VERSION;
+    header.flags        = (theTT == &hy_default_translation_table ? _HY_DATASET_CACHE_DEFAULT_TABLE : 0UL) |
+                          (tree ? _HY_DATASET_CACHE_TREE : 0UL);
+    header.species      = noOfSpecies;
+    header.sites        = theMap.lLength;
+    header.patterns     = lLength;
+    header.reader_settings = DataSetCacheReaderSettings ();
+    header.payload_hash = 0xcbf29ce484222325UL;
+    
+    // written to a temporary file first, and renamed into place when complete
+    
+    _String const cache_path = source & kDataSetCacheExtension,
+                  temp_path  = cache_path & '.' & _String ((long)getpid());
+    
+    FILE * cache_file = doFileOpen (temp_path.get_str(), "wb");
+    if (!cache_file) {
+        return false;
+    }
+    
+    bool ok = fwrite (&header, sizeof (_DataSetCacheHeader), 1, cache_file) == 1;
+    
+    auto write = [&] (void const * from, unsigned long bytes) -> void {
+        if (ok && bytes) {
+            ok = fwrite (from, 1, bytes, cache_file) == bytes;
+            header.payload_hash  = DataSetCacheHash (header.payload_hash, (char const*)from, bytes);
+            header.payload_size += bytes;
+        }
+    };
+    
+    auto write_number = [&] (unsigned long value) -> void {
+        write (&value, sizeof (unsigned long));
+    };
+    
+    auto write_string = [&] (_String const & value) -> void {
+        write_number (value.length());
+        write (value.get_str(), value.length());
+    };
+    
+    auto write_list = [&] (_SimpleList const & value) -> void {
+        write_number (value.lLength);
+        write (value.list_data, value.lLength * sizeof (long));
+    };
+    
+    if (!(header.flags & _HY_DATASET_CACHE_DEFAULT_TABLE)) {
+        write_number (theTT->baseLength);
+        write_string (theTT->tokensAdded);
+        write_string (theTT->baseSet);
+        write_list   (theTT->translationsAdded);
+    }
+    
+    if (tree) {
+        write_string (tree->get_str());
+    }
+    
+    for (unsigned long s = 0UL; s < noOfSpecies; s++) {
+        write_string (*GetSequenceName (s));
+    }
+    
+    for (unsigned long p = 0UL; p < lLength; p++) {
+        write (((_String*)list_data[p])->get_str(), noOfSpecies);
+    }
+    
+    write_list (theMap);
+    write_list (theFrequencies);
+    
+    ok = ok && fseek (cache_file, 0L, SEEK_SET) == 0 && fwrite (&header, sizeof (_DataSetCacheHeader), 1, cache_file) == 1;
+    ok = (fclose (cache_file) == 0) && ok;
+    
+    if (ok && rename (temp_path.get_str(), cache_path.get_str()) == 0) {
+        return true;
+    }
+    remove (temp_path.get_str());
+    return false;
+#else
+    return false;
+#endif
+}
@@ -51,11 +51,13 @@ _DataSetFilter::_DataSetFilter(void) {
   unitLength = 0;
   theData = NULL;
   accessCache = nil;
+  packedCodeBits = 0;
 }
 //_________________________________________________________
 _DataSetFilter::_DataSetFilter(_DataSet *ds, char, _String &) {
   theData = ds;
   accessCache = nil;
+  packedCodeBits = 0;
 }
 //_________________________________________________________
 _DataSetFilter::~_DataSetFilter(void) { DeleteObject(accessCache); }
@@ -70,8 +72,11 @@ void _DataSetFilter::CopyFilter (_DataSetFilter const *copyFrom) {
     theOriginalOrder.Duplicate      (&copyFrom->theOriginalOrder);
     conversionCache.Duplicate       (&copyFrom->conversionCache);
     duplicateMap.Duplicate          (&copyFrom->duplicateMap);
+    packedStateCodes.Duplicate      (&copyFrom->packedStateCodes);
+    packedCodeMasks.Duplicate       (&copyFrom->packedCodeMasks);
     
     dimension               = copyFrom->dimension;
+    packedCodeBits          = copyFrom->packedCodeBits;
     undimension             = copyFrom->undimension;
     unitLength              = copyFrom->unitLength;
     accessCache             = nil;
@@ -97,6 +102,7 @@ void _DataSetFilter::Duplicate(BaseRefConst source)  {
 void    _DataSetFilter::SetDimensions (void) {
     dimension   = GetDimension(true);
     undimension = GetDimension(false);
+    ClearPackedStateCodes();
 }
 
 //_______________________________________________________________________
@@ -512,6 +518,65 @@ void    _DataSetFilter::SetFilter (_DataSet const * ds, unsigned char unit, _Sim
     FilterDeletions();
     
 }
+//_______________________________________________________________________
+void    _DataSetFilter::SetPatterns (_DataSet * target, _List& columns, _SimpleList const& site_patterns) {
+    /*
+        20261018: SLKP
+        'columns' holds unitLength _Site columns (with one character for every sequence of this filter)
+        for each pattern, and 'site_patterns' maps every site (in units) to its pattern; the columns are
+        handed over to 'target', which becomes the data set of this filter (with the sequences in filter
+        order) and must outlive its use; exclusions are kept, and no duplicate site search is needed
+    */
+    
+    unsigned long pattern_count = columns.lLength / unitLength,
+                  sequences     = theNodeMap.lLength;
+    
+    _SimpleList   counts     (pattern_count, 0L, 0L),
+                  first_site (pattern_count, 0L, 0L);
+    
+    site_patterns.Each ([&] (long pattern, unsigned long site) -> void {
+        if (counts.list_data[pattern]++ == 0L) {
+            first_site.list_data[pattern] = site;
+        }
+    });
+    
+    target->Clear();
+    target->SetTranslationTable (theData);
+    for (unsigned long k = 0UL; k < sequences; k++) {
+        target->AddName (*GetSequenceName (k));
+    }
+    target->SetNoSpecies (sequences);
+    
+    for (unsigned long c = 0UL; c < columns.lLength; c++) {
+        (*target) << columns.GetItem (c);
+        target->theFrequencies << counts.get (c / unitLength);
+    }
+    
+    target->theMap.RequestSpace (site_patterns.lLength * unitLength);
+    site_patterns.Each ([&] (long pattern, unsigned long) -> void {
+        for (unsigned long j = 0UL; j < unitLength; j++) {
+            target->theMap << pattern * unitLength + j;
+        }
+    });
+    
+    theData = target;
+    theNodeMap.Populate       (sequences, 0L, 1L);
+    theOriginalOrder.Populate (site_patterns.lLength * unitLength, 0L, 1L);
+    theFrequencies.Duplicate  (&counts);
+    duplicateMap.Duplicate    (&site_patterns);
+    conversionCache.Clear();
+    
+    theMap.Clear();
+    theMap.RequestSpace (pattern_count * unitLength);
+    first_site.Each ([&] (long site, unsigned long) -> void {
+        for (unsigned long j = 0UL; j < unitLength; j++) {
+            theMap << site * unitLength + j;
+        }
+    });
+    
+    SetDimensions();
+}
+
 //_______________________________________________________________________
 long    _DataSetFilter::FindSpeciesName (_List& s, _SimpleList& r) const {
   
@@ -547,6 +612,8 @@ void    _DataSetFilter::FilterDeletions(_SimpleList *theExc) {
   
     bool  skip_nfolds = hy_env::EnvVariableTrue(hy_env::skip_omissions);
   
+    ClearPackedStateCodes();
+  
     if (skip_nfolds || theExc ) { // somthing to do
         _SimpleList patterns_to_be_removed;
         if (theExc) {
@@ -799,6 +866,7 @@ unsigned long    _DataSetFilter::GetDimension (bool correct) const {
 
 void     _DataSetFilter::SetMap  (_String const &s) {
     theNodeMap.Clear();
+    ClearPackedStateCodes();
     if (s.nonempty()) {
         s.Tokenize(_String (",")).ForEach([&] (BaseRef piece, unsigned long) -> void {
             theNodeMap << ((_String*)piece)->to_long();
@@ -1490,6 +1558,190 @@ void _DataSetFilter::ComputePairwiseDifferences (_Matrix& target, long i, long j
 
 //_________________________________________________________
 
+static inline unsigned long _hy_bit_count (unsigned long word) {
+#if defined __GNUC__ || defined __clang__
+    return __builtin_popcountl (word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555UL);
+    word = (word & 0x3333333333333333UL) + ((word >> 2) & 0x3333333333333333UL);
+    return (((word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FUL) * 0x0101010101010101UL) >> 56;
+#endif
+}
+
+#define _HY_DISTANCE_TILE 32L
+
+//_________________________________________________________
+
+_Matrix * _DataSetFilter::ComputePairwiseDistances (_hy_dataset_filter_distance_model model, bool count_gaps_in_frequencies) const {
+    /*
+        20261018: SLKP
+        all pairwise distances between the sequences of a single character filter, counting only
+        the sites at which both sequences have a resolved character (as kAmbiguityHandlingSkip in
+        ComputePairwiseDifferences does). Each sequence is stored as bit planes over sites (each
+        site pattern repeated as many times as it occurs): one plane flags resolved characters,
+        and the others hold the bits of the state index, so that the matching (and, for nucleotides,
+        the transition / transversion) counts for a pair come from a few AND / XOR / popcount
+        operations per 64 sites. Pairs are processed in tiles of _HY_DISTANCE_TILE x _HY_DISTANCE_TILE
+        sequences (so that both sets of bit planes stay in cache), in parallel over rows of tiles.
+     
+        p-distances (any alphabet) are the proportions of mismatches; K2P and TN93 (nucleotides)
+        follow res/TemplateBatchFiles/libv3/tasks/distances.bf: TN93 uses the nucleotide frequencies
+        of the filter and reverts to K2P if one of them is 0, and saturated pairs get 1000.
+    */
+    
+    if (unitLength != 1UL) {
+        throw _String ("Pairwise distance matrices are only implemented for filters with single character units");
+    }
+    if (conversionCache.empty()) {
+        throw _String ("ComputePairwiseDistances called on a filter with an empty conversionCache");
+    }
+    
+    unsigned long const state_count   = GetDimension (true),
+                        species       = NumberSpecies(),
+                        pattern_count = GetPatternCount();
+    
+    if (model != kDistanceP && state_count != 4UL) {
+        throw _String ("K2P and TN93 distances require a nucleotide filter");
+    }
+    
+    unsigned long code_bits = 1UL;
+    while ((1UL << code_bits) < state_count) {
+        code_bits ++;
+    }
+    
+    unsigned long const planes = code_bits + 1UL;
+    
+    _SimpleList   offsets (pattern_count + 1UL, 0L, 0L);
+    for (unsigned long p = 0UL; p < pattern_count; p++) {
+        offsets.list_data[p + 1UL] = offsets.list_data[p] + theFrequencies.list_data[p];
+    }
+    
+    unsigned long const site_count = offsets.list_data[pattern_count],
+                        words      = MAX (1UL, (site_count + 63UL) >> 6),
+                        stride     = planes * words; // per sequence: resolved, then code bits 0, 1, ...
+    
+    unsigned long * bits = (unsigned long*)MemAllocate (sizeof (unsigned long) * stride * MAX (1UL, species), true);
+    
+#ifdef _OPENMP
+  #pragma omp parallel for default(shared) schedule(static) if (species * site_count >= 0x100000UL)
+#endif
+    for (unsigned long s = 0UL; s < species; s++) {
+        unsigned long * sequence_bits = bits + s * stride;
+        long const      sequence      = theNodeMap.list_data[s];
+        for (unsigned long p = 0UL; p < pattern_count; p++) {
+            long const state = conversionCache.list_data[(direct_index_character (p, sequence)-40)*(undimension+1)+undimension];
+            if (state >= 0L) {
+                for (long site = offsets.list_data[p]; site < offsets.list_data[p+1]; site++) {
+                    unsigned long const word = site >> 6,
+                                        bit  = 1UL << (site & 63L);
+                    sequence_bits[word] |= bit;
+                    for (unsigned long b = 0UL; b < code_bits; b++) {
+                        if (state & (1L << b)) {
+                            sequence_bits[(b + 1UL) * words + word] |= bit;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    // distance formulae
+    
+    hyFloat   K1 = 0., K2 = 0., K3 = 0., fR = 0., fY = 0.;
+    bool      use_k2p = model == kDistanceK2P;
+    
+    if (model == kDistanceTN93) {
+        _Matrix * frequencies = HarvestFrequencies (1, 1, false, count_gaps_in_frequencies);
+        hyFloat const * f = frequencies->theData;
+        fY = f[1] + f[3];
+        fR = 1. - fY;
+        if (f[0] == 0. || f[1] == 0. || f[2] == 0. || f[3] == 0.) {
+            use_k2p = true;
+        } else {
+            K1 = 2.*f[0]*f[2]/fR;
+            K2 = 2.*f[1]*f[3]/fY;
+            K3 = 2.*(fR*fY-f[0]*f[2]*fY/fR-f[1]*f[3]*fR/fY);
+        }
+        DeleteObject (frequencies);
+    }
+    
+    auto distance = [&] (unsigned long compared, unsigned long matches, unsigned long purine_transitions, unsigned long transitions) -> hyFloat {
+        if (compared == 0UL) {
+            return 0.;
+        }
+        hyFloat const scale = 1./compared;
+        if (model == kDistanceP) {
+            return (compared - matches) * scale;
+        }
+        hyFloat const transversions = (compared - matches - transitions) * scale;
+        if (use_k2p) {
+            hyFloat const d1 = 1.-2.*transitions*scale-transversions,
+                          d2 = 1.-2.*transversions;
+            return d1 > 0. && d2 > 0. ? -(0.5*log (d1)+0.25*log (d2)) : 1000.;
+        }
+        hyFloat const d1 = 1.-purine_transitions*scale/K1-0.5*transversions/fR,
+                      d2 = 1.-(transitions - purine_transitions)*scale/K2-0.5*transversions/fY,
+                      d3 = 1.-0.5*transversions/fY/fR;
+        return d1 > 0. && d2 > 0. && d3 > 0. ? -K1*log (d1)-K2*log (d2)-K3*log (d3) : 1000.;
+    };
+    
+    _Matrix * result = new _Matrix (species, species, false, true);
+    
+    long const tiles = (species + _HY_DISTANCE_TILE - 1L) / _HY_DISTANCE_TILE;
+    
+#ifdef _OPENMP
+  #pragma omp parallel for default(shared) schedule(dynamic) if (species * words >= 0x1000UL)
+#endif
+    for (long row_tile = 0L; row_tile < tiles; row_tile++) {
+        for (long column_tile = row_tile; column_tile < tiles; column_tile++) {
+            unsigned long const row_end    = MIN (species, (unsigned long)(row_tile + 1L) * _HY_DISTANCE_TILE),
+                                column_end = MIN (species, (unsigned long)(column_tile + 1L) * _HY_DISTANCE_TILE);
+        
+            for (unsigned long x = row_tile * _HY_DISTANCE_TILE; x < row_end; x++) {
+                unsigned long const * x_bits = bits + x * stride;
+                for (unsigned long y = MAX (x + 1UL, (unsigned long)column_tile * _HY_DISTANCE_TILE); y < column_end; y++) {
+                    unsigned long const * y_bits = bits + y * stride;
+                    unsigned long compared = 0UL, matches = 0UL, purine_transitions = 0UL, transitions = 0UL;
+                
+                    if (state_count == 4UL) {
+                        // A = 00, C = 01, G = 10, T = 11: code bit 0 separates purines from pyrimidines
+                        unsigned long const * x0 = x_bits + words, * x1 = x0 + words,
+                                            * y0 = y_bits + words, * y1 = y0 + words;
+                        for (unsigned long w = 0UL; w < words; w++) {
+                            unsigned long const both       = x_bits[w] & y_bits[w],
+                                                same_class = both & ~(x0[w] ^ y0[w]),
+                                                transition = same_class & (x1[w] ^ y1[w]);
+                            compared           += _hy_bit_count (both);
+                            matches            += _hy_bit_count (same_class & ~transition);
+                            transitions        += _hy_bit_count (transition);
+                            purine_transitions += _hy_bit_count (transition & ~x0[w]);
+                        }
+                    } else {
+                        for (unsigned long w = 0UL; w < words; w++) {
+                            unsigned long const both = x_bits[w] & y_bits[w];
+                            unsigned long       differ = 0UL;
+                            for (unsigned long b = 1UL; b < planes; b++) {
+                                differ |= x_bits[b * words + w] ^ y_bits[b * words + w];
+                            }
+                            compared += _hy_bit_count (both);
+                            matches  += _hy_bit_count (both & ~differ);
+                        }
+                    }
+                
+                    hyFloat const d = distance (compared, matches, purine_transitions, transitions);
+                    result->theData[x * species + y] = d;
+                    result->theData[y * species + x] = d;
+                }
+            }
+        }
+    }
+    
+    free (bits);
+    return result;
+}
+
+//_________________________________________________________
+
 _Matrix * _DataSetFilter::HarvestFrequencies (char unit, char atom, bool posSpec, bool countGaps) const {
     _SimpleList copy_seqs (theNodeMap), copy_sites (theOriginalOrder);
     return theData->HarvestFrequencies (unit,atom, posSpec, copy_seqs, copy_sites, countGaps);
@@ -1774,6 +2026,106 @@ void    _DataSetFilter::SetupConversion (void) {
     }
 }
 
+//_______________________________________________________________________
+bool    _DataSetFilter::PackStateCodes (void) {
+    /*
+        20261018: SLKP
+        the state of every (pattern, sequence) cell is stored as a small code:
+        the mask of compatible states for nucleotides (so that 4-bit codes follow
+        IUPAC ambiguities), and the state index (0-19) or one of the ambiguities
+        that occur in the data (20-31) for amino acids; characters are translated
+        once each, and the codes are packed into 64-bit words, pattern by pattern
+    */
+  
+    ClearPackedStateCodes();
+  
+    unsigned long const states = GetDimension();
+  
+    if (unitLength != 1 || (states != 4UL && states != 20UL)) {
+        return false;
+    }
+  
+    unsigned char const bits      = states == 4UL ? 4 : 5;
+    unsigned long const per_word  = 64UL / bits,
+                        sequences = theNodeMap.lLength,
+                        patterns  = GetPatternCount();
+  
+    _SimpleList masks;
+    if (bits == 4) {
+        masks.Populate (16L, 0L, 1L);
+    } else {
+        for (unsigned long s = 0UL; s < states; s++) {
+            masks << (1L << s);
+        }
+    }
+  
+    long      character_codes [256];
+    hyFloat   resolution      [HYPHY_SITE_DEFAULT_BUFFER_SIZE];
+    InitializeArray (character_codes, 256, -1L);
+  
+    auto code_for = [&] (unsigned char c) -> long {
+        if (character_codes[c] < 0L) {
+            Translate2Frequencies ((char)c, resolution, true);
+            long mask = 0L;
+            for (unsigned long s = 0UL; s < states; s++) {
+                if (resolution[s] > 0.) {
+                    mask |= 1L << s;
+                }
+            }
+            long code = masks.Find (mask);
+            if (code < 0L) {
+                if (masks.lLength == 1UL << bits) {
+                    return -1L; // too many different ambiguities
+                }
+                code = masks.lLength;
+                masks << mask;
+            }
+            character_codes[c] = code;
+        }
+        return character_codes[c];
+    };
+  
+    packedStateCodes.Populate ((patterns * sequences + per_word - 1UL) / per_word, 0L, 0L);
+  
+    for (unsigned long p = 0UL; p < patterns; p++) {
+        char const * column = GetColumn (p);
+        for (unsigned long s = 0UL; s < sequences; s++) {
+            long const code = code_for (column[theNodeMap.list_data[s]]);
+            if (code < 0L) {
+                ClearPackedStateCodes();
+                return false;
+            }
+            unsigned long const cell = p * sequences + s;
+            packedStateCodes.list_data[cell / per_word] |= (long)((unsigned long)code << ((cell % per_word) * bits));
+        }
+    }
+  
+    packedCodeMasks.Duplicate (&masks);
+    packedCodeBits = bits;
+    return true;
+}
+
+//_______________________________________________________________________
+long    _DataSetFilter::PackedCodeResolution (unsigned long code, hyFloat* parvect) const {
+    long const          mask   = packedCodeMasks.get (code);
+    unsigned long const states = GetDimension();
+    long                state  = -1L,
+                        count  = 0L;
+  
+    for (unsigned long s = 0UL; s < states; s++) {
+        bool const compatible = (mask >> s) & 1L;
+        if (parvect) {
+            parvect[s] = compatible ? 1. : 0.;
+        }
+        if (compatible) {
+            state = s;
+            count ++;
+        }
+    }
+  
+    return count == 1L ? state : -1L;
+}
+
   //_________________________________________________________
 
 _String const _DataSetFilter::GenerateConsensusString (_SimpleList* majority) const {
@@ -146,7 +146,9 @@ namespace hy_global {
 
     unsigned long    matrix_exp_count,
                      taylor_terms_count,
-                     squarings_count;
+                     squarings_count,
+                     matrix_exp_cache_hits,
+                     matrix_exp_cache_misses;
     
     int              hy_mpi_node_rank,
         // [MPI only] the MPI rank of the current node (0 = master, 1... = slaves)
@@ -156,11 +156,23 @@ _String const
         // if TRUE, then HyPhy will attempt to solve BL (t) = C for model parameter t, whenever possible
     base_directory                                  ("HYPHY_BASE_DIRECTORY"),
         // is set to the base directory for local path names; can be set via a CL argument (BASEPATH)
+    batch_exponentials                              ("BATCH_EXPONENTIALS"),
+        // if TRUE, trees in likelihood functions set up after this point will exponentiate branches that
+        // share a rate matrix (up to a scalar multiple) from Taylor series terms computed once per matrix
     blockwise_matrix                                ("BLOCK_LIKELIHOOD"),
         // this _template_ variable is used to define likelihood function evaluator templates
     branch_length_stencil                           ("BRANCH_LENGTH_STENCIL"),
+    concurrent_partition_blocks                     ("CONCURRENT_PARTITION_BLOCKS"),
+        // if TRUE, likelihood functions set up after this point will prune site blocks from all
+        // partitions (and rate classes of partitions with a single category variable) in one parallel region,
+        // instead of one partition/rate class at a time
     covariance_parameter                            ("COVARIANCE_PARAMETER"),
         // used to control the behavior of CovarianceMatrix
+    data_file_cache                                 ("DATA_FILE_CACHE"),
+        // if TRUE, DataSet ... = ReadDataFile (...) will load data sets from binary caches next to their (non-NEXUS)
+        // files (file name + .hyphy-dset), and save a cache for every file read without one; a cache is used for
+        // as long as its file keeps the same size and modification time and the reader settings (default
+        // translation table, DATA_FILE_DEFAULT_WIDTH and DATA_FILE_GAP_WIDTH) are unchanged
     data_file_default_width                         ("DATA_FILE_DEFAULT_WIDTH"),
       // for file formats with grouped alignment columns (e.g. PHYLIP), determines the width of a column
     data_file_gap_width                             ("DATA_FILE_GAP_WIDTH"),
@@ -229,6 +241,11 @@ _String const
         // literal for the expected number of substitions (per unit time)
     kGetStringFromUser                              ("PROMPT_FOR_STRING"),
         // [LEGACY] placeholder for prompting the user for a string value
+    kLFTopologyMove                                 ("LF_TOPOLOGY_MOVE"),
+        // SetParameter (lf, LF_TOPOLOGY_MOVE, {"TREE" : tree name, "MOVE" : "NNI" or "SPR", "SUBTREE" : node name, "TARGET" : node name})
+        // applies a topology move to a tree of the likelihood function, recomputing only the affected conditionals (see _LikelihoodFunction::ApplyTopologyMove)
+    kLFUndoTopologyMove                             ("LF_UNDO_TOPOLOGY_MOVE"),
+        // SetParameter (lf, LF_UNDO_TOPOLOGY_MOVE, 0) reverts the last LF_TOPOLOGY_MOVE and, if parameters have not changed since, restores the caches it invalidated
     kSCFGCorpus                                     ("SCFG_STRING_CORPUS"),
         // set SCFG training corpus
     kStringSuppliedLengths                          ("STRING_SUPPLIED_LENGTHS"),
@@ -266,6 +283,12 @@ _String const
         // if set, will trigger automatic renaming of sequence names from files to valid
         // HyPhy IDs, e.g. "awesome monkey!" -> "awesome_monkey_"
         // the mapping will go into dataset_id.mapping
+    numa_aware_caches                               ("NUMA_AWARE_CACHES"),
+        // if TRUE, likelihood functions set up after this point will have the site slice of their conditional
+        // caches computed by each thread first touched by that thread, and assign site blocks to threads statically
+    pad_conditional_caches                          ("PAD_CONDITIONAL_CACHES"),
+        // if TRUE, likelihood functions set up after this point will space per-site state vectors
+        // in conditional likelihood caches on 64-byte boundaries (for alphabets with more than 4 states)
     path_to_current_bf                              ("PATH_TO_CURRENT_BF"),
         // is set to the absolute path for the currently executed batch file (assuming it has one)
     print_float_digits                              ("PRINT_DIGITS"),
@@ -280,16 +303,26 @@ _String const
         // this _template_ variable is used to define likelihood function evaluator templates
     short_mpi_return                                ("SHORT_MPI_RETURN"),
         // controls the return format of optimized functions from MPI slave nodes
+    simd_kernels                                    ("SIMD_KERNELS"),
+        // if set to "scalar" or "avx2", trees in likelihood functions set up after this point will use pruning
+        // kernels (for alphabets other than nucleotides) of at most that level, e.g. to compare them with the
+        // default ones; the HYPHY_SIMD environment variable and the CPU still cap the level
     skip_omissions                                  ("SKIP_OMISSIONS"),
         // if set, will cause data filters to _EXCLUDE_ sites with gaps or other N-fold redundancies
     status_bar_update_string                        ("STATUS_BAR_STATUS_STRING"),
         // used to set the progress message displayed to the user
     try_numeric_sequence_match                      ("TRY_NUMERIC_SEQUENCE_MATCH"),
         // try matching sequences by 0 (or 1) based index, if matching by name fails
+    transition_matrix_cache                         ("TRANSITION_MATRIX_CACHE"),
+        // if > 0, trees in likelihood functions set up after this point will keep up to this many
+        // exponentiated transition matrices, keyed on the numeric contents of the rate matrix
     true_const                                      ("TRUE"),
         // the TRUE (1.0) constant
     use_last_model                                  ("USE_LAST_MODEL"),
         // a stand-in for the last declared model
+    use_eigen_exponentials                          ("USE_EIGEN_EXPONENTIALS"),
+        // if TRUE, transition matrices for time-reversible models are computed from cached
+        // eigen-decompositions of the rate matrix, rather than by Taylor series
     use_traversal_heuristic                         ("USE_TRAVERSAL_HEURISTIC")
         // TODO (20170413): don't remember what this does; , see @ _DataSetFilter::MatchStartNEnd
         // #DEPRECATE
@@ -264,6 +264,7 @@ public:
     bool      HandleFprintf                         (_ExecutionList&);
     bool      HandleHarvestFrequencies              (_ExecutionList&);
     bool      HandleOptimizeCovarianceMatrix        (_ExecutionList&, bool);
+    bool      HandleParametricBootstrap             (_ExecutionList&);
     bool      HandleComputeLFFunction               (_ExecutionList&);
     bool      HandleSelectTemplateModel             (_ExecutionList&);
     bool      HandleUseModel                        (_ExecutionList&);
@@ -168,6 +168,13 @@ public:
                                    _ExecutionList *);
   friend long ProcessLine(_String &s, FileState *fs, _DataSet &ds);
 
+  static _DataSet *LoadCache(_String const &, _String * = nil);
+  // load the binary cache (file name & kDataSetCacheExtension) saved for a
+  // data file, if there is one and the data file has not changed since;
+  // returns nil otherwise
+  bool SaveCache(_String const &) const;
+  // save this (finalized) data set as the binary cache for a data file
+
   static _DataSet *Concatenate(const _SimpleList &);
   static _DataSet *Combine(const _SimpleList &);
 
@@ -211,6 +218,8 @@ _DataSet *ReadDataSetFile(FILE *, char = 0, _String * = nil, _String * = nil,
 
 
 bool StoreADataSet(_DataSet *, _String *);
+
+extern const _String kDataSetCacheExtension;
 void    ReadNexusFile               (FileState& fState, FILE*f, _DataSet& result);
 
 
@@ -52,6 +52,12 @@ enum _hy_dataset_filter_ambiguity_resolution {
   kAmbiguityHandlingSkip
 };
 
+enum _hy_dataset_filter_distance_model {
+  kDistanceP,
+  kDistanceK2P,
+  kDistanceTN93
+};
+
 enum _hy_dataset_filter_unique_match {
   kUniqueMatchExact = 0L,
   kUniqueMatchExactOrGap = 1L,
@@ -77,6 +83,10 @@ public:
   void CopyFilter(_DataSetFilter const *);
   void SetFilter(_DataSet const *, unsigned char, _SimpleList &, _SimpleList &,
                  bool isFilteredAlready = false);
+  void SetPatterns(_DataSet *, _List &, _SimpleList const &);
+  // 20261018: SLKP
+  // replace the data of this filter with site patterns that are already
+  // compressed (see _LikelihoodFunction::SimulatePatterns)
   void SetExclusions(_String const&, bool = true);
 
   _String *GetExclusions(void) const;
@@ -86,6 +96,7 @@ public:
   void SetMap(_SimpleList &newMap) {
     theNodeMap.Clear(); // used to allow nonsequential maps to tree leaves
     theNodeMap.Duplicate(&newMap);
+    ClearPackedStateCodes();
   }
 
   unsigned long NumberSpecies(void) const { return theNodeMap.lLength; }
@@ -112,6 +123,14 @@ public:
                              _hy_dataset_filter_ambiguity_resolution =
                                  kAmbiguityHandlingResolveFrequencyAware) const;
 
+  _Matrix *ComputePairwiseDistances(_hy_dataset_filter_distance_model,
+                                    bool = true) const;
+  // 20261018: SLKP
+  // the (species x species) matrix of pairwise distances between all
+  // sequences (single character filters; K2P and TN93 need nucleotides),
+  // from the sites where both sequences are resolved; the second argument
+  // is passed on to HarvestFrequencies for the TN93 nucleotide frequencies
+
   BaseRefConst GetMap(void) const {
     return theNodeMap.lLength ? &theNodeMap : NULL;
   }
@@ -217,6 +236,37 @@ public:
   long LookupConversion(char c, hyFloat *receptacle) const;
   void SetupConversion(void);
   bool ConfirmConversionCache(void) const;
+
+  bool PackStateCodes(void);
+  // 20261018: SLKP
+  // store the states of a single character nucleotide (4 bits per cell) or
+  // amino-acid (5 bits per cell) filter as packed codes, pattern by pattern;
+  // returns false (and packs nothing) for other filters. The codes are
+  // discarded whenever the patterns, sequences or exclusions change.
+  // They are kept in addition to (not in place of) the characters of the
+  // underlying _DataSet, which all other consumers read, so packing costs
+  // memory (4 or 5 bits per pattern cell); it only speeds up leaf setup.
+
+  unsigned char PackedCodeBits(void) const { return packedCodeBits; }
+  // 0 if the states are not packed
+
+  unsigned long PackedCode(unsigned long pattern, unsigned long sequence) const {
+    unsigned long const cell = pattern * theNodeMap.lLength + sequence,
+                        per_word = 64UL / packedCodeBits;
+    return ((unsigned long)packedStateCodes.list_data[cell / per_word] >>
+            ((cell % per_word) * packedCodeBits)) &
+           ((1UL << packedCodeBits) - 1UL);
+  }
+
+  long PackedCodeResolution(unsigned long code, hyFloat * = nil) const;
+  // the state of a packed code, or -1 if it is ambiguous; the second argument,
+  // if given, receives the indicators (0/1) of all compatible states
+
+  void ClearPackedStateCodes(void) {
+    packedStateCodes.Clear();
+    packedCodeMasks.Clear();
+    packedCodeBits = 0;
+  }
   void FilterDeletions(_SimpleList *theExc = nil);
   _Matrix *GetFilterCharacters(bool = false) const;
 
@@ -285,6 +335,10 @@ private:
 
   long undimension;
 
+  _SimpleList packedStateCodes, // see PackStateCodes
+      packedCodeMasks;          // code -> bit mask of compatible states
+  unsigned char packedCodeBits;
+
   _DataSet *theData;
   //      _SimpleList     conversionCache;
 };
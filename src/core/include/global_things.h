@@ -284,7 +284,10 @@ namespace hy_global {
     
   extern unsigned long matrix_exp_count,
                        taylor_terms_count,
-                       squarings_count;
+                       squarings_count,
+                       matrix_exp_cache_hits,
+                       matrix_exp_cache_misses;
+  // matrices served from (or added to) the transition matrix caches of trees, see _TheTree::QueueExponentials
     
   
   extern   hyTreeDefinitionPhase isDefiningATree;
@@ -142,6 +142,7 @@ namespace hy_env {
           assume_reversible,
           data_file_tree,
           data_file_tree_string,
+          data_file_cache,
           nexus_file_tree_matrix      ,
           data_file_partition_matrix  ,
           use_traversal_heuristic    ,
@@ -157,6 +158,11 @@ namespace hy_env {
           base_directory,
           lib_directory,
           directory_separator_char,
+          pad_conditional_caches,
+          numa_aware_caches,
+          batch_exponentials,
+          simd_kernels,
+          concurrent_partition_blocks,
           path_to_current_bf,
           print_float_digits,
           true_const,
@@ -177,6 +183,8 @@ namespace hy_env {
           error_report_format_expression_stdin,
           status_bar_update_string,
           use_last_model,
+          use_eigen_exponentials,
+          transition_matrix_cache,
           last_model_parameter_list,
           kGetStringFromUser,
           get_data_info_returns_only_the_index,
@@ -196,7 +204,9 @@ namespace hy_env {
           lf_convergence_criterion,
           try_numeric_sequence_match,
           short_mpi_return,
-          kSCFGCorpus
+          kSCFGCorpus,
+          kLFTopologyMove,
+          kLFUndoTopologyMove
     ;
   
   
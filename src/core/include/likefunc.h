@@ -132,6 +132,85 @@ enum _LikelihoodFunctionCountType {
 
 //_______________________________________________________________________________________
 
+struct _LocalProcessPool; // see StartProcessPool
+
+//_______________________________________________________________________________________
+
+struct  _TopologyMove {
+    // 20261018: SLKP
+    // the last topology move applied by _LikelihoodFunction::ApplyTopologyMove, kept to undo it
+    _TheTree            *tree;
+    node<long>          *subtree,
+                        *target;
+    // the arguments of the inverse move
+    bool                spr,
+                        restorable;
+    // whether the caches saved before the move can be put back on undo; this requires that they were
+    // up-to-date at the time of the move, and that the independent parameters still have the same values
+    _SimpleList         dirty;
+    // internal nodes (post-move indices) whose conditionals were invalidated by the move
+    _List               saved;
+    // a _Matrix of independent parameter values, followed by a _Matrix of conditionals and a _Matrix
+    // of scaling factors of the 'dirty' nodes for every rate class of every partition on the tree
+};
+
+//_______________________________________________________________________________________
+
+class _BlockEvaluation {
+    // 20261018: SLKP
+    // the state of one ComputeBlock call (a partition, or a rate class of a partition)
+    // that has been set up (transition matrices queued, nodes to update determined)
+    // but not yet pruned; this lets _LikelihoodFunction::Compute set up several
+    // (partition x rate class) blocks serially and then prune their site blocks
+    // in a single parallel region
+    
+public:
+    _BlockEvaluation (void) {
+        pending         = false;
+        block_results   = nil;
+    }
+    ~_BlockEvaluation (void) {
+        if (block_results) {
+            delete [] block_results;
+        }
+    }
+    
+    bool                pending;
+    // true if the site blocks still need to be pruned, i.e. the result has not been computed yet
+    
+    long                index,
+                        catID,
+                        branchIndex,
+                        doCachedComp,
+                        np,
+                        block_count,
+                        sites_per_block,
+                        matrix_count;
+    
+    _TheTree            *tree;
+    _DataSetFilter const*filter;
+    _SimpleList         *order,
+                        *branches,
+                        *tcc,
+                        changedBranches;
+    _List               changedModels;
+    
+    hyFloat             *inc,
+                        *ssf,
+                        *bc,
+                        *siteRes,
+                        *block_results;
+    
+    long                *scc,
+                        *sccb,
+                        *cbid,
+                        *branchValues;
+    
+    _ExponentialQueue   exponentials;
+};
+
+//_______________________________________________________________________________________
+
 class   _LikelihoodFunction: public BaseObj
 {
 
@@ -198,18 +277,30 @@ public:
 
     void        PrepareToCompute (bool = false);
     void        DoneComputing    (bool = false);
+    _AssociativeList*
+                GradientReport   (void);
+    // 20261018: SLKP; LFCompute (lf, LF_GRADIENT): analytic and finite difference gradients at the current point
     virtual
     _Matrix*    Optimize (_AssociativeList const* options = nil);
     _Matrix*    ConstructCategoryMatrix     (const _SimpleList&, unsigned, bool = true, _String* = nil);
 
     hyFloat     SimplexMethod               (hyFloat& precision, unsigned long max_iterations = 100000UL, unsigned long max_evals = 0xFFFFFF);
+    hyFloat     QuasiNewtonMethod           (hyFloat precision, unsigned long max_iterations = 100000UL, unsigned long max_evals = 0xFFFFFF, _FString * convergence_callback = nil);
     void        Anneal                      (hyFloat& precision);
 
     void        Simulate                    (_DataSet &,_List&, _Matrix* = nil, _Matrix* = nil, _Matrix* = nil, _String const* = nil) const;
+    _Matrix*    ParametricBootstrap         (long, _SimpleList const&, long = 1L);
+    /*
+        20261018: SLKP
+        simulate the given number of replicates from this likelihood function (at the current parameter values)
+        and refit the likelihood functions (indices into likeFuncList) to each one, using up to the given
+        number of processes; returns a (replicates x likelihood functions) matrix of maximized log-likelihoods
+    */
 
-    void        ReconstructAncestors        (_DataSet &, _SimpleList&, _String&, bool = false, bool = false, bool = false);
+    void        ReconstructAncestors        (_DataSet &, _SimpleList&, _String&, bool = false, bool = false, bool = false, unsigned long = 1UL);
     // 20090224: added an argument to allow the marginal state reconstruction
     // 20091009: added an argument to allow the reconstruction of leaves
+    // 20261018: added an argument for the number of ancestral samples to draw
 
     long        MaximumDimension            (void);
 
@@ -257,7 +348,17 @@ public:
     long        SequenceCount           (long);
     unsigned long        SiteCount               (void) const;
     void        Rebuild                 (bool rescan_parameters = false);
-    virtual void        SerializeLF             (_StringBuffer&, char=0, _SimpleList* = nil, _SimpleList* = nil);
+    void        ApplyTopologyMove       (_TheTree*, bool, node<long>*, node<long>*, bool = false);
+    void        UndoTopologyMove        (void);
+    /*
+        20261018: SLKP
+        apply an NNI (bool = false) or SPR (bool = true) move to a tree of the likelihood function
+        (see _TheTree::ApplyTopologyMove) without rebuilding its caches; cached conditionals follow their nodes
+        to the new post-order positions, and only the internal nodes with new subtrees (the paths from the moved
+        branches to the root) are recomputed by the next evaluation; the last move can be undone, which restores the
+        caches it invalidated (the last bool argument is internal, and marks the inverse move applied by the undo)
+    */
+    virtual void        SerializeLF            (_StringBuffer&, char=0, _SimpleList* = nil, _SimpleList* = nil);
     _Formula*   HasComputingTemplate    (void) const{
         return computingTemplate;
     }
@@ -346,10 +447,14 @@ protected:
     void            OptimalOrder            (long, _SimpleList&);
     // determine the optimal order of compuation for a block
 
-    hyFloat      ComputeBlock            (long, hyFloat* siteResults = nil, long currentRateClass = -1, long = -1, _SimpleList* = nil);
+    hyFloat      ComputeBlock            (long, hyFloat* siteResults = nil, long currentRateClass = -1, long = -1, _SimpleList* = nil, _BlockEvaluation* = nil);
     // 20090224: SLKP
     // added the option to pass an interior branch (referenced by the 3rd argument in the same order as flatTree)
     // and a set of values for each site pattern (indexed left to right) in the 4th argument
+    // 20261018: SLKP
+    // if the last argument is provided, and the block needs to be pruned, ComputeBlock only sets up
+    // the computation in it (with ->pending set to true); EvaluateBlocks and FinishBlockEvaluation
+    // then need to be called to obtain the result
 
     void            SetReferenceNodes       (void);
     // compute likelihood over block index i
@@ -380,12 +485,12 @@ protected:
 
     long            CostOfPath            (_DataSetFilter const*, _TheTree const* , _SimpleList&, _SimpleList* = nil) const;
 
-    void            BuildLeafProbs        (node<long>& , unsigned long*, unsigned long, _DataSet&, _TheTree*, unsigned long&, bool, long, _DataSetFilter const*, long, _DataSet* = nil) const;
     bool            SingleBuildLeafProbs  (node<long>&, long, _SimpleList&, _SimpleList&, _TheTree*, bool,_DataSetFilter const*, _SimpleList* = nil) const;
+    void            SimulatePatterns      (long, _List&, _SimpleList&);
 
     bool            HasBlockChanged       (long) const;
     long            BlockLength           (long) const;
-    void            PartitionCatVars      (_SimpleList&, long);
+    void            PartitionCatVars      (_SimpleList&, long) const;
     // 20090210: extract variable indices for category variables in i-th partition
     // and append them to _SimpleList
 
@@ -415,13 +520,36 @@ protected:
 
 
     bool            SendOffToMPI                (long);
+    void            ComputeOnMPIQueue           (_SimpleList const&, bool);
     void            InitMPIOptimizer            (void);
     void            CleanupMPIOptimizer         (void);
+    void            AssignPartitionsToNodes     (long, _List&);
+    void            RescalePartitionCosts       (_SimpleList const&, hyFloat);
+    bool            StartProcessPool            (long);
+    void            StopProcessPool             (void);
+    void            RunProcessPoolWorker        (long, long);
+    /*
+        20261018: SLKP
+        partitions are split between LOCAL_PROCESS_POOL worker processes by AssignPartitionsToNodes,
+        using the costs measured during the previous run (see RescalePartitionCosts); MPI nodes (partition and
+        site template modes) get chunks of partitions from a queue instead, see ComputeOnMPIQueue;
+        StartProcessPool forks the worker processes (each runs RunProcessPoolWorker), and StopProcessPool
+        terminates them
+    */
     void            ComputeBlockInt1            (long,hyFloat&,_TheTree*,_DataSetFilter*, char);
     void            CheckStep                   (hyFloat&, _Matrix, _Matrix* selection = nil);
     void            GetGradientStepBound        (_Matrix&, hyFloat &, hyFloat &, long* = nil);
     void            ComputeGradient             (_Matrix&,  hyFloat&, _Matrix&, _SimpleList&,
             long, bool normalize = true);
+    void            ComputeBranchGradients      (_Matrix&, _SimpleList&, _SimpleList&, _SimpleList* = nil);
+    bool            MapBranchParameters         (_SimpleList&, _SimpleList&, _SimpleList&, bool = false);
+    void            ComputeHessianBatched       (_SimpleList const&, _Matrix&, _Matrix&, hyFloat, long, bool);
+    /*
+        20261018: SLKP
+        MapBranchParameters finds the parameters which enter a single branch matrix (shared by
+        ComputeBranchGradients and ComputeHessianBatched); ComputeHessianBatched is the
+        COVARIANCE_PROCESSES / COVARIANCE_USE_GRADIENTS path of CovarianceMatrix
+    */
     bool            SniffAround                 (_Matrix& , hyFloat& , hyFloat&);
     void            RecurseCategory             (long,long,long,long,hyFloat
 #ifdef _SLKP_LFENGINE_REWRITE_
@@ -434,7 +562,7 @@ protected:
 
 
     void            SetNthBit                   (long&,char);
-    bool            CheckNthBit                 (long&,char);
+    bool            CheckNthBit                 (long const&,char) const;
     void            BuildIncrements             (long, _SimpleList&);
     char            HighestBit                  (long);
     char            LowestBit                   (long);
@@ -448,6 +576,23 @@ protected:
     void            CleanUpOptimize             (void);
     void            ComputeBlockForTemplate     (long, bool = false);
     void            ComputeBlockForTemplate2    (long, hyFloat*, hyFloat*, long);
+    void            EvaluateBlocks              (_BlockEvaluation*, long);
+    hyFloat         FinishBlockEvaluation       (_BlockEvaluation&);
+    /*
+        20261018: SLKP
+        prune the site blocks of all pending evaluations (2nd argument is the number of evaluations)
+        in one parallel region, and then (serially) assemble the log-likelihood of an evaluation
+        (including branch cache setup and scaling); see ComputeBlock
+    */
+    hyFloat         ComputePartition            (long);
+    hyFloat         ComputePartitionsConcurrently (_Matrix*);
+    bool            CanDeferRateClasses         (long) const;
+    /*
+        20261018: SLKP
+        the CONCURRENT_PARTITION_BLOCKS mode of Compute (compute modes 0 and 3); returns the log-likelihood
+        (and populates the block matrix if provided); CanDeferRateClasses checks if the rate classes of a
+        partition with category variables can be pruned concurrently
+    */
     void            DeleteCaches                (bool = true);
     void            PopulateConditionalProbabilities
     (long index, char runMode, hyFloat* buffer, _SimpleList& scalers, long = -1, _SimpleList* = nil);
@@ -497,6 +642,7 @@ protected:
 
     void LoggerLogL               (hyFloat logL);
     void LoggerAddGradientPhase   (hyFloat precision);
+    void LoggerAddQuasiNewtonPhase (hyFloat step, long curvature_pairs);
     void LoggerAddCoordinatewisePhase (hyFloat shrinkage, char convergence_mode);
     void LoggerAllVariables          ();
     void LoggerSingleVariable        (unsigned long index, hyFloat logL, hyFloat bracket_precision, hyFloat brent_precision, hyFloat bracket_width, unsigned long bracket_evals, unsigned long brent_evals);
@@ -513,10 +659,28 @@ protected:
 
     _List*          RecoverAncestralSequencesMarginal
     (long, _Matrix&,_List const&, bool = false);
+    hyFloat*        ComputeRateClassPosteriors  (long, long&);
+    void            FillInConditionalsForAllClasses
+    (long, long);
     void            RestoreScalingFactors       (long, long, long, long*, long *);
     void            SetupLFCaches               (void);
+    void            SetConditionalPrecision     (bool);
+    void            GetSiteBlockLayout          (long, long&, long&, long&) const;
+    void            PlaceConditionalCaches      (long);
+    void            FirstTouchConditionalCaches (void);
+    void            RestoreThreadAffinity       (void);
+    void            ReportCachePlacement        (void);
+    static void     OwnedSiteBlocks             (long, long, long, long&, long&);
+    /*
+        20261018: SLKP
+        NUMA_AWARE_CACHES support: GetSiteBlockLayout returns the site blocks ComputeBlock uses with a given
+        number of threads, and OwnedSiteBlocks the (static) range of blocks computed by a given thread;
+        PlaceConditionalCaches reallocates the caches and has each thread first touch the slices it owns;
+        the threads stay pinned until RestoreThreadAffinity (called by DoneComputing) gives them their CPU masks back
+    */
     void            SetupCategoryCaches         (void);
     bool            HasPartitionChanged         (long);
+    bool            PartitionNeedsUpdate        (long);
     void            SetupParameterMapping       (void);
     void            CleanupParameterMapping     (void);
 
@@ -532,7 +696,12 @@ protected:
     /* 20110718: SLKP this list holds the index of the parameter interval mapping function
         used during optimization */
 
-    _Vector  computationalResults;
+    _Vector  computationalResults,
+             mpiPartitionCosts;
+    // 20261018: SLKP
+    // [MPI partition and site template modes, LOCAL_PROCESS_POOL] relative cost of evaluating every
+    // partition, refined from measured evaluation times after every MPI chunk (see ComputeOnMPIQueue)
+    // or at the end of each optimization with a process pool (see AssignPartitionsToNodes)
 
     _List           optimalOrders,
                     leafSkips,
@@ -611,10 +780,34 @@ protected:
      */
 
     bool            hasBeenOptimized,
-                    siteArrayPopulated;
+                    siteArrayPopulated,
+                    useAnalyticGradients,
+                    paddedConditionalCaches,
+                    concurrentPartitionBlocks,
+                    singlePrecisionConditionals,
+                    numaAwareCaches;
+    // 20261018 SLKP: whether ComputeGradient may use ComputeBranchGradients;
+    // whether SetupLFCaches laid out conditional caches with padded (_TheTree::GetConditionalStride) state vectors;
+    // whether Compute prunes all (partition x rate class) blocks in a single parallel region;
+    // whether conditionalInternalNodeLikelihoodCaches actually hold floats (only ever set inside Optimize,
+    // where only ComputeBlock and FillInConditionals touch these caches; see SetConditionalPrecision);
+    // whether conditional caches are placed and pruned using a static thread affinity map (see PlaceConditionalCaches)
+
+    long            numaPlacementThreads;
+    _SimpleList     numaThreadNodes,
+                    numaAllowedCPUs;
+    _List           numaSavedMasks;
+    // 20261018: SLKP; the thread count for which caches have been placed (0 : not yet placed), the memory node
+    // of every thread at placement time, the CPUs the process was allowed to run on (threads are pinned to these),
+    // and, for every thread that is currently pinned, the CPUs (a _SimpleList) of the mask it had before (empty if unpinned)
 
     _Formula*       computingTemplate;
     MSTCache*       mstCache;
+    _LocalProcessPool*
+                    processPool;
+    // 20261018: SLKP; worker processes evaluating partitions during Optimize (nil unless LOCAL_PROCESS_POOL > 1)
+    _TopologyMove*  topologyMove;
+    // 20261018: SLKP; the last topology move (nil if there is nothing to undo), see ApplyTopologyMove
 
     hyFloat      smoothingTerm,
                     smoothingReduction,
@@ -784,6 +977,8 @@ extern  _Vector      _scalerMultipliers,
 hyFloat                  acquireScalerMultiplier (long);
 hyFloat                  myLog                   (hyFloat);
 hyFloat                  mapParameterToInverval  (hyFloat, char, bool);
+hyFloat                  mapParameterToIntervalDerivative
+                                                 (hyFloat, char);
 
 #ifdef  __HYPHYMPI__
 extern                  _Matrix     resTransferMatrix;
@@ -309,6 +309,8 @@ public:
 
 
     _Matrix*    Exponentiate (hyFloat scale_to = 1.0, bool check_transition = false);                // exponent of a matrix
+    void        ExponentiateBatch (hyFloat const * t, long n, _List& results) const;
+    // append exp (t[i] * this), i = 0..n-1, to results; the Taylor terms are computed once for all t (see _TaylorExponential)
     void        Transpose (void);                   // transpose a matrix
     _Matrix     Gauss   (void);                     // Gaussian Triangularization process
     HBLObjectRef   LUDecompose (void) const;
@@ -689,6 +691,135 @@ private:
 
 /*__________________________________________________________________________________________________________________________________________ */
 
+class       _EigenExponential: public BaseObj {
+    /**
+        A cached spectral decomposition of a time-reversible rate matrix, normalized
+        to have unit (negative) trace, Q = U diag (L) U^{-1}.
+
+        Any matrix of the form c*Q can then be exponentiated with a diagonal scaling
+        and a single matrix product, which is what the tree engine needs when only
+        branch lengths change between likelihood evaluations.
+
+        The decomposition is deferred until the normalized matrix has been requested
+        at least twice, so that one-off rate matrices do not pay for it.
+     */
+
+public:
+    _EigenExponential           (hyFloat const * dense_rates, long dimension, hyFloat scale);
+    // dense_rates: row-major, dimension x dimension; stored divided by scale
+
+    virtual ~_EigenExponential  (void);
+    virtual BaseRef makeDynamic (void) const { return nil; }
+    virtual void    Duplicate   (BaseRefConst) {}
+
+    bool        Matches         (hyFloat const * dense_rates, hyFloat scale) const;
+    // true if dense_rates / scale equals the stored normalized rate matrix (to rounding)
+
+    bool        Decompose       (void);
+    // compute U, U^{-1} and L; returns false (and marks the object as unusable)
+    // if the matrix does not satisfy detailed balance or is reducible
+
+    bool        IsDecomposed    (void) const { return status == 1; }
+    bool        IsUsable        (void) const { return status >= 0; }
+
+    _Matrix*    Exponentiate    (hyFloat scale) const;
+    // exp (scale * Q); assumes that Decompose has succeeded; returns nil if a row has more than
+    // round-off negative mass or does not sum to 1, in which case the caller should fall back on
+    // _Matrix::Exponentiate
+
+    static  hyFloat NormalizingScale (_Matrix const&, hyFloat* dense_rates);
+    // returns -trace of the argument, and unpacks it into a row-major buffer
+
+private:
+    long        dimension;
+    char        status;         // 0 - not decomposed, 1 - decomposed, -1 - not reversible
+    hyFloat     *rates,         // the normalized rate matrix
+                *left,          // U  (columns are right eigenvectors)
+                *right,         // U^{-1}
+                *eigenvalues,
+                max_rate;
+};
+
+/*__________________________________________________________________________________________________________________________________________ */
+
+class       _TaylorExponential: public BaseObj {
+    /**
+        The Taylor series terms Q^k/k! of a rate matrix normalized to unit (negative)
+        trace, shared by the exponentials of all matrices of the form c*Q.
+
+        Each exp (c*Q) then costs a weighted sum of the stored terms (for c*Q scaled
+        down by 2^s, so that its norm is at most 1/2) followed by s squarings, instead
+        of a full Taylor series with a matrix product per term. This pays off as soon
+        as two branches share a rate matrix, e.g. for a global model on a tree.
+     */
+
+public:
+    _TaylorExponential          (hyFloat const * dense_rates, long dimension, hyFloat scale);
+    // dense_rates: row-major, dimension x dimension; stored divided by scale
+
+    virtual ~_TaylorExponential (void);
+    virtual BaseRef makeDynamic (void) const { return nil; }
+    virtual void    Duplicate   (BaseRefConst) {}
+
+    bool        Matches         (hyFloat const * dense_rates, hyFloat scale) const;
+    // true if dense_rates / scale equals the stored normalized rate matrix (to rounding)
+
+    void        ComputeTerms    (void);
+    // compute the Taylor terms; must be called once before Exponentiate
+
+    _Matrix*    Exponentiate    (hyFloat scale) const;
+    // exp (scale * Q); returns nil if the result does not look like a transition
+    // matrix, in which case the caller should fall back on _Matrix::Exponentiate
+
+private:
+    long        dimension,
+                term_count;
+    hyFloat     *rates,         // the normalized rate matrix
+                *terms,         // Q^k/k!, k = 1..term_count, one after the other
+                max_rate,
+                norm;           // the infinity norm of Q
+};
+
+/*__________________________________________________________________________________________________________________________________________ */
+
+class       _CachedExponential: public BaseObj {
+    /**
+        A memoized transition matrix, exp (Q), keyed on the exact numeric contents
+        of the (branch length scaled) rate matrix Q.
+
+        Lookups compare a 64-bit hash first and then the full matrix, so a cached
+        exponential is only ever returned for a bit-identical Q, and using the
+        cache does not change the computed likelihoods.
+     */
+
+public:
+    _CachedExponential          (hyFloat const * dense_rates, long dimension, unsigned long hash);
+    // dense_rates: row-major, dimension x dimension
+
+    virtual ~_CachedExponential (void);
+    virtual BaseRef makeDynamic (void) const { return nil; }
+    virtual void    Duplicate   (BaseRefConst) {}
+
+    bool        Matches         (hyFloat const * dense_rates, unsigned long hash) const;
+    // true if the hashes agree and dense_rates is identical to the stored rate matrix
+
+    void        Store           (_Matrix const&);
+    // keep a copy of the exponential of the stored rate matrix
+
+    bool        IsStored        (void) const { return exponential != nil; }
+
+    _Matrix*    Exponential     (void) const;
+    // a new copy of the stored exponential; assumes that Store has been called
+
+    static  unsigned long Hash  (_Matrix const&, hyFloat* dense_rates);
+    // unpacks the argument into a row-major buffer, and returns its hash
+
+private:
+    long            dimension;
+    unsigned long   hash;
+    hyFloat         *rates;
+    _Matrix         *exponential;
+};
 
 /*__________________________________________________________________________________________________________________________________________ */
 
@@ -0,0 +1,98 @@
+/*
+
+HyPhy - Hypothesis Testing Using Phylogenies.
+
+Copyright (C) 1997-now
+Core Developers:
+  Sergei L Kosakovsky Pond (spond@ucsd.edu)
+  Art FY Poon    (apoon42@uwo.ca)
+  Steven Weaver (sweaver@ucsd.edu)
+  
+Module Developers:
+	Lance Hepler (nlhepler@gmail.com)
+	Martin Smith (martin.audacis@gmail.com)
+
+Significant contributions from:
+  Spencer V Muse (muse@stat.ncsu.edu)
+  Simon DW Frost (sdf22@cam.ac.uk)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef     __RANDOM_STREAM__
+#define     __RANDOM_STREAM__
+
+#include <stdint.h>
+#include "hy_types.h"
+#include "mersenne_twister.h"
+
+class _hyRandomStream {
+    /*
+        20261018: SLKP
+        a small (xoshiro256**) generator for the simulation and sampling routines that draw in parallel:
+        each block of work gets its own stream, identified by a (seed, stream) pair, so the draws do not
+        depend on which thread (or how many threads) did the work
+    */
+
+    public:
+        static uint64_t GlobalSeed (void) {
+            // 64 bits from the global (RANDOM_SEED) generator; two separate statements fix the order of the draws
+            uint64_t const high = genrand_int32 ();
+            return (high << 32) | (uint64_t)genrand_int32 ();
+        }
+
+        _hyRandomStream (uint64_t seed, uint64_t stream) {
+            uint64_t mixer = seed ^ (stream * 0xd1b54a32d192ed03ULL);
+            for (uint64_t & word : state) {
+                // splitmix64
+                uint64_t z = (mixer += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                word = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t Next (void) {
+            uint64_t const result  = Rotate (state[1] * 5ULL, 7) * 9ULL,
+                           shifted = state[1] << 17;
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= shifted;
+            state[3]  = Rotate (state[3], 45);
+            return result;
+        }
+
+        hyFloat Uniform (void) {
+            // on [0,1), with 53 random bits
+            return (Next () >> 11) * (1. / 9007199254740992.);
+        }
+
+    private:
+        static uint64_t Rotate (uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        uint64_t state[4];
+};
+
+#endif
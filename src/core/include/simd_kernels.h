@@ -0,0 +1,88 @@
+/*
+
+HyPhy - Hypothesis Testing Using Phylogenies.
+
+Copyright (C) 1997-now
+Core Developers:
+  Sergei L Kosakovsky Pond (spond@ucsd.edu)
+  Art FY Poon    (apoon42@uwo.ca)
+  Steven Weaver (sweaver@ucsd.edu)
+  
+Module Developers:
+	Lance Hepler (nlhepler@gmail.com)
+	Martin Smith (martin.audacis@gmail.com)
+
+Significant contributions from:
+  Spencer V Muse (muse@stat.ncsu.edu)
+  Simon DW Frost (sdf22@cam.ac.uk)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef     __SIMD_KERNELS__
+#define     __SIMD_KERNELS__
+
+#include "hy_types.h"
+
+/**
+    20261018: SLKP
+ 
+    Matrix x vector kernels for the pruning algorithm on alphabets other than
+    nucleotides (20-state proteins, 61-state codons and arbitrary N), selected at
+    run time from the instruction sets the CPU actually supports, rather than at
+    compile time by _SLKP_USE_AVX_INTRINSICS. This allows a single binary built
+    for a generic x86-64 target to run AVX2/FMA or AVX-512 code on nodes that
+    have it.
+ 
+    The detected level can be lowered (never raised) by setting the HYPHY_SIMD
+    environment variable to "scalar", "avx2" or "avx512", and further for the trees
+    of a likelihood function with SIMD_KERNELS (see _TheTree::SetSIMDLevel).
+ 
+    tMatrix is a row-major D x D transition matrix.
+*/
+
+enum _hy_simd_level {
+    kSIMDScalar = 0,
+    kSIMDAVX2   = 1,
+    kSIMDAVX512 = 2
+};
+
+/**
+    parent[p] *= sum_c tMatrix[p*D+c] * child[c] for p = 0..D-1
+    @return sum_p parent[p] (after the update), used for scaling checks
+*/
+typedef hyFloat (*_hy_pruning_kernel)   (hyFloat const * tMatrix, hyFloat const * child, hyFloat * parent, unsigned long D);
+
+/**
+    @return sum_p root[p] * freqs[p] * (sum_c tMatrix[p*D+c] * branch[c])
+*/
+typedef hyFloat (*_hy_branch_ll_kernel) (hyFloat const * tMatrix, hyFloat const * branch, hyFloat const * root, hyFloat const * freqs, unsigned long D);
+
+_hy_simd_level          _hy_simd_get_level          (void);
+const char *            _hy_simd_level_name         (_hy_simd_level);
+_hy_simd_level          _hy_simd_level_from_name    (const char *, _hy_simd_level otherwise);
+// "scalar", "avx2" or "avx512"; 'otherwise' for anything else
+
+// the kernels for the detected level, or for 'cap' if that is lower
+_hy_pruning_kernel      _hy_select_pruning_kernel   (unsigned long D, _hy_simd_level cap = kSIMDAVX512);
+_hy_branch_ll_kernel    _hy_select_branch_ll_kernel (unsigned long D, _hy_simd_level cap = kSIMDAVX512);
+
+#endif
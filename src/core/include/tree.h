@@ -40,6 +40,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef     __TREE__
 #define     __TREE__
 
+#include    <stdint.h>
 #include    "topology.h"
 #include    "dataset_filter.h"
 #include    "dataset_filter_numeric.h"
@@ -73,8 +74,89 @@ public:
 
 }; // used for tree imaging
 
+//_______________________________________________________________________________________________
+
+class _ExponentialQueue {
+    // 20261018: SLKP
+    // transition matrices that need to be (re)computed for one rate class of a tree;
+    // filled in by _TheTree::QueueExponentials, processed one matrix at a time
+    // by _TheTree::ExponentiateQueued (thread-safe for distinct indices) and
+    // finalized by _TheTree::FinishExponentials
+    
+    // if node tracking is requested, 'ready' has a flag for every node in the flat
+    // (leaves followed by internal nodes) order, which is cleared for nodes with queued
+    // matrices and set again once their matrices are available; this lets pruning
+    // on site blocks start before all the matrices have been computed
+    
+    // if the tree keeps a transition matrix cache, 'cacheEntries' has the matching
+    // _CachedExponential (or 0) for every queued matrix; a matrix that repeats an
+    // earlier one in the same queue records the index of the latter in 'duplicateOf',
+    // and waits for its 'cacheReady' flag instead of being exponentiated again
+    
+    // with batched exponentials, matrices that are scalar multiples of the same rate matrix
+    // share a _TaylorExponential ('taylorSources', scaled by 'taylorScales'); the first matrix
+    // of every such group ('taylorLeaders') computes the Taylor terms and sets its
+    // 'taylorReady' flag, which the other members of the group wait for
 
+public:
+    _ExponentialQueue (void) {
+        eigenScales = nil;
+        ready       = nil;
+        cacheReady  = nil;
+        taylorScales= nil;
+        taylorReady = nil;
+        hasExplicitForm = false;
+        catID       = -1L;
+    }
+    ~_ExponentialQueue (void) {
+        if (eigenScales) {
+            delete [] eigenScales;
+        }
+        if (ready) {
+            delete [] ready;
+        }
+        if (cacheReady) {
+            delete [] cacheReady;
+        }
+        if (taylorScales) {
+            delete [] taylorScales;
+            delete [] taylorReady;
+        }
+    }
+    
+    unsigned long   countitems      (void) const {
+        return matrices.lLength;
+    }
+    
+    bool            IsTracking      (void) const {
+        return ready != nil;
+    }
+    
+    void            WaitFor         (long) const;
 
+    _List           matrices,
+                    nodes,
+                    eigenInUse,
+                    cacheInUse,
+                    taylorInUse;
+    
+    _SimpleList     isExplicitForm,
+                    eigenSources,
+                    flatIndices,
+                    computed,
+                    cacheEntries,
+                    duplicateOf,
+                    taylorSources,
+                    taylorLeaders;
+    
+    hyFloat       * eigenScales,
+                  * taylorScales;
+    char          * ready,
+                  * cacheReady,
+                  * taylorReady;
+    bool            hasExplicitForm;
+    long            catID;
+};
 
 //_______________________________________________________________________________________________
 
@@ -126,7 +208,12 @@ public:
 
 
 
-    _List*      RecoverAncestralSequences       (_DataSetFilter const*, _SimpleList const&, _List const&, hyFloat *, hyFloat const*, long, long*, _Vector*, bool = false);
+    _List*      RecoverAncestralSequences       (_DataSetFilter const*, _List const&, hyFloat const*, long*, _Vector const*, bool = false, long = 1);
+    void        ComputeMarginalSupport          (_DataSetFilter const*, _SimpleList const&, hyFloat const*, long*, _Vector const*, long, hyFloat const*, bool, _Matrix&, long = 1);
+    _List*      SampleAncestralStates           (_DataSetFilter const*, _SimpleList const&, hyFloat const*, long, hyFloat const*, hyFloat const*, unsigned long, uint64_t, long = 1);
+    // 20261018: SLKP
+    // ancestral reconstruction routines, parallel over site patterns (or blocks of sites for sampling);
+    // marginal support and sampling read the conditional likelihoods from the (up-to-date) caches of the LF
     void        RecoverNodeSupportStates        (_DataSetFilter const*, long, _Matrix&);
     void        RecoverNodeSupportStates2       (node<long>*,hyFloat*,hyFloat*,long, _AVLListX &);
     _List*      SampleAncestors                 (_DataSetFilter*, node<long>*);
@@ -134,6 +221,14 @@ public:
 
     long        ComputeReleafingCost            (_DataSetFilter const*, long, long, _SimpleList* = nil, long = 0) const;
     long        ComputeReleafingCostChar        (_DataSetFilter const*, long, long) const;
+    void        ClusterPatternsByLeafColumns    (_DataSetFilter const*, _SimpleList&) const;
+    uint64_t    PatternContentHash              (_DataSetFilter const*) const;
+    // 20261018: SLKP
+    // fast (linear in the number of leaves per pattern, parallel over patterns) alternative to the greedy
+    // spanning tree ordering of OptimalOrder: patterns are sorted lexicographically by (hashed) leaf
+    // characters in post-order, which makes patterns that share the columns of whole subtrees neighbors;
+    // PatternContentHash fingerprints the topology and the leaf characters of every pattern, and is
+    // the key of the on-disk summation order cache
     void        DumpingOrder                    (_DataSetFilter*, _SimpleList&);
     void        SetTreeCodeBase                 (long);
     long        IsLinkedToALF                   (long&) const;
@@ -158,6 +253,11 @@ public:
     void        MolecularClock                  (_String const&, _List&) const;
 
     void        SetUp                           (void);
+    void        ApplyTopologyMove               (bool, node<long>*, node<long>*, _SimpleList&, _SimpleList&, _SimpleList&);
+    // 20261018: SLKP
+    // apply an NNI (bool = false) or SPR (bool = true) move to the tree and rebuild the flat traversal lists;
+    // reports where leaves and internal nodes have moved in the post-order, and which internal nodes have new subtrees
+    // (see _LikelihoodFunction::ApplyTopologyMove); throws a _String on invalid moves
     void        SetUpMatrices                   (long);
     void        CleanUpMatrices                 (void);
     //void        BuildTopLevelCache              (void);
@@ -220,7 +320,7 @@ public:
     void        ClearForcedRecomputeList        (void)          {
         forceRecalculationOnTheseBranches.Clear();
     }
-    bool        HasForcedRecomputeList          (void)          {
+    bool        HasForcedRecomputeList          (void) const    {
         return forceRecalculationOnTheseBranches.lLength;
     }
     // 20090306: SLKP
@@ -239,12 +339,59 @@ public:
   
 
 #ifdef  _SLKP_LFENGINE_REWRITE_
-    void            SampleAncestorsBySequence       (_DataSetFilter const*, _SimpleList const&, node<long>*, _AVLListX const*, hyFloat const*, _List&, _SimpleList*, _List&, hyFloat const*, long);
-
-    hyFloat      ComputeTreeBlockByBranch        (_SimpleList&, _SimpleList&, _SimpleList*, _DataSetFilter const*, hyFloat*, long*, hyFloat*, _Vector*, long&, long, long, long = -1, hyFloat* = nil, long* = nil, long = -1, long * = nil);
+    template <typename CACHE_TYPE>
+    hyFloat      ComputeTreeBlockByBranch        (_SimpleList&, _SimpleList&, _SimpleList*, _DataSetFilter const*, CACHE_TYPE*, long*, hyFloat*, _Vector*, long&, long, long, long = -1, hyFloat* = nil, long* = nil, long = -1, long * = nil, _ExponentialQueue const* = nil);
+    // 20261018: SLKP
+    // instantiated (in tree.cpp) for hyFloat and float internal node caches, as is FillInConditionals
     long            DetermineNodesForUpdate         (_SimpleList&,  _List* = nil, long = -1, long = -1, bool = true);
     void            ExponentiateMatrices            (_List&, long, long = -1);
-    void            FillInConditionals              (_DataSetFilter const*, hyFloat*,  _SimpleList*);
+    void            QueueExponentials               (_List&, long, _ExponentialQueue&, bool = false);
+    void            ExponentiateQueued              (_ExponentialQueue&, unsigned long) const;
+    void            ExponentiateQueue               (_ExponentialQueue&, long);
+    void            FinishExponentials              (_ExponentialQueue&);
+    // 20261018: SLKP
+    // the stages of ExponentiateMatrices; a caller can interleave ExponentiateQueued calls with
+    // ComputeTreeBlockByBranch on site blocks, by passing it a node-tracking queue
+    void            SetEigenExponentials            (bool use_eigen) {
+        if (!(useEigenExponentials = use_eigen)) {
+            eigenExponentials.Clear();
+        }
+    }
+    // 20261018: SLKP
+    // toggle the use of cached spectral decompositions (_EigenExponential) in ExponentiateMatrices;
+    // rate matrices that fail the detailed balance check are still exponentiated directly
+    void            SetBatchExponentials            (bool batch) {
+        batchExponentials = batch;
+    }
+    // 20261018: SLKP
+    // exponentiate the matrices in a queue that share a rate matrix (up to a scalar) from
+    // common Taylor series terms; see _TaylorExponential and QueueExponentials
+    void            SetTransitionMatrixCache        (unsigned long size) {
+        if (!(transitionMatrixCacheSize = size)) {
+            transitionMatrixCache.Clear();
+        }
+    }
+    // 20261018: SLKP
+    // keep up to 'size' exponentiated matrices (0 to disable), shared by all the nodes and rate
+    // classes of the tree; see QueueExponentials
+    void            SetSIMDLevel                    (long level) {
+        simdLevel = level;
+    }
+    // 20261018: SLKP
+    // the highest _hy_simd_level (see simd_kernels.h) of the pruning kernels used for this tree;
+    // the level supported by the CPU still applies
+    void            SetPaddedConditionals           (bool pad) {
+        paddedConditionals = pad;
+    }
+    unsigned long   GetConditionalStride            (unsigned long dimension) const {
+        return paddedConditionals && dimension > 4UL ? (dimension + 7UL) & ~7UL : dimension;
+    }
+    // 20261018: SLKP
+    // with padding on, per-site vectors in internal node and branch conditional caches are
+    // spaced by a multiple of 8 doubles, so that each vector in a 64-byte aligned cache starts
+    // on a cache line; only the first 'dimension' entries of each vector are ever read
+    template <typename CACHE_TYPE>
+    void            FillInConditionals              (_DataSetFilter const*, CACHE_TYPE*,  _SimpleList*);
 
     void            ComputeBranchCache              ( _SimpleList&,
             long nodeID,
@@ -274,6 +421,16 @@ public:
         hyFloat*         storageVec = nil
     );
 
+    unsigned long   ChildrenInCSR                   (_SimpleList&, _SimpleList&) const;
+    // 20261018: SLKP
+    // the children of each internal node in compressed (offsets, flat node indices) form
+
+    bool            ComputeBranchGradients          (_DataSetFilter const*, long*, _Vector const*, _SimpleList const&, _List const&, hyFloat*, long = -1, long = 1, bool = false, hyFloat const* = nil, long = 1L);
+    // 20261018: SLKP
+    // accumulate d log L / dx for parameters that enter a single branch matrix, given
+    // the matrices dP/dx; uses one inside and one outside pass per site pattern
+    // (with the last argument set, accumulate the change in log L for replacing P by P + D instead)
+
     hyFloat          ComputeTwoSequenceLikelihood    (
         _SimpleList&            siteOrdering,
         _DataSetFilter const*     theFilter,
@@ -292,12 +449,25 @@ public:
 
     long        categoryCount;
 
+    bool        useEigenExponentials,
+                paddedConditionals,
+                batchExponentials;
+    
+    unsigned long
+                transitionMatrixCacheSize;
+    
+    long        simdLevel;
+
 protected:
   
     void        delete_associated_calcnode (node<long>*) const;
 
     virtual void _RemoveNodeList (_SimpleList const& list);
 
+    _EigenExponential*  MapToEigenExponential   (_Matrix const&, hyFloat&, hyFloat*, _List&);
+    unsigned long       MapToCachedExponentials (_ExponentialQueue&);
+    void                MapToTaylorExponentials (_ExponentialQueue&);
+
     bool        IntPopulateLeaves   (_DataSetFilter const*, long) const;
 
     virtual     void                PreTreeConstructor                  (bool);
@@ -315,6 +485,11 @@ protected:
                 topLevelRightL,
                 forceRecalculationOnTheseBranches,
                 nodesToUpdate;
+
+    _List       eigenExponentials,
+    // most recently used rate matrix decompositions, see ExponentiateMatrices
+                transitionMatrixCache;
+    // most recently used transition matrices (_CachedExponential), see QueueExponentials
     
     static      hyFloat _timesCharWidths[256],
                          _maxTimesCharWidth;
@@ -43,6 +43,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <float.h>
 #include <math.h>
 
 
@@ -55,9 +56,11 @@
 #include "global_object_lists.h"
 #include "global_things.h"
 #include "time_difference.h"
+#include "random_stream.h"
 #include "scfg.h"
 #include "tree_iterator.h"
 #include "vector.h"
+#include "simd_kernels.h"
 
 using namespace hyphy_global_objects;
 using namespace hy_global;
@@ -67,6 +70,28 @@ using namespace hy_global;
 //#define    _COMPARATIVE_LF_DEBUG_DUMP
 //#define    _COMPARATIVE_LF_DEBUG_CHECK
 
+#ifdef __linux__
+    // NUMA_AWARE_CACHES: thread pinning and page placement queries
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#endif
+
+#ifdef __UNIX__
+    // summation order caches: process-private temporary files, cache directory creation
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+#if defined __UNIX__ && !defined __HYPHYMPI__
+    // LOCAL_PROCESS_POOL: worker processes forked by the likelihood function
+    #define _HY_LOCAL_PROCESS_POOL_
+    #include <unistd.h>
+    #include <errno.h>
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+#endif
+
 #if defined _COMPARATIVE_LF_DEBUG_CHECK
 #include <signal.h>
     unsigned long  _comparative_lf_index = 0UL;
@@ -100,7 +125,76 @@ long         siteEvalCount  =   0;
 _List           parallelOptimizerTasks;
 
 _Matrix         varTransferMatrix,
-                resTransferMatrix;
+                resTransferMatrix,
+                varTransferHistory,
+                mpiResponseTimes,
+                mpiChunkMessages;
+
+// 20261018: SLKP
+// parameter values are sent to MPI compute nodes as deltas: varTransferMatrix holds
+// [number of changed values, index, value, index, value, ...] (the first cell is < -1e100
+// to terminate the compute loop), and row i of varTransferHistory has the values last
+// sent to node i+1 (NaN if nothing has been sent yet); the likelihood functions themselves
+// are still sent (by InitMPIOptimizer) as the HBL text of SerializeLF, which every node
+// parses and executes before its first evaluation, i.e. only the per-evaluation traffic
+// is binary
+
+// row i of mpiResponseTimes has [MPI_Wtime of the last request sent to node i+1,
+// total time spent waiting for node i+1, number of requests]; in partition and site
+// template modes, row i of mpiChunkMessages is the (nonblocking) send buffer for node i+1:
+// the parameter deltas followed by [number of partitions, partition, partition, ...],
+// see ComputeOnMPIQueue
+
+static void    _hy_mpi_setup_transfer_buffers (long nodes, long variables, long partitions = 0L) {
+    _Matrix::CreateMatrix (&varTransferMatrix, 1, 1 + 2*variables, false, true, false);
+    _Matrix::CreateMatrix (&varTransferHistory, nodes, MAX (variables, 1L), false, true, false);
+    InitializeArray (varTransferHistory.theData, varTransferHistory.GetSize(), (hyFloat)NAN);
+    _Matrix::CreateMatrix (&mpiResponseTimes, nodes, 3, false, true, false);
+    if (partitions > 0L) {
+        _Matrix::CreateMatrix (&mpiChunkMessages, nodes, 2 + 2*variables + partitions, false, true, false);
+    }
+}
+
+static hyFloat _hy_mpi_record_response (long index) {
+    hyFloat * times = mpiResponseTimes.theData + 3*index,
+              elapsed = MPI_Wtime() - times[0];
+    times[1] += elapsed;
+    times[2] += 1.;
+    return elapsed;
+}
+
+static long    _hy_mpi_pack_parameters (long index, hyFloat * message, bool& anyChanged) {
+    // write [changed, index, value, ...] for the parameters of node index+1 which differ from
+    // those last sent to it into 'message'; 'anyChanged' is set if any of them has been modified
+    _SimpleList     *   slaveParams = (_SimpleList*)parallelOptimizerTasks(index);
+    hyFloat const   *   lastSent    = varTransferHistory.theData + index * varTransferHistory.GetVDim();
+    long                changed     = 0L;
+
+    for (unsigned long varID = 0UL; varID < slaveParams->lLength; varID++) {
+        _Variable * aVar = LocateVar (slaveParams->list_data[varID]);
+        hyFloat     value = aVar->IsIndependent() ? aVar->Value() : aVar->Compute()->Value();
+
+        anyChanged = anyChanged || aVar->HasChanged();
+        
+        // NaN in lastSent (nothing sent yet) never compares equal
+        if (value != lastSent[varID]) {
+            message[1 + 2*changed] = varID;
+            message[2 + 2*changed] = value;
+            changed ++;
+        }
+    }
+    
+    message[0] = changed;
+    return changed;
+}
+
+static void    _hy_mpi_commit_parameters (long index, hyFloat const * message) {
+    // record the values packed into 'message' as sent to node index+1
+    hyFloat * lastSent = varTransferHistory.theData + index * varTransferHistory.GetVDim();
+    for (long k = 0L; k < (long)message[0]; k++) {
+        lastSent[(long)message[1 + 2*k]] = message[2 + 2*k];
+    }
+}
 
 long            MPICategoryCount,
                 transferrableVars,
@@ -112,6 +206,185 @@ _String         mpiLoopSwitchToOptimize ("_CONTEXT_SWITCH_MPIPARTITIONS_"),
 
 #endif
 
+//_______________________________________________________________________________________
+
+struct _LocalProcessPool {
+    /*
+        20261018: SLKP
+        the state of a LOCAL_PROCESS_POOL
+     
+        the master and the worker processes exchange data through a single anonymous shared
+        memory mapping laid out as
+            [parameters : one value per independent variable of the likelihood function]
+            [results    : one log-likelihood per partition]
+            [times      : total time spent evaluating by each worker]
+        pipes are used only for signalling: the master writes a byte to the 'go' pipe of every worker
+        after it has stored the parameter values, and each worker writes a byte to the shared 'done'
+        pipe after it has stored the log-likelihoods of its partitions; a byte of 0 tells the workers
+        to exit (as does the master closing its end of the pipe)
+    */
+    _SimpleList     workers,        // process IDs
+                    go_pipes;       // write end of the 'go' pipe for every worker
+    _List           partitions;     // _SimpleList of partition indices for every worker (from AssignPartitionsToNodes)
+    _Matrix         start_values;   // independent variable values when the pool was started
+    int             done_pipe[2];
+    long            evaluations;
+    hyFloat       * shared,
+                  * parameters,
+                  * results,
+                  * times;
+    size_t          shared_size;
+};
+
+#ifdef _HY_LOCAL_PROCESS_POOL_
+static void _hy_pool_signal (int fd, char what) {
+    while (write (fd, &what, 1) < 0 && errno == EINTR) {}
+}
+
+static char _hy_pool_wait (int fd) {
+    char what = 0;
+    ssize_t got;
+    while ((got = read (fd, &what, 1)) < 0 && errno == EINTR) {}
+    return got == 1 ? what : 0;
+}
+
+template <typename BODY>
+static pid_t _hy_fork_worker (BODY const& body) {
+    /*
+        20261018: SLKP
+        fork a worker process (for LOCAL_PROCESS_POOL and _hy_forked_task_pool) that runs body () with one OpenMP
+        thread and exits, with status 1 if body throws, without returning; returns the process ID (< 0 on failure)
+    */
+    pid_t pid = fork ();
+    if (pid == 0) {
+        int exit_status = 0;
+        try {
+#ifdef _OPENMP
+            // the OpenMP thread pool of the parent process does not survive the fork
+            omp_set_num_threads (1);
+#endif
+            body ();
+        } catch (...) {
+            // an error must not unwind into the interpreter of the parent process
+            exit_status = 1;
+        }
+        // skip atexit handlers and stream flushing, which belong to the parent process
+        _exit (exit_status);
+    }
+    return pid;
+}
+
+static bool _hy_wait_for_worker (long pid) {
+    // wait for a process started by _hy_fork_worker; false if it did not exit normally
+    int status = 0;
+    return waitpid (pid, &status, 0) == pid && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+template <typename TASK, typename SETUP>
+static bool _hy_forked_task_pool (long tasks, long result_size, long processes, hyFloat * results, TASK const& run_task, SETUP const& worker_setup, _String const& task_name) {
+    /*
+        20261018: SLKP
+        run_task (t, results + t*result_size) for t = 0..tasks-1 on this process and (processes - 1) forked workers,
+        which claim tasks on demand and return the results through a shared memory mapping (each worker starts with
+        a copy-on-write image of this process, and calls worker_setup first); tasks left unfinished by a failed
+        worker (one that exits with a non-zero status, e.g. because a task threw) are redone by this process;
+        returns false (having done nothing) if the mapping can't be allocated
+    */
+    // [the next task to claim][a completion flag for every task][results]
+    size_t  shared_size = sizeof (long) * (tasks + 1L) + sizeof (hyFloat) * tasks * result_size;
+    void  * shared      = mmap (nil, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shared == MAP_FAILED) {
+        ReportWarning (_String ("Failed to allocate the shared memory buffer for worker processes; every ") & task_name & " will be run by this process");
+        return false;
+    }
+
+    long    * next_task      = (long*)shared,
+            * completed      = next_task + 1L;
+    hyFloat * shared_results = (hyFloat*)(completed + tasks);
+
+    *next_task = 0L;
+    InitializeArray (completed, tasks, 0L);
+
+    auto claim_tasks = [&] (void) -> void {
+        for (long t = __sync_fetch_and_add (next_task, 1L); t < tasks && !terminate_execution; t = __sync_fetch_and_add (next_task, 1L)) {
+            run_task (t, shared_results + t * result_size);
+            completed[t] = 1L;
+        }
+    };
+
+    fflush (stdout);
+    fflush (stderr);
+
+    _SimpleList workers;
+    for (long w = 1L; w < processes; w++) {
+        pid_t pid = _hy_fork_worker ([&] (void) -> void {
+            worker_setup ();
+            claim_tasks ();
+        });
+        if (pid < 0) {
+            break;
+        }
+        workers << pid;
+    }
+
+    auto wait_for_workers = [&] (void) -> void {
+        workers.Each ([&] (long pid, unsigned long) -> void {
+            if (!_hy_wait_for_worker (pid)) {
+                ReportWarning (_String ("A worker process failed while running a ") & task_name & "; its unfinished tasks will be redone by this process");
+            }
+        });
+    };
+
+    try {
+        claim_tasks ();
+    } catch (...) {
+        // let the workers finish before the mapping goes away
+        __sync_fetch_and_add (next_task, tasks);
+        wait_for_workers ();
+        munmap (shared, shared_size);
+        throw;
+    }
+    wait_for_workers ();
+
+    for (long t = 0L; t < tasks && !terminate_execution; t++) {
+        if (!completed[t]) {
+            ReportWarning (_String ("The ") & task_name & " " & t & " was not completed by a worker process and will be redone");
+            run_task (t, shared_results + t * result_size);
+        }
+    }
+
+    memcpy (results, shared_results, sizeof (hyFloat) * tasks * result_size);
+    munmap (shared, shared_size);
+    return true;
+}
+#endif
+
+template <typename TASK>
+static void _hy_run_evaluation_tasks (_LikelihoodFunction * lf, long tasks, long result_size, long processes, hyFloat * results, TASK const& run_task, _String const& task_name) {
+    /*
+        20261018: SLKP
+        run likelihood evaluation tasks on up to 'processes' processes (see _hy_forked_task_pool), or on this process
+        only; with more than one process, every process evaluates with one thread, so that the results do not depend
+        on which process computed them
+    */
+    bool done = false;
+#ifdef _HY_LOCAL_PROCESS_POOL_
+    processes = MIN (processes, tasks);
+    if (processes > 1L) {
+        long const threads = lf->GetThreadCount ();
+        lf->SetThreadCount (1L);
+        done = _hy_forked_task_pool (tasks, result_size, processes, results, run_task, [lf] (void) -> void {
+            lf->SetThreadCount (1L);
+        }, task_name);
+        lf->SetThreadCount (threads);
+    }
+#endif
+    for (long t = 0L; t < tasks && !done && !terminate_execution; t++) {
+        run_task (t, results + t * result_size);
+    }
+}
+
 #define     SQR(A) (A)*(A)
 #define     GOLDEN_RATIO 1.618034
 #define     GOLDEN_RATIO_R  0.61803399
@@ -147,7 +420,12 @@ _String  const
                                 kIntermediatePrecision          ("INTERMEDIATE_PRECISION"),
                                 keepOptimalOrder                ("KEEP_OPTIMAL_ORDER"),
                                 optimizeSummationOrder          ("OPTIMIZE_SUMMATION_ORDER"),
+                                // 0 : keep the filter order of site patterns; 1 (default) : greedy spanning tree ordering (serial,
+                                // quadratic in OPTIMIZE_SUMMATION_ORDER_PARTITION); 2 : parallel sort of patterns by leaf columns (see ClusterPatternsByLeafColumns)
                                 optimizePartitionSize           ("OPTIMIZE_SUMMATION_ORDER_PARTITION"),
+                                kSummationOrderCache            ("SUMMATION_ORDER_CACHE"),
+                                // if set to a directory, site pattern orders computed by OptimalOrder are saved there, keyed by
+                                // the content of the filter, the tree topology and the ordering mode, and reused by later analyses
                                 likefuncOutput                  ("LIKELIHOOD_FUNCTION_OUTPUT"),
                                 categorySimulationMethod        ("CATEGORY_SIMULATION_METHOD"),
                                 kUseInitialDistanceGuess        ("USE_DISTANCES"),
@@ -162,6 +440,16 @@ _String  const
                                 allowSequenceMismatch           ("ALLOW_SEQUENCE_MISMATCH"),
                                 mpiPrefixCommand                ("MPI_PREFIX_COMMAND"),
                                 kSkipConjugateGradient          ("SKIP_CONJUGATE_GRADIENT"),
+                                kUseAnalyticGradients           ("USE_ANALYTIC_GRADIENTS"),
+                                // if TRUE (default), gradients for parameters local to a single branch
+                                // are computed from one inside/outside pass rather than by finite differences
+                                kLocalProcessPool               ("LOCAL_PROCESS_POOL"),
+                                // if set to N > 1 (default is 0), partitions are evaluated during optimization by N worker
+                                // processes forked for the duration of Optimize; see StartProcessPool
+                                kUseSinglePrecision             ("USE_SINGLE_PRECISION_CONDITIONALS"),
+                                // if TRUE (default is FALSE), internal node conditional likelihoods are stored as floats
+                                // during optimization (with more frequent rescaling); the log-likelihood at the optimum
+                                // is recomputed in double precision, and the difference is reported
                                 useIntervalMapping              ("USE_INTERVAL_MAPPING"),
                                 intervalMappingMethod           ("INTERVAL_MAPPING_METHOD"),
                                 kUseAdaptiveVariableStep        ("USE_ADAPTIVE_VARIABLE_STEP"),
@@ -188,7 +476,14 @@ _String  const
                                 kAddLFSmoothing                 ("LF_SMOOTHING_SCALER"),
                                 kOptimizationPrecision          ("OPTIMIZATION_PRECISION"),
                                 kOptimizationMethod             ("OPTIMIZATION_METHOD"),
-                                kReduceLFSmoothing              ("LF_SMOOTHING_REDUCTION");
+                                kReduceLFSmoothing              ("LF_SMOOTHING_REDUCTION"),
+                                kSimulationThreads              ("SIMULATION_THREADS"),
+                                // if set to N > 0, Simulate and SimulateDataSet draw sites on N threads instead of the
+                                // thread count of the likelihood function; the simulated data do not depend on it
+                                kLikelihoodFunctionThreads      ("LIKELIHOOD_FUNCTION_THREADS");
+                                // if set to N > 0, likelihood functions constructed after this point evaluate on at most
+                                // N threads (e.g. N = 1 to compare site blocks pruned concurrently with serial evaluation);
+                                // Optimize still picks its own thread count
 
 
 
@@ -556,6 +851,14 @@ void _LikelihoodFunction::Init (void)
     siteArrayPopulated  = false;
     smoothingTerm       = 0.;
     smoothingPenalty    = 0.;
+    useAnalyticGradients = true;
+    paddedConditionalCaches = false;
+    concurrentPartitionBlocks = false;
+    singlePrecisionConditionals = false;
+    numaAwareCaches     = false;
+    numaPlacementThreads = 0L;
+    processPool         = nil;
+    topologyMove        = nil;
 
     conditionalInternalNodeLikelihoodCaches = nil;
     conditionalTerminalNodeStateFlag        = nil;
@@ -784,8 +1087,299 @@ void     _LikelihoodFunction::Rebuild (bool rescan_parameters) {
 
 //_______________________________________________________________________________________
 
+static void _hy_move_cache_slices (char * base, unsigned long slice, _SimpleList const& map, char * buffer) {
+    // move the k-th 'slice' bytes long block of 'base' to position map[k] by following the cycles of the permutation
+    _SimpleList source (map.lLength, 0, 0),
+                done   (map.lLength, 0, 0);
+
+    map.Each ([&] (long to, unsigned long from) -> void {
+        source[to] = from;
+    });
+
+    for (long k = 0L; k < map.lLength; k++) {
+        if (done.get (k) || source.get (k) == k) {
+            continue;
+        }
+        memcpy (buffer, base + k * slice, slice);
+        long to = k;
+        while (source.get (to) != k) {
+            memcpy (base + to * slice, base + source.get (to) * slice, slice);
+            done[to] = 1L;
+            to       = source.get (to);
+        }
+        memcpy (base + to * slice, buffer, slice);
+        done[to] = 1L;
+    }
+}
+
+//_______________________________________________________________________________________
+
+void     _LikelihoodFunction::ApplyTopologyMove (_TheTree* tree, bool spr, node<long>* subtree, node<long>* target, bool undo) {
+
+    /*
+        20261018: SLKP
+
+        cached conditionals, scaling factors and leaf states are permuted to follow their nodes, which
+        is all the 'unaffected' nodes need, because their subtrees (and hence traversal masks) are the same;
+        the nodes with new subtrees start from unit scaling factors (removing them from the scaling tallies),
+        so that their scaling is consistent with the new traversal masks, and are queued for recomputation
+
+        the conditionals and scaling factors of these nodes are saved before they are reset; undoing the move
+        with no intervening parameter changes puts them back, and only the root needs to be recomputed
+    */
+
+    _SimpleList partitions,
+                leaf_map,
+                node_map,
+                dirty,
+                stale_branches;
+
+    for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+        if (GetIthTree (i) == tree) {
+            partitions << i;
+        }
+    }
+
+    if (partitions.empty()) {
+        throw (tree->GetName()->Enquote() & " is not a part of the likelihood function");
+    }
+
+    // outside of a compute block (e.g. after Optimize) there are no caches to carry over; the tree,
+    // the filter map and the traversal shortcuts are still updated, and the next setup starts afresh
+    bool const cached     = conditionalInternalNodeLikelihoodCaches != nil;
+    bool       restorable = cached && !undo && evalsSinceLastSetup > 0L && computationalResults.get_used() == theTrees.lLength;
+
+    for (unsigned long p = 0UL; p < partitions.lLength; p++) {
+        long i = partitions.get (p);
+        if (cached && !conditionalInternalNodeLikelihoodCaches[i]) {
+            throw _String ("Topology moves require conditional likelihood caches, i.e. a character data filter and a tree with at least three leaves");
+        }
+        for (unsigned long j = 0UL; j < theDataFilters.lLength; j++) {
+            if (theDataFilters.get (j) == theDataFilters.get (i) && GetIthTree (j) != tree) {
+                throw (_String ("Cannot rearrange ") & tree->GetName()->Enquote() & " because its data filter is shared with another partition of the likelihood function");
+            }
+        }
+        for (unsigned long lfID = 0UL; lfID < likeFuncList.lLength; lfID++) {
+            _LikelihoodFunction* lfp = (_LikelihoodFunction*)likeFuncList(lfID);
+            if (lfp && lfp != this && lfp->DependOnDF (theDataFilters.get(i))) {
+                throw _String ("Cannot rearrange ") & tree->GetName()->Enquote() & " because its data filter " & *GetObjectNameByType (HY_BL_DATASET_FILTER, theDataFilters.get(i), false) &
+                " is also used by likelihood function '" & *GetObjectNameByType (HY_BL_LIKELIHOOD_FUNCTION, lfID, false) & "'";
+            }
+        }
+        restorable = restorable && !(blockDependancies.get (i) ? HasBlockChanged (i) : HasPartitionChanged (i)) && !GetIthFrequencies (i)->HasChanged() &&
+                     !ListAny (*(_SimpleList*)cachedBranches(i), [] (long value, unsigned long) -> bool {return value >= 0L;});
+    }
+
+    node<long> * inverse_target = subtree;
+    // NNI is its own inverse with the arguments swapped; SPR is undone by regrafting onto the current sibling
+    if (spr && subtree && subtree->get_parent() && subtree->get_parent()->get_num_nodes() == 2) {
+        inverse_target = subtree->get_parent()->go_down (subtree->get_child_num() == 1 ? 2 : 1);
+    }
+
+    tree->ApplyTopologyMove (spr, subtree, target, leaf_map, node_map, dirty);
+
+    long const leaf_count  = tree->GetLeafCount(),
+               inode_count = tree->GetINodeCount();
+
+    auto tally_scalers = [this, tree, inode_count] (long i, _SimpleList const& nodes, long sign) -> void {
+        // add (sign = 1) or remove (sign = -1) the scaling factors of 'nodes' to/from partition and site scaling tallies
+        _DataSetFilter const * df         = GetIthFilter (i);
+        _SimpleList    const * order      = (_SimpleList const*)optimalOrders(i);
+        long                   patternCnt = df->GetPatternCount(),
+                             * scc        = ((_SimpleList*)siteCorrections(i))->list_data;
+
+        for (long c = 0L; c < tree->categoryCount; c++) {
+            nodes.Each ([&] (long node_index, unsigned long) -> void {
+                hyFloat const * factors = siteScalingFactors[i] + (c * inode_count + node_index) * patternCnt;
+                for (long s = 0L; s < patternCnt; s++) {
+                    if (factors[s] != 1.) {
+                        long exponent = lround (log (factors[s]) / _logLFScaler) * sign,
+                             pattern  = order->get (s);
+                        scc [c * patternCnt + pattern] += exponent;
+                        if (tree->categoryCount == 1L) {
+                            overallScalingFactors[i] += exponent * df->theFrequencies.get (pattern);
+                        }
+                    }
+                }
+            });
+        }
+    };
+
+    bool restore = cached && undo && topologyMove->restorable;
+
+    if (restore) {
+        _Matrix const * independents = (_Matrix const*)topologyMove->saved.GetItem (0);
+        for (unsigned long k = 0UL; k < indexInd.lLength && restore; k++) {
+            restore = GetIthIndependent (k) == independents->theData[k];
+        }
+    }
+
+    _TopologyMove * record = nil;
+
+    if (restorable) {
+        record = new _TopologyMove;
+        record->saved.AppendNewInstance (new _Matrix (indexInd.lLength, 1, false, true));
+        for (unsigned long k = 0UL; k < indexInd.lLength; k++) {
+            ((_Matrix*)record->saved.GetItem (0))->theData[k] = GetIthIndependent (k);
+        }
+    }
+
+    _SimpleList restored_nodes;
+    if (restore) {
+        topologyMove->dirty.Each ([&] (long value, unsigned long) -> void {
+            restored_nodes << node_map.get (value);
+        });
+    }
+
+    for (unsigned long p = 0UL; p < partitions.lLength; p++) {
+        long                  i            = partitions.get (p);
+        _DataSetFilter      * df           = GetIthFilterMutable (i);
+        _SimpleList         * order        = (_SimpleList*)optimalOrders(i);
+
+        long                  patternCnt   = df->GetPatternCount(),
+                              stride       = tree->GetConditionalStride (df->GetDimension()),
+                              element      = singlePrecisionConditionals ? sizeof (float) : sizeof (hyFloat),
+                              slice        = element * stride * patternCnt;
+
+        if (cached) {
+            // branch caches are about to become invalid; the branch they were computed for must be recomputed
+            _SimpleList * cbids = (_SimpleList*)cachedBranches(i);
+            long        * scc   = (blockDependancies.get (i) || computingTemplate) ? ((_SimpleList*)siteCorrections(i))->list_data : nil,
+                        * sccb  = scc ? ((_SimpleList*)siteCorrectionsBackup(i))->list_data : nil;
+
+            for (long c = 0L; c < cbids->lLength; c++) {
+                if (cbids->get (c) >= 0L) {
+                    stale_branches << cbids->get (c);
+                    RestoreScalingFactors (i, cbids->get (c), patternCnt, scc ? scc + c * patternCnt : nil, sccb ? sccb + c * patternCnt : nil);
+                    (*cbids)[c] = -1L;
+                }
+            }
+
+            char * buffer = new char [MAX (slice, (long)MAX (sizeof (long), sizeof (hyFloat)) * patternCnt)];
+
+            for (long c = 0L; c < tree->categoryCount; c++) {
+                _hy_move_cache_slices ((char*)conditionalInternalNodeLikelihoodCaches[i] + c * inode_count * slice, slice, node_map, buffer);
+                _hy_move_cache_slices ((char*)(siteScalingFactors[i] + c * inode_count * patternCnt), sizeof (hyFloat) * patternCnt, node_map, buffer);
+            }
+            _hy_move_cache_slices ((char*)conditionalTerminalNodeStateFlag[i], sizeof (long) * patternCnt, leaf_map, buffer);
+            delete [] buffer;
+        }
+
+        // leaf to sequence map, and the summation shortcuts that depend on it
+
+        _SimpleList const * old_map = (_SimpleList const*)df->GetMap();
+        _SimpleList         new_map (leaf_count, 0, 0);
+        leaf_map.Each ([&] (long to, unsigned long from) -> void {
+            new_map[to] = old_map->get (from);
+        });
+        df->SetMap (new_map);
+        ((_SimpleList*)leafSkips(i))->Clear();
+        df->MatchStartNEnd (*order, *(_SimpleList*)leafSkips(i));
+
+        // traversal masks are rebuilt only if they were in use; nodes with unchanged subtrees get the same masks
+
+        _SimpleList * tcc = treeTraversalMasks.lLength > i ? (_SimpleList*)treeTraversalMasks(i) : nil;
+        if (tcc && ListAny (*tcc, [] (long value, unsigned long) -> bool {return value != 0L;})) {
+            InitializeArray (tcc->list_data, tcc->lLength, 0L);
+            CostOfPath (df, tree, *order, tcc);
+        }
+
+        if (restore) {
+            // put back the conditionals and scaling factors from before the move
+            _Matrix const * conditionals = (_Matrix const*)topologyMove->saved.GetItem (2 * p + 1),
+                          * factors      = (_Matrix const*)topologyMove->saved.GetItem (2 * p + 2);
+            tally_scalers (i, restored_nodes, -1L);
+            for (long c = 0L; c < tree->categoryCount; c++) {
+                restored_nodes.Each ([&] (long node_index, unsigned long k) -> void {
+                    long         offset   = (c * inode_count + node_index) * patternCnt;
+                    hyFloat const * data  = conditionals->theData + (c * restored_nodes.lLength + k) * patternCnt * stride;
+                    if (singlePrecisionConditionals) {
+                        float * target_data = (float*)conditionalInternalNodeLikelihoodCaches[i] + offset * stride;
+                        for (long e = 0L; e < patternCnt * stride; e++) {
+                            target_data[e] = data[e];
+                        }
+                    } else {
+                        memcpy (conditionalInternalNodeLikelihoodCaches[i] + offset * stride, data, sizeof (hyFloat) * patternCnt * stride);
+                    }
+                    memcpy (siteScalingFactors[i] + offset, factors->theData + (c * restored_nodes.lLength + k) * patternCnt, sizeof (hyFloat) * patternCnt);
+                });
+            }
+            tally_scalers (i, restored_nodes, 1L);
+        } else if (cached) {
+            if (record) {
+                _Matrix * conditionals = new _Matrix (1, tree->categoryCount * dirty.lLength * patternCnt * stride, false, true),
+                        * factors      = new _Matrix (1, tree->categoryCount * dirty.lLength * patternCnt, false, true);
+                for (long c = 0L; c < tree->categoryCount; c++) {
+                    dirty.Each ([&] (long node_index, unsigned long k) -> void {
+                        long      offset = (c * inode_count + node_index) * patternCnt;
+                        hyFloat * data   = conditionals->theData + (c * dirty.lLength + k) * patternCnt * stride;
+                        if (singlePrecisionConditionals) {
+                            float const * source_data = (float const*)conditionalInternalNodeLikelihoodCaches[i] + offset * stride;
+                            for (long e = 0L; e < patternCnt * stride; e++) {
+                                data[e] = source_data[e];
+                            }
+                        } else {
+                            memcpy (data, conditionalInternalNodeLikelihoodCaches[i] + offset * stride, sizeof (hyFloat) * patternCnt * stride);
+                        }
+                        memcpy (factors->theData + (c * dirty.lLength + k) * patternCnt, siteScalingFactors[i] + offset, sizeof (hyFloat) * patternCnt);
+                    });
+                }
+                record->saved.AppendNewInstance (conditionals);
+                record->saved.AppendNewInstance (factors);
+            }
+            tally_scalers (i, dirty, -1L);
+            for (long c = 0L; c < tree->categoryCount; c++) {
+                dirty.Each ([&] (long node_index, unsigned long) -> void {
+                    InitializeArray (siteScalingFactors[i] + (c * inode_count + node_index) * patternCnt, patternCnt, 1.);
+                });
+            }
+        }
+    }
+
+    stale_branches.Each ([&] (long value, unsigned long) -> void {
+        tree->AddBranchToForcedRecomputeList (value < leaf_count ? leaf_map.get (value) : leaf_count + node_map.get (value - leaf_count));
+    });
+
+    if (restore) {
+        // marking the root recomputes only the root conditionals (from those of its restored children)
+        tree->AddBranchToForcedRecomputeList (leaf_count + inode_count - 1L);
+    } else {
+        // this also marks the partitions as changed when the caches are set up afresh
+        dirty.Each ([&] (long value, unsigned long) -> void {
+            tree->AddBranchToForcedRecomputeList (leaf_count + value);
+        });
+    }
+
+    if (topologyMove) {
+        delete topologyMove;
+        topologyMove = nil;
+    }
+
+    if (!undo) {
+        topologyMove = record ? record : new _TopologyMove;
+        topologyMove->tree       = tree;
+        topologyMove->spr        = spr;
+        topologyMove->subtree    = spr ? subtree : target;
+        topologyMove->target     = spr ? inverse_target : subtree;
+        topologyMove->restorable = record != nil;
+        topologyMove->dirty.Duplicate (&dirty);
+    }
+}
+
+//_______________________________________________________________________________________
+
+void     _LikelihoodFunction::UndoTopologyMove (void) {
+    if (!topologyMove) {
+        throw _String ("There is no topology move to undo");
+    }
+    ApplyTopologyMove (topologyMove->tree, topologyMove->spr, topologyMove->subtree, topologyMove->target, true);
+}
+
+//_______________________________________________________________________________________
+
 void     _LikelihoodFunction::Clear (void)
 {
+    RestoreThreadAffinity ();
     DeleteCaches  ();
 
     //unsigned long partition_count = CountObjects(kLFCountPartitions);
@@ -819,6 +1413,11 @@ void     _LikelihoodFunction::Clear (void)
         mstCache = nil;
     }
 
+    if (topologyMove) {
+        delete (topologyMove);
+        topologyMove = nil;
+    }
+
     if (optimizatonHistory) {
       DeleteObject(optimizatonHistory);
       optimizatonHistory = nil;
@@ -1088,6 +1687,12 @@ bool     _LikelihoodFunction::Construct(_List& triplets, _VariableContainer* the
 
     ScanAllVariables();
     Setup();
+#ifdef _OPENMP
+    long const thread_cap = hy_env::EnvVariableGetNumber (kLikelihoodFunctionThreads, 0.0);
+    if (thread_cap > 0L && thread_cap < lfThreadCount) {
+        lfThreadCount = thread_cap;
+    }
+#endif
     return true;
 }
 
@@ -1108,6 +1713,7 @@ _LikelihoodFunction::_LikelihoodFunction (_LikelihoodFunction& lf) // stack copy
 
     mstCache        = nil;
     nonConstantDep  = nil;
+    topologyMove    = nil;
 
     Duplicate (&lf);
 }
@@ -1410,13 +2016,43 @@ void        _LikelihoodFunction::MPI_LF_Compute (long, bool)
     if (!partMode) {
         AllocateSiteResults ();
     }
+    
+    /*
+        20261018: SLKP
+        in partition and site template modes, this node holds the entire likelihood function, and every
+        request is [parameter deltas, number of partitions, partition, partition, ...] (a chunk handed
+        out by ComputeOnMPIQueue); the node returns the log-likelihood of every partition in the chunk,
+        or (site template mode) its site likelihoods followed by its scaling factors
+     
+        a new set of parameter values starts a new 'step'; because PostCompute clears the 'changed' flags
+        at the end of each step, the cached conditionals of a partition which this node has not computed
+        at the previous step (some other node did) may be stale: all of its parameters are marked as
+        modified before it is computed again
+    */
+    
+    bool          queue   = hyphyMPIOptimizerMode == _hyphyLFMPIModePartitions || hyphyMPIOptimizerMode == _hyphyLFMPIModeSiteTemplate;
 
-    _Matrix       variableStash (indexInd.lLength,1,false,true);
+    // parameter values arrive as [count, index, value, index, value, ...]; see SendOffToMPI
+    _Matrix       variableStash (1 + 2*indexInd.lLength + (queue ? 1 + theTrees.lLength : 0),1,false,true);
     hyFloat    siteLL = 0.;
+    
+    _SimpleList   computed_at (theTrees.lLength, -2L, 0L),
+                  chunk;
+    long          step    = 0L,
+                  max_results = partMode ? theTrees.lLength : 0L;
+    bool          step_ok = false;
+    
+    if (queue && !partMode) {
+        for (unsigned long p = 0UL; p < theTrees.lLength; p++) {
+            max_results += 2L * BlockLength (p);
+        }
+    }
+    
+    _Matrix       chunk_results (1, queue ? max_results : 1L, false, true);
 
     MPI_Status    status;
     //ReportWarning (_String ("Waiting on:") & (long) indexInd.lLength & " MPI_DOUBLES");
-    ReportMPIError(MPI_Recv(variableStash.theData, indexInd.lLength, MPI_DOUBLE, senderID, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD,&status),false);
+    ReportMPIError(MPI_Recv(variableStash.theData, variableStash.GetHDim(), MPI_DOUBLE, senderID, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD,&status),false);
 
     //printf ("[ENTER NODE] %d\n", hy_mpi_node_rank);
 
@@ -1425,12 +2061,81 @@ void        _LikelihoodFunction::MPI_LF_Compute (long, bool)
     {
         //ReportWarning (_String("In at step  ") & loopie);
         bool    doSomething = false;
-        for (long i = 0; i<indexInd.lLength; i++) {
+        long    changed     = variableStash.theData[0];
+        
+        if (queue) {
+            bool new_step = step == 0L;
+            for (long k = 0; k < changed && !new_step; k++) {
+                new_step = !CheckEqual (GetIthIndependent (variableStash.theData[1 + 2*k]), variableStash.theData[2 + 2*k]);
+            }
+            
+            if (new_step) {
+                if (step > 0L) {
+                    PostCompute ();
+                }
+                for (long k = 0; k < changed; k++) {
+                    SetIthIndependent (variableStash.theData[1 + 2*k], variableStash.theData[2 + 2*k]);
+                }
+                step ++;
+                step_ok = PreCompute ();
+            }
+            
+            chunk.Clear();
+            long    partition_count = variableStash.theData[1 + 2*changed],
+                    result_count    = 0L;
+            
+            for (long k = 0L; k < partition_count; k++) {
+                long p = variableStash.theData[2 + 2*changed + k];
+                chunk << p;
+                result_count += partMode ? 1L : 2L * BlockLength (p);
+            }
+            
+            hyFloat * result = chunk_results.theData;
+            
+            chunk.Each ([&] (long p, unsigned long) -> void {
+                if (computed_at.list_data[p] < step - 1L) {
+                    ((_SimpleList*)indVarsByPartition (p))->Each ([] (long v, unsigned long) -> void {
+                        LocateVar (v)->MarkModified();
+                    });
+                }
+                
+                long const patterns = partMode ? 0L : BlockLength (p);
+                
+                if (partMode) {
+                    *(result++) = step_ok ? ComputePartition (p) : -INFINITY;
+                } else {
+                    if (step_ok) {
+                        ComputeSiteLikelihoodsForABlock (p, siteResults->theData, siteScalerBuffer);
+                        for (long s = 0L; s < patterns; s++) {
+                            result[s]            = siteResults->theData[s];
+                            result[patterns + s] = siteScalerBuffer.list_data[s];
+                        }
+                    } else {
+                        // dependant condition failed
+                        InitializeArray (result, patterns, 1e-100);
+                        InitializeArray (result + patterns, patterns, 0.);
+                    }
+                    result += 2L * patterns;
+                }
+                
+                if (step_ok) {
+                    computed_at.list_data[p] = step;
+                }
+            });
+            
+            ReportMPIError(MPI_Send(chunk_results.theData, result_count, MPI_DOUBLE, senderID, HYPHY_MPI_DATA_TAG, MPI_COMM_WORLD),true);
+            ReportMPIError(MPI_Recv(variableStash.theData, variableStash.GetHDim(), MPI_DOUBLE, senderID, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD,&status),false);
+            continue;
+        }
+        
+        for (long k = 0; k < changed; k++) {
+            long      i     = variableStash.theData[1 + 2*k];
+            hyFloat   value = variableStash.theData[2 + 2*k];
             _Variable *anInd = LocateVar(indexInd.list_data[i]);
-            //ReportWarning (*anInd->GetName() & " = " & variableStash.theData[i]);
-            if (anInd->HasChanged() || !CheckEqual(anInd->Value(), variableStash.theData[i])) {
+            //ReportWarning (*anInd->GetName() & " = " & value);
+            if (anInd->HasChanged() || !CheckEqual(anInd->Value(), value)) {
                 doSomething = true;
-                SetIthIndependent (i,variableStash.theData[i]);
+                SetIthIndependent (i,value);
             }
         }
         if (doSomething) {
@@ -1471,7 +2176,11 @@ void        _LikelihoodFunction::MPI_LF_Compute (long, bool)
         {
             ReportMPIError(MPI_Send(siteResults->theData, siteResults->GetSize(), MPI_DOUBLE, senderID, HYPHY_MPI_DATA_TAG, MPI_COMM_WORLD),true);
         }
-        ReportMPIError(MPI_Recv(variableStash.theData, indexInd.lLength, MPI_DOUBLE, senderID, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD,&status),false);
+        ReportMPIError(MPI_Recv(variableStash.theData, variableStash.GetHDim(), MPI_DOUBLE, senderID, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD,&status),false);
+    }
+    
+    if (step > 0L) {
+        PostCompute ();
     }
     //ReportWarning (_String("Exiting slave loop after step  ") & loopie);
 #endif
@@ -1798,22 +2507,12 @@ bool      _LikelihoodFunction::SendOffToMPI       (long index) {
  In particular, need to confirm that changes to category variables are handled correctly (e.g. HaveParametersChanged, vs has changed */
 
     bool                sendToSlave = (computationalResults.GetSize() < parallelOptimizerTasks.lLength);
-    _SimpleList     *   slaveParams = (_SimpleList*)parallelOptimizerTasks(index);
-
-    for (unsigned long varID = 0UL; varID < slaveParams->lLength; varID++) {
-        _Variable * aVar = LocateVar (slaveParams->list_data[varID]);
-        if (aVar->IsIndependent()) {
-            varTransferMatrix.theData[varID] = aVar->Value();
-        } else {
-            varTransferMatrix.theData[varID] = aVar->Compute()->Value();
-        }
-
-        //printf ("%s => %g\n", aVar->GetName()->sData, varTransferMatrix.theData[varID]);
-        sendToSlave = sendToSlave || aVar->HasChanged();
-    }
+    long                changed     = _hy_mpi_pack_parameters (index, varTransferMatrix.theData, sendToSlave);
 
     if (sendToSlave) {
-        ReportMPIError(MPI_Send(varTransferMatrix.theData, slaveParams->lLength, MPI_DOUBLE, index+1 , HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD),true);
+        _hy_mpi_commit_parameters (index, varTransferMatrix.theData);
+        mpiResponseTimes.theData[3*index] = MPI_Wtime();
+        ReportMPIError(MPI_Send(varTransferMatrix.theData, 1 + 2*changed, MPI_DOUBLE, index+1 , HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD),true);
     }
     return sendToSlave;
 
@@ -1822,31 +2521,186 @@ bool      _LikelihoodFunction::SendOffToMPI       (long index) {
 
 }
 
-
 //_______________________________________________________________________________________
 
-bool    _LikelihoodFunction::PreCompute         (void)
-{
-
-    useGlobalUpdateFlag = true;
-    // mod 20060125 to only update large globals once
-    unsigned long i = 0UL;
-    
-    _SimpleList * arrayToCheck = nonConstantDep?nonConstantDep:&indexDep;
-
+void      _LikelihoodFunction::ComputeOnMPIQueue (_SimpleList const& partitions, bool bySite) {
+    /*
+        20261018: SLKP
+        [MPI partition and site template modes] every node holds the entire likelihood function
+        (see InitMPIOptimizer), so any partition can be computed by any node; 'partitions' (those
+        that need to be recomputed) are grouped into chunks of roughly equal estimated cost, several
+        per node (kMPIChunksPerNode), largest first, and handed out from a queue: each node gets a
+        chunk, and the next chunk goes to whichever node finishes first (MPI_Isend / MPI_Irecv /
+        MPI_Waitany); the time each chunk took refines the costs of its partitions (mpiPartitionCosts),
+        which determine how partitions are grouped (and ordered) for the next evaluation
+     
+        the nodes return the log-likelihood of each partition (stored with UpdateBlockResult) or,
+        with 'bySite', its site likelihoods and scaling factors (mapped into bySiteResults and
+        partScalingCache); callers sum these in partition (site) order, so the result does not depend
+        on which node computed what, or in which order the results arrived
+    */
+#ifdef __HYPHYMPI__
+    const   long          kMPIChunksPerNode = 4L;
+    const   hyFloat       kCostUpdateWeight = 0.5;
     
+    long    const         nodes       = parallelOptimizerTasks.lLength,
+                          stride      = mpiChunkMessages.GetVDim(),
+                          block_width = bySite ? bySiteResults->GetVDim() : 0L;
     
-    for (; i < arrayToCheck->lLength; i++) {
-        _Variable* cornholio = LocateVar(arrayToCheck->list_data[i]);
-        hyFloat tp = cornholio->Compute()->Value();
-         if (!cornholio->IsValueInBounds(tp)){
-            ReportWarning (_String ("Failing bound checks on ") & *cornholio->GetName() & " = " & _String (tp, "%25.16g"));
-        }
+    if (partitions.empty()) {
+        return;
     }
-
-    useGlobalUpdateFlag = false;
-    // mod 20060125 to only update large globals once
-
+    
+    // most expensive partitions first
+    
+    _SimpleList     by_cost;
+    hyFloat         total_cost = 0.;
+    
+    partitions.Each ([&] (long p, unsigned long) -> void {
+        hyFloat const cost = mpiPartitionCosts.theData[p];
+        long          k    = by_cost.countitems();
+        while (k > 0L && mpiPartitionCosts.theData[by_cost.get (k-1L)] < cost) {
+            k--;
+        }
+        by_cost.InsertElement ((BaseRef)p, k, false, false);
+        total_cost += cost;
+    });
+    
+    // group them into chunks
+    
+    hyFloat const   target_cost = total_cost / (kMPIChunksPerNode * nodes);
+    _List           chunks;
+    _SimpleList     result_offsets,
+                    // offset of every chunk in 'received' (one more entry for the total)
+                    chunk_of_node (nodes, -1L, 0L);
+    long            results = 0L;
+    hyFloat         chunk_cost = 0.;
+    
+    result_offsets << 0L;
+    by_cost.Each ([&] (long p, unsigned long k) -> void {
+        if (chunk_cost == 0.) {
+            chunks.AppendNewInstance (new _SimpleList);
+        }
+        (*(_SimpleList*)chunks.GetItem (chunks.lLength - 1UL)) << p;
+        results    += bySite ? 2L * BlockLength (p) : 1L;
+        chunk_cost += mpiPartitionCosts.theData[p];
+        if (chunk_cost >= target_cost || k + 1UL == by_cost.lLength) {
+            result_offsets << results;
+            chunk_cost = 0.;
+        }
+    });
+    
+    hyFloat     * received = new hyFloat [results];
+    MPI_Request * requests = new MPI_Request [2*nodes];
+    // receives from node i+1 in requests [i], sends to it in requests [nodes + i]
+    
+    for (long k = 0L; k < 2*nodes; k++) {
+        requests[k] = MPI_REQUEST_NULL;
+    }
+    
+    auto dispatch = [&] (long node, long chunk) -> void {
+        hyFloat           * message   = mpiChunkMessages.theData + node * stride;
+        _SimpleList const * members   = (_SimpleList const*)chunks.GetItem (chunk);
+        bool                modified  = false;
+        
+        ReportMPIError (MPI_Wait (requests + nodes + node, MPI_STATUS_IGNORE), false);
+        
+        long        changed   = _hy_mpi_pack_parameters (node, message, modified),
+                    length    = 2L + 2L * changed + members->lLength;
+        
+        _hy_mpi_commit_parameters (node, message);
+        message[1 + 2*changed] = members->lLength;
+        members->Each ([&] (long p, unsigned long k) -> void {
+            message[2 + 2*changed + k] = p;
+        });
+        
+        chunk_of_node.list_data[node]        = chunk;
+        mpiResponseTimes.theData[3*node]     = MPI_Wtime();
+        ReportMPIError (MPI_Irecv (received + result_offsets.get (chunk), result_offsets.get (chunk+1L) - result_offsets.get (chunk), MPI_DOUBLE, node+1, HYPHY_MPI_DATA_TAG, MPI_COMM_WORLD, requests + node), false);
+        ReportMPIError (MPI_Isend (message, length, MPI_DOUBLE, node+1, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD, requests + nodes + node), false);
+    };
+    
+    long    next_chunk      = 0L;
+    hyFloat total_elapsed   = 0.,
+            total_estimated = 0.;
+    
+    for (long node = 0L; node < nodes && next_chunk < chunks.lLength; node++) {
+        dispatch (node, next_chunk++);
+    }
+    
+    for (long remaining = chunks.lLength; remaining > 0L; remaining--) {
+        MPI_Status      status;
+        int             node;
+        
+        ReportMPIError (MPI_Waitany (nodes, requests, &node, &status), false);
+        
+        long              chunk          = chunk_of_node.list_data[node];
+        _SimpleList const * members      = (_SimpleList const*)chunks.GetItem (chunk);
+        hyFloat const     * chunk_results = received + result_offsets.get (chunk),
+                            elapsed       = _hy_mpi_record_response (node);
+        hyFloat             estimated     = 0.;
+        
+        if (next_chunk < chunks.lLength) {
+            dispatch (node, next_chunk++);
+        }
+        
+        members->Each ([&] (long p, unsigned long) -> void {
+            estimated += mpiPartitionCosts.theData[p];
+        });
+        
+        // costs are relative (the initial ones need not be in seconds): the partitions of a chunk
+        // which took longer per unit of estimated cost than all the chunks so far become costlier
+        total_elapsed   += elapsed;
+        total_estimated += estimated;
+        hyFloat const relative_rate = estimated > 0. && total_elapsed > 0. ? (elapsed / estimated) / (total_elapsed / total_estimated) : 1.;
+        
+        members->Each ([&] (long p, unsigned long) -> void {
+            mpiPartitionCosts.theData[p] *= 1. - kCostUpdateWeight + kCostUpdateWeight * relative_rate;
+            if (bySite) {
+                long const             patterns = BlockLength (p);
+                _DataSetFilter const * filter   = GetIthFilter (p);
+                filter->PatternToSiteMapper (chunk_results, bySiteResults->theData + p*block_width, block_width, 1.);
+                filter->PatternToSiteMapper (chunk_results + patterns, ((_SimpleList*)partScalingCache(p))->list_data, block_width, 0L);
+                chunk_results += 2L * patterns;
+            } else {
+                UpdateBlockResult (p, *chunk_results);
+                chunk_results ++;
+            }
+        });
+    }
+    
+    ReportMPIError (MPI_Waitall (nodes, requests + nodes, MPI_STATUSES_IGNORE), false);
+    
+    delete [] requests;
+    delete [] received;
+#endif
+}
+
+
+//_______________________________________________________________________________________
+
+bool    _LikelihoodFunction::PreCompute         (void)
+{
+
+    useGlobalUpdateFlag = true;
+    // mod 20060125 to only update large globals once
+    unsigned long i = 0UL;
+    
+    _SimpleList * arrayToCheck = nonConstantDep?nonConstantDep:&indexDep;
+
+    
+    
+    for (; i < arrayToCheck->lLength; i++) {
+        _Variable* cornholio = LocateVar(arrayToCheck->list_data[i]);
+        hyFloat tp = cornholio->Compute()->Value();
+         if (!cornholio->IsValueInBounds(tp)){
+            ReportWarning (_String ("Failing bound checks on ") & *cornholio->GetName() & " = " & _String (tp, "%25.16g"));
+        }
+    }
+
+    useGlobalUpdateFlag = false;
+    // mod 20060125 to only update large globals once
+
     for (unsigned long j=0UL; j < i; j++) {
         _Variable* cornholio = LocateVar(arrayToCheck->list_data[j]);
         if (cornholio->varFlags&HY_DEP_V_COMPUTED) {
@@ -1938,6 +2792,19 @@ void    _LikelihoodFunction::ComputeBlockForTemplate2       (long i, hyFloat* re
 
 //_______________________________________________________________________________________
 
+inline void addCompensated (hyFloat& sum, hyFloat& correction, hyFloat term) {
+    // compensated (Kahan) summation of partition log-likelihoods, with -INFINITY absorbing
+    if (sum == -INFINITY || term == -INFINITY) {
+        sum = -INFINITY;
+        return;
+    }
+    term -= correction;
+    hyFloat temp_sum = sum + term;
+    correction = (temp_sum - sum) - term;
+    sum = temp_sum;
+}
+
+//_______________________________________________________________________________________
 hyFloat  _LikelihoodFunction::Compute        (void)
 /*
     code cleanup SLKP: 20090317
@@ -1955,6 +2822,16 @@ hyFloat  _LikelihoodFunction::Compute        (void)
     if (!PreCompute()) {
         return -INFINITY;
     }
+    
+    if (numaAwareCaches) {
+        long np = 1L;
+#ifdef _OPENMP
+        np = MIN(GetThreadCount(),omp_get_max_threads());
+#endif
+        if (np != numaPlacementThreads) {
+            PlaceConditionalCaches (np);
+        }
+    }
 
     /* GUI flag to verify whether MLEs have been altered
        after last optimization
@@ -1983,6 +2860,8 @@ hyFloat  _LikelihoodFunction::Compute        (void)
               returned
 
             4. MPI compute mode: independent partitions
+
+            5. LOCAL_PROCESS_POOL mode: independent partitions evaluated by worker processes
     */
 
     char       computeMode = 0;
@@ -2010,6 +2889,10 @@ hyFloat  _LikelihoodFunction::Compute        (void)
     }
 #endif
 
+    if (processPool && computeMode == 0) {
+        computeMode = 5;
+    }
+
     bool done = false;
 #ifdef _UBER_VERBOSE_LF_DEBUG
     fprintf (stderr, "\n*** Likelihood function evaluation %ld ***\n", likeFuncEvalCallCount+1);
@@ -2028,48 +2911,19 @@ hyFloat  _LikelihoodFunction::Compute        (void)
             blockMatrix = (_Matrix*)blockWiseVar->GetValue();
 
         }
+        
+        hyFloat correction = 0.;
+        
+        if (concurrentPartitionBlocks) {
+            result = ComputePartitionsConcurrently (blockMatrix);
+        } else
         for (unsigned long partID=0; partID<theTrees.lLength; partID++) {
-            if (blockDependancies.list_data[partID]) {
-                // has category variables
-                if ( computationalResults.get_used()<=partID || HasBlockChanged(partID))
-                    // first time computing or partition requires updating
-                {
-                    /* TODO: add HMM and constant on partition test
-                       Roll into ComputeSiteLikelihoodsForABlock and SumUpSiteLikelihoods?
-                    */
-
-#ifdef __HYPHYMPI__
-                    if (hy_mpi_node_rank == 0) {
-                        ComputeSiteLikelihoodsForABlock    (partID, siteResults->theData, siteScalerBuffer, -1, nil, hyphyMPIOptimizerMode);
-                    } else
-#endif
-                        ComputeSiteLikelihoodsForABlock    (partID, siteResults->theData, siteScalerBuffer);
-
-#ifdef _UBER_VERBOSE_LF_DEBUG
-                    fprintf (stderr, "Did compute %g\n", result);
-#endif
-                    hyFloat                       blockResult = SumUpSiteLikelihoods (partID, siteResults->theData, siteScalerBuffer);
-                    UpdateBlockResult               (partID, blockResult);
-                    if (blockMatrix) {
-                        blockMatrix->theData[partID] = blockResult;
-                    } else {
-                        result += blockResult;
-                    }
-                } else {
-                    if (blockMatrix) {
-                        blockMatrix->theData[partID] =  computationalResults.theData[partID];
-                    }  else {
-                        result += computationalResults.theData[partID];
-                    }
-                }
+            hyFloat blockResult = ComputePartition (partID);
+            
+            if (blockMatrix) {
+                blockMatrix->theData[partID] = blockResult;
             } else {
-                hyFloat  blockResult =  ComputeBlock (partID);
-                if (blockMatrix) {
-                    blockMatrix->theData[partID] = blockResult;
-                } else {
-                    result += blockResult;
-                }
-                UpdateBlockResult       (partID, blockResult);
+                addCompensated (result, correction, blockResult);
             }
 
         }
@@ -2077,6 +2931,38 @@ hyFloat  _LikelihoodFunction::Compute        (void)
             result = computingTemplate->Compute()->Value();
         }
         done = true;
+    } else if (computeMode == 5) {
+#ifdef _HY_LOCAL_PROCESS_POOL_
+        // see StartProcessPool; only the workers with at least one partition that needs updating
+        // (by the same criteria as ComputePartition and ComputeBlock use) are woken up
+        for (unsigned long i = 0UL; i < indexInd.lLength; i++) {
+            processPool->parameters[i] = GetIthIndependent (i, false);
+        }
+        long woken_up = 0L;
+        for (unsigned long w = 0UL; w < processPool->workers.lLength; w++) {
+            if (processPool->evaluations == 0L || forceRecomputation ||
+                ListAny (*(_SimpleList*)processPool->partitions.GetItem (w), [this] (long partID, unsigned long) -> bool {
+                    return PartitionNeedsUpdate (partID);
+                })) {
+                _hy_pool_signal (processPool->go_pipes.get (w), 1);
+                woken_up ++;
+            }
+        }
+        for (long w = 0L; w < woken_up; w++) {
+            if (!_hy_pool_wait (processPool->done_pipe[0])) {
+                HandleApplicationError ("LOCAL_PROCESS_POOL: a worker process has terminated unexpectedly");
+                return -INFINITY;
+            }
+        }
+        processPool->evaluations ++;
+        
+        hyFloat correction = 0.;
+        for (unsigned long partID = 0UL; partID < theTrees.lLength; partID++) {
+            UpdateBlockResult (partID, processPool->results[partID]);
+            addCompensated    (result, correction, processPool->results[partID]);
+        }
+        done = true;
+#endif
     } else if (computeMode == 1)
         // handle _hyphyLFComputationalTemplateBySite
     {
@@ -2084,35 +2970,15 @@ hyFloat  _LikelihoodFunction::Compute        (void)
 
 #ifdef __HYPHYMPI__
         if (hyphyMPIOptimizerMode == _hyphyLFMPIModeSiteTemplate && hy_mpi_node_rank == 0) {
-            long    totalSent = 0,
-                    blockPatternSize = PartitionLengths (0);
-            for (long blockID = 0; blockID < parallelOptimizerTasks.lLength; blockID ++) {
-                bool sendToSlave = SendOffToMPI (blockID);
-                if (sendToSlave) {
-                    //printf ("[SEND]: %d\n", blockID, "\n");
-                    totalSent++;
+            // 20261018: SLKP
+            // partitions whose site likelihoods need updating are computed from a work queue; see ComputeOnMPIQueue
+            _SimpleList changed;
+            for (unsigned long partID = 0UL; partID < theTrees.lLength; partID++) {
+                if (!siteArrayPopulated || forceRecomputation || PartitionNeedsUpdate (partID)) {
+                    changed << partID;
                 }
-                /*
-                 else
-                    for (long k = 0; k < blockPatternSize; k++)
-                        printf ("[%d] %d %g %d\n", blockID, k, (bySiteResults->theData + blockID*theTrees.lLength)[k],  ((_SimpleList*)partScalingCache(blockID))->list_data[k]);
-                */
-            }
-
-            while (totalSent) {
-                MPI_Status      status;
-
-                ReportMPIError  (MPI_Recv (bySiteResults->theData + blockWidth*theTrees.lLength, 2*blockPatternSize, MPI_DOUBLE, MPI_ANY_SOURCE , HYPHY_MPI_DATA_TAG, MPI_COMM_WORLD,&status),true);
-                long partID = status.MPI_SOURCE-1;
-
-                //printf ("[RECEIVE]: %d\n", partID, "\n");
-
-                _DataSetFilter const * thisBlockFilter      = GetIthFilter(partID);
-                thisBlockFilter->PatternToSiteMapper (bySiteResults->theData + blockWidth*theTrees.lLength, bySiteResults->theData + partID*blockWidth, blockWidth, 1.);
-                _SimpleList* blockScalers = ((_SimpleList*)partScalingCache(partID));
-                thisBlockFilter->PatternToSiteMapper (bySiteResults->theData + (blockWidth*theTrees.lLength+blockPatternSize), blockScalers->list_data, blockWidth, 0L);
-                totalSent--;
             }
+            ComputeOnMPIQueue (changed, true);
         } else
 #endif
             for (long partID=0; partID<theTrees.lLength; partID++) {
@@ -2177,28 +3043,49 @@ hyFloat  _LikelihoodFunction::Compute        (void)
         if (computeMode == 4) {
 #ifdef __HYPHYMPI__
             if (hy_mpi_node_rank == 0) {
-                long    totalSent = 0;
-                for (long blockID = 0; blockID < parallelOptimizerTasks.lLength; blockID ++) {
-                    bool sendToSlave = SendOffToMPI (blockID);
-                    if (sendToSlave) {
-                        totalSent++;
-                    } else {
-                        result += computationalResults[blockID];
+                // 20261018: SLKP
+                // in partition mode, the partitions that need updating are computed from a work queue
+                // (see ComputeOnMPIQueue); in auto mode, each node returns the log-likelihood of its block
+                // of sites, in whatever order the nodes finish. In both cases the results are summed (with
+                // compensation) in partition (block) order afterwards, so that the log-likelihood depends
+                // neither on the order of arrival nor on which node computed what
+                if (hyphyMPIOptimizerMode == _hyphyLFMPIModePartitions) {
+                    _SimpleList changed;
+                    for (unsigned long partID = 0UL; partID < theTrees.lLength; partID++) {
+                        if (computationalResults.get_used() < theTrees.lLength || forceRecomputation || PartitionNeedsUpdate (partID)) {
+                            changed << partID;
+                        }
+                    }
+                    ComputeOnMPIQueue (changed, false);
+                } else {
+                    _SimpleList   sent;
+                    MPI_Request * requests = new MPI_Request [parallelOptimizerTasks.lLength];
+                    hyFloat     * received = new hyFloat     [parallelOptimizerTasks.lLength];
+                    
+                    for (long blockID = 0; blockID < parallelOptimizerTasks.lLength; blockID ++) {
+                        if (SendOffToMPI (blockID)) {
+                            ReportMPIError (MPI_Irecv (received + blockID, 1, MPI_DOUBLE, blockID+1, HYPHY_MPI_DATA_TAG, MPI_COMM_WORLD, requests + sent.lLength), false);
+                            sent << blockID;
+                        }
+                    }
+                    
+                    for (long remaining = sent.lLength; remaining > 0L; remaining--) {
+                        MPI_Status      status;
+                        int             which;
+                        ReportMPIError(MPI_Waitany (sent.lLength, requests, &which, &status), false);
+                        long            blockID = sent.list_data[which];
+                        //printf ("Got %g from block %d \n", received[blockID], blockID);
+                        _hy_mpi_record_response (blockID);
+                        UpdateBlockResult (blockID, received[blockID]);
                     }
+                    
+                    delete [] requests;
+                    delete [] received;
                 }
-
-                while (totalSent) {
-                    MPI_Status      status;
-                    hyFloat      blockRes;
-                    ReportMPIError(MPI_Recv (&blockRes, 1, MPI_DOUBLE, MPI_ANY_SOURCE , HYPHY_MPI_DATA_TAG, MPI_COMM_WORLD,&status),true);
-                    //printf ("Got %g from block %d \n", blockRes, status.MPI_SOURCE-1);
-
-                    result            += blockRes;
-                    /*if (status.MPI_SOURCE == 1 && computationalResults.GetUsed()) {
-                        printf ("\033\015 COMPUTED / CACHED %g / %g             ", blockRes, computationalResults[0]);
-                    }*/
-                    UpdateBlockResult (status.MPI_SOURCE-1, blockRes);
-                    totalSent--;
+                
+                hyFloat correction = 0.;
+                for (long blockID = 0; blockID < computationalResults.get_used(); blockID ++) {
+                    addCompensated (result, correction, computationalResults.theData[blockID]);
                 }
 
                 done = true;
@@ -2251,13 +3138,267 @@ hyFloat  _LikelihoodFunction::Compute        (void)
 }
 //_______________________________________________________________________________________
 
+bool        _LikelihoodFunction::CanDeferRateClasses (long index) const {
+    /*
+        20261018: SLKP
+        rate classes are deferred only if there is a single (not HMM or constant-on-partition)
+        category variable: with several, a node that depends on only some of them shares
+        transition matrices between rate classes; root frequencies are stored by the tree,
+        so they must not depend on the rate class either
+    */
+#ifdef __HYPHYMPI__
+    if (hyphyMPIOptimizerMode == _hyphyLFMPIModeREL) {
+        return false;
+    }
+#endif
+    _List const * traversal_pattern = (_List const*)categoryTraversalTemplate.GetItem (index);
+    
+    return ((_List const*)traversal_pattern->GetItem (0))->countitems() == 1UL &&
+           ((_SimpleList const*)traversal_pattern->GetItem (3))->empty() &&
+           GetIthFrequencies (index)->is_numeric();
+}
+
+//_______________________________________________________________________________________
+
+hyFloat     _LikelihoodFunction::ComputePartition (long partID) {
+    // compute (or retrieve, if nothing has changed) the log-likelihood of a partition, and update computationalResults
+    hyFloat blockResult;
+    
+    if (blockDependancies.list_data[partID]) {
+        // has category variables
+        if ( computationalResults.get_used()<=partID || HasBlockChanged(partID))
+            // first time computing or partition requires updating
+        {
+            /* TODO: add HMM and constant on partition test
+               Roll into ComputeSiteLikelihoodsForABlock and SumUpSiteLikelihoods?
+            */
+
+#ifdef __HYPHYMPI__
+            if (hy_mpi_node_rank == 0) {
+                ComputeSiteLikelihoodsForABlock    (partID, siteResults->theData, siteScalerBuffer, -1, nil, hyphyMPIOptimizerMode);
+            } else
+#endif
+                ComputeSiteLikelihoodsForABlock    (partID, siteResults->theData, siteScalerBuffer);
+
+            blockResult = SumUpSiteLikelihoods (partID, siteResults->theData, siteScalerBuffer);
+            UpdateBlockResult               (partID, blockResult);
+        } else {
+            blockResult = computationalResults.theData[partID];
+        }
+    } else {
+        blockResult =  ComputeBlock (partID);
+        UpdateBlockResult       (partID, blockResult);
+    }
+    
+    return blockResult;
+}
+
+//_______________________________________________________________________________________
+
+hyFloat     _LikelihoodFunction::ComputePartitionsConcurrently (_Matrix* blockMatrix) {
+    /*
+        20261018: SLKP
+        compute modes 0 and 3 with site blocks from all partitions (and rate classes) pruned together
+     
+        1. serially, in partition order, set up each partition (or each rate class of a partition with
+           category variables) with a deferred ComputeBlock call; this does all the formula evaluation
+           (model matrices, category weights, nodes to update); partitions which can't be deferred are
+           computed right away
+        2. prune all deferred site blocks in one parallel region (EvaluateBlocks)
+        3. serially, in partition order, finish each evaluation, sum over rate classes and add up partition
+           log-likelihoods
+     
+        none of the site block layouts or the order of summation depends on how blocks get scheduled,
+        so the result is identical to that obtained by computing one partition at a time
+    */
+    
+    unsigned long     partition_count  = theTrees.lLength;
+    long              evaluation_count = 0L,
+                      buffer_size      = 0L;
+    
+    _SimpleList       deferred_classes  (partition_count, -1L, 0L),
+                      // -1 : already computed, 0 : a single deferred evaluation, N > 0 : N deferred rate classes
+                      first_evaluation  (partition_count, 0L, 0L),
+                      buffer_offset     (partition_count, 0L, 0L);
+    
+    hyFloat         * partition_results = new hyFloat [partition_count];
+    
+    for (unsigned long partID = 0UL; partID < partition_count; partID++) {
+        if (blockDependancies.list_data[partID]) {
+            if ( computationalResults.get_used()<=partID || HasBlockChanged(partID)) {
+                if (CanDeferRateClasses (partID)) {
+                    _List       * traversal_pattern = (_List*)categoryTraversalTemplate(partID);
+                    long          rate_classes      = ((_SimpleList*)traversal_pattern->GetItem(1))->get (0);
+                    
+                    deferred_classes.list_data[partID] = rate_classes;
+                    first_evaluation.list_data[partID] = evaluation_count;
+                    buffer_offset.list_data[partID]    = buffer_size;
+                    evaluation_count += rate_classes;
+                    buffer_size      += rate_classes * BlockLength (partID);
+                } else {
+                    ComputeSiteLikelihoodsForABlock    (partID, siteResults->theData, siteScalerBuffer);
+                    partition_results[partID] = SumUpSiteLikelihoods (partID, siteResults->theData, siteScalerBuffer);
+                    UpdateBlockResult (partID, partition_results[partID]);
+                }
+            } else {
+                partition_results[partID] = computationalResults.theData[partID];
+            }
+        } else {
+            deferred_classes.list_data[partID] = 0L;
+            first_evaluation.list_data[partID] = evaluation_count++;
+        }
+    }
+    
+    _BlockEvaluation  * evaluations       = evaluation_count ? new _BlockEvaluation [evaluation_count] : nil;
+    hyFloat           * class_likelihoods = buffer_size ? new hyFloat [buffer_size] : nil,
+                      * class_weights     = evaluation_count ? new hyFloat [evaluation_count] : nil;
+    
+    for (unsigned long partID = 0UL; partID < partition_count; partID++) {
+        long              rate_classes = deferred_classes.list_data[partID];
+        _BlockEvaluation *evaluation   = evaluations + first_evaluation.list_data[partID];
+        
+        if (rate_classes == 0L) {
+            partition_results[partID] = ComputeBlock (partID, nil, -1L, -1L, nil, evaluation);
+        } else if (rate_classes > 0L) {
+            // the same sequence of category variable changes as in PopulateConditionalProbabilities
+            
+            _CategoryVariable * category_variable = (_CategoryVariable*)((_List*)((_List*)categoryTraversalTemplate(partID))->GetItem(0))->GetItem(0);
+            category_variable->Refresh();
+            category_variable->SetIntervalValue(0,true);
+            
+            _Matrix           * weights      = category_variable->GetWeights();
+            long                block_length = BlockLength (partID);
+            
+            for (long rate_class = 0L; rate_class < rate_classes; rate_class++) {
+                if (rate_class) {
+                    category_variable->SetIntervalValue(rate_class);
+                }
+                
+                hyFloat weight = class_weights [first_evaluation.list_data[partID] + rate_class] = weights->theData[rate_class];
+                if (weight == 0.0) {
+                    continue;
+                }
+                
+                hyFloat * class_buffer = class_likelihoods + buffer_offset.list_data[partID] + rate_class * block_length;
+                
+                ComputeBlock    (partID, class_buffer, rate_class, -1L, nil, evaluation + rate_class);
+                if (usedCachedResults) {
+                    bool saveFR = forceRecomputation;
+                    forceRecomputation = true;
+                    ComputeBlock    (partID, class_buffer, rate_class, -1L, nil, evaluation + rate_class);
+                    forceRecomputation = saveFR;
+                }
+            }
+        }
+    }
+    
+    if (evaluation_count) {
+        EvaluateBlocks (evaluations, evaluation_count);
+    }
+    
+    hyFloat     result     = 0.,
+                correction = 0.;
+    
+    for (unsigned long partID = 0UL; partID < partition_count; partID++) {
+        long              rate_classes = deferred_classes.list_data[partID];
+        _BlockEvaluation *evaluation   = evaluations + first_evaluation.list_data[partID];
+        
+        if (rate_classes == 0L) {
+            if (evaluation->pending) {
+                partition_results[partID] = FinishBlockEvaluation (*evaluation);
+            }
+            UpdateBlockResult (partID, partition_results[partID]);
+        } else if (rate_classes > 0L) {
+            // weighted sum over rate classes, as in the _hyphyLFConditionProbsWeightedSum mode of PopulateConditionalProbabilities
+            
+            long          block_length     = BlockLength (partID);
+            hyFloat     * buffer           = siteResults->theData;
+            _SimpleList * site_corrections = (_SimpleList*)siteCorrections(partID);
+            
+            InitializeArray (buffer, block_length, 0.);
+            siteScalerBuffer.Populate (block_length,0,0);
+            
+            for (long rate_class = 0L; rate_class < rate_classes; rate_class++) {
+                hyFloat weight = class_weights [first_evaluation.list_data[partID] + rate_class];
+                if (weight == 0.0) {
+                    continue;
+                }
+                
+                if (evaluation[rate_class].pending) {
+                    FinishBlockEvaluation (evaluation[rate_class]);
+                }
+                
+                hyFloat const * class_buffer   = class_likelihoods + buffer_offset.list_data[partID] + rate_class * block_length;
+                long    const * siteCorrectors = site_corrections->lLength ? site_corrections->list_data + block_length * rate_class : nil;
+                
+                for (long r1 = 0L; r1 < block_length; r1++) {
+                    if (siteCorrectors) {
+                        long scv = siteCorrectors[r1];
+                        
+                        if (rate_class == 0L) { // first entry
+                            buffer[r1] = weight * class_buffer[r1];
+                            siteScalerBuffer.list_data[r1] = scv;
+                        } else {
+                            if (scv < siteScalerBuffer.list_data[r1]) { // this class has a _smaller_ scaling factor
+                                buffer[r1] = weight * class_buffer[r1] + buffer[r1] * acquireScalerMultiplier (siteScalerBuffer.list_data[r1] - scv);
+                                siteScalerBuffer.list_data[r1] = scv;
+                            } else {
+                                if (scv > siteScalerBuffer.list_data[r1]) { // this is a _larger_ scaling factor
+                                    buffer[r1] += weight * class_buffer[r1] * acquireScalerMultiplier (scv - siteScalerBuffer.list_data[r1]);
+                                } else { // same scaling factors
+                                    buffer[r1] += weight * class_buffer[r1];
+                                }
+                            }
+                        }
+                    } else {
+                        buffer[r1] += weight * class_buffer[r1];
+                    }
+                }
+            }
+            
+            partition_results[partID] = SumUpSiteLikelihoods (partID, buffer, siteScalerBuffer);
+            UpdateBlockResult (partID, partition_results[partID]);
+        }
+        
+        if (blockMatrix) {
+            blockMatrix->theData[partID] = partition_results[partID];
+        } else {
+            addCompensated (result, correction, partition_results[partID]);
+        }
+    }
+    
+    if (evaluations) {
+        delete [] evaluations;
+    }
+    if (class_likelihoods) {
+        delete [] class_likelihoods;
+    }
+    if (class_weights) {
+        delete [] class_weights;
+    }
+    delete [] partition_results;
+    
+    return result;
+}
+
+//_______________________________________________________________________________________
+
 long        _LikelihoodFunction::BlockLength(long index) const {
     return GetIthFilter (index)->GetPatternCount();
 }
 //_______________________________________________________________________________________
 
 bool        _LikelihoodFunction::HasBlockChanged(long index) const {
-    return GetIthTree (index)->HasChanged2();
+    _TheTree * t = GetIthTree (index);
+    return t->HasForcedRecomputeList() || t->HasChanged2();
+}
+
+//_______________________________________________________________________________________
+
+bool        _LikelihoodFunction::PartitionNeedsUpdate (long index) {
+    // whether a partition evaluated elsewhere (by a worker process or an MPI node) has to be recomputed;
+    // the same criteria as those used by ComputePartition and ComputeBlock
+    return blockDependancies.list_data[index] ? HasBlockChanged (index) : HasPartitionChanged (index) || GetIthFrequencies (index)->HasChanged();
 }
 
 //_______________________________________________________________________________________
@@ -3227,7 +4368,7 @@ void    _LikelihoodFunction::InitMPIOptimizer (void)
             //ReportWarning (((_String*)parallelOptimizerTasks.toStr())->getStr());
         }
 
-        _Matrix::CreateMatrix (&varTransferMatrix, 1, transferrableVars, false, true, false);
+        _hy_mpi_setup_transfer_buffers (parallelOptimizerTasks.lLength, transferrableVars);
         _Matrix::CreateMatrix (&resTransferMatrix, 2, cacheSize, false, true, false);
         ReportWarning(_String("[MPI] InitMPIOptimizer successful. ") & transferrableVars & " transferrable parameters, " & cacheSize & " sites to be cached.");
     } else {
@@ -3243,7 +4384,7 @@ void    _LikelihoodFunction::InitMPIOptimizer (void)
 
             if (hyphyMPIOptimizerMode == _hyphyLFMPIModePartitions   && theDataFilters.lLength>1 ||
                     hyphyMPIOptimizerMode == _hyphyLFMPIModeAuto         && theDataFilters.lLength == 1 ||
-                    hyphyMPIOptimizerMode == _hyphyLFMPIModeSiteTemplate && theDataFilters.lLength>1 && slaveNodes>=theDataFilters.lLength) {
+                    hyphyMPIOptimizerMode == _hyphyLFMPIModeSiteTemplate && theDataFilters.lLength>1) {
 
                 if (hyphyMPIOptimizerMode == _hyphyLFMPIModeSiteTemplate) {
                     if (templateKind != _hyphyLFComputationalTemplateBySite) {
@@ -3341,78 +4482,39 @@ void    _LikelihoodFunction::InitMPIOptimizer (void)
                 }
                 // no autoParallelize
                 else {
-                    long     perNode        =  (hyphyMPIOptimizerMode == _hyphyLFMPIModeAuto)?1:theDataFilters.lLength / slaveNodes,
-                             overFlow       =  (hyphyMPIOptimizerMode == _hyphyLFMPIModeAuto)?0:theDataFilters.lLength % slaveNodes;
-
-                    if (perNode == 0L) { // more nodes than filters
-                        slaveNodes         = theDataFilters.lLength;
-                        totalNodeCount     = slaveNodes + 1;
-                        perNode            = 1L;
-                        overFlow           = 0L;
-                    }
-
-                    _Matrix partition_weights (theDataFilters.lLength, 2, false, true);
+                    /*
+                        20261018: SLKP
+                        every node gets the entire likelihood function, and partitions are handed out in
+                        chunks from a queue at every evaluation (see ComputeOnMPIQueue); the initial costs
+                        of partitions (refined as the run goes) are those of the previous run, if there was
+                        one, or proportional to (site patterns) x (branches) x (states)^2
+                    */
                     
-                    if (theDataFilters.lLength > slaveNodes) {
-                        
-                        for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
-                            //fprintf (stderr, "\nComputing block %ld\n", i);
-                            TimeDifference timer;
-                            ComputeBlock(i);
-                            hyFloat timeDiff   = timer.TimeSinceStart();
-                            partition_weights.Store (i, 0, timeDiff);
-                        }
-                        
-                    } else {
+                    slaveNodes     = MIN (slaveNodes, theDataFilters.lLength);
+                    totalNodeCount = slaveNodes + 1;
+                    
+                    if (mpiPartitionCosts.get_used() != theDataFilters.lLength) {
+                        mpiPartitionCosts.Clear();
                         for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
-                            partition_weights.Store (i, 0, 1.);
+                            _TheTree * tree      = GetIthTree (i);
+                            long const dimension = GetIthFilter (i)->GetDimension();
+                            mpiPartitionCosts.Store ((hyFloat)BlockLength (i) * (tree->GetLeafCount() + tree->GetINodeCount()) * dimension * dimension);
                         }
                     }
-                    
-                    _Constant * sum = (_Constant*)partition_weights.Sum();
-                    partition_weights *= (slaveNodes/sum->Value());
-                    for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
-                        partition_weights.Store (i, 1, i);
-                    }
-                    
-                    sum->SetValue(0.);
-                    _Matrix * sorted_by_weight = (_Matrix*)partition_weights.SortMatrixOnColumn(sum);
-                    DeleteObject (sum);
-                    
 
                     MPISwitchNodesToMPIMode (slaveNodes);
                     
-                    long current_index = 0L;
-                    
                     ReportWarning    (_String ("InitMPIOptimizer with:") & (long)theDataFilters.lLength & " partitions on " & (long)slaveNodes
-                                      & " MPI computational nodes. ");
+                                      & " MPI computational nodes (from a work queue). ");
+                    
+                    _StringBuffer     sLF (8192L);
+                    SerializeLF       (sLF,_hyphyLFSerializeModeVanilla);
+                    sLF.TrimSpace     ();
                     
                     for (long i = 1L; i<totalNodeCount; i++) {
-                        hyFloat sum = 0.;
-                        _SimpleList my_part;
-                        do {
-                            sum += (*sorted_by_weight) (current_index, 0);
-                            my_part << round ((*sorted_by_weight) (current_index, 1));
-                            current_index++;
-                        } while (sum < 1. && theDataFilters.lLength - current_index >= (totalNodeCount - i));
-                        
-                        ReportWarning    (_String ("InitMPIOptimizer sending partitions ") & _String ((_String*)my_part.toStr()) & " to node " & i);
-                        
-                        
-                        //fprintf (stderr, "%s\n", _String ((_String*)my_part.toStr()).getStr());
-                        
-                        
-                        _StringBuffer     sLF (8192L);
-                        SerializeLF       (sLF,_hyphyLFSerializeModeVanilla,&my_part);
-                        sLF.TrimSpace     ();
-                        
                         MPISendString    (sLF,i);
                         parallelOptimizerTasks.AppendNewInstance (new _SimpleList);
                     }
-                    
-                    
-                    DeleteObject (sorted_by_weight);
-                    
                 }
 
 
@@ -3440,7 +4542,7 @@ void    _LikelihoodFunction::InitMPIOptimizer (void)
                     DeleteObject (mapString);
                 }
 
-                _Matrix::CreateMatrix (&varTransferMatrix, 1, transferrableVars, false, true, false);
+                _hy_mpi_setup_transfer_buffers (parallelOptimizerTasks.lLength, transferrableVars, hyphyMPIOptimizerMode == _hyphyLFMPIModeAuto ? 0L : theDataFilters.lLength);
                 ReportWarning(_String("[MPI] InitMPIOptimizer:Finished with the setup. Maximum of ") & transferrableVars & " transferrable parameters.");
             }
         }
@@ -3458,17 +4560,316 @@ void    _LikelihoodFunction::CleanupMPIOptimizer (void)
 
 
         for (long i=0; i<parallelOptimizerTasks.lLength; i++) {
-            ReportMPIError(MPI_Send(varTransferMatrix.theData, ((_SimpleList*)parallelOptimizerTasks(i))->lLength , MPI_DOUBLE, i+1, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD),true);
+            ReportMPIError(MPI_Send(varTransferMatrix.theData, 1, MPI_DOUBLE, i+1, HYPHY_MPI_VARS_TAG, MPI_COMM_WORLD),true);
             MPISendString (kEmptyString, i+1);
         }
 
         if (hyphyMPIOptimizerMode == _hyphyLFMPIModeREL) {
             resTransferMatrix.Clear();
         }
-        varTransferMatrix.Clear();
-        parallelOptimizerTasks.Clear();
-    }
-    hyphyMPIOptimizerMode = _hyphyLFMPIModeNone;
+        // report how long each node took to respond (per request: an evaluation, or a chunk of partitions);
+        // in partition and site template modes, mpiPartitionCosts have been refined as the run went
+        // (see ComputeOnMPIQueue), and will be used by the next run of this likelihood function
+        
+        _StringBuffer response_report (256UL);
+        hyFloat       slowest = 0.,
+                      mean    = 0.;
+        
+        response_report << "[MPI] Mean response times (ms) by node:";
+        for (long i=0; i<parallelOptimizerTasks.lLength; i++) {
+            hyFloat * times = mpiResponseTimes.theData + 3*i,
+                      node_mean = times[2] > 0. ? times[1] / times[2] : 0.;
+            response_report << ' ' << _String (node_mean * 1000., "%.3g") << " (" << _String ((long)times[2]) << " requests)";
+            StoreIfGreater (slowest, node_mean);
+            mean += node_mean / parallelOptimizerTasks.lLength;
+        }
+        if (mean > 0.) {
+            response_report << ". Slowest/mean = " << _String (slowest / mean, "%.3g");
+        }
+        ReportWarning (response_report);
+        
+        varTransferMatrix.Clear();
+        varTransferHistory.Clear();
+        mpiResponseTimes.Clear();
+        mpiChunkMessages.Clear();
+        parallelOptimizerTasks.Clear();
+    }
+    hyphyMPIOptimizerMode = _hyphyLFMPIModeNone;
+#endif
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::AssignPartitionsToNodes (long nodes, _List& assignment) {
+    /*
+        20261018: SLKP
+        split the partitions of this likelihood function into 'nodes' groups of (roughly) equal cost;
+        the costs are either those stored by the previous parallel run (MPI or LOCAL_PROCESS_POOL),
+        or timed by evaluating each partition once; 'assignment' receives 'nodes' sorted _SimpleLists
+        of partition indices
+    */
+    
+    _Matrix partition_weights (theDataFilters.lLength, 2, false, true);
+    
+    if (theDataFilters.lLength > nodes && mpiPartitionCosts.get_used() == theDataFilters.lLength) {
+        // costs measured during the previous parallel run of this likelihood function, see RescalePartitionCosts
+        ReportWarning ("Balancing partitions using the evaluation times measured during the previous run");
+        for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
+            partition_weights.Store (i, 0, mpiPartitionCosts.theData[i]);
+        }
+    } else if (theDataFilters.lLength > nodes) {
+        
+        for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
+            //fprintf (stderr, "\nComputing block %ld\n", i);
+            TimeDifference timer;
+            ComputeBlock(i);
+            hyFloat timeDiff   = timer.TimeSinceStart();
+            partition_weights.Store (i, 0, timeDiff);
+        }
+        
+    } else {
+        for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
+            partition_weights.Store (i, 0, 1.);
+        }
+    }
+    
+    _Constant * sum = (_Constant*)partition_weights.Sum();
+    partition_weights *= (nodes/sum->Value());
+    mpiPartitionCosts.Clear();
+    for (unsigned long i = 0UL; i < theDataFilters.lLength; i++) {
+        mpiPartitionCosts.Store (partition_weights (i, 0));
+        partition_weights.Store (i, 1, i);
+    }
+    
+    sum->SetValue(0.);
+    _Matrix * sorted_by_weight = (_Matrix*)partition_weights.SortMatrixOnColumn(sum);
+    DeleteObject (sum);
+    
+    long current_index = 0L;
+    
+    for (long i = 0L; i < nodes; i++) {
+        hyFloat sum = 0.;
+        _SimpleList * my_part = new _SimpleList;
+        do {
+            sum += (*sorted_by_weight) (current_index, 0);
+            (*my_part) << round ((*sorted_by_weight) (current_index, 1));
+            current_index++;
+        } while (sum < 1. && theDataFilters.lLength - current_index >= (nodes - i));
+        my_part->Sort();
+        assignment.AppendNewInstance (my_part);
+    }
+    
+    DeleteObject (sorted_by_weight);
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::RescalePartitionCosts (_SimpleList const& partitions, hyFloat measured) {
+    // rescale the estimated costs of a group of partitions so that they add up to the time measured
+    // for evaluating the group; the next AssignPartitionsToNodes call will use them
+    if (measured > 0.) {
+        hyFloat estimated = 0.;
+        partitions.Each ([&] (long p, unsigned long) -> void {
+            estimated += mpiPartitionCosts.theData[p];
+        });
+        if (estimated > 0.) {
+            partitions.Each ([&] (long p, unsigned long) -> void {
+                mpiPartitionCosts.theData[p] *= measured / estimated;
+            });
+        }
+    }
+}
+
+//_______________________________________________________________________________________
+bool    _LikelihoodFunction::StartProcessPool (long workers) {
+    /*
+        20261018: SLKP
+        fork 'workers' processes, each of which will evaluate its own subset of partitions (split as in
+        MPI partition mode, see AssignPartitionsToNodes) until StopProcessPool is called; while the pool
+        is running, Compute (mode 5) only exchanges parameter values and partition log-likelihoods with
+        the workers, and the sum over partitions is taken in partition order
+     
+        every worker starts with a copy-on-write image of this process, and the first write to a page of
+        a conditional cache gives the worker its own copy of the page, allocated on the memory node
+        where the worker is running; so each worker ends up owning (and first-touching) the caches of
+        its partitions, while the caches of other partitions are never copied
+     
+        the pool is not started (and false is returned) if there is only one partition, if the likelihood
+        function uses a computational template, or if processes can't be forked on this platform
+    */
+#ifdef _HY_LOCAL_PROCESS_POOL_
+    if (workers > theTrees.lLength) {
+        workers = theTrees.lLength;
+    }
+    if (workers < 2L || computingTemplate || processPool) {
+        return false;
+    }
+    
+    _LocalProcessPool * pool = new _LocalProcessPool;
+    AssignPartitionsToNodes (workers, pool->partitions);
+    
+    pool->shared_size = sizeof (hyFloat) * (indexInd.lLength + theTrees.lLength + workers);
+    pool->shared      = (hyFloat*)mmap (nil, pool->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pool->shared == MAP_FAILED || pipe (pool->done_pipe) != 0) {
+        if (pool->shared != MAP_FAILED) {
+            munmap (pool->shared, pool->shared_size);
+        }
+        ReportWarning ("LOCAL_PROCESS_POOL: failed to allocate the shared memory buffer; partitions will be evaluated by this process");
+        delete pool;
+        return false;
+    }
+    pool->parameters  = pool->shared;
+    pool->results     = pool->parameters + indexInd.lLength;
+    pool->times       = pool->results    + theTrees.lLength;
+    pool->evaluations = 0L;
+    InitializeArray (pool->times, workers, 0.);
+    
+    // parameter values are exchanged unmapped, see SetupParameterMapping
+    _Matrix::CreateMatrix (&pool->start_values, 1, indexInd.lLength, false, true, false);
+    for (unsigned long i = 0UL; i < indexInd.lLength; i++) {
+        pool->start_values.theData[i] = GetIthIndependent (i, false);
+    }
+    
+    _SimpleList go_read;
+    for (long w = 0L; w < workers; w++) {
+        int go_pipe [2];
+        if (pipe (go_pipe) != 0) {
+            break;
+        }
+        go_read        << go_pipe[0];
+        pool->go_pipes << go_pipe[1];
+    }
+    
+    processPool = pool;
+    
+    if (go_read.lLength == workers) {
+        fflush (stdout);
+        fflush (stderr);
+        
+        for (long w = 0L; w < workers; w++) {
+            pid_t pid = _hy_fork_worker ([&] (void) -> void {
+                // only keep this worker's end of its 'go' pipe and the write end of the 'done' pipe
+                for (long k = 0L; k < workers; k++) {
+                    close (pool->go_pipes.get (k));
+                    if (k != w) {
+                        close (go_read.get (k));
+                    }
+                }
+                close (pool->done_pipe[0]);
+                RunProcessPoolWorker (w, go_read.get (w));
+            });
+            if (pid < 0) {
+                break;
+            }
+            pool->workers << pid;
+        }
+    }
+    
+    go_read.Each ([] (long fd, unsigned long) -> void {close (fd);});
+    close (pool->done_pipe[1]);
+    
+    if (pool->workers.lLength < workers) {
+        ReportWarning (_String ("LOCAL_PROCESS_POOL: failed to start ") & workers & " worker processes; partitions will be evaluated by this process");
+        StopProcessPool ();
+        return false;
+    }
+    
+    _StringBuffer pool_report (256UL);
+    pool_report << "LOCAL_PROCESS_POOL: started " << _String (workers) << " worker processes with partitions";
+    pool->partitions.ForEach ([&] (BaseRefConst p, unsigned long) -> void {
+        pool_report << ' ' << _String ((_String*)((_SimpleList*)p)->toStr());
+    });
+    ReportWarning (pool_report);
+    
+    return true;
+#else
+    return false;
+#endif
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::StopProcessPool (void) {
+    // terminate the worker processes (if any), report how long each one spent evaluating its partitions
+    // and update the partition costs used by AssignPartitionsToNodes
+#ifdef _HY_LOCAL_PROCESS_POOL_
+    if (!processPool) {
+        return;
+    }
+    
+    _LocalProcessPool * pool = processPool;
+    processPool = nil;
+    
+    pool->go_pipes.Each ([] (long fd, unsigned long) -> void {
+        _hy_pool_signal (fd, 0);
+        close (fd);
+    });
+    pool->workers.Each ([] (long pid, unsigned long) -> void {
+        if (!_hy_wait_for_worker (pid)) {
+            ReportWarning (_String ("LOCAL_PROCESS_POOL: worker process ") & pid & " did not exit normally");
+        }
+    });
+    close (pool->done_pipe[0]);
+    
+    if (pool->evaluations > 0L && pool->workers.lLength == pool->partitions.lLength) {
+        _StringBuffer time_report (256UL);
+        time_report << "LOCAL_PROCESS_POOL: mean evaluation times (ms) by worker:";
+        for (unsigned long w = 0UL; w < pool->workers.lLength; w++) {
+            hyFloat worker_mean = pool->times[w] / pool->evaluations;
+            time_report << ' ' << _String (worker_mean * 1000., "%.3g");
+            RescalePartitionCosts (*(_SimpleList const*)pool->partitions.GetItem (w), worker_mean);
+        }
+        time_report << " over " << _String (pool->evaluations) << " evaluations";
+        ReportWarning (time_report);
+    }
+    
+    /*
+        this process has not updated its own caches while the pool was running, but its variables
+        have been marked as unchanged after every evaluation; mark all parameters that have moved since
+        the pool was started as changed, so that the next evaluation brings the caches up to date
+    */
+    for (unsigned long i = 0UL; i < indexInd.lLength; i++) {
+        hyFloat current_value = GetIthIndependent (i, false);
+        if (current_value != pool->start_values.theData[i]) {
+            GetIthIndependentVar (i)->SetValue (new _Constant (current_value), false);
+        }
+    }
+    computationalResults.Clear();
+    
+    munmap (pool->shared, pool->shared_size);
+    delete pool;
+#endif
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::RunProcessPoolWorker (long worker, long go_pipe) {
+    // the evaluation loop of a LOCAL_PROCESS_POOL worker process (run by _hy_fork_worker); see StartProcessPool
+#ifdef _HY_LOCAL_PROCESS_POOL_
+    _SimpleList const * my_partitions = (_SimpleList const*)processPool->partitions.GetItem (worker);
+    
+    SetThreadCount (1L);
+    
+    while (_hy_pool_wait (go_pipe)) {
+        TimeDifference timer;
+        
+        for (unsigned long i = 0UL; i < indexInd.lLength; i++) {
+            _Variable * parameter = GetIthIndependentVar (i);
+            if (parameter->Value() != processPool->parameters[i]) {
+                parameter->SetValue (new _Constant (processPool->parameters[i]), false);
+            }
+        }
+        
+        if (PreCompute()) {
+            my_partitions->Each ([this] (long partID, unsigned long) -> void {
+                processPool->results[partID] = ComputePartition (partID);
+            });
+            PostCompute();
+        } else {
+            my_partitions->Each ([this] (long partID, unsigned long) -> void {
+                processPool->results[partID] = -INFINITY;
+            });
+        }
+        
+        processPool->times[worker] += timer.TimeSinceStart();
+        _hy_pool_signal (processPool->done_pipe[1], 1);
+    }
 #endif
 }
 
@@ -3492,10 +4893,36 @@ void            _LikelihoodFunction::SetupLFCaches              (void) {
 
     evalsSinceLastSetup = 0L;
 
+    // 20261018: SLKP
+    // the layout is fixed for the lifetime of the caches; the OpenCL evaluator expects unpadded vectors
+#ifdef MDSOCL
+    paddedConditionalCaches = false;
+    singlePrecisionConditionals = false;
+    numaAwareCaches = false;
+#else
+    paddedConditionalCaches = hy_env::EnvVariableTrue(hy_env::pad_conditional_caches);
+    numaAwareCaches = hy_env::EnvVariableTrue(hy_env::numa_aware_caches);
+#endif
+    // caches are placed by the first evaluation, see PlaceConditionalCaches
+    numaPlacementThreads = 0L;
+    concurrentPartitionBlocks = hy_env::EnvVariableTrue(hy_env::concurrent_partition_blocks);
+    if (concurrentPartitionBlocks) {
+        // partitions that share a tree also share its transition matrices, so they can't be pruned concurrently
+        _SimpleList sorted_trees (theTrees);
+        sorted_trees.Sort();
+        for (unsigned long i = 1UL; i < sorted_trees.lLength; i++) {
+            if (sorted_trees.get (i) == sorted_trees.get (i-1)) {
+                concurrentPartitionBlocks = false;
+                break;
+            }
+        }
+    }
+
     for (unsigned long i=0UL; i<theTrees.lLength; i++) {
         _TheTree * cT = GetIthTree(i);
         _DataSetFilter const *theFilter = GetIthFilter(i);
 
+        cT->SetPaddedConditionals (paddedConditionalCaches);
         conditionalInternalNodeLikelihoodCaches[i] = nil;
         conditionalTerminalNodeStateFlag       [i] = nil;
         siteScalingFactors                     [i] = nil;
@@ -3510,6 +4937,7 @@ void            _LikelihoodFunction::SetupLFCaches              (void) {
 
         unsigned long patternCount   = theFilter->GetPatternCount(),
              stateSpaceDim    = theFilter->GetDimension (),
+             cacheStride      = cT->GetConditionalStride (stateSpaceDim),
              leafCount      = cT->GetLeafCount(),
              iNodeCount        = cT->GetINodeCount(),
              atomSize      = theFilter->GetUnitLength();
@@ -3517,8 +4945,8 @@ void            _LikelihoodFunction::SetupLFCaches              (void) {
         long ambig_resolution_count = 1L;
 
         if (leafCount > 1UL) {
-            conditionalInternalNodeLikelihoodCaches[i] = (hyFloat*)MemAllocate (sizeof(hyFloat)*patternCount*stateSpaceDim*iNodeCount*cT->categoryCount, false, 64);
-            branchCaches[i]                            = (hyFloat*)MemAllocate (sizeof(hyFloat)*2*patternCount*stateSpaceDim*cT->categoryCount, false, 64);
+            conditionalInternalNodeLikelihoodCaches[i] = (hyFloat*)MemAllocate ((singlePrecisionConditionals ? sizeof (float) : sizeof(hyFloat))*patternCount*cacheStride*iNodeCount*cT->categoryCount, false, 64);
+            branchCaches[i]                            = (hyFloat*)MemAllocate (sizeof(hyFloat)*2*patternCount*cacheStride*cT->categoryCount, false, 64);
         }
 
         siteScalingFactors[i]                          = (hyFloat*)MemAllocate (sizeof(hyFloat)*patternCount*iNodeCount*cT->categoryCount, false, 64);
@@ -3545,36 +4973,64 @@ void            _LikelihoodFunction::SetupLFCaches              (void) {
         hyFloat      * translationCache  = (hyFloat*)alloca (sizeof (hyFloat)* stateSpaceDim);
         _Vector  * ambigs            = new _Vector();
 
-        for (unsigned long siteID = 0UL; siteID < patternCount; siteID ++) {
-            siteScalingFactors[i][siteID] = 1.;
-            for (unsigned long k = 0UL; k < atomSize; k++) {
-                columnBlock[k] = theFilter->GetColumn(siteID*atomSize+k);
-            }
+        long const uptoL = Maximum (2UL,leafCount);
 
-            long uptoL = Maximum (2UL,leafCount);
+        /* 20261018: SLKP
+            single character nucleotide and amino-acid filters are translated from their packed
+            state codes (see _DataSetFilter::PackStateCodes), once per distinct code
+        */
+        if (atomSize == 1UL && (unsigned long)uptoL <= theFilter->NumberSpecies() && (theFilter->PackedCodeBits() || GetIthFilterMutable(i)->PackStateCodes())) {
+            long code_translation [32]; // stateSpaceDim marks codes not seen yet
+            InitializeArray (code_translation, 32, (long)stateSpaceDim);
+
+            for (unsigned long siteID = 0UL; siteID < patternCount; siteID ++) {
+                siteScalingFactors[i][siteID] = 1.;
+                for (long leafID = 0; leafID < uptoL; leafID ++) {
+                    unsigned long const code = theFilter->PackedCode (siteID, leafID);
+                    long translation = code_translation[code];
+                    if (translation == (long)stateSpaceDim) {
+                        translation = theFilter->PackedCodeResolution (code, translationCache);
+                        if (translation < 0L) {
+                            for (unsigned long j = 0UL; j < stateSpaceDim; j++) {
+                                ambigs->Store(translationCache[j]);
+                            }
+                            translation = -ambig_resolution_count++;
+                        }
+                        code_translation[code] = translation;
+                    }
+                    conditionalTerminalNodeStateFlag [i][leafID*patternCount + siteID] = translation;
+                }
+            }
+        } else {
+            for (unsigned long siteID = 0UL; siteID < patternCount; siteID ++) {
+                siteScalingFactors[i][siteID] = 1.;
+                for (unsigned long k = 0UL; k < atomSize; k++) {
+                    columnBlock[k] = theFilter->GetColumn(siteID*atomSize+k);
+                }
 
-            for (long leafID = 0; leafID < uptoL; leafID ++) {
-                long mappedLeaf  = theFilter->theNodeMap.list_data[leafID],
-                     translation;
+                for (long leafID = 0; leafID < uptoL; leafID ++) {
+                    long mappedLeaf  = theFilter->theNodeMap.list_data[leafID],
+                         translation;
 
-                for (long k = 0; k < atomSize; k++) {
-                    aState.set_char (k, columnBlock[k][mappedLeaf]);
-                }
+                    for (long k = 0; k < atomSize; k++) {
+                        aState.set_char (k, columnBlock[k][mappedLeaf]);
+                    }
 
-                translation = foundCharacters.Find (&aState);
-                if (translation < 0L) {
-                    translation = theFilter->Translate2Frequencies (aState, translationCache, true);
+                    translation = foundCharacters.Find (&aState);
                     if (translation < 0L) {
-                        for (unsigned long j = 0UL; j < stateSpaceDim; j++) {
-                            ambigs->Store(translationCache[j]);
+                        translation = theFilter->Translate2Frequencies (aState, translationCache, true);
+                        if (translation < 0L) {
+                            for (unsigned long j = 0UL; j < stateSpaceDim; j++) {
+                                ambigs->Store(translationCache[j]);
+                            }
+                            translation = -ambig_resolution_count++;
                         }
-                        translation = -ambig_resolution_count++;
+                        foundCharacters.Insert (new _String(aState), translation);
+                    } else {
+                        translation = foundCharacters.GetXtra (translation);
                     }
-                    foundCharacters.Insert (new _String(aState), translation);
-                } else {
-                    translation = foundCharacters.GetXtra (translation);
+                    conditionalTerminalNodeStateFlag [i][leafID*patternCount + siteID] = translation;
                 }
-                conditionalTerminalNodeStateFlag [i][leafID*patternCount + siteID] = translation;
             }
         }
         conditionalTerminalNodeLikelihoodCaches < ambigs;
@@ -3585,6 +5041,67 @@ void            _LikelihoodFunction::SetupLFCaches              (void) {
     }
 }
 
+//_______________________________________________________________________________________
+void        _LikelihoodFunction::SetConditionalPrecision    (bool single_precision) {
+    // 20261018: SLKP
+    // reallocate internal node conditional caches with the requested element type;
+    // cached scaling factors refer to the old cache contents, so they are reset as well,
+    // and the next evaluation recomputes every branch
+    // with NUMA_AWARE_CACHES, scaling factors and branch caches are reallocated too, and all three
+    // are first touched by the threads that will compute them (see PlaceConditionalCaches)
+    singlePrecisionConditionals = single_precision;
+    
+    if (!conditionalInternalNodeLikelihoodCaches) {
+        return;
+    }
+
+    for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+        _TheTree * cT = GetIthTree(i);
+        _DataSetFilter const *theFilter = GetIthFilter(i);
+        
+        unsigned long patternCount   = theFilter->GetPatternCount(),
+                      iNodeCount     = cT->GetINodeCount(),
+                      cacheStride    = cT->GetConditionalStride (theFilter->GetDimension());
+        
+        if (conditionalInternalNodeLikelihoodCaches[i]) {
+            free (conditionalInternalNodeLikelihoodCaches[i]);
+            conditionalInternalNodeLikelihoodCaches[i] = (hyFloat*)MemAllocate ((single_precision ? sizeof (float) : sizeof(hyFloat))*patternCount*cacheStride*iNodeCount*cT->categoryCount, false, 64);
+            if (numaAwareCaches && branchCaches[i]) {
+                free (branchCaches[i]);
+                branchCaches[i] = (hyFloat*)MemAllocate (sizeof(hyFloat)*2*patternCount*cacheStride*cT->categoryCount, false, 64);
+            }
+        }
+        if (siteScalingFactors[i]) {
+            if (numaAwareCaches && conditionalInternalNodeLikelihoodCaches[i]) {
+                free (siteScalingFactors[i]);
+                siteScalingFactors[i] = (hyFloat*)MemAllocate (sizeof(hyFloat)*patternCount*iNodeCount*cT->categoryCount, false, 64);
+            } else {
+                InitializeArray(siteScalingFactors[i] , patternCount*iNodeCount*cT->categoryCount, 1.);
+            }
+        }
+    }
+    
+    if (numaAwareCaches) {
+        FirstTouchConditionalCaches ();
+    }
+    
+    auto reset_list = [] (_List& lists, long value) -> void {
+        for (unsigned long i = 0UL; i < lists.countitems(); i++) {
+            _SimpleList * list = (_SimpleList*)lists.GetItem (i);
+            list->Populate (list->countitems(), value, 0);
+        }
+    };
+    
+    reset_list (siteCorrections, 0L);
+    reset_list (siteCorrectionsBackup, 0L);
+    reset_list (cachedBranches, -1L);
+    overallScalingFactors.Populate       (theTrees.lLength, 0,0);
+    overallScalingFactorsBackup.Populate (theTrees.lLength, 0,0);
+    
+    evalsSinceLastSetup = 0L;
+    computationalResults.Clear();
+}
+
 //extern long marginalLFEvals, marginalLFEvalsAmb;
 
 //_______________________________________________________________________________________
@@ -3634,6 +5151,20 @@ void        _LikelihoodFunction::LoggerAddGradientPhase (hyFloat precision) {
 
 //_______________________________________________________________________________________
 
+void        _LikelihoodFunction::LoggerAddQuasiNewtonPhase (hyFloat step, long curvature_pairs) {
+  if (optimizatonHistory) {
+    _AssociativeList* new_phase = new _AssociativeList;
+    (*new_phase) < (_associative_list_key_value){"type", new _FString ("L-BFGS")}
+                 < (_associative_list_key_value){"step", new _Constant (step)}
+                 < (_associative_list_key_value){"memory", new _Constant (curvature_pairs)};
+
+
+     *((_AssociativeList*) this->optimizatonHistory->GetByKey("Phases")) < (_associative_list_key_value){nil, new_phase};
+  }
+}
+
+//_______________________________________________________________________________________
+
 void        _LikelihoodFunction::LoggerAddCoordinatewisePhase (hyFloat shrinkage, char convergence_mode) {
   if (optimizatonHistory) {
     _String phase_kind;
@@ -3755,7 +5286,8 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
         kMethodCoordinate                              ("coordinate-wise"),
         kMethodNedlerMead                              ("nedler-mead"),
         kMethodHybrid                                  ("hybrid"),
-        kMethodGradientDescent                         ("gradient-descent");
+        kMethodGradientDescent                         ("gradient-descent"),
+        kMethodQuasiNewton                             ("l-bfgs");
 
         // optimization setting to produce a detailed log of optimization runs
 
@@ -3784,7 +5316,8 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
         kOptimizationCoordinateWise,
         kOptimizationNedlerMead,
         kOptimizationGradientDescent,
-        kOptimizationHybrid
+        kOptimizationHybrid,
+        kOptimizationQuasiNewton
     } optimization_mode = kOptimizationHybrid;
     
     auto get_opt_method_string = [&] () -> const _String {
@@ -3796,6 +5329,8 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
             return kMethodGradientDescent;
         if (optimization_mode == kOptimizationNedlerMead)
             return kMethodNedlerMead;
+        if (optimization_mode == kOptimizationQuasiNewton)
+            return kMethodQuasiNewton;
     };
 
     if (lockedLFID != -1) {
@@ -3866,8 +5401,17 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
     
     long        fnDim               = MaximumDimension(),
                 evalsIn             = likeFuncEvalCallCount,
-                exponentiationsIn   = matrix_exp_count;
+                exponentiationsIn   = matrix_exp_count,
+                cacheHitsIn         = matrix_exp_cache_hits,
+                cacheMissesIn       = matrix_exp_cache_misses;
 
+    auto report_cache_hits = [cacheHitsIn, cacheMissesIn] (void) -> _String {
+        // only reported when some tree keeps a transition matrix cache (TRANSITION_MATRIX_CACHE)
+        if (matrix_exp_cache_hits == cacheHitsIn && matrix_exp_cache_misses == cacheMissesIn) {
+            return kEmptyString;
+        }
+        return _String ((long)matrix_exp_cache_hits - cacheHitsIn) & " transition matrices were reused from tree caches (" & _String ((long)matrix_exp_cache_misses - cacheMissesIn) & " cache misses)\n";
+    };
 
     TimeDifference timer;
 
@@ -3904,6 +5448,7 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
          GetIthTree (tree_index)->CountTreeCategories();
     }
 
+    singlePrecisionConditionals = ! CheckEqual (get_optimization_setting (kUseSinglePrecision, 0.0), 0.0);
     SetupLFCaches       ();
     SetupCategoryCaches ();
     computationalResults.Clear();
@@ -3949,6 +5494,9 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
 #endif
 
 
+    // analytic gradients read conditional caches as doubles
+    useAnalyticGradients = ! CheckEqual (get_optimization_setting (kUseAnalyticGradients, 1.0), 0.0) && !singlePrecisionConditionals;
+
     bool            skipCG                  = ! CheckEqual (get_optimization_setting (kSkipConjugateGradient, 0.0), 0.0),
                     keepStartingPoint       = ! CheckEqual (get_optimization_setting (kUseLastResults, 0.0), 0.0),
                     go2Bound                = ! CheckEqual (get_optimization_setting (kAllowBoundary, 1.0), 0.0);
@@ -3964,6 +5512,15 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
          }
     }
     
+    long          pool_size = get_optimization_setting (kLocalProcessPool, 0.0);
+    if (pool_size > 1L
+#ifdef __HYPHYMPI__
+        && hyphyMPIOptimizerMode == _hyphyLFMPIModeNone
+#endif
+        ) {
+        StartProcessPool (pool_size);
+    }
+    
     if (keepStartingPoint) {
         indexInd.Each ([this] (long v, unsigned long i) -> void {
             _Variable *iv = GetIthIndependentVar (i);
@@ -4030,6 +5587,8 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
             optimization_mode = kOptimizationHybrid;
         } else if (*sm == kMethodGradientDescent) {
             optimization_mode = kOptimizationGradientDescent;
+        } else if (*sm == kMethodQuasiNewton) {
+            optimization_mode = kOptimizationQuasiNewton;
         }
     } else {
         switch ((long) get_optimization_setting (kOptimizationMethod, -1.)) {
@@ -4045,6 +5604,9 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
             case 7:
                 optimization_mode = kOptimizationGradientDescent;
                 break;
+            case 8:
+                optimization_mode = kOptimizationQuasiNewton;
+                break;
         }
         
     }
@@ -4753,7 +6315,7 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
 
         }
 
-        ReportWarning (_String("Optimization finished in ") & loopCounter & " loop passes.\n" & _String ((long)likeFuncEvalCallCount-evalsIn) & " likelihood evaluation calls and " & _String ((long)matrix_exp_count - exponentiationsIn) & " matrix exponentiations calls were made\n");
+        ReportWarning (_String("Optimization finished in ") & loopCounter & " loop passes.\n" & _String ((long)likeFuncEvalCallCount-evalsIn) & " likelihood evaluation calls and " & _String ((long)matrix_exp_count - exponentiationsIn) & " matrix exponentiations calls were made\n" & report_cache_hits ());
 
         if (optimization_mode == kOptimizationGradientDescent) {
             _Matrix bestMSoFar (indexInd.lLength,1,false,true);
@@ -4764,6 +6326,9 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
 
     } else if (optimization_mode== kOptimizationNedlerMead) {
         SimplexMethod (precision, get_optimization_setting (kMaximumIterations, 10000000), maxItersPerVar);
+    } else if (optimization_mode == kOptimizationQuasiNewton) {
+        maxSoFar = QuasiNewtonMethod (precision, get_optimization_setting (kMaximumIterations, 10000000), maxItersPerVar, custom_convergence_callback >= 0 ? custom_convergence_callback_name : nil);
+        ReportWarning (_String("L-BFGS optimization finished.\n") & _String ((long)likeFuncEvalCallCount-evalsIn) & " likelihood evaluation calls and " & _String ((long)matrix_exp_count - exponentiationsIn) & " matrix exponentiations calls were made\n" & report_cache_hits ());
     }
     
     if (keepOptimizationLog) {
@@ -4778,11 +6343,50 @@ _Matrix*        _LikelihoodFunction::Optimize (_AssociativeList const * options)
         optimizatonHistory = nil;
     }
 
+    ReportCachePlacement ();
+    StopProcessPool ();
+    
     _Matrix result (2,indexInd.lLength+indexDep.lLength<3?3:indexInd.lLength+indexDep.lLength, false, true);
 
-    //forceRecomputation = true;
-    result.Store (1,0,Compute());
-    //forceRecomputation = false;
+    if (singlePrecisionConditionals
+#ifdef __HYPHYMPI__
+        && hyphyMPIOptimizerMode == _hyphyLFMPIModeNone
+#endif
+    ) {
+        /* 20261018: SLKP
+           the optimum was located with single precision conditionals; report the log-likelihood
+           recomputed in double precision, together with the observed difference, and an a priori bound
+           on it: every site likelihood is a sum of products with non-negative coefficients of stored
+           conditionals, so K float roundings per site (one per branch) perturb it by a relative error
+           of at most (1+u)^K-1 ~ K*u, with u = FLT_EPSILON/2 (the bound assumes no stored value underflows)
+        */
+        hyFloat single_precision_logL = Compute(),
+                error_bound           = 0.;
+        
+        for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+            _DataSetFilter const * filter = GetIthFilter (i);
+            error_bound += filter->GetSiteCountInUnits() * (GetIthTree(i)->GetINodeCount() + GetIthTree(i)->GetLeafCount() - 1UL);
+        }
+        error_bound *= FLT_EPSILON * 0.5;
+        
+        SetConditionalPrecision (false);
+        hyFloat double_precision_logL = Compute();
+        
+        ReportWarning (_String ("Single precision conditionals: log L = ") & _String (single_precision_logL, "%.12g") & ", recomputed in double precision = " & _String (double_precision_logL, "%.12g") & ", difference = " & _String (double_precision_logL - single_precision_logL, "%.6g") & ", bound = " & _String (error_bound, "%.6g"));
+        
+        _AssociativeList * precision_report = new _AssociativeList;
+        (*precision_report) < _associative_list_key_value {"LogL", new _Constant (double_precision_logL)}
+                            < _associative_list_key_value {"Single precision LogL", new _Constant (single_precision_logL)}
+                            < _associative_list_key_value {"Error", new _Constant (fabs (double_precision_logL - single_precision_logL))}
+                            < _associative_list_key_value {"Error bound", new _Constant (error_bound)};
+        CheckReceptacleAndStore(AppendContainerName("precision", GetObjectNameByType(HY_BL_LIKELIHOOD_FUNCTION,lockedLFID, false)), "", false, precision_report, false);
+        
+        result.Store (1,0,double_precision_logL);
+    } else {
+        //forceRecomputation = true;
+        result.Store (1,0,Compute());
+        //forceRecomputation = false;
+    }
     result.Store (1,1,indexInd.lLength);
     result.Store (1,2,CountObjects(kLFCountGlobalVariables));
 
@@ -4828,6 +6432,7 @@ void    _LikelihoodFunction::_TerminateAndDump(const _String &error, bool sig_te
 
 void _LikelihoodFunction::CleanUpOptimize (void) {
     categID = 0;
+    StopProcessPool ();
     CleanupParameterMapping ();
     //printf ("Done OPT LF eval %d MEXP %d\n", likeFuncEvalCallCount, matrix_exp_count);
 #ifdef __HYPHYMPI__
@@ -4839,6 +6444,7 @@ void _LikelihoodFunction::CleanUpOptimize (void) {
         }
 
         DeleteCaches (false);
+        singlePrecisionConditionals = false;
 
         if (mstCache) {
             hyFloat      umst = 0.0;
@@ -5352,7 +6958,18 @@ void    _LikelihoodFunction::CheckStep (hyFloat& tryStep, _Matrix vect, _Matrix*
 
 HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList) {
     
-    const static _String kCovariancePrecision ("COVARIANCE_PRECISION");
+    const static _String kCovariancePrecision ("COVARIANCE_PRECISION"),
+                         kCovarianceProcesses ("COVARIANCE_PROCESSES"),
+                         kCovarianceGradients ("COVARIANCE_USE_GRADIENTS");
+    
+    /*
+        20261018: SLKP
+     
+        COVARIANCE_PROCESSES = N > 0 evaluates the likelihood at all the displaced points needed for the
+        Hessian (or the profiles of all parameters when COVARIANCE_PRECISION < 1) as a batch of tasks shared by
+        this process and (N-1) forked workers (see ComputeHessianBatched); COVARIANCE_USE_GRADIENTS = TRUE
+        builds the Hessian from differences of analytic gradients where they are available
+    */
 
     if (indexInd.empty()) {
         return new _MathObject;
@@ -5364,6 +6981,8 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
                 t2,
                 cm = hy_env::EnvVariableGetNumber(kCovariancePrecision);
     
+    long        processes     = hy_env::EnvVariableGetNumber(kCovarianceProcesses, 0.);
+    bool        use_gradients = hy_env::EnvVariableTrue (kCovarianceGradients);
  
 
     PrepareToCompute();
@@ -5446,22 +7065,25 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
         _ExecutionList exL (fString);
         exL.Execute ();
 
-        for (parameter_count=0; parameter_count<parameterList->lLength; parameter_count++) {
-            long j = useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count;
-            t2 = GetIthIndependent (j);
+        // the profile of each parameter is an independent task (see COVARIANCE_PROCESSES)
+        
+        auto profile_parameter = [&] (long k, hyFloat * row) -> void {
+            long j = useIndirectIndexing?parameterList->list_data[k]:k;
+            hyFloat t2 = GetIthIndependent (j),
+                    h;
             _Variable* function_parameter = GetIthIndependentVar(j);
             //ObjectToConsole(function_parameter->GetName()); NLToConsole();
             thisVar->SetBounds (function_parameter->GetLowerBound(),function_parameter->GetUpperBound());
-            sigLevels->Store (parameter_count,1,t2);
+            row[1] = t2;
 
             char buffer[255];
             snprintf (buffer, sizeof(buffer),"%.14g",t1);
 
-            fString = _String("_profileFit(") & xxc & "," & j & ")-(" & buffer& ')';
+            _String fString = _String("_profileFit(") & xxc & "," & j & ")-(" & buffer& ')';
             _Formula    FitFla (fString,nil);
             
             if (CheckEqual(t2,function_parameter->GetLowerBound())) {
-                sigLevels->Store (parameter_count,0,t2);
+                row[0] = t2;
             } else {
                 h = FitFla.Brent (thisVar,t2+1,t2,t2*0.0001+0.000001);
                 //sigLevels.Store (i,0,MAX(h,thisVar2->GetLowerBound()));
@@ -5471,24 +7093,24 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
                   lf_buffer = _String("_profileFit(_xx_,") & j & ")-(" & buffer& ')';
                   _Formula try_again (lf_buffer,nil);
                   h = try_again.Brent (thisVar,t2+1,t2,t2*0.0001+0.000001);
-                  sigLevels->Store (parameter_count,5,h);
-                  sigLevels->Store (parameter_count,0,function_parameter->GetLowerBound());
+                  row[5] = h;
+                  row[0] = function_parameter->GetLowerBound();
 
                 } else {
-                  sigLevels->Store (parameter_count,0,h);
-                  sigLevels->Store (parameter_count,5,h);
+                  row[0] = h;
+                  row[5] = h;
                 }
            }
 
-            snprintf (buffer, sizeof(buffer),"%.14g",(*sigLevels) (parameter_count,0));
+            snprintf (buffer, sizeof(buffer),"%.14g",row[0]);
             _String checkLFDIFF = _String("CChi2(2*(-_profileFit(") & buffer & "," & j & ")+(" & functionValue & ")),1)";
             HBLObjectRef lf_diff = (HBLObjectRef) _FString (checkLFDIFF, false).Evaluate(_hyDefaultExecutionContext);
-            sigLevels->Store (parameter_count,3,lf_diff->Value());
+            row[3] = lf_diff->Value();
             DeleteObject (lf_diff);
 
 
             if (CheckEqual(t2,function_parameter->GetUpperBound())) {
-                sigLevels->Store (parameter_count,2,t2);
+                row[2] = t2;
             } else {
                 //_List store_evals;
                 h = FitFla.Brent (thisVar,t2,t2,t2*0.0001+0.000001);//, &store_evals);
@@ -5498,23 +7120,25 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
                   lf_buffer = _String("_profileFit(_xx_,") & j & ")-(" & buffer& ')';
                   _Formula try_again (lf_buffer,nil);
                   h = try_again.Brent (thisVar, t2,t2,t2*0.0001+0.000001);
-                  sigLevels->Store (parameter_count,6,h);
-                  sigLevels->Store (parameter_count,2,function_parameter->GetUpperBound());
+                  row[6] = h;
+                  row[2] = function_parameter->GetUpperBound();
 
                 } else {
-                  sigLevels->Store (parameter_count,2,h);
-                  sigLevels->Store (parameter_count,6,h);
+                  row[2] = h;
+                  row[6] = h;
                 }
             }
 
-             snprintf (buffer, sizeof(buffer),"%.14g",(*sigLevels) (parameter_count,2));
+             snprintf (buffer, sizeof(buffer),"%.14g",row[2]);
              checkLFDIFF =_String("CChi2(2*(-_profileFit(") & buffer & "," & j & ")+(" & functionValue & ")),1)";
              lf_diff = (HBLObjectRef) _FString (checkLFDIFF, false).Evaluate(_hyDefaultExecutionContext);
-             sigLevels->Store (parameter_count,4,lf_diff->Value());
+             row[4] = lf_diff->Value();
              DeleteObject (lf_diff);
 
             SetIthIndependent (j,t2);
-        }
+        };
+        
+        _hy_run_evaluation_tasks (this, parameterList->lLength, 7L, processes, sigLevels->theData, profile_parameter, "profile likelihood parameter");
 
         DoneComputing();
         DeleteVariable(thisVar->get_index(), true, false);
@@ -5537,6 +7161,7 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
     }
     // y,x',x''
     // first check for boundary values and move the parameter values a bit if needed
+    bool moved_off_bounds = false;
     for (parameter_count=0; parameter_count<parameterList->lLength; parameter_count++) {
         long     dIndex = useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count;
         thisVar = LocateVar (indexInd.list_data[dIndex]);
@@ -5583,8 +7208,10 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
 
         if (t1+locH > thisVar->GetUpperBound()) {
             SetIthIndependent (dIndex,thisVar->GetUpperBound()-2.0*locH);
+            moved_off_bounds = true;
         } else if (t1-locH < thisVar->GetLowerBound()) {
             SetIthIndependent (dIndex,thisVar->GetLowerBound()+2.0*locH);
+            moved_off_bounds = true;
         }
 
         if (uim > 0.5) {
@@ -5621,7 +7248,10 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
         }
     }
 
-
+    // 20261018: SLKP; the finite differences are taken around the (moved) point, not the original one
+    if (moved_off_bounds) {
+        functionValue = Compute();
+    }
 
 #if defined __MAC__ || defined __WINDOZE__ || defined __HYPHYQT__ || defined __HYPHY_GTK__
     hyFloat totalCount    = 2*parameterList->lLength;
@@ -5637,125 +7267,154 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
     BenchmarkThreads(this);
 #endif
 
-    // fill in funcValues with L(...,x_i\pm h,...) and 1st derivatives and get 2nd derivatives
-    for (parameter_count=0; parameter_count<parameterList->lLength; parameter_count++) {
-        long              pIdx = useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count;
-
-        hyFloat        pVal = GetIthIndependent (pIdx),
-                          d1,
-                          locH = funcValues (parameter_count,4);
-
-        SetIthIndependent (pIdx,pVal-locH); // - step
-        t1 = Compute();
-        funcValues.Store (parameter_count,0,t1);
-        SetIthIndependent (pIdx,pVal+locH); // + step
-        t2 = Compute();
-        funcValues.Store (parameter_count,1,t2);          // reset value
-        SetIthIndependent (pIdx,pVal);
-        d1 = (t2-t1)/(2.0*locH);
-        // central 1st derivative
-        funcValues.Store (parameter_count,2,d1);
-
-        t1  = ((t1-functionValue)+(t2-functionValue))/(locH*locH);
-        // Standard central second derivative
-
-        if (uim < 0.5) {
-            hessian.Store (parameter_count,parameter_count,-t1);
-        } else {
-            hessian.Store (parameter_count,parameter_count,-(t1*(*iMap)(parameter_count,1)*(*iMap)(parameter_count,1)+(*iMap)(parameter_count,2)*d1));
-        }
-
-#ifndef __UNIX__
-        finishedCount += 2;
-        if (TimerDifferenceFunction(true)>1.) {
-            SetStatusBarValue (finishedCount/totalCount*100.,1,0);
-            TimerDifferenceFunction (false);
+    if (processes > 0L || use_gradients) {
+        _SimpleList parameters;
+        _Matrix     derivatives (parameter_count,parameter_count,false,true);
+        for (long k = 0L; k < parameterList->lLength; k++) {
+            parameters << (useIndirectIndexing?parameterList->list_data[k]:k);
         }
-#endif
-    }
-
-
-    if (cm>1.1) {
-        // fill in off-diagonal elements using the f-la
-        // f_xy = 1/4h^2 (f(x+h,y+h)-f(x+h,y-h)+f(x-h,y-h)-f(x-h,y+h))
-
-        for (parameter_count=0; parameter_count<parameterList->lLength-1; parameter_count++) {
-            long        iidx = useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count;
-
-            hyFloat  ival  = GetIthIndependent(iidx),
-                        locHi = 1/8192.;//funcValues (i,4);
-
-            for (long j=parameter_count+1; j<parameterList->lLength; j++) {
-                long        jidx = useIndirectIndexing?parameterList->list_data[j]:j;
-
-                hyFloat  jval  = GetIthIndependent(jidx),
-                            locHj = locHi, //funcValues (j,4),
-                            a, // f (x+h,y+h)
-                            b, // f (x+h,y-h)
-                            c, // f (x-h,y-h)
-                            d; // f (x-h,y+h)
-
-                SetIthIndependent (iidx,ival+locHi);
-                SetIthIndependent (jidx,jval+locHj);
-                a = Compute();
-                SetIthIndependent (jidx,jval-locHj);
-                b = Compute();
-                SetIthIndependent (iidx,ival-locHi);
-                c = Compute();
-                SetIthIndependent (jidx,jval+locHj);
-                d = Compute();
-
-                t2 = (a-b-d+c)/(4*locHi*locHj);
-
-                if (uim > 0.5) {
-                    t2 *= (*iMap)(parameter_count,1)*(*iMap)(j,1);
+        
+        ComputeHessianBatched (parameters, funcValues, derivatives, cm, MAX (processes, 1L), use_gradients);
+        
+        for (long i = 0L; i < parameter_count; i++) {
+            for (long j = 0L; j < parameter_count; j++) {
+                if (uim < 0.5) {
+                    hessian.Store (i,j,-derivatives(i,j));
+                } else if (i == j) {
+                    hessian.Store (i,i,-(derivatives(i,i)*(*iMap)(i,1)*(*iMap)(i,1)+(*iMap)(i,2)*funcValues(i,2)));
+                } else {
+                    hessian.Store (i,j,-derivatives(i,j)*(*iMap)(i,1)*(*iMap)(j,1));
                 }
+            }
+        }
+    } else {
+        // fill in funcValues with L(...,x_i\pm h,...) and 1st derivatives and get 2nd derivatives
+        for (parameter_count=0; parameter_count<parameterList->lLength; parameter_count++) {
+            long              pIdx = useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count;
+
+            hyFloat        pVal = GetIthIndependent (pIdx),
+                              d1,
+                              locH = funcValues (parameter_count,4);
+
+            SetIthIndependent (pIdx,pVal-locH); // - step
+            t1 = Compute();
+            funcValues.Store (parameter_count,0,t1);
+            SetIthIndependent (pIdx,pVal+locH); // + step
+            t2 = Compute();
+            funcValues.Store (parameter_count,1,t2);          // reset value
+            SetIthIndependent (pIdx,pVal);
+            d1 = (t2-t1)/(2.0*locH);
+            // central 1st derivative
+            funcValues.Store (parameter_count,2,d1);
+
+            t1  = ((t1-functionValue)+(t2-functionValue))/(locH*locH);
+            // Standard central second derivative
+
+            if (uim < 0.5) {
+                hessian.Store (parameter_count,parameter_count,-t1);
+            } else {
+                hessian.Store (parameter_count,parameter_count,-(t1*(*iMap)(parameter_count,1)*(*iMap)(parameter_count,1)+(*iMap)(parameter_count,2)*d1));
+            }
 
-                hessian.Store (parameter_count,j,-t2);
-                hessian.Store (j,parameter_count,-t2);
-                SetIthIndependent (iidx,ival);
-                SetIthIndependent (jidx,jval);
 #ifndef __UNIX__
-                finishedCount += 4;
-                if (TimerDifferenceFunction(true)>1.) {
-                    SetStatusBarValue (finishedCount/totalCount*100.,1,0);
-                    TimerDifferenceFunction (false);
-                }
-#endif
+            finishedCount += 2;
+            if (TimerDifferenceFunction(true)>1.) {
+                SetStatusBarValue (finishedCount/totalCount*100.,1,0);
+                TimerDifferenceFunction (false);
             }
+#endif
         }
 
-    } else {
-        // fill in off-diagonal elements using the f-la
-        // f_xy = 1/h^2 (f(x+h,y+h)-f(x)-f_x h -f_y h -.5h^2(f_xx+f_yy))
 
-        if (CheckEqual(cm,1.)) {
+        if (cm>1.1) {
+            // fill in off-diagonal elements using the f-la
+            // f_xy = 1/4h^2 (f(x+h,y+h)-f(x+h,y-h)+f(x-h,y-h)-f(x-h,y+h))
+            // 20261018: SLKP; steps are shortened for parameters closer than 1/8192 to a bound, which
+            // would otherwise be clamped on one side (the same steps as in ComputeHessianBatched)
+
+            auto pair_step = [this] (long index, hyFloat value) -> hyFloat {
+                return MIN (1./8192., MIN (value - GetIthIndependentBound (index, true), GetIthIndependentBound (index, false) - value));
+            };
+
             for (parameter_count=0; parameter_count<parameterList->lLength-1; parameter_count++) {
-                hyFloat t3 = GetIthIndependent(useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count),
-                           t5 = hessian(parameter_count,parameter_count),
-                           t6 = funcValues(parameter_count,2);
+                long        iidx = useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count;
+
+                hyFloat  ival  = GetIthIndependent(iidx),
+                            locHi = pair_step (iidx, ival);//funcValues (i,4);
 
-                SetIthIndependent (useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count,t3+h);
                 for (long j=parameter_count+1; j<parameterList->lLength; j++) {
-                    hyFloat t4 = GetIthIndependent(useIndirectIndexing?parameterList->list_data[j]:j);
-                    SetIthIndependent (useIndirectIndexing?parameterList->list_data[j]:j,t4+h);
-                    t1 = Compute();
-                    t2 = (t1-functionValue-(t6+funcValues(j,2)-.5*(t5+hessian(j,j))*h)*h)/(h*h);
+                    long        jidx = useIndirectIndexing?parameterList->list_data[j]:j;
+
+                    hyFloat  jval  = GetIthIndependent(jidx),
+                                locHj = pair_step (jidx, jval), //funcValues (j,4),
+                                a, // f (x+h,y+h)
+                                b, // f (x+h,y-h)
+                                c, // f (x-h,y-h)
+                                d; // f (x-h,y+h)
+
+                    SetIthIndependent (iidx,ival+locHi);
+                    SetIthIndependent (jidx,jval+locHj);
+                    a = Compute();
+                    SetIthIndependent (jidx,jval-locHj);
+                    b = Compute();
+                    SetIthIndependent (iidx,ival-locHi);
+                    c = Compute();
+                    SetIthIndependent (jidx,jval+locHj);
+                    d = Compute();
+
+                    t2 = (a-b-d+c)/(4*locHi*locHj);
+
+                    if (uim > 0.5) {
+                        t2 *= (*iMap)(parameter_count,1)*(*iMap)(j,1);
+                    }
+
                     hessian.Store (parameter_count,j,-t2);
                     hessian.Store (j,parameter_count,-t2);
-                    SetIthIndependent (useIndirectIndexing?parameterList->list_data[j]:j,t4);
+                    SetIthIndependent (iidx,ival);
+                    SetIthIndependent (jidx,jval);
 #ifndef __UNIX__
-                    finishedCount ++;
+                    finishedCount += 4;
                     if (TimerDifferenceFunction(true)>1.) {
                         SetStatusBarValue (finishedCount/totalCount*100.,1,0);
                         TimerDifferenceFunction (false);
                     }
 #endif
                 }
-                SetIthIndependent (useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count,t3);
+            }
+
+        } else {
+            // fill in off-diagonal elements using the f-la
+            // f_xy = 1/h^2 (f(x+h,y+h)-f(x)-f_x h -f_y h -.5h^2(f_xx+f_yy))
+
+            if (CheckEqual(cm,1.)) {
+                for (parameter_count=0; parameter_count<parameterList->lLength-1; parameter_count++) {
+                    hyFloat t3 = GetIthIndependent(useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count),
+                               t5 = hessian(parameter_count,parameter_count),
+                               t6 = funcValues(parameter_count,2);
+
+                    SetIthIndependent (useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count,t3+h);
+                    for (long j=parameter_count+1; j<parameterList->lLength; j++) {
+                        hyFloat t4 = GetIthIndependent(useIndirectIndexing?parameterList->list_data[j]:j);
+                        SetIthIndependent (useIndirectIndexing?parameterList->list_data[j]:j,t4+h);
+                        t1 = Compute();
+                        t2 = (t1-functionValue-(t6+funcValues(j,2)-.5*(t5+hessian(j,j))*h)*h)/(h*h);
+                        hessian.Store (parameter_count,j,-t2);
+                        hessian.Store (j,parameter_count,-t2);
+                        SetIthIndependent (useIndirectIndexing?parameterList->list_data[j]:j,t4);
+#ifndef __UNIX__
+                        finishedCount ++;
+                        if (TimerDifferenceFunction(true)>1.) {
+                            SetStatusBarValue (finishedCount/totalCount*100.,1,0);
+                            TimerDifferenceFunction (false);
+                        }
+#endif
+                    }
+                    SetIthIndependent (useIndirectIndexing?parameterList->list_data[parameter_count]:parameter_count,t3);
+                }
             }
         }
     }
+    
     // undo changes to var values if needed
 
     DoneComputing();
@@ -5779,18 +7438,370 @@ HBLObjectRef   _LikelihoodFunction::CovarianceMatrix (_SimpleList* parameterList
 
 //_______________________________________________________________________________________
 
-void    _LikelihoodFunction::GetGradientStepBound (_Matrix& gradient,hyFloat& left, hyFloat& right, long * freezeCount)
-{
-    left = right = DEFAULTPARAMETERUBOUND;
-
-    if (freezeCount) {
-        *freezeCount = 0;
-    }
-
-    for (unsigned long i = 0; i < indexInd.lLength; i++) {
-        hyFloat directionalStep = gradient.theData[i];
-        if (directionalStep) {
-            hyFloat currentValue = GetIthIndependent (i),
+void    _LikelihoodFunction::ComputeHessianBatched (_SimpleList const& parameters, _Matrix& funcValues, _Matrix& derivatives, hyFloat precision, long processes, bool use_gradients) {
+    /*
+        20261018: SLKP
+     
+        fill in the second derivatives of log L with respect to 'parameters' (indices of independent variables)
+        and the first derivatives (column 2 of 'funcValues'; the step for every parameter is in column 4), using
+        the finite difference formulas of CovarianceMatrix (as selected by 'precision'), except that all the
+        displaced points are collected first and then evaluated as a batch
+     
+        - a point which only moves parameters of one branch (see MapBranchParameters), e.g. for a diagonal term of
+          a branch length, or an off-diagonal term for two parameters of a local model, does not need a full
+          evaluation: the change in log L for the new transition matrix of the branch is read off the inside
+          and outside vectors, and one such pass per partition (_TheTree::ComputeBranchGradients) handles all
+          of these points at once
+        - the other points are evaluated with Compute, by 'processes' processes (see _hy_run_evaluation_tasks)
+        - with 'use_gradients', the rows for parameters with exact analytic gradients (see ComputeBranchGradients)
+          are central differences of the gradient, which takes two gradient evaluations per parameter instead of
+          2-4 evaluations per pair of parameters; only the block of the remaining parameters is left to the
+          formulas which use function values
+     
+        all values are taken relative to log L at the current point
+    */
+    
+    long    const   n          = parameters.lLength;
+    hyFloat const   base       = Compute(),
+                    pair_step  = 1./8192.,  // four point formula for off-diagonal terms (precision > 1.1)
+                    cross_step = 1.e-5;     // one point formula for off-diagonal terms (precision == 1)
+    bool    const   four_point = precision > 1.1,
+                    one_point  = !four_point && CheckEqual (precision, 1.);
+    
+    _SimpleList     owners,
+                    ownerPartitions,
+                    ownerNodes,
+                    analytic,               // positions in 'parameters' with analytic gradients
+                    analytic_row (n, -1, 0),// position in 'analytic' or -1
+                    nothing_frozen;
+    
+    bool    const   branch_parameters = MapBranchParameters (owners, ownerPartitions, ownerNodes),
+                    saved_analytic    = useAnalyticGradients;
+    
+    _Matrix         gradient (indexInd.lLength, 1, false, true);
+    
+    if (use_gradients && branch_parameters) {
+        // derivatives which are themselves difference quotients (of a branch matrix) are too noisy to be differenced again
+        _SimpleList computed,
+                    exact;
+        useAnalyticGradients = true;
+        ComputeBranchGradients (gradient, nothing_frozen, computed, &exact);
+        computed.Sort();
+        exact.Sort();
+        for (long k = 0L; k < n; k++) {
+            if (computed.BinaryFind (parameters.get (k)) >= 0L && exact.BinaryFind (parameters.get (k)) >= 0L) {
+                analytic_row.list_data[k] = analytic.countitems();
+                analytic << k;
+            }
+        }
+    }
+    
+    // the displaced points: (first parameter, step) and optionally (second parameter, step)
+    
+    _SimpleList     point_first,
+                    point_second,
+                    diagonal_point (n, -1, 0),              // [- step, + step]
+                    pair_point;                             // n x n; [(+,+), (+,-), (-,-), (-,+)] or [(+,+)]
+    _Vector         first_step,
+                    second_step;
+    
+    auto add_point = [&] (long i, hyFloat di, long j, hyFloat dj) -> long {
+        point_first  << i;
+        point_second << j;
+        first_step   << di;
+        second_step  << dj;
+        return point_first.countitems() - 1L;
+    };
+    
+    for (long k = 0L; k < n; k++) {
+        if (analytic_row.get (k) < 0L) {
+            diagonal_point.list_data[k] = add_point (k, -funcValues (k,4), -1L, 0.);
+            add_point (k, funcValues (k,4), -1L, 0.);
+        }
+    }
+    
+    // unlike CovarianceMatrix, the four point formula uses smaller steps for parameters near their bounds
+    // (which would otherwise be clamped on one side)
+    
+    _Vector         pair_steps;
+    for (long k = 0L; k < n; k++) {
+        hyFloat const value = GetIthIndependent (parameters.get (k));
+        pair_steps << MIN (pair_step, MIN (value - GetIthIndependentBound (parameters.get (k), true), GetIthIndependentBound (parameters.get (k), false) - value));
+    }
+    
+    if (four_point || one_point) {
+        pair_point.Populate (n*n, -1, 0);
+        for (long i = 0L; i < n; i++) {
+            for (long j = i + 1L; j < n; j++) {
+                if (analytic_row.get (i) < 0L && analytic_row.get (j) < 0L) {
+                    if (four_point) {
+                        hyFloat const hi = pair_steps.theData[i],
+                                      hj = pair_steps.theData[j];
+                        pair_point.list_data[i*n+j] = add_point (i, hi, j, hj);
+                        add_point (i,  hi, j, -hj);
+                        add_point (i, -hi, j, -hj);
+                        add_point (i, -hi, j,  hj);
+                    } else {
+                        pair_point.list_data[i*n+j] = add_point (i, cross_step, j, cross_step);
+                    }
+                }
+            }
+        }
+    }
+    
+    long    const   points   = point_first.countitems();
+    hyFloat       * relative = new hyFloat [points];        // log L at the point - log L at the current point
+    _SimpleList     pending;                                // points which need a full evaluation
+    
+    // branch-local points
+    
+    _List           local_branches,
+                    local_differences,
+                    local_points;
+    
+    for (unsigned long partition = 0UL; partition < theTrees.lLength; partition++) {
+        local_branches.AppendNewInstance    (new _SimpleList);
+        local_differences.AppendNewInstance (new _List);
+        local_points.AppendNewInstance      (new _SimpleList);
+    }
+    
+    // probes bypass SetIthIndependent, as in ComputeBranchGradients
+    
+    auto branch_matrix = [&] (_CalcNode * node, long point, bool displaced) -> _Matrix* {
+        _Variable     * first        = GetIthIndependentVar (parameters.get (point_first.get (point))),
+                      * second       = point_second.get (point) >= 0L ? GetIthIndependentVar (parameters.get (point_second.get (point))) : nil;
+        hyFloat const   first_value  = first->Value(),
+                        second_value = second ? second->Value() : 0.;
+        if (displaced) {
+            first->SetValue (first_value + first_step.theData[point]);
+            if (second) {
+                second->SetValue (second_value + second_step.theData[point]);
+            }
+        }
+        _Matrix rates;
+        node->RecomputeMatrix (0, 1, &rates);
+        rates.CheckIfSparseEnough (true);
+        _Matrix * transitions = rates.Exponentiate (1., true);
+        transitions->CheckIfSparseEnough (true);
+        first->SetValue (first_value);
+        if (second) {
+            second->SetValue (second_value);
+        }
+        return transitions;
+    };
+    
+    // the branch matrix at the current point is the same for every point on a branch, so it is computed once per branch
+    
+    _Matrix ** current_matrices = branch_parameters ? new _Matrix* [ownerNodes.countitems()] : nil;
+    if (current_matrices) {
+        InitializeArray (current_matrices, ownerNodes.countitems(), (_Matrix*)nil);
+    }
+    
+    for (long point = 0L; point < points; point++) {
+        long key = -1L;
+        if (branch_parameters) {
+            key = owners.get (parameters.get (point_first.get (point)));
+            if (point_second.get (point) >= 0L && owners.get (parameters.get (point_second.get (point))) != key) {
+                key = -1L;
+            }
+        }
+        if (key >= 0L) {
+            long            const partition = ownerPartitions.get (key),
+                                  dimension = GetIthFilter (partition)->GetDimension();
+            _CalcNode           * node      = (_CalcNode*)GetIthTree (partition)->GetNodeFromFlatIndex (ownerNodes.get (key));
+            _Matrix       const * current   = node->GetCompExp (-1);
+            
+            if (current && current->GetHDim() == dimension && current->is_dense()) {
+                if (!current_matrices[key]) {
+                    current_matrices[key] = branch_matrix (node, point, false);
+                }
+                _Matrix       * displaced_matrix = branch_matrix (node, point, true);
+                _Matrix const * current_matrix   = current_matrices[key];
+                if (displaced_matrix->GetHDim() == dimension && displaced_matrix->is_dense() && current_matrix->GetHDim() == dimension && current_matrix->is_dense()) {
+                    for (long k = 0L; k < dimension * dimension; k++) {
+                        displaced_matrix->theData[k] -= current_matrix->theData[k];
+                    }
+                    *(_SimpleList*)local_branches.GetItem (partition) << ownerNodes.get (key);
+                    *(_SimpleList*)local_points.GetItem (partition)   << point;
+                    ((_List*)local_differences.GetItem (partition))->AppendNewInstance (displaced_matrix);
+                    continue;
+                }
+                DeleteObject (displaced_matrix);
+            }
+        }
+        pending << point;
+    }
+    
+    if (current_matrices) {
+        for (long key = 0L; key < ownerNodes.countitems(); key++) {
+            DeleteObject (current_matrices[key]);
+        }
+        delete [] current_matrices;
+    }
+    
+    for (unsigned long partition = 0UL; partition < theTrees.lLength; partition++) {
+        _SimpleList const * branches     = (_SimpleList const*)local_branches.GetItem (partition),
+                          * branch_points = (_SimpleList const*)local_points.GetItem (partition);
+        if (branches->empty()) {
+            continue;
+        }
+        hyFloat * values = new hyFloat [branches->lLength];
+        if (GetIthTree (partition)->ComputeBranchGradients (GetIthFilter (partition), conditionalTerminalNodeStateFlag[partition],
+                                                            (_Vector const*)conditionalTerminalNodeLikelihoodCaches(partition),
+                                                            *branches, *(_List const*)local_differences.GetItem (partition), values, -1, GetThreadCount(), true)) {
+            branch_points->Each ([&] (long point, unsigned long k) -> void {
+                relative[point] = values[k];
+            });
+        } else {
+            pending << *branch_points;
+        }
+        delete [] values;
+    }
+    
+    // full evaluations (and gradients at the displaced points)
+    
+    long    const   gradient_tasks = analytic.empty() ? 0L : 2L * n,
+                    tasks          = pending.countitems() + gradient_tasks,
+                    result_size    = MAX (1L, analytic.countitems());
+    hyFloat       * results        = new hyFloat [MAX (1L, tasks * result_size)];
+    
+    // consecutive points share most of their coordinates, so parameters are only moved (and caches
+    // invalidated) when their values differ from those of the previous point evaluated by this process
+    
+    _Matrix         base_values;
+    _SimpleList     displaced;
+    GetAllIndependent (base_values);
+    
+    auto move_to = [&] (long first, hyFloat first_value, long second, hyFloat second_value) -> void {
+        displaced.Each ([&] (long index, unsigned long) -> void {
+            if (index != first && index != second) {
+                SetIthIndependent (index, base_values.theData[index]);
+            }
+        });
+        displaced.Clear();
+        for (long k = 0L; k < 2L; k++) {
+            long    const index = k ? second : first;
+            hyFloat const value = k ? second_value : first_value;
+            if (index >= 0L) {
+                if (GetIthIndependent (index) != value) {
+                    SetIthIndependent (index, value);
+                }
+                if (value != base_values.theData[index]) {
+                    displaced << index;
+                }
+            }
+        }
+    };
+    
+    useAnalyticGradients = true;
+    
+    _hy_run_evaluation_tasks (this, tasks, result_size, processes, results, [&] (long t, hyFloat * result) -> void {
+        if (t < pending.lLength) {
+            long    const point  = pending.get (t),
+                          first  = parameters.get (point_first.get (point)),
+                          second = point_second.get (point) >= 0L ? parameters.get (point_second.get (point)) : -1L;
+            
+            move_to (first, base_values.theData[first] + first_step.theData[point], second, second >= 0L ? base_values.theData[second] + second_step.theData[point] : 0.);
+            result[0] = Compute() - base;
+        } else {
+            long    const column = (t - pending.lLength) / 2L,
+                          index  = parameters.get (column);
+            hyFloat const step   = funcValues (column,4);
+            _Matrix       displaced_gradient (indexInd.lLength, 1, false, true);
+            _SimpleList   computed;
+            
+            move_to (index, (t - pending.lLength) % 2L ? base_values.theData[index] + step : base_values.theData[index] - step, -1L, 0.);
+            Compute ();
+            ComputeBranchGradients (displaced_gradient, nothing_frozen, computed);
+            analytic.Each ([&] (long k, unsigned long a) -> void {
+                result[a] = displaced_gradient.theData[parameters.get (k)];
+            });
+        }
+    }, "covariance matrix evaluation");
+    
+    move_to (-1L, 0., -1L, 0.);
+    useAnalyticGradients = saved_analytic;
+    
+    pending.Each ([&] (long point, unsigned long t) -> void {
+        relative[point] = results[t * result_size];
+    });
+    
+    // diagonal terms and first derivatives
+    
+    for (long k = 0L; k < n; k++) {
+        long const point = diagonal_point.get (k);
+        if (point >= 0L) {
+            hyFloat const step  = funcValues (k,4),
+                          minus = relative[point],
+                          plus  = relative[point+1L];
+            funcValues.Store  (k,0,base + minus);
+            funcValues.Store  (k,1,base + plus);
+            funcValues.Store  (k,2,(plus - minus) / (2.*step));
+            derivatives.Store (k,k,(minus + plus) / (step*step));
+        } else {
+            funcValues.Store  (k,0,base);
+            funcValues.Store  (k,1,base);
+            funcValues.Store  (k,2,gradient.theData[parameters.get (k)]);
+        }
+    }
+    
+    // rows of parameters with analytic gradients, symmetrized
+    
+    for (long j = 0L; j < gradient_tasks / 2L; j++) {
+        hyFloat const * minus = results + (pending.lLength + 2L*j) * result_size,
+                      * plus  = minus + result_size,
+                        scale = 1. / (2.*funcValues (j,4));
+        analytic.Each ([&] (long k, unsigned long a) -> void {
+            if (k == j || four_point || one_point) {
+                derivatives.Store (k,j,(plus[a] - minus[a]) * scale);
+            }
+        });
+    }
+    
+    for (long i = 0L; i < n; i++) {
+        for (long j = i + 1L; j < n; j++) {
+            bool const analytic_i = analytic_row.get (i) >= 0L,
+                       analytic_j = analytic_row.get (j) >= 0L;
+            if (analytic_i && analytic_j) {
+                hyFloat const mean = 0.5 * (derivatives (i,j) + derivatives (j,i));
+                derivatives.Store (i,j,mean);
+                derivatives.Store (j,i,mean);
+            } else if (analytic_i) {
+                derivatives.Store (j,i,derivatives (i,j));
+            } else if (analytic_j) {
+                derivatives.Store (i,j,derivatives (j,i));
+            } else if (four_point || one_point) {
+                long    const point = pair_point.get (i*n+j);
+                hyFloat       value;
+                if (four_point) {
+                    value = (relative[point] - relative[point+1L] - relative[point+3L] + relative[point+2L]) / (4.*pair_steps.theData[i]*pair_steps.theData[j]);
+                } else {
+                    value = (relative[point] - (funcValues (i,2) + funcValues (j,2) + .5*(derivatives (i,i) + derivatives (j,j))*cross_step)*cross_step) / (cross_step*cross_step);
+                }
+                derivatives.Store (i,j,value);
+                derivatives.Store (j,i,value);
+            }
+        }
+    }
+    
+    delete [] relative;
+    delete [] results;
+}
+
+//_______________________________________________________________________________________
+
+void    _LikelihoodFunction::GetGradientStepBound (_Matrix& gradient,hyFloat& left, hyFloat& right, long * freezeCount)
+{
+    left = right = DEFAULTPARAMETERUBOUND;
+
+    if (freezeCount) {
+        *freezeCount = 0;
+    }
+
+    for (unsigned long i = 0; i < indexInd.lLength; i++) {
+        hyFloat directionalStep = gradient.theData[i];
+        if (directionalStep) {
+            hyFloat currentValue = GetIthIndependent (i),
                        ub                       = GetIthIndependentBound (i,false)-currentValue,
                        lb                       = currentValue-GetIthIndependentBound (i,true);
 
@@ -5828,6 +7839,343 @@ void    _LikelihoodFunction::GetGradientStepBound (_Matrix& gradient,hyFloat& le
 
 //_______________________________________________________________________________________
 
+bool    _LikelihoodFunction::MapBranchParameters (_SimpleList& owners, _SimpleList& ownerPartitions, _SimpleList& ownerNodes, bool rateClasses) {
+    /*
+        20261018: SLKP
+     
+        find the independent parameters which enter the transition matrix of exactly one branch
+        (in a partition without category variables, or, with 'rateClasses', one whose rate classes
+        can be deferred, see CanDeferRateClasses); owners [i] is the index of the branch of
+        parameter i in (ownerPartitions, ownerNodes [flat node index]), or a negative number
+        if the parameter is not a branch parameter
+     
+        returns false if the likelihood function can't be handled at all (a computational template,
+        a smoothing penalty, no conditional caches, or a parallel evaluation mode)
+    */
+    
+    if (computingTemplate || smoothingTerm > 0. || !conditionalInternalNodeLikelihoodCaches || processPool) {
+        return false;
+    }
+    
+#ifdef __HYPHYMPI__
+    if (hyphyMPIOptimizerMode != _hyphyLFMPIModeNone) {
+        return false;
+    }
+#endif
+    
+    // map local independent variables to their branches; -1 : not a branch parameter, -2 : shared by several branches
+    
+    _SimpleList     sortedIndependents (indexInd),
+                    independentOrder   (indexInd.lLength, 0, 1),
+                    dependentOwnersL;
+    
+    _AVLListX       dependentOwners (&dependentOwnersL);
+    
+    owners.Populate (indexInd.lLength, -1, 0);
+    ownerPartitions.Clear();
+    ownerNodes.Clear();
+    SortLists (&sortedIndependents, &independentOrder);
+    
+    auto independent_index = [&] (long variable_index) -> long {
+        long f = sortedIndependents.BinaryFind (variable_index);
+        return f >= 0 ? independentOrder.list_data[f] : -1L;
+    };
+    
+    for (unsigned long partition = 0UL; partition < theTrees.lLength; partition++) {
+        bool const eligible = conditionalInternalNodeLikelihoodCaches[partition] && (!blockDependancies.list_data[partition] || (rateClasses && CanDeferRateClasses (partition)));
+        _TheTree * tree = GetIthTree (partition);
+        long const node_count = tree->GetLeafCount() + tree->GetINodeCount();
+        
+        for (long node_code = 0L; node_code + 1L < node_count; node_code++) {
+            _CalcNode * node = (_CalcNode*)tree->GetNodeFromFlatIndex (node_code);
+            if (!eligible || node->GetModelIndex () == HY_NO_MODEL || node->HasExplicitFormModel()) {
+                // parameters of branches which can't be handled are disqualified everywhere
+                for (long k = 0L; k < node->CountIndependents(); k++) {
+                    long idx = independent_index (node->GetIthIndependent(k)->get_index());
+                    if (idx >= 0L) {
+                        owners.list_data[idx] = -2L;
+                    }
+                }
+                continue;
+            }
+            long const key = ownerNodes.countitems();
+            ownerPartitions << partition;
+            ownerNodes      << node_code;
+            
+            for (long k = 0L; k < node->CountIndependents(); k++) {
+                long idx = independent_index (node->GetIthIndependent(k)->get_index());
+                if (idx >= 0L) {
+                    owners.list_data[idx] = owners.list_data[idx] == -1L ? key : -2L;
+                }
+            }
+            for (long k = 0L; k < node->CountDependents(); k++) {
+                dependentOwners.Insert ((BaseRef)node->GetIthDependent(k)->get_index(), key);
+            }
+        }
+    }
+    
+    // a constraint which ties a branch parameter to anything outside its branch disqualifies it
+    
+    indexDep.Each ([&] (long dependent, unsigned long) -> void {
+        long         f   = dependentOwners.Find ((BaseRef)dependent),
+                     key = f >= 0L ? dependentOwners.GetXtra (f) : -1L;
+        _SimpleList  referencedL;
+        _AVLList     referenced (&referencedL);
+        LocateVar (dependent)->ScanForVariables (referenced, true);
+        referencedL.Each ([&] (long variable_index, unsigned long) -> void {
+            long idx = independent_index (variable_index);
+            if (idx >= 0L && owners.list_data[idx] >= 0L && owners.list_data[idx] != key) {
+                owners.list_data[idx] = -2L;
+            }
+        });
+    });
+    
+    
+    return true;
+}
+
+//_______________________________________________________________________________________
+
+void    _LikelihoodFunction::ComputeBranchGradients (_Matrix& gradient, _SimpleList& freeze, _SimpleList& computed, _SimpleList* exact) {
+    /*
+        20261018: SLKP
+     
+        fill in exact partial derivatives for independent parameters that enter
+        the transition matrix of exactly one branch (e.g. branch lengths), using one
+        inside/outside pass per partition (_TheTree::ComputeBranchGradients);
+        the indices of parameters handled here are stored in 'computed'
+     
+        if the rate matrix of the branch is proportional to the parameter x, Q = x*A, then
+        dP/dx = A P exactly; otherwise dP/dx is obtained from a finite difference of P alone
+     
+        derivatives are taken with respect to the original parameter values, and then
+        converted to the mapped parameter space (if there is one) used by the optimizer;
+        if 'exact' is supplied, it receives the indices of parameters handled with dP/dx = A P
+        (in every rate class, for partitions with one)
+     
+        assumes that Compute() has just been called at the current parameter values
+    */
+    
+    computed.Clear();
+    
+    _SimpleList     owners,
+                    ownerPartitions,
+                    ownerNodes;
+    
+    if (!useAnalyticGradients || !MapBranchParameters (owners, ownerPartitions, ownerNodes, true)) {
+        return;
+    }
+    
+    _List           requests;
+    
+    for (unsigned long partition = 0UL; partition < theTrees.lLength; partition++) {
+        requests.AppendNewInstance (new _SimpleList);
+    }
+    
+    for (unsigned long index = 0UL; index < indexInd.lLength; index++) {
+        long key = owners.list_data[index];
+        if (key >= 0L && freeze.Find (index) < 0L) {
+            (*(_SimpleList*)requests.GetItem (ownerPartitions.list_data[key])) << index;
+        }
+    }
+    
+    // probes bypass SetIthIndependent, so that the parameter mapping is left untouched
+    
+    auto rate_matrix = [&] (_CalcNode * node, _Variable * parameter, hyFloat value, _Matrix& store) -> hyFloat {
+        parameter->SetValue (value);
+        node->RecomputeMatrix (0, 1, &store);
+        store.CheckIfSparseEnough (true);
+        return parameter->Value();
+    };
+    
+    auto branch_derivative = [&] (_CalcNode * node, _Variable * parameter, _Matrix const * transitions, long dimension, bool& proportional) -> _Matrix* {
+        // dP/dx for the branch of 'node' (with transition matrix 'transitions'), or nil if it can't be computed
+        long          const cells         = dimension * dimension;
+        hyFloat       const current_value = parameter->Value(),
+                            lb            = parameter->GetLowerBound(),
+                            ub            = parameter->GetUpperBound();
+        
+        // probe Q (x) at two more points to see if Q (x) = x * A
+        
+        hyFloat       step = MAX (fabs (current_value) * 0.5, 0.01);
+        if (current_value + 2. * step > ub) {
+            step = ub - current_value >= current_value - lb ? 0.5 * (ub - current_value) : -0.5 * (current_value - lb);
+        }
+        
+        _Matrix       q0, q1, q2;
+        hyFloat       x0 = rate_matrix (node, parameter, current_value, q0),
+                      x1 = x0,
+                      x2 = x0;
+        
+        proportional = fabs (step) > 1.e-8;
+        
+        if (proportional) {
+            x1 = rate_matrix (node, parameter, current_value + step, q1);
+            x2 = rate_matrix (node, parameter, current_value + 2. * step, q2);
+            proportional = x1 != 0. && x2 != 0. && x1 != x2 && q0.GetHDim() == dimension && q1.GetHDim() == dimension && q2.GetHDim() == dimension;
+        }
+        
+        if (proportional) {
+            hyFloat scale = 0.;
+            for (long k = 0L; k < cells; k++) {
+                StoreIfGreater (scale, fabs (q2.theData[k] * x1));
+            }
+            hyFloat const tolerance = 1.e-8 * scale + 1.e-300;
+            for (long k = 0L; k < cells && proportional; k++) {
+                proportional = fabs (q1.theData[k] * x2 - q2.theData[k] * x1) <= tolerance && fabs (q0.theData[k] * x1 - q1.theData[k] * x0) <= tolerance;
+            }
+        }
+        
+        _Matrix * derivative = new _Matrix (dimension, dimension, false, true);
+        
+        if (proportional) {
+            // dP/dx = A P, with A = Q (x1) / x1
+            hyFloat const inv_x1 = 1. / x1;
+            for (long i = 0L; i < dimension; i++) {
+                hyFloat       * row    = derivative->theData + i * dimension;
+                hyFloat const * a_row  = q1.theData + i * dimension;
+                for (long k = 0L; k < dimension; k++) {
+                    hyFloat const a_ik = a_row[k] * inv_x1;
+                    if (a_ik != 0.) {
+                        hyFloat const * p_row = transitions->theData + k * dimension;
+                        for (long j = 0L; j < dimension; j++) {
+                            row[j] += a_ik * p_row[j];
+                        }
+                    }
+                }
+            }
+        } else {
+            // a difference quotient of the branch matrix alone (same step rules as in ComputeGradient)
+            hyFloat test_step = MAX (current_value * STD_GRAD_STEP, STD_GRAD_STEP);
+            if (test_step >= ub - current_value) {
+                test_step = current_value - lb > test_step ? -test_step : 0.;
+            }
+            if (test_step == 0.) {
+                DeleteObject (derivative);
+                parameter->SetValue (current_value);
+                return nil;
+            }
+            hyFloat   actual_step = rate_matrix (node, parameter, current_value + test_step, q1) - current_value;
+            _Matrix * perturbed   = q1.Exponentiate (1., true);
+            perturbed->CheckIfSparseEnough (true);
+            for (long k = 0L; k < cells; k++) {
+                derivative->theData[k] = (perturbed->theData[k] - transitions->theData[k]) / actual_step;
+            }
+            DeleteObject (perturbed);
+        }
+        
+        parameter->SetValue (current_value);
+        return derivative;
+    };
+    
+    for (unsigned long partition = 0UL; partition < theTrees.lLength; partition++) {
+        _SimpleList * parameters = (_SimpleList*)requests.GetItem (partition);
+        if (parameters->empty()) {
+            continue;
+        }
+        
+        _TheTree              * tree        = GetIthTree (partition);
+        _DataSetFilter const  * filter      = GetIthFilter (partition);
+        long            const   dimension   = filter->GetDimension(),
+                                count       = parameters->lLength;
+        long                    class_count = 1L;
+        hyFloat               * posteriors  = nil;
+        _CategoryVariable     * category_variable = nil;
+        
+        /*
+            with rate classes (a single category variable, see MapBranchParameters), the gradient of each
+            class is weighted, site by site, by the posterior probability of the class, because
+         
+                d log L_s / d x = sum_c w_c dL_s,c / dx / sum_c w_c L_s,c = sum_c Pr (c | s) d log L_s,c / dx
+        */
+        
+        if (blockDependancies.list_data[partition]) {
+            posteriors        = ComputeRateClassPosteriors (partition, class_count);
+            category_variable = (_CategoryVariable*)((_List*)((_List*)categoryTraversalTemplate(partition))->GetItem(0))->GetItem(0);
+            category_variable->Refresh();
+            category_variable->SetIntervalValue(0,true);
+        }
+        
+        _SimpleList             usable       (count, 1L, 0L),
+                                proportional (count, 1L, 0L);
+        hyFloat               * totals       = new hyFloat [count],
+                              * values       = new hyFloat [count];
+        bool                    all_positive = true;
+        
+        InitializeArray (totals, count, 0.);
+        
+        for (long rate_class = 0L; rate_class < class_count && all_positive; rate_class++) {
+            if (rate_class) {
+                category_variable->SetIntervalValue(rate_class);
+            }
+            
+            _SimpleList         branches,
+                                which;
+            _List               derivatives;
+            
+            for (long p = 0L; p < count; p++) {
+                if (!usable.list_data[p]) {
+                    continue;
+                }
+                long          const index       = parameters->list_data[p],
+                                    node_code   = ownerNodes.list_data[owners.list_data[index]];
+                _CalcNode         * node        = (_CalcNode*)tree->GetNodeFromFlatIndex (node_code);
+                _Matrix     const * transitions = node->GetCompExp (category_variable ? rate_class : -1L);
+                _Matrix           * derivative  = nil;
+                bool                exact_class = false;
+                
+                if (transitions && transitions->GetHDim() == dimension && transitions->is_dense()) {
+                    derivative = branch_derivative (node, GetIthIndependentVar (index), transitions, dimension, exact_class);
+                }
+                
+                if (!derivative) {
+                    usable.list_data[p] = 0L;
+                    continue;
+                }
+                
+                proportional.list_data[p] = proportional.list_data[p] && exact_class;
+                branches << node_code;
+                which    << p;
+                derivatives.AppendNewInstance (derivative);
+            }
+            
+            if (branches.countitems()) {
+                all_positive = tree->ComputeBranchGradients (filter, conditionalTerminalNodeStateFlag[partition],
+                                                             (_Vector const*)conditionalTerminalNodeLikelihoodCaches(partition),
+                                                             branches, derivatives, values, category_variable ? rate_class : -1L, GetThreadCount(),
+                                                             false, posteriors ? posteriors + rate_class : nil, class_count);
+                for (unsigned long k = 0UL; k < which.lLength; k++) {
+                    totals[which.list_data[k]] += values[k];
+                }
+            }
+        }
+        
+        if (all_positive) {
+            for (long p = 0L; p < count; p++) {
+                if (usable.list_data[p]) {
+                    long const index = parameters->list_data[p];
+                    gradient[index] = totals[p];
+                    if (parameterValuesAndRanges) {
+                        gradient[index] *= mapParameterToIntervalDerivative (GetIthIndependentVar (index)->Value(), parameterTransformationFunction.Element(index));
+                    }
+                    computed << index;
+                    if (proportional.list_data[p] && exact) {
+                        *exact << index;
+                    }
+                }
+            }
+        }
+        
+        delete [] totals;
+        delete [] values;
+        if (posteriors) {
+            delete [] posteriors;
+        }
+    }
+}
+
+//_______________________________________________________________________________________
+
 void    _LikelihoodFunction::ComputeGradient (_Matrix& gradient,  hyFloat& gradientStep, _Matrix& values,_SimpleList& freeze, long order, bool normalize)
 {
     hyFloat funcValue;
@@ -5844,9 +8192,14 @@ void    _LikelihoodFunction::ComputeGradient (_Matrix& gradient,  hyFloat& gradi
 
     if (order==1) {
         funcValue = Compute();
+        _SimpleList analytic;
+        ComputeBranchGradients (gradient, freeze, analytic);
+        analytic.Sort();
         for (long index=0; index<indexInd.lLength; index++) {
             if (freeze.Find(index)!=-1) {
                 gradient[index]=0.;
+            } else if (analytic.BinaryFind(index) >= 0) {
+                continue;
             } else {
                 //_Variable  *cv            = GetIthIndependentVar (index);
                 hyFloat currentValue = GetIthIndependent(index),
@@ -5919,6 +8272,62 @@ void    _LikelihoodFunction::ComputeGradient (_Matrix& gradient,  hyFloat& gradi
 }
 //_______________________________________________________________________________________
 
+_AssociativeList*    _LikelihoodFunction::GradientReport (void) {
+    /*
+        20261018: SLKP
+        the partial derivatives of the log-likelihood with respect to the independent parameters at their
+        current values, both from ComputeBranchGradients ("Analytic"; only for parameters with "Has analytic"
+        = 1, and "Exact" = 1 for those where dP/dx = A P) and from the finite differences (with the step
+        the optimizer uses) of ComputeGradient with analytic gradients switched off ("Numeric");
+        "Parameters" has the names of the parameters, in the same order
+    */
+    
+    long const      N                 = indexInd.lLength;
+    bool const      saved_analytic    = useAnalyticGradients;
+    hyFloat         gradient_step     = STD_GRAD_STEP;
+    
+    _Matrix         analytic          (N, 1, false, true),
+                    numeric           (N, 1, false, true),
+                    has_analytic      (N, 1, false, true),
+                    exact_flags       (N, 1, false, true),
+                    current_point;
+    
+    _SimpleList     freeze,
+                    computed,
+                    exact;
+    
+    _List           names;
+    
+    GetAllIndependent (current_point);
+    
+    Compute ();
+    useAnalyticGradients = true;
+    ComputeBranchGradients (analytic, freeze, computed, &exact);
+    useAnalyticGradients = false;
+    ComputeGradient (numeric, gradient_step, current_point, freeze, 1, false);
+    useAnalyticGradients = saved_analytic;
+    
+    computed.Each ([&has_analytic] (long index, unsigned long) -> void {
+        has_analytic.theData[index] = 1.;
+    });
+    exact.Each ([&exact_flags] (long index, unsigned long) -> void {
+        exact_flags.theData[index] = 1.;
+    });
+    for (long index = 0L; index < N; index++) {
+        names < new _String (*GetIthIndependentName (index));
+    }
+    
+    _AssociativeList * report = new _AssociativeList;
+    (*report) < _associative_list_key_value {"Parameters", new _Matrix (names)}
+              < _associative_list_key_value {"Analytic", new _Matrix (analytic)}
+              < _associative_list_key_value {"Has analytic", new _Matrix (has_analytic)}
+              < _associative_list_key_value {"Exact", new _Matrix (exact_flags)}
+              < _associative_list_key_value {"Numeric", new _Matrix (numeric)};
+    return report;
+}
+
+//_______________________________________________________________________________________
+
 bool    _LikelihoodFunction::SniffAround (_Matrix& values, hyFloat& bestSoFar, hyFloat& step)
 {
     for (long index = 0; index<indexInd.lLength; index++) {
@@ -7296,6 +9705,284 @@ hyFloat      _LikelihoodFunction::SimplexMethod (hyFloat& gPrecision, unsigned l
 }
 
 
+//_______________________________________________________________________________________
+hyFloat      _LikelihoodFunction::QuasiNewtonMethod (hyFloat precision, unsigned long iterations, unsigned long max_evaluations, _FString * convergence_callback) {
+    
+    /**
+        20261018 : SLKP
+     
+        Limited-memory BFGS with simple bounds; cf.
+     
+        "A limited memory algorithm for bound constrained optimization"
+         SIAM J. Sci. Comput. Vol. 16, No. 5, pp. 1190–1208
+     
+        The search runs in the space of (mapped) independent variables, so the feasible box is
+        given by GetIthIndependentBound. On each iteration, variables sitting on a bound with
+        the gradient pointing out of the box are held fixed; the direction comes from the
+        two-loop recursion over the remaining variables and the step from a projected
+        backtracking (Armijo) line search. Curvature pairs with s'y <= 0 are discarded.
+     
+        The log-likelihood is maximized; the recursion itself is written for -logL.
+    **/
+    
+    static const long    kMemory     = 7L,      // curvature pairs kept
+                         kBacktracks = 30L,     // step halvings per line search
+                         kConverged  = 2L;      // consecutive iterations within precision
+    static const hyFloat kArmijo     = 1.e-4;   // sufficient increase constant
+    
+    long     N                  = indexInd.countitems(),
+             stored_pairs       = 0L,
+             newest_pair        = -1L,
+             in_count           = 0L,
+             logged_phase       = -1L;          // the kind of step last written to the optimization log
+    
+    unsigned long evaluations_in = likeFuncEvalCallCount;
+    
+    hyFloat  gradient_step      = STD_GRAD_STEP,
+             current_value      = Compute(),
+             hessian_scale      = 1.;
+    
+    _OptimiztionProgress progress_tracker;
+    
+    _Matrix  current_point,
+             trial_point,
+             gradient       (N, 1, false, true),
+             trial_gradient (N, 1, false, true),
+             direction      (N, 1, false, true),
+             lower          (N, 1, false, true),
+             upper          (N, 1, false, true),
+             s_history      (kMemory, N, false, true),
+             y_history      (kMemory, N, false, true),
+             rho            (kMemory, 1, false, true),
+             alpha          (kMemory, 1, false, true);
+    
+    _SimpleList freeze,
+                fixed;
+    
+    GetAllIndependent (current_point);
+    
+    for (long i = 0L; i < N; i++) {
+        lower.theData[i] = GetIthIndependentBound (i, true);
+        upper.theData[i] = GetIthIndependentBound (i, false);
+    }
+    
+    ComputeGradient (gradient, gradient_step, current_point, freeze, 1, false);
+    
+    auto pair_slot = [&] (long k) -> long { // k = 0 is the newest pair
+        return (newest_pair - k + kMemory) % kMemory;
+    };
+    
+    for (unsigned long it_count = 0UL; it_count < iterations && likeFuncEvalCallCount - evaluations_in < max_evaluations; it_count ++) {
+        
+        /** variables pinned to a bound by the gradient are held fixed for this iteration **/
+        
+        fixed.Clear();
+        hyFloat projected_norm = 0.;
+        
+        for (long i = 0L; i < N; i++) {
+            hyFloat xi = current_point.theData[i],
+                    gi = gradient.theData[i];
+            
+            if ((xi - lower.theData[i] <= STD_GRAD_STEP && gi < 0.) || (upper.theData[i] - xi <= STD_GRAD_STEP && gi > 0.)) {
+                fixed << i;
+            } else {
+                projected_norm = MAX (projected_norm, fabs (gi));
+            }
+        }
+        
+        if (projected_norm == 0.) {
+            break;
+        }
+        
+        /** two-loop recursion on G = -gradient; direction = -H G **/
+        
+        for (long i = 0L; i < N; i++) {
+            direction.theData[i] = -gradient.theData[i];
+        }
+        fixed.Each ([&] (long v, unsigned long) -> void {direction.theData[v] = 0.;});
+        
+        for (long k = 0L; k < stored_pairs; k++) {
+            long slot = pair_slot (k);
+            hyFloat a = 0.;
+            for (long i = 0L; i < N; i++) {
+                a += s_history (slot, i) * direction.theData[i];
+            }
+            a *= rho.theData[slot];
+            alpha.theData[slot] = a;
+            for (long i = 0L; i < N; i++) {
+                direction.theData[i] -= a * y_history (slot, i);
+            }
+        }
+        
+        direction *= hessian_scale;
+        
+        for (long k = stored_pairs - 1L; k >= 0L; k--) {
+            long slot = pair_slot (k);
+            hyFloat b = 0.;
+            for (long i = 0L; i < N; i++) {
+                b += y_history (slot, i) * direction.theData[i];
+            }
+            b = alpha.theData[slot] - b * rho.theData[slot];
+            for (long i = 0L; i < N; i++) {
+                direction.theData[i] += b * s_history (slot, i);
+            }
+        }
+        
+        // flip to an ascent direction for logL
+        
+        direction *= -1.;
+        fixed.Each ([&] (long v, unsigned long) -> void {direction.theData[v] = 0.;});
+        
+        hyFloat slope = 0.;
+        for (long i = 0L; i < N; i++) {
+            slope += direction.theData[i] * gradient.theData[i];
+        }
+        
+        long phase = 1L; // 1 : quasi-Newton step, 0 : projected gradient step
+        
+        if (slope <= 0. || stored_pairs == 0L) {
+            /** not an ascent direction (or no curvature information yet): restart from the projected gradient **/
+            phase = 0L;
+            stored_pairs = 0L;
+            hessian_scale = 1.;
+            slope = 0.;
+            for (long i = 0L; i < N; i++) {
+                direction.theData[i] = gradient.theData[i];
+            }
+            fixed.Each ([&] (long v, unsigned long) -> void {direction.theData[v] = 0.;});
+            direction *= MIN (1., 0.1 / projected_norm);
+        }
+        
+        long const pairs_used = stored_pairs; // curvature pairs that went into the direction
+        
+        /** projected backtracking line search **/
+        
+        hyFloat step        = 1.,
+                trial_value = -INFINITY;
+        
+        bool    accepted    = false;
+        
+        for (long backtrack = 0L; backtrack < kBacktracks; backtrack++, step *= 0.5) {
+            trial_point = current_point;
+            hyFloat predicted = 0.,
+                    moved     = 0.;
+            
+            for (long i = 0L; i < N; i++) {
+                hyFloat xi = current_point.theData[i] + step * direction.theData[i];
+                if (xi < lower.theData[i]) {
+                    xi = lower.theData[i];
+                } else if (xi > upper.theData[i]) {
+                    xi = upper.theData[i];
+                }
+                trial_point.theData[i] = xi;
+                xi -= current_point.theData[i];
+                predicted += gradient.theData[i] * xi;
+                moved      = MAX (moved, fabs (xi));
+            }
+            
+            if (moved == 0.) {
+                break;
+            }
+            
+            SetAllIndependent (&trial_point);
+            trial_value = Compute ();
+            
+            if (trial_value >= current_value + kArmijo * predicted) {
+                accepted = true;
+                break;
+            }
+        }
+        
+        if (!accepted) {
+            SetAllIndependent (&current_point);
+            if (stored_pairs == 0L) {
+                // steepest ascent failed as well; nothing left to do
+                break;
+            }
+            stored_pairs = 0L;
+            hessian_scale = 1.;
+            continue;
+        }
+        
+        ComputeGradient (trial_gradient, gradient_step, trial_point, freeze, 1, false);
+        
+        /** curvature pair, s = x[k+1]-x[k], y = G[k+1]-G[k] **/
+        
+        hyFloat sy = 0.,
+                yy = 0.;
+        
+        long slot = (newest_pair + 1L) % kMemory;
+        
+        for (long i = 0L; i < N; i++) {
+            hyFloat si = trial_point.theData[i] - current_point.theData[i],
+                    yi = gradient.theData[i] - trial_gradient.theData[i];
+            s_history.Store (slot, i, si);
+            y_history.Store (slot, i, yi);
+            sy += si * yi;
+            yy += yi * yi;
+        }
+        
+        if (sy > 1.e-10 * yy && yy > 0.) {
+            newest_pair          = slot;
+            rho.theData[slot]    = 1. / sy;
+            hessian_scale        = sy / yy;
+            stored_pairs         = MIN (stored_pairs + 1L, kMemory);
+        }
+        
+        hyFloat previous_value = current_value;
+        
+        current_point = trial_point;
+        gradient      = trial_gradient;
+        current_value = trial_value;
+        
+        if (phase != logged_phase) {
+            // a new phase starts when the search switches between gradient and quasi-Newton steps
+            LoggerAddQuasiNewtonPhase (step, pairs_used);
+            logged_phase = phase;
+        }
+        LoggerAllVariables ();
+        LoggerLogL (current_value);
+        
+        if (verbosity_level==1) {
+            UpdateOptimizationStatus (current_value,progress_tracker.PushValue (current_value),1,true,progressFileString);
+        } else {
+            if (verbosity_level>5) {
+                char buffer [2048];
+                snprintf (buffer, sizeof(buffer),"L-BFGS iteration %10ld; current max %15.12g, step %12.6g, %ld parameters at bounds, %ld curvature pairs [precision %g]\n", it_count, current_value, step, fixed.countitems(), stored_pairs, precision);
+                BufferToConsole (buffer);
+            }
+        }
+        
+        hyFloat change = current_value - previous_value;
+        
+        if (convergence_callback) {
+            _List arguments;
+            _AssociativeList * parameters = new _AssociativeList;
+            
+            GetIndependentVars().Each ([&] (long value, unsigned long i) -> void {
+                parameters-> MStore (*GetIthIndependentName(i), new _Constant (GetIthIndependent(i, false)));
+            });
+            arguments < new _Constant (current_value) < parameters;
+            
+            HBLObjectRef convegence_check = convergence_callback->Call (&arguments, nil);
+            change = convegence_check->Value ();
+            DeleteObject (convegence_check);
+        }
+        
+        if (change <= precision) {
+            if (++in_count >= kConverged) {
+                break;
+            }
+        } else {
+            in_count = 0L;
+        }
+    }
+    
+    SetAllIndependent (&current_point);
+    return Compute();
+}
+
+
 //_______________________________________________________________________________________
 
 void    _LikelihoodFunction::Anneal (hyFloat&)
@@ -7964,6 +10651,11 @@ void    _LikelihoodFunction::Setup (bool check_reversibility)
         mstCache = new MSTCache;
     }
 
+    if (topologyMove) {
+        // summation orders and traversal masks may change, so the caches saved by the last topology move are stale
+        topologyMove->restorable = false;
+    }
+
     if (theTrees.lLength==optimalOrders.lLength) {
         //check to see if we need to recompute the
         // optimal summation order
@@ -8047,6 +10739,14 @@ void    _LikelihoodFunction::Setup (bool check_reversibility)
           }
           canUseReversibleSpeedups << isReversiblePartition;
         }
+        
+        // 20261018: SLKP
+        // the decompositions verify detailed balance on their own, so this flag is only a hint
+        t->SetEigenExponentials (canUseReversibleSpeedups.get (i) && hy_env::EnvVariableTrue(hy_env::use_eigen_exponentials));
+        t->SetBatchExponentials (hy_env::EnvVariableTrue(hy_env::batch_exponentials));
+        _FString * simd_kernels = (_FString*)hy_env::EnvVariableGet(hy_env::simd_kernels, STRING);
+        t->SetSIMDLevel (simd_kernels ? _hy_simd_level_from_name (simd_kernels->get_str().get_str(), kSIMDAVX512) : kSIMDAVX512);
+        t->SetTransitionMatrixCache (MAX (0L, (long)hy_env::EnvVariableGetNumber(hy_env::transition_matrix_cache, 0.)));
     }
 
 }
@@ -8054,8 +10754,9 @@ void    _LikelihoodFunction::Setup (bool check_reversibility)
 //_______________________________________________________________________________________
 
 bool    _LikelihoodFunction::HasPartitionChanged (long index) {
+    // branches marked for recomputation (e.g. by ApplyTopologyMove) invalidate the cached partition result
 
-    return ListAny (*(_SimpleList*)indVarsByPartition(index),
+    return GetIthTree (index)->HasForcedRecomputeList() || ListAny (*(_SimpleList*)indVarsByPartition(index),
                     [] (const long value, const unsigned long index) -> bool {
                         return LocateVar(value)->HasChanged();
                        }
@@ -8067,7 +10768,7 @@ bool    _LikelihoodFunction::HasPartitionChanged (long index) {
 
 //_______________________________________________________________________________________
 
-hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long currentRateClass, long branchIndex, _SimpleList * branchValues)
+hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long currentRateClass, long branchIndex, _SimpleList * branchValues, _BlockEvaluation* deferTo)
 // compute likelihood over block index i
 /*
     to optimize
@@ -8114,15 +10815,31 @@ hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long c
 
         if (conditionalInternalNodeLikelihoodCaches[index]) {
             // not a 2 sequence analysis
-            long blockID    = df->GetPatternCount()*t->GetINodeCount(),
-                 patternCnt = df->GetPatternCount();
+            t->SetPaddedConditionals (paddedConditionalCaches);
 
-            _SimpleList         *tcc  = (_SimpleList*)treeTraversalMasks(index);
-
-            hyFloat          *inc  = (currentRateClass<1)?conditionalInternalNodeLikelihoodCaches[index]:
-                                        conditionalInternalNodeLikelihoodCaches[index] + currentRateClass*df->GetDimension()*blockID,
-                                *ssf  = (currentRateClass<1)?siteScalingFactors[index]: siteScalingFactors[index] + currentRateClass*blockID,
-                                *bc   = (currentRateClass<1)?branchCaches[index]: (branchCaches[index] + currentRateClass*patternCnt*df->GetDimension()*2);
+            long blockID    = df->GetPatternCount()*t->GetINodeCount(),
+                 patternCnt = df->GetPatternCount(),
+                 stride     = t->GetConditionalStride (df->GetDimension());
+
+            _BlockEvaluation    local_evaluation,
+                                &evaluation = deferTo ? *deferTo : local_evaluation;
+
+            evaluation.index        = index;
+            evaluation.catID        = catID;
+            evaluation.branchIndex  = branchIndex;
+            evaluation.tree         = t;
+            evaluation.filter       = df;
+            evaluation.order        = sl;
+            evaluation.siteRes      = siteRes;
+            evaluation.branchValues = branchIndex >= 0 ? branchValues->list_data: nil;
+            evaluation.tcc          = (_SimpleList*)treeTraversalMasks(index);
+
+            long    const    cache_offset = (currentRateClass<1) ? 0L : currentRateClass*stride*blockID;
+            // with single precision conditionals, the offset is in floats (and EvaluateBlocks casts inc back)
+            evaluation.inc = singlePrecisionConditionals ? (hyFloat*)((float*)conditionalInternalNodeLikelihoodCaches[index] + cache_offset) :
+                                        conditionalInternalNodeLikelihoodCaches[index] + cache_offset;
+            evaluation.ssf = (currentRateClass<1)?siteScalingFactors[index]: siteScalingFactors[index] + currentRateClass*blockID;
+            hyFloat          *bc   = evaluation.bc = (currentRateClass<1)?branchCaches[index]: (branchCaches[index] + currentRateClass*patternCnt*stride*2);
 
             long  *scc = nil,
                   *sccb = nil;
@@ -8132,13 +10849,16 @@ hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long c
                 scc =  ((_SimpleList*)siteCorrections(index))->list_data       + ((currentRateClass<1)?0:patternCnt*currentRateClass);
             }
 
-            _SimpleList changedBranches, *branches;
-            _List       changedModels,   *matrices;
+            evaluation.scc  = scc;
+            evaluation.sccb = sccb;
+
+            _SimpleList *branches;
+            _List       *matrices;
             long        doCachedComp     = 0,     // whether or not to use a cached branch calculation when only one
                         // local tree parameter is being adjusted at a time
 
                         ciid          = MAX(0,currentRateClass),
-                        *cbid            = &(((_SimpleList*)cachedBranches(index))->list_data[ciid]);
+                        *cbid            = evaluation.cbid = &(((_SimpleList*)cachedBranches(index))->list_data[ciid]);
 
             if (computedLocalUpdatePolicy.lLength && branchIndex < 0) {
                 branches = (_SimpleList*)(*((_List*)localUpdatePolicy(index)))(ciid);
@@ -8165,7 +10885,9 @@ hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long c
                     if (snID != *cbid) {
                         RestoreScalingFactors (index, *cbid, patternCnt, scc, sccb);
                         *cbid = -1;
-                        if (snID >= 0 && canUseReversibleSpeedups.list_data[index]) {
+                        // branch caches are kept in double precision and are filled from the conditional caches,
+                        // so they are not used with single precision conditionals
+                        if (snID >= 0 && canUseReversibleSpeedups.list_data[index] && !singlePrecisionConditionals) {
                             ((_SimpleList*)computedLocalUpdatePolicy(index))->list_data[ciid] = snID+3;
                             doCachedComp = -snID-1;
                         } else {
@@ -8175,7 +10897,7 @@ hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long c
                     // 20120718: SLKP added this branch to reuse the old cache if the branch that is being computed
                     // is the same as the one cached last time, e.g. sequentially iterating through all local parameters
                     // of a given branch.
-                        if (snID >= 0 && canUseReversibleSpeedups.list_data[index]) {
+                        if (snID >= 0 && canUseReversibleSpeedups.list_data[index] && !singlePrecisionConditionals) {
                             doCachedComp = ((_SimpleList*)computedLocalUpdatePolicy(index))->list_data[ciid] = snID+3;
                           } else {
                             ((_SimpleList*)computedLocalUpdatePolicy(index))->list_data[ciid] = nodeID + 1;
@@ -8189,36 +10911,74 @@ hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long c
                 RestoreScalingFactors       (index, *cbid, patternCnt, scc, sccb);
 
 
-                t->DetermineNodesForUpdate  (changedBranches,&changedModels,catID,(branchIndex >=0 )?
+                t->DetermineNodesForUpdate  (evaluation.changedBranches,&evaluation.changedModels,catID,(branchIndex >=0 )?
                                              (branchIndex<t->GetINodeCount()?branchIndex+t->GetLeafCount():branchIndex):*cbid,canClear);
                 *cbid                       = -1;
-                branches                    = &changedBranches;
-                matrices                    = &changedModels;
+                branches                    = &evaluation.changedBranches;
+                matrices                    = &evaluation.changedModels;
             }
 
             if (evalsSinceLastSetup == 0) {
                 branches->Populate (t->GetINodeCount()+t->GetLeafCount()-1,0,1);
             }
 
+            evaluation.branches     = branches;
+            evaluation.doCachedComp = doCachedComp;
+
 #ifdef _UBER_VERBOSE_LF_DEBUG
             fprintf (stderr, "%d matrices, %d branches marked for rate class %d\n", matrices->lLength, branches->lLength, catID);
             if (matrices->lLength == 0) {
                 fprintf (stderr, "Hmm\n");
             }
 #endif
+            long np = 1;
+#ifdef _OPENMP
+            np           = MIN(GetThreadCount(),omp_get_max_threads());
+#endif
+            
+            /* 20261018: SLKP
+               the pruning pass is split into site blocks, several per thread, which are claimed
+               dynamically, so that threads that get cheap blocks (e.g. most sites skipped via traversal
+               masks) take on more of them; the blocks are never smaller than ~4096 transition matrix
+               entries worth of sites, so that small partitions do not pay for a parallel region they can't use
+             
+               transition matrices are exponentiated inside the same parallel region: a thread first claims
+               matrices and then site blocks, and each site block waits only for the matrices of the branches
+               it is about to process; independent subtrees (sibling clades) are not scheduled as separate tasks
+               (every site block walks the whole post-order traversal), and the threads are those of the OpenMP
+               team, not a dedicated pool that persists across Compute calls
+             
+               the block layout depends only on the thread count, so a deferred evaluation (see
+               ComputePartitionsConcurrently) is pruned in exactly the same way as a direct one; the matrices
+               of deferred rate classes are exponentiated here, because the nodes of a tree
+               are shared by all of its rate classes
+            */
+            
+            long    block_count,
+                    sites_per_block;
+            
+            GetSiteBlockLayout (index, np, block_count, sites_per_block);
+            
+            evaluation.np              = np;
+            evaluation.block_count     = block_count;
+            evaluation.sites_per_block = sites_per_block;
+
+            _ExponentialQueue   &exponentials = evaluation.exponentials;
+            
             if (matrices->lLength) {
-                t->ExponentiateMatrices(*matrices, GetThreadCount(),catID);
+                t->QueueExponentials (*matrices, catID, exponentials, doCachedComp < 3 && (deferTo ? catID < 0 : np > 1));
+                if (!exponentials.IsTracking()) {
+                    t->ExponentiateQueue (exponentials, GetThreadCount());
+                }
             }
-
-
-
-            hyFloat sum  = 0.;
+            
+            evaluation.matrix_count = exponentials.IsTracking() ? exponentials.countitems() : 0L;
 
             if (doCachedComp >= 3) {
 #ifdef _UBER_VERBOSE_LF_DEBUG
                 fprintf (stderr, "CACHE compute branch %d\n",doCachedComp-3);
 #endif
-                sum = t->ComputeLLWithBranchCache (*sl,
+                return t->ComputeLLWithBranchCache (*sl,
                                                    doCachedComp-3,
                                                    bc,
                                                    df,
@@ -8227,204 +10987,605 @@ hyFloat  _LikelihoodFunction::ComputeBlock (long index, hyFloat* siteRes, long c
                                                    catID,
                                                    siteRes)
                       - _logLFScaler * overallScalingFactors.list_data[index];
-                return sum;
             }
 
-            long np = 1;
-#ifdef _OPENMP
-            np           = MIN(GetThreadCount(),omp_get_max_threads());
-#endif
-            long sitesPerP    = df->GetPatternCount() / np + 1L;
-
 #ifdef _UBER_VERBOSE_LF_DEBUG
                 fprintf (stderr, "NORMAL compute lf \n");
 #endif
+            
+            evaluation.block_results = new hyFloat [block_count];
+            evaluation.pending       = true;
+            
+            if (deferTo) {
+                return 0.;
+            }
+            
+            EvaluateBlocks (&evaluation, 1L);
+            return FinishBlockEvaluation (evaluation);
+        } else if (conditionalTerminalNodeStateFlag[index] || !df->IsNormalFilter()) {
+            // two sequence analysis
 
-            hyFloat* thread_results = (hyFloat*) alloca (sizeof(hyFloat)*np);
+            _SimpleList bc;
+            _List       mc;
+            t->DetermineNodesForUpdate         (bc, &mc);
+            if (mc.lLength) {
+                t->ExponentiateMatrices(mc, GetThreadCount(),catID);
+            }
 
-#ifdef _OPENMP
+            //branchedGlobalCache.Clear(false);
+            //matricesGlobalCache.Clear(false);
+            if (df->IsNormalFilter())
+                return t->ComputeTwoSequenceLikelihood (*sl,
+                                                        df,
+                                                        conditionalTerminalNodeStateFlag[index],
+                                                        (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
+                                                        0,
+                                                        df->GetPatternCount (),
+                                                        catID,
+                                                        siteRes);
+            else {
+                return t->Process3TaxonNumericFilter ((_DataSetFilterNumeric*)df);
+            }
+
+        }
+
+    } else {
+        HandleApplicationError ("Dude -- lame! No cache. I can't compute like that with the new LF engine.");
+    }
+
+    return 0.0;
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::GetSiteBlockLayout (long index, long& np, long& block_count, long& sites_per_block) const {
+    // the site block layout of ComputeBlock for 'np' threads; np is reduced to the number of blocks if needed
+    _DataSetFilter const * df         = GetIthFilter (index);
+    long                   patternCnt = df->GetPatternCount(),
+                           minimum_block = MAX (4L, 4096L / (df->GetDimension() * df->GetDimension()));
+    
+    block_count   = np > 1L ? MIN (np * 4L, (patternCnt + minimum_block - 1L) / minimum_block) : 1L;
+    
+    if (block_count < 1L) {
+        block_count = 1L;
+    }
+    sites_per_block = (patternCnt + block_count - 1L) / block_count;
+    block_count     = MAX (1L, (patternCnt + sites_per_block - 1L) / sites_per_block);
+    np              = MIN (np, block_count);
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::PlaceConditionalCaches (long np) {
+    /*
+        20261018: SLKP
+        NUMA_AWARE_CACHES: (re)allocate conditional caches, scaling factors and branch caches so that
+        the site slice of every thread is first touched (and hence placed on the memory node of) the
+        thread that computes it
+     
+        the affinity map is static: with np threads, thread t owns a contiguous run of site blocks
+        (see OwnedSiteBlocks) in every partition and rate class, and on Linux (unless OMP_PLACES is in effect)
+        thread t is pinned to the (t*C/np)-th of the C CPUs that the process is allowed to run on when it
+        touches its slices, and stays there (so that it keeps computing on the node its slices are on) for as
+        long as the likelihood function is being computed; DoneComputing (via RestoreThreadAffinity) gives every
+        thread its own CPU mask back, so that the rest of the program, and other code sharing the OpenMP thread
+        pool, is not left pinned; the map only changes when the number of threads does, which triggers another
+        placement (and unpins the threads before pinning them again)
+    */
+    numaPlacementThreads = np;
+    SetConditionalPrecision (singlePrecisionConditionals);
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::OwnedSiteBlocks (long thread_id, long np, long block_count, long& first, long& last) {
+    // thread 'thread_id' of 'np' owns site blocks [first, last)
+    first = thread_id < np ? (thread_id * block_count + np - 1L) / np : block_count;
+    last  = thread_id < np ? ((thread_id + 1L) * block_count + np - 1L) / np : block_count;
+}
+
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::FirstTouchConditionalCaches (void) {
+    // see PlaceConditionalCaches
+    long np = MAX (1L, numaPlacementThreads);
+    
+    RestoreThreadAffinity ();
+    numaThreadNodes.Populate (np, -1L, 0L);
+    
+#if defined __linux__ && defined _OPENMP
+    if (numaAllowedCPUs.empty()) {
+        cpu_set_t allowed;
+        if (sched_getaffinity (0, sizeof (allowed), &allowed) == 0) {
+            for (long cpu = 0L; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET (cpu, &allowed)) {
+                    numaAllowedCPUs << cpu;
+                }
+            }
+        }
+    }
+    bool pin_threads = !numaAllowedCPUs.empty();
 #if _OPENMP>=201511
-#pragma omp  parallel for default(shared) schedule(monotonic:guided,1) private(blockID) proc_bind(spread) num_threads (np) if (np>1)
+    pin_threads = pin_threads && omp_get_num_places() == 0;
+#endif
+    if (pin_threads) {
+        for (long t = 0L; t < np; t++) {
+            numaSavedMasks < new _SimpleList;
+        }
+    }
+#endif
+    
+#ifdef _OPENMP
+#if _OPENMP>=201307
+#pragma omp  parallel default(shared) proc_bind(spread) num_threads (np) if (np>1)
 #else
-#if _OPENMP>=200803
-#pragma omp  parallel for default(shared) schedule(guided,1) private(blockID) proc_bind(spread) num_threads (np) if (np>1)
-#endif
-#endif
-#endif
-              for (blockID = 0; blockID < np; blockID ++) {
-                thread_results[blockID] = t->ComputeTreeBlockByBranch (*sl,
-                                                    *branches,
-                                                    tcc,
-                                                    df,
-                                                    inc,
-                                                    conditionalTerminalNodeStateFlag[index],
-                                                    ssf,
-                                                    (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
-                                                    overallScalingFactors.list_data[index],
-                                                    blockID * sitesPerP,
-                                                    (1+blockID) * sitesPerP,
-                                                    catID,
-                                                    siteRes,
-                                                    scc,
-                                                    branchIndex,
-                                                    branchIndex >= 0 ? branchValues->list_data: nil);
-              }
+#pragma omp  parallel default(shared) num_threads (np) if (np>1)
+#endif
+#endif
+    {
+        long thread_id = 0L;
+#ifdef _OPENMP
+        thread_id = omp_get_thread_num();
+#endif
+        
+#ifdef __linux__
+#ifdef _OPENMP
+        cpu_set_t saved_mask;
+        if (pin_threads && sched_getaffinity (0, sizeof (saved_mask), &saved_mask) == 0) {
+            cpu_set_t mine;
+            CPU_ZERO (&mine);
+            CPU_SET  (numaAllowedCPUs.get (thread_id * numaAllowedCPUs.lLength / np), &mine);
+            if (sched_setaffinity (0, sizeof (mine), &mine) == 0) {
+                // each thread only writes its own list
+                _SimpleList * saved = (_SimpleList*)numaSavedMasks.GetItem (thread_id);
+                for (long cpu = 0L; cpu < CPU_SETSIZE; cpu++) {
+                    if (CPU_ISSET (cpu, &saved_mask)) {
+                        (*saved) << cpu;
+                    }
+                }
+            }
+        }
+#endif
+        unsigned cpu, node;
+        if (syscall (SYS_getcpu, &cpu, &node, nil) == 0) {
+            numaThreadNodes.list_data[thread_id] = node;
+        }
+#endif
+        
+        for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+            if (!conditionalInternalNodeLikelihoodCaches[i]) {
+                continue;
+            }
+            
+            _TheTree             * cT        = GetIthTree(i);
+            _DataSetFilter const * theFilter = GetIthFilter(i);
+            
+            long patternCount = theFilter->GetPatternCount(),
+                 iNodeCount   = cT->GetINodeCount(),
+                 cacheStride  = cT->GetConditionalStride (theFilter->GetDimension()),
+                 element_size = singlePrecisionConditionals ? sizeof (float) : sizeof (hyFloat),
+                 partition_np = np,
+                 block_count,
+                 sites_per_block,
+                 first_block,
+                 last_block;
+            
+            GetSiteBlockLayout (i, partition_np, block_count, sites_per_block);
+            OwnedSiteBlocks    (thread_id, partition_np, block_count, first_block, last_block);
+            
+            long site_from = MIN (first_block * sites_per_block, patternCount),
+                 site_to   = MIN (last_block  * sites_per_block, patternCount);
+            
+            if (site_from >= site_to) {
+                continue;
+            }
+            
+            for (long slice = 0L; slice < iNodeCount * cT->categoryCount; slice++) {
+                long offset = slice * patternCount + site_from;
+                memset ((char*)conditionalInternalNodeLikelihoodCaches[i] + offset * cacheStride * element_size, 0, (site_to - site_from) * cacheStride * element_size);
+                InitializeArray (siteScalingFactors[i] + offset, site_to - site_from, 1.);
+            }
+            for (long slice = 0L; slice < 2L * cT->categoryCount; slice++) {
+                memset (branchCaches[i] + (slice * patternCount + site_from) * cacheStride, 0, (site_to - site_from) * cacheStride * sizeof (hyFloat));
+            }
+        }
+    }
+}
 
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::RestoreThreadAffinity (void) {
+    // give the threads pinned by FirstTouchConditionalCaches their own CPU masks back;
+    // the parallel region is set up exactly like the pinning one, so that thread t is the same OpenMP thread
+    long np = numaSavedMasks.lLength;
+    
+    if (np == 0L) {
+        return;
+    }
+    
+#if defined __linux__ && defined _OPENMP
+#if _OPENMP>=201307
+#pragma omp  parallel default(shared) proc_bind(spread) num_threads (np) if (np>1)
+#else
+#pragma omp  parallel default(shared) num_threads (np) if (np>1)
+#endif
+    {
+        _SimpleList const * saved = (_SimpleList const*)numaSavedMasks.GetItem (omp_get_thread_num());
+        if (saved->nonempty()) {
+            cpu_set_t mask;
+            CPU_ZERO (&mask);
+            saved->Each ([&mask] (long cpu, unsigned long) -> void {
+                CPU_SET (cpu, &mask);
+            });
+            sched_setaffinity (0, sizeof (mask), &mask);
+        }
+    }
+#endif
+    
+    numaSavedMasks.Clear();
+}
 
-            if (np > 1) {
-              hyFloat correction = 0.;
-              for (blockID = 0; blockID < np; blockID ++)  {
-                if (thread_results[blockID] == -INFINITY) {
-                  sum = -INFINITY;
-                  break;
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::ReportCachePlacement (void) {
+    /*
+        20261018: SLKP
+        NUMA_AWARE_CACHES diagnostic: for every thread, look up the memory node of the page in the middle
+        of each of its conditional cache slices (one per internal node, rate class and partition), and report
+        the fraction of these pages that are not on the node where the thread was running when it touched them
+    */
+    if (!numaAwareCaches || numaPlacementThreads < 1L || !conditionalInternalNodeLikelihoodCaches) {
+        return;
+    }
+    
+#if defined __linux__ && defined SYS_move_pages
+    long           np        = numaPlacementThreads;
+    unsigned long  page_size = sysconf (_SC_PAGESIZE);
+    
+    _SimpleList    remote  (np, 0L, 0L),
+                   sampled (np, 0L, 0L);
+    
+    for (long thread_id = 0L; thread_id < np; thread_id++) {
+        _SimpleList pages;
+        
+        for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+            if (!conditionalInternalNodeLikelihoodCaches[i]) {
+                continue;
+            }
+            _TheTree             * cT        = GetIthTree(i);
+            _DataSetFilter const * theFilter = GetIthFilter(i);
+            
+            long patternCount = theFilter->GetPatternCount(),
+                 cacheStride  = cT->GetConditionalStride (theFilter->GetDimension()),
+                 element_size = singlePrecisionConditionals ? sizeof (float) : sizeof (hyFloat),
+                 partition_np = np,
+                 block_count,
+                 sites_per_block,
+                 first_block,
+                 last_block;
+            
+            GetSiteBlockLayout (i, partition_np, block_count, sites_per_block);
+            OwnedSiteBlocks    (thread_id, partition_np, block_count, first_block, last_block);
+            
+            long site_from = MIN (first_block * sites_per_block, patternCount),
+                 site_to   = MIN (last_block  * sites_per_block, patternCount);
+            
+            if (site_from < site_to) {
+                for (long slice = 0L; slice < cT->GetINodeCount() * cT->categoryCount; slice++) {
+                    long middle = slice * patternCount + (site_from + site_to) / 2L;
+                    pages << (((long)conditionalInternalNodeLikelihoodCaches[i] + middle * cacheStride * element_size) & ~(long)(page_size - 1UL));
                 }
-                thread_results[blockID] -= correction;
-                hyFloat temp_sum = sum +  thread_results[blockID];
-                correction = (temp_sum - sum) - thread_results[blockID];
-                sum = temp_sum;
-              }
+            }
+        }
+        
+        if (pages.nonempty()) {
+            int  * status = new int [pages.lLength];
+            if (syscall (SYS_move_pages, 0, pages.lLength, (void**)pages.list_data, nil, status, 0) == 0) {
+                for (unsigned long k = 0UL; k < pages.lLength; k++) {
+                    if (status[k] >= 0) {
+                        sampled.list_data[thread_id] ++;
+                        if (status[k] != numaThreadNodes.get (thread_id)) {
+                            remote.list_data[thread_id] ++;
+                        }
+                    }
+                }
+            }
+            delete [] status;
+        }
+    }
+    
+    _StringBuffer report (256UL);
+    long          total_remote  = 0L,
+                  total_sampled = 0L;
+    
+    report << "NUMA_AWARE_CACHES: remote/sampled conditional cache pages by thread (node):";
+    for (long thread_id = 0L; thread_id < np; thread_id++) {
+        report << ' ' << _String (remote.get (thread_id)) << '/' << _String (sampled.get (thread_id)) << " (" << _String (numaThreadNodes.get (thread_id)) << ')';
+        total_remote  += remote.get (thread_id);
+        total_sampled += sampled.get (thread_id);
+    }
+    if (total_sampled > 0L) {
+        report << "; remote access ratio = " << _String ((hyFloat)total_remote / total_sampled, "%.3g");
+    }
+    ReportWarning (report);
+#else
+    ReportWarning ("NUMA_AWARE_CACHES: page placement can't be queried on this platform");
+#endif
+}
 
+//_______________________________________________________________________________________
+void    _LikelihoodFunction::EvaluateBlocks (_BlockEvaluation* evaluations, long count) {
+    /*
+        20261018: SLKP
+        a thread first claims transition matrices and then site blocks (from all evaluations,
+        in evaluation order), so a block that waits on a matrix can only wait on a matrix that has
+        already been claimed by a running thread; the block -> evaluation maps are walked with a per-thread cursor,
+        because each thread claims block (and matrix) indices in increasing order
+    */
+    
+    long    total_matrices = 0L,
+            total_blocks   = 0L,
+            np             = 1L;
+    
+    _SimpleList matrix_offsets,
+                block_offsets;
+    
+    for (long e = 0L; e < count; e++) {
+        matrix_offsets << total_matrices;
+        block_offsets  << total_blocks;
+        if (evaluations[e].pending) {
+            total_matrices += evaluations[e].matrix_count;
+            total_blocks   += evaluations[e].block_count;
+        }
+    }
+    matrix_offsets << total_matrices;
+    block_offsets  << total_blocks;
+    
+#ifdef _OPENMP
+    np = MIN (GetThreadCount(),omp_get_max_threads());
+#endif
+    np = MAX (1L, MIN (np, total_blocks));
+    
+    long    next_matrix = 0L,
+            next_block  = 0L,
+            owners      = 1L;
+    
+    for (long e = 0L; e < count; e++) {
+        if (evaluations[e].pending) {
+            StoreIfGreater (owners, evaluations[e].np);
+        }
+    }
+    
+#ifdef _OPENMP
+#if _OPENMP>=201307
+#pragma omp  parallel default(shared) proc_bind(spread) num_threads (np) if (np>1)
+#else
+#pragma omp  parallel default(shared) num_threads (np) if (np>1)
+#endif
+#endif
+    {
+        long e = 0L;
+        
+        while (true) {
+            long matrix_id;
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+            matrix_id = next_matrix++;
+            if (matrix_id >= total_matrices) {
+                break;
+            }
+            while (matrix_id >= matrix_offsets.list_data[e+1]) {
+                e++;
+            }
+            evaluations[e].tree->ExponentiateQueued (evaluations[e].exponentials, matrix_id - matrix_offsets.list_data[e]);
+        }
+        
+        auto prune_block = [&] (long e, long local_id) -> void {
+            _BlockEvaluation & evaluation = evaluations[e];
+            long               index      = evaluation.index;
+            
+            if (singlePrecisionConditionals) {
+                evaluation.block_results[local_id] = evaluation.tree->ComputeTreeBlockByBranch (*evaluation.order,
+                                                *evaluation.branches,
+                                                evaluation.tcc,
+                                                evaluation.filter,
+                                                (float*)evaluation.inc,
+                                                conditionalTerminalNodeStateFlag[index],
+                                                evaluation.ssf,
+                                                (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
+                                                overallScalingFactors.list_data[index],
+                                                local_id * evaluation.sites_per_block,
+                                                (1+local_id) * evaluation.sites_per_block,
+                                                evaluation.catID,
+                                                evaluation.siteRes,
+                                                evaluation.scc,
+                                                evaluation.branchIndex,
+                                                evaluation.branchValues,
+                                                evaluation.matrix_count ? &evaluation.exponentials : nil);
             } else {
-              sum = thread_results[0];
+                evaluation.block_results[local_id] = evaluation.tree->ComputeTreeBlockByBranch (*evaluation.order,
+                                                *evaluation.branches,
+                                                evaluation.tcc,
+                                                evaluation.filter,
+                                                evaluation.inc,
+                                                conditionalTerminalNodeStateFlag[index],
+                                                evaluation.ssf,
+                                                (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
+                                                overallScalingFactors.list_data[index],
+                                                local_id * evaluation.sites_per_block,
+                                                (1+local_id) * evaluation.sites_per_block,
+                                                evaluation.catID,
+                                                evaluation.siteRes,
+                                                evaluation.scc,
+                                                evaluation.branchIndex,
+                                                evaluation.branchValues,
+                                                evaluation.matrix_count ? &evaluation.exponentials : nil);
+            }
+        };
+        
+        long thread_id = 0L,
+             team_size = 1L;
+#ifdef _OPENMP
+        thread_id = omp_get_thread_num();
+        team_size = omp_get_num_threads();
+#endif
+        
+        if (numaAwareCaches && team_size >= owners) {
+            // every thread prunes the blocks it owns in the static affinity map (see PlaceConditionalCaches)
+            for (e = 0L; e < count; e++) {
+                if (evaluations[e].pending) {
+                    long first_block,
+                         last_block;
+                    OwnedSiteBlocks (thread_id, evaluations[e].np, evaluations[e].block_count, first_block, last_block);
+                    for (long local_id = first_block; local_id < last_block; local_id++) {
+                        prune_block (e, local_id);
+                    }
+                }
             }
-
-            /*
-            #pragma omp  parallel for default(shared) schedule(static,1) private(blockID) num_threads (np) reduction(+:sum) if (np>1)
-            for (blockID = 0; blockID < np; blockID ++) {
-                sum += t->ComputeTreeBlockByBranch (*sl,
-                                                    *branches,
-                                                    tcc,
-                                                    df,
-                                                    inc,
-                                                    conditionalTerminalNodeStateFlag[index],
-                                                    ssf,
-                                                    (_GrowingVector*)conditionalTerminalNodeLikelihoodCaches(index),
-                                                    overallScalingFactors.list_data[index],
-                                                    blockID * sitesPerP,
-                                                    (1+blockID) * sitesPerP,
-                                                    catID,
-                                                    siteRes,
-                                                    scc,
-                                                    branchIndex,
-                                                    branchIndex >= 0 ? branchValues->list_data: nil);
-            }*/
-
-            sum -= _logLFScaler * overallScalingFactors.list_data[index];
+        } else {
+            e = 0L;
             
+            while (true) {
+                long block_id;
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+                block_id = next_block++;
+                if (block_id >= total_blocks) {
+                    break;
+                }
+                while (block_id >= block_offsets.list_data[e+1]) {
+                    e++;
+                }
+                
+                prune_block (e, block_id - block_offsets.list_data[e]);
+            }
+        }
+    }
+}
+
+//_______________________________________________________________________________________
+hyFloat    _LikelihoodFunction::FinishBlockEvaluation (_BlockEvaluation& evaluation) {
+    
+    long            index        = evaluation.index,
+                    block_count  = evaluation.block_count,
+                    doCachedComp = evaluation.doCachedComp,
+                    catID        = evaluation.catID,
+                    np           = evaluation.np,
+                    blockID;
+    
+    _TheTree        *t            = evaluation.tree;
+    _DataSetFilter const *df      = evaluation.filter;
+    _SimpleList     *sl           = evaluation.order;
+    hyFloat         *thread_results = evaluation.block_results,
+                    sum           = 0.;
 
-            if (doCachedComp < 0) {
-                //printf ("Cache check in %d %d\n", doCachedComp, overallScalingFactors[index]);
-                doCachedComp = -doCachedComp-1;
-                //printf ("Set up %d\n", doCachedComp);
-                *cbid = doCachedComp;
+    evaluation.pending = false;
+    
+    if (evaluation.matrix_count) {
+        t->FinishExponentials (evaluation.exponentials);
+    }
 
+    if (block_count > 1) {
+      hyFloat correction = 0.;
+      for (blockID = 0; blockID < block_count; blockID ++)  {
+        if (thread_results[blockID] == -INFINITY) {
+          sum = -INFINITY;
+          break;
+        }
+        thread_results[blockID] -= correction;
+        hyFloat temp_sum = sum +  thread_results[blockID];
+        correction = (temp_sum - sum) - thread_results[blockID];
+        sum = temp_sum;
+      }
 
-                overallScalingFactorsBackup.list_data[index] = overallScalingFactors.list_data[index];
-                if (sccb)
-                    for (long recoverIndex = 0; recoverIndex < patternCnt; recoverIndex++) {
-                        sccb[recoverIndex] = scc[recoverIndex];
-                    }
+    } else {
+      sum = thread_results[0];
+    }
 
-                /*for (unsigned long p_id = 0; p_id < indexInd.lLength; p_id++) {
-                  printf ("%ld %s = %15.12g\n", p_id, GetIthIndependentVar(p_id)->GetName()->sData, (*parameterValuesAndRanges)(p_id,0));
-                }*/
+    sum -= _logLFScaler * overallScalingFactors.list_data[index];
+    
+
+    if (doCachedComp < 0) {
+        long patternCnt = df->GetPatternCount();
+        //printf ("Cache check in %d %d\n", doCachedComp, overallScalingFactors[index]);
+        doCachedComp = -doCachedComp-1;
+        //printf ("Set up %d\n", doCachedComp);
+        *evaluation.cbid = doCachedComp;
+
+
+        overallScalingFactorsBackup.list_data[index] = overallScalingFactors.list_data[index];
+        if (evaluation.sccb)
+            for (long recoverIndex = 0; recoverIndex < patternCnt; recoverIndex++) {
+                evaluation.sccb[recoverIndex] = evaluation.scc[recoverIndex];
+            }
+
+        auto branch_cache_block = [&] (long blockID) -> void {
+            t->ComputeBranchCache (*sl,doCachedComp, evaluation.bc, evaluation.inc, df,
+                                   conditionalTerminalNodeStateFlag[index],
+                                   evaluation.ssf,
+                                   evaluation.scc,
+                                   (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
+                                   overallScalingFactors.list_data[index],
+                                   blockID * evaluation.sites_per_block,
+                                   (1+blockID) * evaluation.sites_per_block,
+                                   catID,evaluation.tcc,evaluation.siteRes);
+        };
+        
+        if (numaAwareCaches) {
+            // only the blocks owned by each thread (see PlaceConditionalCaches); iteration k runs on thread k
+            long thread_id;
 #ifdef _OPENMP
-  #if _OPENMP>=201511
-    #pragma omp  parallel for default(shared) schedule(monotonic:guided,1) private(blockID) proc_bind(spread) num_threads (np) if (np>1)
+  #if _OPENMP>=201307
+    #pragma omp  parallel for default(shared) schedule(static,1) private(thread_id,blockID) proc_bind(spread) num_threads (np) if (np>1)
   #else
-  #if _OPENMP>=200803
-    #pragma omp  parallel for default(shared) schedule(guided,1) private(blockID) proc_bind(spread) num_threads (np) if (np>1)
-  #endif
+    #pragma omp  parallel for default(shared) schedule(static,1) private(thread_id,blockID) num_threads (np) if (np>1)
   #endif
 #endif
-                for (blockID = 0; blockID < np; blockID ++) {
-                    t->ComputeBranchCache (*sl,doCachedComp, bc, inc, df,
-                                           conditionalTerminalNodeStateFlag[index],
-                                           ssf,
-                                           scc,
-                                           (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
-                                           overallScalingFactors.list_data[index],
-                                           blockID * sitesPerP,
-                                           (1+blockID) * sitesPerP,
-                                           catID,tcc,siteRes);
-                }
-
-                // check results
-
-                if (sum > -INFINITY) {
-                   hyFloat checksum = t->ComputeLLWithBranchCache (*sl,
-                                                     doCachedComp,
-                                                     bc,
-                                                     df,
-                                                     0,
-                                                     df->GetPatternCount (),
-                                                     catID,
-                                                     siteRes)
-                  - _logLFScaler * overallScalingFactors.list_data[index];
-
-                  if (fabs ((checksum-sum)/sum) > 1.e-10 * df->GetPatternCount ()) {
-                    /*hyFloat check2 = t->ComputeTreeBlockByBranch (*sl,
-                                                                     *branches,
-                                                                     tcc,
-                                                                     df,
-                                                                     inc,
-                                                                     conditionalTerminalNodeStateFlag[index],
-                                                                     ssf,
-                                                                     (_GrowingVector*)conditionalTerminalNodeLikelihoodCaches(index),
-                                                                     overallScalingFactors.list_data[index],
-                                                                     0,
-                                                                     df->GetPatternCount(),
-                                                                     catID,
-                                                                     siteRes,
-                                                                     scc,
-                                                                     branchIndex,
-                                                                     branchIndex >= 0 ? branchValues->list_data: nil);*/
-
-                    _String* node_name =   GetIthTree (index)->GetNodeFromFlatIndex(doCachedComp)->GetName();
-
-                    _TerminateAndDump (_String("Internal error in ComputeBranchCache (branch ") & *node_name &
-                                         +                                       " ) reversible model cached likelihood = "& _String (checksum, "%20.16g") & ", directly computed likelihood = " & _String (sum, "%20.16g") &
-                                         +                                       ". This is most likely because a non-reversible model was incorrectly auto-detected (or specified by the model file in environment variables).");
-
-                     return -INFINITY;
-                  }
+            for (thread_id = 0L; thread_id < np; thread_id ++) {
+                long last_block;
+                OwnedSiteBlocks (thread_id, np, block_count, blockID, last_block);
+                for (; blockID < last_block; blockID ++) {
+                    branch_cache_block (blockID);
                 }
-
-                // need to update siteRes when computing cache and changing scaling factors!
             }
-            return sum;
-        } else if (conditionalTerminalNodeStateFlag[index] || !df->IsNormalFilter()) {
-            // two sequence analysis
-
-            _SimpleList bc;
-            _List       mc;
-            t->DetermineNodesForUpdate         (bc, &mc);
-            if (mc.lLength) {
-                t->ExponentiateMatrices(mc, GetThreadCount(),catID);
+        } else {
+#ifdef _OPENMP
+  #if _OPENMP>=201511
+    #pragma omp  parallel for default(shared) schedule(monotonic:dynamic,1) private(blockID) proc_bind(spread) num_threads (np) if (np>1)
+  #else
+  #if _OPENMP>=200803
+    #pragma omp  parallel for default(shared) schedule(dynamic,1) private(blockID) proc_bind(spread) num_threads (np) if (np>1)
+  #endif
+  #endif
+#endif
+            for (blockID = 0; blockID < block_count; blockID ++) {
+                branch_cache_block (blockID);
             }
+        }
 
-            //branchedGlobalCache.Clear(false);
-            //matricesGlobalCache.Clear(false);
-            if (df->IsNormalFilter())
-                return t->ComputeTwoSequenceLikelihood (*sl,
-                                                        df,
-                                                        conditionalTerminalNodeStateFlag[index],
-                                                        (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
-                                                        0,
-                                                        df->GetPatternCount (),
-                                                        catID,
-                                                        siteRes);
-            else {
-                return t->Process3TaxonNumericFilter ((_DataSetFilterNumeric*)df);
-            }
+        // check results
+
+        if (sum > -INFINITY) {
+           hyFloat checksum = t->ComputeLLWithBranchCache (*sl,
+                                             doCachedComp,
+                                             evaluation.bc,
+                                             df,
+                                             0,
+                                             patternCnt,
+                                             catID,
+                                             evaluation.siteRes)
+          - _logLFScaler * overallScalingFactors.list_data[index];
+
+          if (fabs ((checksum-sum)/sum) > 1.e-10 * patternCnt) {
+            _String* node_name =   t->GetNodeFromFlatIndex(doCachedComp)->GetName();
+
+            _TerminateAndDump (_String("Internal error in ComputeBranchCache (branch ") & *node_name &
+                                 +                                       " ) reversible model cached likelihood = "& _String (checksum, "%20.16g") & ", directly computed likelihood = " & _String (sum, "%20.16g") &
+                                 +                                       ". This is most likely because a non-reversible model was incorrectly auto-detected (or specified by the model file in environment variables).");
 
+             return -INFINITY;
+          }
         }
 
-    } else {
-        HandleApplicationError ("Dude -- lame! No cache. I can't compute like that with the new LF engine.");
+        // need to update siteRes when computing cache and changing scaling factors!
     }
-
-    return 0.0;
+    return sum;
 }
 
 //_______________________________________________________________________________________
@@ -8589,6 +11750,90 @@ void    setComputingArrays (node<long>* startingNode, node<long>* childNode, _Si
 
 //_______________________________________________________________________________________
 
+static _String const   summationOrderCachePath (_DataSetFilter const* df, _TheTree const* t, long mode, long partition) {
+    // empty unless SUMMATION_ORDER_CACHE names a directory
+    _FString * cache_dir = (_FString *)FetchObjectFromVariableByType (&kSummationOrderCache, STRING);
+    if (!cache_dir || cache_dir->get_str().empty()) {
+        return kEmptyString;
+    }
+    char buffer [64];
+    snprintf (buffer, sizeof(buffer), "%016llx_%ld_%ld.order", (unsigned long long)t->PatternContentHash (df), mode, partition);
+    _String path = cache_dir->get_str();
+    if (path.get_char (path.length () - 1) != get_platform_directory_char ()) {
+        path = path & get_platform_directory_char ();
+    }
+    return path & buffer;
+}
+
+//_______________________________________________________________________________________
+
+static bool    readSummationOrder (_String const& path, long patterns, _SimpleList& sl) {
+    // the file must hold a permutation of 0..patterns-1, otherwise it is ignored
+    if (path.empty()) {
+        return false;
+    }
+    FILE * cache_file = doFileOpen (path.get_str(), "rb");
+    if (!cache_file) {
+        return false;
+    }
+
+    long        stored = -1L;
+    _SimpleList order,
+                seen (patterns, 0, 0);
+
+    if (fread (&stored, sizeof (long), 1, cache_file) == 1 && stored == patterns) {
+        order.RequestSpace (patterns);
+        long site;
+        while (fread (&site, sizeof (long), 1, cache_file) == 1 && site >= 0L && site < patterns && !seen.get (site)) {
+            seen [site] = 1L;
+            order << site;
+        }
+    }
+    fclose (cache_file);
+
+    if (order.countitems() != patterns) {
+        ReportWarning (_String ("Ignored an invalid summation order cache file ") & path.Enquote());
+        return false;
+    }
+    sl << order;
+    ReportWarning (_String ("Loaded the summation order from ") & path.Enquote());
+    return true;
+}
+
+//_______________________________________________________________________________________
+
+static void    writeSummationOrder (_String const& path, _SimpleList const& sl) {
+    // write to a file private to this process and rename, so that concurrent analyses never see partial orders;
+    // the cache directory is created if it does not exist yet
+    if (path.empty()) {
+        return;
+    }
+#ifdef __UNIX__
+    long const directory_end = path.FindBackwards (_String (get_platform_directory_char ()));
+    if (directory_end > 0L) {
+        mkdir (path.Cut (0L, directory_end - 1L).get_str(), 0777);
+    }
+    _String partial = path & ".partial." & _String ((long)getpid());
+#else
+    _String partial = path & ".partial." & _String ((long)hy_mpi_node_rank) & "." & _String ((long)time (nil));
+#endif
+    FILE  * cache_file = doFileOpen (partial.get_str(), "wb");
+    if (cache_file) {
+        long patterns = sl.countitems();
+        bool written  = fwrite (&patterns, sizeof (long), 1, cache_file) == 1 &&
+                        fwrite (sl.list_data, sizeof (long), patterns, cache_file) == patterns;
+        fclose (cache_file);
+        if (written && rename (partial.get_str(), path.get_str()) == 0) {
+            ReportWarning (_String ("Saved the summation order to ") & path.Enquote());
+            return;
+        }
+        remove (partial.get_str());
+    }
+    ReportWarning (_String ("Failed to save the summation order to ") & path.Enquote());
+}
+
+//_______________________________________________________________________________________
+
 void        _LikelihoodFunction::OptimalOrder    (long index, _SimpleList& sl) {
 
     _DataSetFilter const* df = GetIthFilter (index);
@@ -8617,6 +11862,7 @@ void        _LikelihoodFunction::OptimalOrder    (long index, _SimpleList& sl) {
         return;
     }
     SetStatusLine ("Optimizing data ordering");
+    long const order_mode = skipo > 1.5 && !mstCache ? 2L : 1L;
     checkParameter (optimizePartitionSize,skipo,0.0);
     totalSites = df->GetPatternCount();
     if (skipo) { //  partition the sequence into smaller subseqs. for optimization
@@ -8639,6 +11885,15 @@ void        _LikelihoodFunction::OptimalOrder    (long index, _SimpleList& sl) {
 
     _SimpleList   partitionSites, distances, edges;
 
+    // the MST heuristic needs the spanning trees built by the greedy search, so it bypasses the disk cache
+    _String const order_cache      = mstCache ? kEmptyString : summationOrderCachePath (df, t, order_mode, order_mode == 1L ? partition : 0L);
+    bool   const  order_from_cache = readSummationOrder (order_cache, totalSites, sl);
+
+    if (!order_from_cache && order_mode == 2L) {
+        t->ClusterPatternsByLeafColumns (df, sl);
+    }
+
+    completedSites = sl.countitems(); // all sites are done if the order was loaded or clustered
 
     while (completedSites<totalSites) {
         if (totalSites-completedSites<partition) {
@@ -8831,6 +12086,10 @@ void        _LikelihoodFunction::OptimalOrder    (long index, _SimpleList& sl) {
         }
     }
 
+    if (!order_from_cache) {
+        writeSummationOrder (order_cache, sl);
+    }
+
     _SimpleList straight (sl.lLength, 0, 1),
                 * tcc = nil;
 
@@ -9640,6 +12899,258 @@ void    _LikelihoodFunction::StateCounter (long functionCallback) const {
 
     //_______________________________________________________________________________________
 
+static void _hy_build_alias_table (hyFloat const * weights, unsigned long n, hyFloat * keep, long * alias, long * scratch) {
+    // Vose's alias method for drawing from (not necessarily normalized) 'weights' with one uniform variate u:
+    // the index i = floor (n*u) is kept if frac (n*u) < keep[i], and replaced with alias[i] otherwise;
+    // 'scratch' must have room for 2n entries
+
+    hyFloat total = 0.;
+    for (unsigned long i = 0UL; i < n; i++) {
+        total += weights[i];
+    }
+
+    long * small       = scratch,
+         * large       = scratch + n;
+    long   small_count = 0L,
+           large_count = 0L;
+
+    for (unsigned long i = 0UL; i < n; i++) {
+        keep[i]  = total > 0. ? weights[i] * n / total : 1.;
+        alias[i] = i;
+        if (keep[i] < 1.) {
+            small[small_count++] = i;
+        } else {
+            large[large_count++] = i;
+        }
+    }
+
+    while (small_count && large_count) {
+        long const lesser  = small[--small_count],
+                   greater = large[--large_count];
+        alias[lesser] = greater;
+        keep [greater] += keep[lesser] - 1.;
+        if (keep[greater] < 1.) {
+            small[small_count++] = greater;
+        } else {
+            large[large_count++] = greater;
+        }
+    }
+
+    // what is left over is 1 up to round-off
+    while (small_count) {
+        keep[small[--small_count]] = 1.;
+    }
+    while (large_count) {
+        keep[large[--large_count]] = 1.;
+    }
+}
+
+//_______________________________________________________________________________________
+
+inline long _hy_draw_from_alias_table (hyFloat const * keep, long const * alias, unsigned long n, _hyRandomStream& generator) {
+    hyFloat const       scaled = generator.Uniform () * n;
+    unsigned long const index  = MIN ((unsigned long)scaled, n - 1UL);
+    return scaled - index < keep[index] ? index : alias[index];
+}
+
+//_______________________________________________________________________________________
+
+#ifdef _OPENMP
+static long _hy_simulation_threads (long lf_threads) {
+    // SIMULATION_THREADS, if set, overrides the thread count of the likelihood function
+    long const requested = hy_env::EnvVariableGetNumber (kSimulationThreads, 0.0);
+    return requested > 0L ? requested : lf_threads;
+}
+#endif
+
+//_______________________________________________________________________________________
+
+static void _hy_preorder_nodes (node<long> * current, long parent, _SimpleList& nodes, _SimpleList& parents) {
+    long const index = nodes.lLength;
+    nodes   << (long)current;
+    parents << parent;
+    for (long k = 1L; k <= current->get_num_nodes(); k++) {
+        _hy_preorder_nodes (current->go_down (k), index, nodes, parents);
+    }
+}
+
+//_______________________________________________________________________________________
+
+class _hySiteSimulator {
+    /*
+        20261018: SLKP
+        simulates the states of all the nodes of a tree for a run of sites (_LikelihoodFunction::Simulate
+        and SimulatePatterns)
+
+        the transition matrices of every branch are computed up front for every rate class (an assignment of
+        interval values to the discrete category variables of the partition), and every row is turned into an
+        alias table, so that each state is drawn in constant time with one uniform variate; sites are simulated
+        in blocks of kBlockSize in parallel, block b with stream b of the seed, so that the results do not depend
+        on the number of threads
+
+        if a leaf (or, when 'check_internal_nodes' is set, an internal node other than the root) is assigned
+        one of the excluded states, the entire site (including the rate class) is redrawn
+    */
+
+    public:
+        static const unsigned long kBlockSize = 256UL;
+
+        _hySiteSimulator (_TheTree * tree, hyFloat const * root_frequencies, unsigned long dimension, _SimpleList const& category_variables, _SimpleList const& excluded_states, bool check_internal_nodes) :
+                dimension (dimension), check_internal (check_internal_nodes) {
+
+            _hy_preorder_nodes (&tree->GetRoot(), -1L, nodes, parents);
+
+            // the root is reported as a leaf (the first one) in the degenerate (one child) case
+            bool const root_is_leaf = tree->GetRoot().get_num_nodes() == 1L;
+            for (unsigned long n = 0UL; n < nodes.lLength; n++) {
+                bool const is_leaf = n ? ((node<long>*)nodes.get (n))->is_leaf() : root_is_leaf;
+                leaf_rows     << (is_leaf ? (long)leaf_count++     : -1L);
+                internal_rows << (is_leaf ? -1L : (long)internal_count++);
+            }
+
+            excluded = new bool [dimension];
+            InitializeArray (excluded, dimension, false);
+            excluded_states.Each ([this] (long state, unsigned long) -> void {
+                if (state >= 0L && state < (long)this->dimension) {
+                    excluded[state] = true;
+                }
+            });
+            has_exclusions = excluded_states.nonempty();
+
+            _Vector class_weights;
+            IntergrateOverAssignments (category_variables, true, [&] (long, hyFloat weight) -> void {
+                class_weights.Store (weight);
+            });
+            class_count = class_weights.get_used();
+
+            unsigned long const table_size = class_count * nodes.lLength * dimension * dimension;
+
+            keep        = new hyFloat [table_size + dimension + class_count];
+            alias       = new long    [table_size + dimension + class_count];
+            root_keep   = keep  + table_size;
+            root_alias  = alias + table_size;
+            class_keep  = root_keep  + dimension;
+            class_alias = root_alias + dimension;
+
+            long * scratch = new long [2UL * MAX (dimension, class_count)];
+
+            _hy_build_alias_table (root_frequencies, dimension, root_keep, root_alias, scratch);
+            _hy_build_alias_table (class_weights.theData, class_count, class_keep, class_alias, scratch);
+
+            tree->SetUpMatrices (1L);
+            IntergrateOverAssignments (category_variables, false, [&] (long rate_class, hyFloat) -> void {
+                for (unsigned long n = 1UL; n < nodes.lLength; n++) {
+                    _CalcNode * branch = (_CalcNode*)LocateVar (((node<long>*)nodes.get (n))->get_data());
+                    if (branch->NeedNewCategoryExponential (-1)) {
+                        branch->RecomputeMatrix (0, 1);
+                    }
+                    hyFloat const * transitions = branch->GetCompExp()->fastIndex();
+                    for (unsigned long parent_state = 0UL; parent_state < dimension; parent_state++) {
+                        unsigned long const offset = TableOffset (rate_class, n, parent_state);
+                        _hy_build_alias_table (transitions + parent_state * dimension, dimension, keep + offset, alias + offset, scratch);
+                    }
+                }
+            });
+            tree->CleanUpMatrices ();
+
+            delete [] scratch;
+        }
+
+        ~_hySiteSimulator (void) {
+            delete [] keep;
+            delete [] alias;
+            delete [] excluded;
+        }
+
+        unsigned long LeafCount     (void) const {return leaf_count;}
+        unsigned long InternalCount (void) const {return internal_count;}
+
+        void Simulate (unsigned long site_count, uint64_t seed, hyFloat const * root_states, char const * letters, unsigned long unit,
+                       long threads, char * leaf_characters, char * internal_characters, long * site_classes) const {
+            /*
+                writes the characters (unit per site, 'letters' has unit characters for every state) of each leaf (in
+                traversal order), and, if 'internal_characters' is given, of every internal node (the root first, in
+                pre-order) as rows of (site_count * unit) characters; 'root_states' (optional) fixes the state
+                of the root at each site, and 'site_classes' (optional) receives the rate class of each site
+            */
+
+            long const block_count = (site_count + kBlockSize - 1UL) / kBlockSize,
+                       row_length  = site_count * unit;
+
+#ifdef _OPENMP
+            threads = MIN (threads, block_count);
+  #pragma omp parallel for default(shared) schedule(dynamic,1) num_threads (threads) if (threads>1)
+#endif
+            for (long block = 0L; block < block_count; block++) {
+                _hyRandomStream generator (seed, block);
+                long          * states     = new long [nodes.lLength];
+                unsigned long   block_end  = MIN ((block + 1UL) * kBlockSize, site_count);
+
+                for (unsigned long site = block * kBlockSize; site < block_end; site++) {
+                    long rate_class;
+                    bool accepted;
+
+                    do {
+                        rate_class = class_count > 1UL ? _hy_draw_from_alias_table (class_keep, class_alias, class_count, generator) : 0L;
+                        states[0]  = root_states ? (long)root_states[site] : _hy_draw_from_alias_table (root_keep, root_alias, dimension, generator);
+                        accepted   = true;
+
+                        for (unsigned long n = 1UL; n < nodes.lLength; n++) {
+                            unsigned long const offset = TableOffset (rate_class, n, states[parents.list_data[n]]);
+                            long const          state  = states[n] = _hy_draw_from_alias_table (keep + offset, alias + offset, dimension, generator);
+                            if (has_exclusions && excluded[state] && (leaf_rows.list_data[n] >= 0L || check_internal)) {
+                                accepted = false;
+                                break;
+                            }
+                        }
+                    } while (!accepted);
+
+                    for (unsigned long n = 0UL; n < nodes.lLength; n++) {
+                        char * row = leaf_rows.list_data[n] >= 0L ? leaf_characters + leaf_rows.list_data[n] * row_length
+                                                                  : (internal_characters ? internal_characters + internal_rows.list_data[n] * row_length : nil);
+                        if (row) {
+                            memcpy (row + site * unit, letters + states[n] * unit, unit);
+                        }
+                    }
+
+                    if (site_classes) {
+                        site_classes[site] = rate_class;
+                    }
+                }
+
+                delete [] states;
+            }
+        }
+
+    private:
+        unsigned long TableOffset (long rate_class, unsigned long node_index, long parent_state) const {
+            return ((rate_class * nodes.lLength + node_index) * dimension + parent_state) * dimension;
+        }
+
+        unsigned long dimension,
+                      class_count    = 1UL,
+                      leaf_count     = 0UL,
+                      internal_count = 0UL;
+
+        _SimpleList   nodes,          // in pre-order
+                      parents,        // index of the parent in 'nodes'
+                      leaf_rows,
+                      internal_rows;
+
+        hyFloat     * keep,           // [rate class][node][parent state][state]
+                    * root_keep,
+                    * class_keep;
+        long        * alias,
+                    * root_alias,
+                    * class_alias;
+
+        bool        * excluded,
+                      has_exclusions,
+                      check_internal;
+};
+
+//_______________________________________________________________________________________
+
   void    _LikelihoodFunction::Simulate (_DataSet &target, _List& theExclusions, _Matrix* catValues, _Matrix* catNames, _Matrix* spawnValues, _String const* storeIntermediates) const {
       // will step thru multiple trees of the project and simulate  a dataset from the likelihood function
 
@@ -9715,6 +13226,11 @@ void    _LikelihoodFunction::StateCounter (long functionCallback) const {
       }
     }
 
+    // 20261018: SLKP
+    // unless HMM or continuous category variables are involved, partitions are simulated by _hySiteSimulator,
+    // with the sites drawn in parallel blocks
+    bool const use_site_simulator = HMM_category_variables.empty() && continuous_category_variables.empty();
+
     _DataSetFilter const *first_filter = GetIthFilter(0);
 
     unsigned long species_count = first_filter->NumberSpecies();
@@ -9798,7 +13314,7 @@ void    _LikelihoodFunction::StateCounter (long functionCallback) const {
         column_wise = true;
       }
 
-      if (column_wise) {
+      if (column_wise && !use_site_simulator) {
 
         _TheTree * this_tree = GetIthTree (partition_index);
         this_tree->SetUpMatrices(1);
@@ -9934,60 +13450,121 @@ void    _LikelihoodFunction::StateCounter (long functionCallback) const {
 
       } else {// end simulate column by column
 
+          // the rate classes of a partition are made up of its own category variables; values
+          // of the other discrete category variables are only drawn to be reported in catValues
 
-        unsigned long *  simulated_sequence = new unsigned long [this_site_count];
+        _SimpleList partition_categories;
+        if (category_simulation_mode != kLFSimulateCategoriesNone) {
+          PartitionCatVars (partition_categories, partition_index);
+        }
 
-          // generate a random "spawning vector"
+        _hySiteSimulator simulator (this_tree, this_freqs, filter_dimension, partition_categories, user_exclusions_numeric, storeIntermediates != nil);
 
-        if (spawnValues) { // use supplied starting values
-          for (unsigned long site_index = 0UL;  site_index < this_site_count; site_index++) {
-            simulated_sequence[site_index] = spawnValues->theData[site_index+site_offset];
-          }
-        } else {
-          for (unsigned long site_index = 0UL;  site_index < this_site_count; site_index++) {
-            simulated_sequence[site_index] = DrawFromDiscrete(this_freqs, filter_dimension);
+        _StringBuffer letters (filter_dimension * sites_per_unit);
+        for (unsigned long state = 0UL; state < filter_dimension; state++) {
+          letters << this_filter->ConvertCodeToLetters (this_filter->CorrectCode(state), sites_per_unit);
+        }
+
+        uint64_t const seed = _hyRandomStream::GlobalSeed ();
+
+        char * leaf_characters     = new char [simulator.LeafCount() * this_raw_site_count],
+             * internal_characters = storeIntermediates ? new char [simulator.InternalCount() * this_raw_site_count] : nil;
+        long * site_classes        = catValues && discrete_category_variables.nonempty() ? new long [this_site_count] : nil;
+
+#ifdef _OPENMP
+        long const threads = _hy_simulation_threads (lfThreadCount);
+#else
+        long const threads = 1L;
+#endif
+
+        simulator.Simulate (this_site_count, seed, spawnValues ? spawnValues->theData + site_offset : nil, letters.get_str(), sites_per_unit, threads, leaf_characters, internal_characters, site_classes);
+
+        if (site_classes) {
+          _hyRandomStream other_categories (seed, -1L);
+
+          for (unsigned long discrete_category_index = 0UL; discrete_category_index < discrete_category_variables.lLength; discrete_category_index++) {
+            _CategoryVariable* discrete_cat = GetIthCategoryVar(discrete_category_variables(discrete_category_index));
+            hyFloat const    * values       = discrete_cat->GetValues()->fastIndex();
+            long               position     = partition_categories.Find (indexCat.get (discrete_category_variables(discrete_category_index))),
+                               stride       = 1L,
+                               intervals    = discrete_cat->GetNumberOfIntervals();
+
+            // rate classes enumerate category values with the last variable changing the fastest
+            for (long k = partition_categories.lLength - 1L; k > position && position >= 0L; k--) {
+              stride *= ((_CategoryVariable*)LocateVar (partition_categories.get (k)))->GetNumberOfIntervals();
+            }
+
+            for (unsigned long site_index = 0UL; site_index < this_site_count; site_index++) {
+              long interval;
+              if (position >= 0L) {
+                interval = (site_classes[site_index] / stride) % intervals;
+              } else {
+                hyFloat const * weights = discrete_cat->GetWeights()->fastIndex();
+                hyFloat         draw    = other_categories.Uniform (),
+                                sum     = weights[0];
+                for (interval = 0L; sum < draw && interval < intervals - 1L; sum += weights[++interval]) {}
+              }
+              catValues->Store (discrete_category_index+HMM_category_variables.lLength,site_offset+site_index,values[interval]);
+            }
           }
+          delete [] site_classes;
         }
 
-          // now proceed down the tree branches to get the values of the probabilities at the leaves
-          // this is done recursively
+          // write the sequences one at a time (as file based data sets require)
+
+        for (unsigned long leaf_index = 0UL; leaf_index < simulator.LeafCount(); leaf_index++) {
+          char const * row = leaf_characters + leaf_index * this_raw_site_count;
+          if (leaf_index == 0UL) {
+            for (unsigned long raw_site_index = 0UL; raw_site_index < this_raw_site_count; raw_site_index++) {
+              target.AddSite (row[raw_site_index]);
+            }
+          } else {
+            for (unsigned long raw_site_index = 0UL; raw_site_index < this_raw_site_count; raw_site_index++) {
+              target.Write2Site (site_offset_raw + raw_site_index, row[raw_site_index]);
+            }
+          }
+        }
+        delete [] leaf_characters;
 
-        _DataSet * ancestral_sequences = nil;
+        if (internal_characters) {
+          _DataSet * ancestral_sequences = nil;
 
-        if (storeIntermediates) {
           if (storeIntermediates->nonempty()) {
             FILE * file_for_ancestral_sequences = doFileOpen (storeIntermediates->get_str(),"w");
             if (!file_for_ancestral_sequences) {
               HandleApplicationError (_String ("Failed to open ") & storeIntermediates->Enquote() & " for writing.");
+              delete [] internal_characters;
               target.Finalize();
               return;
             } else {
               ancestral_sequences = new _DataSet (file_for_ancestral_sequences);
               _TheTree *datree = (_TheTree*)LocateVar(theTrees(0));
               datree->AddNodeNamesToDS (ancestral_sequences,false,true,0);
+              ancestral_sequences->SetTranslationTable (this_filter->GetData());
+
+              for (unsigned long internal_index = 0UL; internal_index < simulator.InternalCount(); internal_index++) {
+                char const * row = internal_characters + internal_index * this_raw_site_count;
+                for (unsigned long raw_site_index = 0UL; raw_site_index < this_raw_site_count; raw_site_index++) {
+                  if (internal_index == 0UL) {
+                    ancestral_sequences->AddSite (row[raw_site_index]);
+                  } else {
+                    ancestral_sequences->Write2Site (raw_site_index, row[raw_site_index]);
+                  }
+                }
+              }
+              ancestral_sequences->Finalize();
+              DeleteObject (ancestral_sequences);
             }
           } else {
-            ancestral_sequences = new _DataSet (this_site_count);
-          }
-
-          ancestral_sequences->SetTranslationTable (this_filter->GetData());
-        }
-
-        BuildLeafProbs (this_tree->GetRoot(), simulated_sequence, this_site_count, target, this_tree, leaf_count, true, sites_per_unit, this_filter, site_offset_raw ,ancestral_sequences);
-
-        if (ancestral_sequences) {
-          ancestral_sequences->Finalize();
-          if (storeIntermediates->nonempty() == 0) {
-            for (unsigned long sequence_index = 0UL; sequence_index < internal_node_count; sequence_index ++ ) {
+            for (unsigned long internal_index = 0UL; internal_index < MIN (internal_node_count, simulator.InternalCount()); internal_index++) {
+              char const * row = internal_characters + internal_index * this_raw_site_count;
               for (unsigned long raw_site_index = 0UL; raw_site_index < this_raw_site_count; raw_site_index++) {
-                target.Write2Site(site_offset_raw + raw_site_index, ancestral_sequences->GetSite (raw_site_index)->char_at(sequence_index));
+                target.Write2Site(site_offset_raw + raw_site_index, row[raw_site_index]);
               }
             }
           }
-          DeleteObject (ancestral_sequences);
+          delete [] internal_characters;
         }
-
-        delete [] simulated_sequence;
       } // end over sequence-wise simulation
 
       site_offset_raw   += this_raw_site_count;
@@ -10001,95 +13578,257 @@ void    _LikelihoodFunction::StateCounter (long functionCallback) const {
 
 //_______________________________________________________________________________________
 
-void    _LikelihoodFunction::BuildLeafProbs (node<long>& curNode, long unsigned * baseVector, unsigned long vecSize, _DataSet& target, _TheTree* curTree, unsigned long& leafCount, bool isRoot, long baseLength, _DataSetFilter const* dsf, long DSOffset, _DataSet* intNodes) const
-/* SLKP TODO check that this works with the new category spec route */
+void    _LikelihoodFunction::SimulatePatterns (long partition, _List& columns, _SimpleList& site_patterns) {
+    /*
+        20261018: SLKP
+        simulate the sites of a partition (at the current parameter values) straight into site pattern form:
+        'columns' receives unit length _Site columns (one character per leaf, in filter order) for every distinct
+        pattern, and 'site_patterns' the pattern of every site (see _DataSetFilter::SetPatterns)
 
-{
-  unsigned long * curVector = nil;
+        rate classes are drawn from the discretized distributions that the likelihood function integrates over;
+        the leaf characters of each site are hashed, and only distinct patterns are turned into columns
+    */
 
-    _CalcNode* ccurNode = (_CalcNode*)LocateVar (curNode.get_data());
+    _DataSetFilter const * df         = GetIthFilter (partition);
+    _TheTree             * tree       = GetIthTree   (partition);
+    hyFloat const        * root_freqs = ((_Matrix*)GetIthFrequencies(partition)->ComputeNumeric())->fastIndex();
 
-    if (!isRoot) {
+    unsigned long const    site_count = df->GetSiteCountInUnits(),
+                           dimension  = df->GetDimension (true),
+                           unit       = df->GetUnitLength(),
+                           leaf_count = df->NumberSpecies(),
+                           row_length = site_count * unit;
 
-        curVector = new unsigned long [vecSize];
-        // first "mutate" the parent vector
+    _SimpleList            category_variables;
+    PartitionCatVars       (category_variables, partition);
 
-        if (ccurNode->NeedNewCategoryExponential(-1)) {
-            ccurNode->RecomputeMatrix(0,1);
-        }
+    _hySiteSimulator       simulator (tree, root_freqs, dimension, category_variables, _SimpleList(), false);
+
+    _StringBuffer          letters (dimension * unit);
+    for (unsigned long state = 0UL; state < dimension; state++) {
+        letters << df->ConvertCodeToLetters (df->CorrectCode (state), unit);
+    }
+
+    uint64_t const seed  = _hyRandomStream::GlobalSeed ();
+    char         * leaf_characters = new char [leaf_count * row_length];
+
+#ifdef _OPENMP
+    long const threads = _hy_simulation_threads (lfThreadCount);
+#else
+    long const threads = 1L;
+#endif
+
+    simulator.Simulate (site_count, seed, nil, letters.get_str(), unit, threads, leaf_characters, nil, nil);
+
+    _List        keys;
+    _AVLListX    patterns (&keys);
+    _SimpleList  representatives;
+    _String      key (leaf_count * unit);
 
-        hyFloat * baseI = ccurNode->GetCompExp()->fastIndex();
+    site_patterns.Clear();
+    site_patterns.RequestSpace (site_count);
 
-        unsigned long const m = ccurNode->GetCompExp()->GetVDim();
+    for (unsigned long s = 0UL; s < site_count; s++) {
+        for (unsigned long l = 0UL; l < leaf_count; l++) {
+            for (unsigned long j = 0UL; j < unit; j++) {
+                key.set_char (l * unit + j, leaf_characters[l * row_length + s * unit + j]);
+            }
+        }
 
-        for (unsigned long i = 0UL; i<vecSize; i++) {
-          curVector[i] = DrawFromDiscrete( baseI + baseVector[i]*m, m);
+        long pattern = patterns.Find (&key);
+        if (pattern < 0L) {
+            pattern = representatives.lLength;
+            patterns.Insert (new _String (key), pattern);
+            representatives << s;
+        } else {
+            pattern = patterns.GetXtra (pattern);
         }
-    } else {
-        // handle the degenerate tree case
-        if (curNode.get_num_nodes() == 1) {
-            for (unsigned long k = 0UL; k<vecSize; k++) {
-                _String letterValue = dsf->ConvertCodeToLetters (dsf->CorrectCode(baseVector[k]), baseLength);
-                for (unsigned long m = 0UL; m<letterValue.length(); m++) {
-                    target.AddSite (letterValue.char_at(m));
-                }
+        site_patterns << pattern;
+    }
+
+    columns.Clear();
+    representatives.Each ([&] (long s, unsigned long) -> void {
+        for (unsigned long j = 0UL; j < unit; j++) {
+            _Site * column = new _Site;
+            for (unsigned long l = 0UL; l < leaf_count; l++) {
+                (*column) << leaf_characters[l * row_length + s * unit + j];
             }
-            leafCount++;
-            BuildLeafProbs (*curNode.go_down(1), baseVector, vecSize, target, curTree, leafCount, false, baseLength, dsf,DSOffset,intNodes);
-            return;
+            column->SetRefNo (0L);
+            columns < column;
         }
+    });
+
+    delete [] leaf_characters;
+}
+
+//_______________________________________________________________________________________
+
+_Matrix*    _LikelihoodFunction::ParametricBootstrap (long replicates, _SimpleList const& refit, long processes) {
+    /*
+        20261018: SLKP
+
+        every replicate is simulated straight into site patterns (SimulatePatterns), which are swapped into the
+        data filters of this likelihood function in place of the original data (_DataSetFilter::SetPatterns);
+        each likelihood function in 'refit' (this one can be among them) may only use these filters, and is
+        rebuilt and optimized from its current parameter values on every replicate; the original filters and
+        parameter values are restored at the end, and all likelihood functions using the filters are rebuilt
+
+        replicate r is simulated with the random seed (s + r), where s is drawn once from the current random
+        number stream, so that the results do not depend on how the replicates are distributed; with more than one
+        process, replicates are handed out on demand to this process and to (processes - 1) forked workers, which
+        return the results through a shared memory mapping (as the LOCAL_PROCESS_POOL does); replicates left
+        unfinished by a failed worker are redone by this process
+    */
+
+    if (replicates < 1L) {
+        throw _String ("The number of replicates must be positive");
+    }
+    if (computingTemplate) {
+        throw _String ("Cannot simulate replicates from a likelihood function with a computational template");
     }
 
-    // now scan the "children" and pass on the parameters as needed
+    _SimpleList filters,
+                affected;
 
-    if (curNode.get_num_nodes()) {
-        if (intNodes) {
-            bool writeOrAdd = intNodes->lLength;
-            for (unsigned long k = 0UL; k<vecSize; k++) {
-                _String letterValue = dsf->ConvertCodeToLetters (dsf->CorrectCode(curVector?curVector[k]:baseVector[k]), baseLength);
-                if (writeOrAdd)
-                    for (unsigned long m = 0UL; m<letterValue.length(); m++) {
-                        intNodes->Write2Site (letterValue.length()*k+m, letterValue.char_at(m));
-                    }
-                else
-                  for (unsigned long m = 0UL; m<letterValue.length(); m++) {
-                      intNodes->AddSite (letterValue.char_at(m));
-                  }
-            }
+    for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+        if (!GetIthFilter (i)->IsNormalFilter()) {
+            throw _String ("Cannot simulate replicates of numeric data filters");
         }
-        for (unsigned long k = 1UL; k<=curNode.get_num_nodes(); k++) {
-            BuildLeafProbs (*curNode.go_down(k), curVector?curVector:baseVector, vecSize, target, curTree, leafCount, false, baseLength, dsf,DSOffset,intNodes);
+        if (filters.Find (theDataFilters.get (i)) >= 0L) {
+            throw _String ("Data filter ") & GetObjectNameByType (HY_BL_DATASET_FILTER, theDataFilters.get (i), false)->Enquote() & " is used by more than one partition of the likelihood function";
         }
-    } else
-        // reached a leaf
-    {
-        // attach a row to the new data set
-        long siteCount = DSOffset;
-        if (!leafCount) {
-            for (unsigned long k = 0UL; k<vecSize; k++) {
-                _String letterValue = dsf->ConvertCodeToLetters (dsf->CorrectCode(curVector[k]), baseLength);
-                for (unsigned long m = 0UL; m<letterValue.length(); m++) {
-                    target.AddSite (letterValue.char_at(m));
-                }
+        filters << theDataFilters.get (i);
+
+        _SimpleList category_variables;
+        PartitionCatVars (category_variables, i);
+        category_variables.Each ([] (long variable, unsigned long) -> void {
+            _CategoryVariable * category = (_CategoryVariable*)LocateVar (variable);
+            if (category->is_hidden_markov() || category->is_constant_on_partition()) {
+                throw _String ("Cannot simulate replicates with hidden Markov or constant on partition category variables like ") & category->GetName()->Enquote();
             }
-            leafCount++;
-        } else {
-            for (unsigned long k = 0UL; k<vecSize; k++) {
-                _String letterValue = dsf->ConvertCodeToLetters (dsf->CorrectCode(curVector[k]), baseLength);
-                for (unsigned long m = 0UL; m<letterValue.length(); m++) {
-                    target.Write2Site (siteCount++, letterValue.char_at(m));
-                }
+        });
+    }
+
+    refit.Each ([&] (long lf_index, unsigned long) -> void {
+        _LikelihoodFunction const * lf = (_LikelihoodFunction const*)likeFuncList (lf_index);
+        lf->theDataFilters.Each ([&] (long filter, unsigned long) -> void {
+            if (filters.Find (filter) < 0L) {
+                throw _String ("Likelihood function ") & GetObjectNameByType (HY_BL_LIKELIHOOD_FUNCTION, lf_index, false)->Enquote() & " uses data filter " &
+                      GetObjectNameByType (HY_BL_DATASET_FILTER, filter, false)->Enquote() & " which is not simulated";
             }
+        });
+    });
+
+    for (unsigned long k = 0UL; k < likeFuncList.lLength; k++) {
+        _LikelihoodFunction * lf = (_LikelihoodFunction*)likeFuncList (k);
+        if (lf && filters.Any ([lf] (long filter, unsigned long) -> bool {return lf->DependOnDF (filter);})) {
+            lf->DoneComputing (true);
+            affected << k;
         }
     }
 
-    if (!isRoot) {
-        ccurNode->FreeUpMemory (0);
+    // starting values, and copies of the filters to restore
+
+    _Matrix     start_values;
+    _List       refit_start_values,
+                saved_filters;
+    _SimpleList original_data;
+
+    GetAllIndependent (start_values);
+    refit.Each ([&] (long lf_index, unsigned long) -> void {
+        _Matrix * values = new _Matrix;
+        ((_LikelihoodFunction*)likeFuncList (lf_index))->GetAllIndependent (*values);
+        refit_start_values.AppendNewInstance (values);
+    });
+    filters.Each ([&] (long filter, unsigned long) -> void {
+        _DataSetFilter const * df = GetDataFilter (filter);
+        saved_filters.AppendNewInstance (df->makeDynamic());
+        original_data << (long)df->GetData();
+    });
+
+    auto restore_filters = [&] (void) -> void {
+        filters.Each ([&] (long filter, unsigned long k) -> void {
+            _DataSetFilter * df = (_DataSetFilter*)GetDataFilter (filter);
+            df->CopyFilter ((_DataSetFilter const*)saved_filters.GetItem (k));
+            df->SetData    ((_DataSet*)original_data.get (k));
+        });
+    };
+
+    unsigned long const base_seed   = genrand_int32(),
+                        resume_seed = genrand_int32();
+    long          const fits        = refit.lLength;
+
+    auto run_replicate = [&] (long r, hyFloat * log_likelihoods) -> void {
+        init_genrand (base_seed + r);
+        SetAllIndependent (&start_values);
+
+        // all partitions are simulated before any of the filters is replaced
+        _List columns,
+              site_patterns,
+              replicate_data;
+
+        // the filters are pointed back at the original data before the replicate data sets are deleted,
+        // also when simulating or fitting the replicate throws
+        struct _restore_on_exit {
+            decltype (restore_filters) & restore;
+            ~_restore_on_exit (void) {
+                restore ();
+            }
+        } restore_guard {restore_filters};
+
+        for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+            _List       * partition_columns  = new _List;
+            _SimpleList * partition_patterns = new _SimpleList;
+            SimulatePatterns (i, *partition_columns, *partition_patterns);
+            columns.AppendNewInstance (partition_columns);
+            site_patterns.AppendNewInstance (partition_patterns);
+        }
+
+        for (unsigned long i = 0UL; i < theTrees.lLength; i++) {
+            _DataSet * replicate = new _DataSet;
+            GetIthFilterMutable (i)->SetPatterns (replicate, *(_List*)columns.GetItem (i), *(_SimpleList const*)site_patterns.GetItem (i));
+            replicate_data.AppendNewInstance (replicate);
+        }
+
+        refit.Each ([&] (long lf_index, unsigned long k) -> void {
+            _LikelihoodFunction * lf = (_LikelihoodFunction*)likeFuncList (lf_index);
+            lf->SetAllIndependent ((_Matrix*)refit_start_values.GetItem (k));
+            lf->Rebuild ();
+            _Matrix * fit = lf->Optimize ();
+            log_likelihoods[k] = (*fit)(1,0);
+            DeleteObject (fit);
+        });
+    };
+
+    _Matrix * results = new _Matrix (replicates, fits, false, true);
+    bool      done    = false;
+
+#ifdef _HY_LOCAL_PROCESS_POOL_
+    processes = MIN (processes, replicates);
+    if (processes > 1L && fits > 0L) {
+        done = _hy_forked_task_pool (replicates, fits, processes, results->theData, run_replicate, [&] (void) -> void {
+            refit.Each ([] (long lf_index, unsigned long) -> void {
+                ((_LikelihoodFunction*)likeFuncList (lf_index))->SetThreadCount (1L);
+            });
+        }, "parametric bootstrap replicate");
     }
+#endif
 
-    if (curVector) {
-        delete [] curVector;
+    for (long r = 0L; r < replicates && !done && !terminate_execution; r++) {
+        run_replicate (r, results->theData + r * fits);
     }
+
+    refit.Each ([&] (long lf_index, unsigned long k) -> void {
+        ((_LikelihoodFunction*)likeFuncList (lf_index))->SetAllIndependent ((_Matrix*)refit_start_values.GetItem (k));
+    });
+    SetAllIndependent (&start_values);
+    init_genrand (resume_seed);
+
+    affected.Each ([] (long lf_index, unsigned long) -> void {
+        ((_LikelihoodFunction*)likeFuncList (lf_index))->Rebuild ();
+    });
+
+    return results;
 }
 
 //_______________________________________________________________________________________
@@ -10158,7 +13897,7 @@ void    _LikelihoodFunction::SetNthBit (long& reference, char n)
 
 //_______________________________________________________________________________________
 
-bool    _LikelihoodFunction::CheckNthBit (long& reference, char n)
+bool    _LikelihoodFunction::CheckNthBit (long const& reference, char n) const
 {
     unsigned long bitshifter = 1;
     bitshifter = bitshifter<<n;
@@ -10327,7 +14066,10 @@ void    _LikelihoodFunction::DoneComputing (bool force)
         DeleteObject (siteResults);
         siteResults = 0;
 
+        ReportCachePlacement ();
+        RestoreThreadAffinity ();
         DeleteCaches        (false);
+        numaPlacementThreads = 0L;
         categoryTraversalTemplate.Clear();
         hasBeenSetUp       = 0;
         siteArrayPopulated = false;
@@ -10350,9 +14092,14 @@ void    _LikelihoodFunction::FillInConditionals(long partIndex) {
 
         _SimpleList* tcc            = (_SimpleList*)treeTraversalMasks(partIndex);
         if (tcc) {
-            long shifter = dsf->GetDimension()*dsf->GetPatternCount()*tree->GetINodeCount();
+            tree->SetPaddedConditionals (paddedConditionalCaches);
+            long shifter = tree->GetConditionalStride (dsf->GetDimension())*dsf->GetPatternCount()*tree->GetINodeCount();
             for (long cc = 0; cc <= catCounter; cc++) {
-                tree->FillInConditionals(dsf, conditionalInternalNodeLikelihoodCaches[partIndex] + cc*shifter, tcc);
+                if (singlePrecisionConditionals) {
+                    tree->FillInConditionals(dsf, (float*)conditionalInternalNodeLikelihoodCaches[partIndex] + cc*shifter, tcc);
+                } else {
+                    tree->FillInConditionals(dsf, conditionalInternalNodeLikelihoodCaches[partIndex] + cc*shifter, tcc);
+                }
             }
         }
     } else {
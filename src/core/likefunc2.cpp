@@ -44,6 +44,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "likefunc.h"
 #include "function_templates.h"
 #include "global_things.h"
+#include "random_stream.h"
 
 using namespace hy_global;
 
@@ -110,7 +111,7 @@ void    _LikelihoodFunction::FlushLocalUpdatePolicy (void)
 }
 
 //_______________________________________________________________________________________
-void            _LikelihoodFunction::PartitionCatVars     (_SimpleList& storage, long partIndex)
+void            _LikelihoodFunction::PartitionCatVars     (_SimpleList& storage, long partIndex) const
 {
     if (partIndex < blockDependancies.lLength) {
         for (long bit = 0; bit < 32; bit++)
@@ -303,11 +304,11 @@ bool    _LikelihoodFunction::ProcessPartitionList (_SimpleList& partsToDo, _Matr
 
 //_______________________________________________________________________________________
 
-void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList& doTheseOnes, _String& baseResultID,  bool sample, bool doMarginal, bool doLeaves)
+void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList& doTheseOnes, _String& baseResultID,  bool sample, bool doMarginal, bool doLeaves, unsigned long samples)
 /*
     Reconstruct ancestors for a likelihood function using
 
--- target      :    the _DataSet object that will receive the results
+-- target      :    the _DataSet object that will receive the results; may be file based (sequences are written one at a time)
 -- doTheseOnes :    a _sorted_ array of partition indices to include in this operation; is assumed to contain valid indices (i.e. 0 -- number of partitions - 1)
 -- baseResultID:    the HBL identifier of the dataset that will receive the result; used as a prefix for .marginal_support_matrix support matrix (when doMarginal = true)
 -- sample      :    if true, an ancestral sample (weighted by likelihood) is drawn, otherwise an ML (or maginal) reconstruction is carried out
@@ -315,7 +316,13 @@ void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList&
                     the likelihood of each node while summing over the rest), otherwise it is joint.
 -- doLeaves    :    if sample == false and doMarginal == false (for now) and doLeaves == true, then the procedure will also
                     reconstruct (joint ML) the best assignment of leaves
+-- samples     :    if sample == true, the number of independent samples to draw; they are stacked along the sites
+                    (sample k occupies sites [k*S, (k+1)*S), where S is the total number of sites in all partitions)
 
+    20261018: SLKP
+    sampling (and marginal reconstruction) reuse the conditional likelihood caches of the LF, which are brought up to date
+    once for all rate classes; rate classes are drawn from their posterior probabilities at each site, except for partitions with
+    HMM or constant-on-partition category variables, where the (Viterbi) ML class assignment is used as before
 */
 {
     _DataSetFilter  const *dsf      = GetIthFilter (doTheseOnes.list_data[0]);
@@ -327,9 +334,14 @@ void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList&
     computationalResults.ZeroUsed();
     PrepareToCompute();
 
-    // check if we need to deal with rate variation
+    auto has_dependent_classes = [this] (long partIndex) -> bool {
+        return HasHiddenMarkov (blockDependancies.list_data[partIndex]) >= 0 || HasHiddenMarkov (blockDependancies.list_data[partIndex], false) >= 0;
+    };
+
+    // check if we need to deal with rate variation: joint reconstructions are conditioned on the ML rate class
+    // assignment, and so is sampling for partitions where rate classes are not independent between sites
     _Matrix         *rateAssignments = nil;
-    if  (!doMarginal && indexCat.lLength>0) {
+    if  (!doMarginal && indexCat.lLength>0 && (!sample || doTheseOnes.Any ([&] (long partIndex, unsigned long) -> bool {return has_dependent_classes (partIndex);}))) {
         rateAssignments = ConstructCategoryMatrix(doTheseOnes,_hyphyLFConstructCategoryMatrixClasses,false);
         if (!rateAssignments) {
             HandleApplicationError (_String ("Failed to construct a category matrix in ") & __PRETTY_FUNCTION__);
@@ -339,21 +351,37 @@ void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList&
         Compute();    // need to do this to populate rate matrices
     }
 
-    long siteOffset         = 0,
-         patternOffset      = 0,
-         sequenceCount       ;
+    if (!sample) {
+        samples = 1UL;
+    }
+
+    uint64_t const  seed            = sample ? _hyRandomStream::GlobalSeed () : 0UL;
+    long            threads         = 1L,
+                    classOffset     = 0L,
+                    sequenceCount   = 0L;
+    bool            failed          = false;
+
+#ifdef _OPENMP
+    threads = GetThreadCount();
+#endif
+
+    _List           reconstructions;
+    _SimpleList     reconstructedLengths;
 
     for (long i = 0; i<doTheseOnes.lLength; i++) {
         long       partIndex    = doTheseOnes.list_data[i];
         _TheTree   *tree        = GetIthTree (partIndex);
         dsf = GetIthFilter(partIndex);
+        tree->SetPaddedConditionals (paddedConditionalCaches);
 
-        long    catCounter = 0;
+        // ML rate class assignments are stored per site for HMM partitions and per site pattern otherwise
+        hyFloat  *  partitionClasses = rateAssignments ? rateAssignments->theData + classOffset : nil;
+        classOffset += HasHiddenMarkov(blockDependancies.list_data[partIndex]) >= 0 ? dsf->GetSiteCountInUnits() : dsf->GetPatternCount();
 
-        if (rateAssignments) {
-            _SimpleList             pcats;
-            PartitionCatVars        (pcats,partIndex);
-            catCounter            = pcats.lLength;
+        _SimpleList             pcats;
+        PartitionCatVars        (pcats,partIndex);
+        if (pcats.empty()) {
+            partitionClasses = nil;
         }
 
         if (i==0) {
@@ -376,32 +404,40 @@ void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList&
         }
 
         _List       * expandedMap   = dsf->ComputePatternToSiteMap(),
-                      * thisSet;
+                    * thisSet       = nil;
 
         if (sample) {
-            _AVLListX   * nodeMapper    = tree->ConstructNodeToIndexMap(true);
-            thisSet                     = new _List;
-            _SimpleList* tcc            = (_SimpleList*)treeTraversalMasks(partIndex);
-            if (tcc) {
-                long shifter = dsf->GetDimension()*dsf->GetPatternCount()*tree->GetINodeCount();
-                for (long cc = 0; cc <= catCounter; cc++) {
-                    tree->FillInConditionals(dsf, conditionalInternalNodeLikelihoodCaches[partIndex] + cc*shifter, tcc);
+            if (!conditionalInternalNodeLikelihoodCaches[partIndex]) {
+                HandleApplicationError (_String ("Ancestral states can not be sampled for partition ") & _String (partIndex+1) & ", because it has no internal node likelihood caches (two sequences?)");
+            } else {
+                long          classCount    = 1L;
+                hyFloat     * posteriors    = nil,
+                            * siteClasses   = nil;
+
+                if (partitionClasses && has_dependent_classes (partIndex)) {
+                    classCount  = TotalRateClassesForAPartition (partIndex);
+                    siteClasses = new hyFloat [dsf->GetSiteCountInUnits()];
+                    if (HasHiddenMarkov(blockDependancies.list_data[partIndex]) >= 0) {
+                        CopyArray (siteClasses, partitionClasses, dsf->GetSiteCountInUnits());
+                    } else {
+                        ((_SimpleList const*)dsf->GetDuplicateSiteMap())->Each ([&] (long pattern, unsigned long site) -> void {
+                            siteClasses[site] = partitionClasses[pattern];
+                        });
+                    }
+                } else {
+                    posteriors = ComputeRateClassPosteriors (partIndex, classCount);
                 }
-            }
-            tree->SampleAncestorsBySequence (dsf, *(_SimpleList*)optimalOrders.list_data[partIndex],
-                                             &tree->GetRoot(),
-                                             nodeMapper,
-                                             conditionalInternalNodeLikelihoodCaches[partIndex],
-                                             *thisSet,
-                                             nil,
-                                             *expandedMap,
-                                             catCounter?rateAssignments->theData+siteOffset:nil,
-                                             catCounter);
 
+                FillInConditionalsForAllClasses (partIndex, classCount);
 
-            nodeMapper->DeleteAll(false);
-            DeleteObject (nodeMapper);
+                thisSet = tree->SampleAncestralStates (dsf, *(_SimpleList*)optimalOrders.list_data[partIndex],
+                                                       conditionalInternalNodeLikelihoodCaches[partIndex],
+                                                       classCount, posteriors, siteClasses,
+                                                       samples, seed + partIndex, threads);
 
+                delete [] posteriors;
+                delete [] siteClasses;
+            }
         } else {
             if (doMarginal) {
                 _Matrix  *marginals = new _Matrix;
@@ -409,36 +445,63 @@ void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList&
                 thisSet = RecoverAncestralSequencesMarginal (partIndex, *marginals, *expandedMap, doLeaves);
                 CheckReceptacleAndStore(&supportMxID, "ReconstructAncestors", true, marginals, false);
 
-            } else
+            } else {
+                hyFloat * patternClasses = partitionClasses;
+                if (patternClasses && HasHiddenMarkov(blockDependancies.list_data[partIndex]) >= 0) {
+                    // a single rate class per site pattern: that of its first site
+                    patternClasses = new hyFloat [dsf->GetPatternCount()];
+                    for (long pattern = 0L; pattern < dsf->GetPatternCount(); pattern++) {
+                        patternClasses[pattern] = partitionClasses[((_SimpleList*)expandedMap->GetItem (pattern))->get (0)];
+                    }
+                }
                 thisSet = tree->RecoverAncestralSequences (dsf,
-                          *(_SimpleList*)optimalOrders.list_data[partIndex],
                           *expandedMap,
-                          conditionalInternalNodeLikelihoodCaches[partIndex],
-                          catCounter?rateAssignments->theData+siteOffset:nil,
-                          catCounter,
+                          patternClasses,
                           conditionalTerminalNodeStateFlag[partIndex],
                           (_Vector*)conditionalTerminalNodeLikelihoodCaches(partIndex),
-                          doLeaves
-                                                          );
-
+                          doLeaves,
+                          threads
+                          );
+                if (patternClasses != partitionClasses) {
+                    delete [] patternClasses;
+                }
+            }
         }
 
+        DeleteObject (expandedMap);
 
-        ((_String*)thisSet->GetItem(0))->Each ([&] (char c, unsigned long) -> void {
-            target.AddSite (c);
-        });
-
-        for (long seqIdx = 1; seqIdx < sequenceCount; seqIdx++) {
-            ((_String*)thisSet->GetItem(seqIdx))->Each ([&] (char c, unsigned long idx) -> void {
-                target.Write2Site (siteOffset + idx, c);
-            });
+        if (!thisSet) {
+            failed = true;
+            break;
         }
-        DeleteObject (thisSet);
-        DeleteObject (expandedMap);
-        siteOffset    += dsf->GetSiteCount();
-        patternOffset += dsf->GetPatternCount();
+
+        reconstructions.AppendNewInstance (thisSet);
+        reconstructedLengths << dsf->GetSiteCount();
     }
 
+    // sequences are written one at a time (as file based data sets require), with all the
+    // partitions of one sample, followed by the next sample
+
+    if (!failed) {
+        for (long seqIdx = 0L; seqIdx < sequenceCount; seqIdx++) {
+            unsigned long written = 0UL;
+            for (unsigned long sampleIdx = 0UL; sampleIdx < samples; sampleIdx++) {
+                reconstructions.ForEach ([&] (BaseRef partition, unsigned long partition_index) -> void {
+                    _String const * reconstruction = (_String const*)((_List*)partition)->GetItem (seqIdx);
+                    unsigned long   length         = reconstructedLengths.get (partition_index),
+                                    from           = sampleIdx * length;
+
+                    for (unsigned long c = 0UL; c < length; c++, written++) {
+                        if (seqIdx == 0L) {
+                            target.AddSite (reconstruction->char_at (from + c));
+                        } else {
+                            target.Write2Site (written, reconstruction->char_at (from + c));
+                        }
+                    }
+                });
+            }
+        }
+    }
 
     target.Finalize();
     target.SetNoSpecies(target.GetNames().lLength);
@@ -453,6 +516,79 @@ void    _LikelihoodFunction::ReconstructAncestors (_DataSet &target,_SimpleList&
 
 //_______________________________________________________________________________________________
 
+hyFloat *   _LikelihoodFunction::ComputeRateClassPosteriors (long index, long& classCount)
+/*
+    20261018: SLKP
+    bring the conditional likelihood caches of a partition up to date for all of its rate classes,
+    and return the posterior probabilities of rate classes for each site pattern (patterns x classes,
+    to be deleted by the caller), or nil if the partition has no category variables (classCount = 1);
+    not for partitions with HMM or constant-on-partition variables
+*/
+{
+    long          const patternCount = GetIthFilter (index)->GetPatternCount();
+    _SimpleList   scalers,
+                  pcats;
+
+    PartitionCatVars (pcats, index);
+
+    if (pcats.empty()) {
+        classCount = 1L;
+        hyFloat * siteLikelihoods = new hyFloat [2*patternCount];
+        ComputeSiteLikelihoodsForABlock (index, siteLikelihoods, scalers);
+        delete [] siteLikelihoods;
+        return nil;
+    }
+
+    classCount = TotalRateClassesForAPartition (index);
+
+    hyFloat * conditionals = new hyFloat [classCount * patternCount],
+            * weights      = new hyFloat [classCount],
+            * posteriors   = new hyFloat [classCount * patternCount];
+
+    // per-class site likelihoods, scaled to a common factor at each site
+    PopulateConditionalProbabilities (index, _hyphyLFConditionProbsScaledMatrixMode, conditionals, scalers);
+    PopulateConditionalProbabilities (index, _hyphyLFConditionProbsClassWeights,     weights,      scalers);
+
+    for (long pattern = 0L; pattern < patternCount; pattern++) {
+        hyFloat * posterior = posteriors + pattern * classCount,
+                  sum       = 0.;
+        for (long r = 0L; r < classCount; r++) {
+            sum += (posterior[r] = weights[r] * conditionals[r * patternCount + pattern]);
+        }
+        if (sum > 0.) {
+            sum = 1. / sum;
+            for (long r = 0L; r < classCount; r++) {
+                posterior[r] *= sum;
+            }
+        } else {
+            CopyArray (posterior, weights, classCount);
+        }
+    }
+
+    delete [] conditionals;
+    delete [] weights;
+
+    return posteriors;
+}
+
+//_______________________________________________________________________________________________
+
+void    _LikelihoodFunction::FillInConditionalsForAllClasses (long index, long classCount) {
+    // sites skipped via traversal masks (see treeTraversalMasks) have no conditionals of their own;
+    // copy them from the sites they were skipped in favor of
+    _SimpleList* tcc = (_SimpleList*)treeTraversalMasks(index);
+    if (tcc) {
+        _DataSetFilter const * dsf  = GetIthFilter (index);
+        _TheTree             * tree = GetIthTree   (index);
+        long shifter = tree->GetConditionalStride (dsf->GetDimension())*dsf->GetPatternCount()*tree->GetINodeCount();
+        for (long cc = 0; cc < classCount; cc++) {
+            tree->FillInConditionals(dsf, conditionalInternalNodeLikelihoodCaches[index] + cc*shifter, tcc);
+        }
+    }
+}
+
+//_______________________________________________________________________________________________
+
 void            _LikelihoodFunction::PopulateConditionalProbabilities   (long index, char runMode, hyFloat* buffer, _SimpleList& scalers, long branchIndex, _SimpleList* branchValues)
 // this function computes site probabilties for each rate class (or something else that involves iterating over rate classes)
 // see run options below
@@ -819,6 +955,13 @@ _List*   _LikelihoodFunction::RecoverAncestralSequencesMarginal (long index, _Ma
 
 // doLeaves     :   compute support values leaves instead of internal nodes
 
+/*
+    20261018: SLKP
+    unless the partition has HMM or constant-on-partition category variables (or no internal node caches),
+    support values are computed in one pass over the cached conditionals (see _TheTree::ComputeMarginalSupport),
+    instead of reevaluating the likelihood function with each node forced to each character in turn
+*/
+
 {
 
     _DataSetFilter const* dsf       = GetIthFilter(index);
@@ -831,71 +974,115 @@ _List*   _LikelihoodFunction::RecoverAncestralSequencesMarginal (long index, _Ma
                     iNodeCount                        = blockTree->GetINodeCount  (),
                     leafCount                     = blockTree->GetLeafCount   (),
                     matrixSize                       = doLeaves?leafCount:iNodeCount,
-                    siteCount                        = dsf->GetSiteCount         (),
+                    siteCount                        = dsf->GetSiteCountInUnits  (),
                     shiftForTheNode                 = patternCount * alphabetDimension;
 
-    hyFloat      *siteLikelihoods                = new hyFloat [2*patternCount],
-    *siteLikelihoodsSpecState       = new hyFloat [2*patternCount];
-
-    _SimpleList     scalersBaseline,
-                    scalersSpecState,
-                    branchValues,
-                    postToIn;
+    _SimpleList     postToIn;
 
     blockTree->MapPostOrderToInOrderTraversal (postToIn, doLeaves == false);
     supportValues.Clear                      ();
     _Matrix::CreateMatrix                             (&supportValues,matrixSize,shiftForTheNode,false,true,false);
 
-    ComputeSiteLikelihoodsForABlock          (index, siteLikelihoods, scalersBaseline);
-    // establish a baseline likelihood for each site
-
-    if (doLeaves) {
-        for                             (long currentChar = 0; currentChar < alphabetDimension; currentChar++) {
-            branchValues.Populate           (patternCount,currentChar,0);
-            for (long branchID = 0; branchID < leafCount; branchID ++) {
-                blockTree->AddBranchToForcedRecomputeList (branchID);
-                long mappedBranchID = postToIn.list_data[branchID];
-                ComputeSiteLikelihoodsForABlock (index, siteLikelihoodsSpecState, scalersSpecState,
-                                                 branchID+iNodeCount, &branchValues);
-                for (long siteID = 0; siteID < patternCount; siteID++) {
-                    long scaleDiff = (scalersSpecState.list_data[siteID]-scalersBaseline.list_data[siteID]);
-                    hyFloat ratio = siteLikelihoodsSpecState[siteID]/siteLikelihoods[siteID];
-
-                    if (scaleDiff > 0) {
-                        ratio *= acquireScalerMultiplier(scaleDiff);
+    if (conditionalInternalNodeLikelihoodCaches[index] && HasHiddenMarkov (blockDependancies.list_data[index]) < 0 && HasHiddenMarkov (blockDependancies.list_data[index], false) < 0) {
+        long      classCount = 1L,
+                  threads    = 1L;
+#ifdef _OPENMP
+        threads = GetThreadCount();
+#endif
+        hyFloat * posteriors = ComputeRateClassPosteriors (index, classCount);
+        FillInConditionalsForAllClasses (index, classCount);
+        blockTree->ComputeMarginalSupport (dsf, *(_SimpleList*)optimalOrders.list_data[index],
+                                           conditionalInternalNodeLikelihoodCaches[index],
+                                           conditionalTerminalNodeStateFlag[index],
+                                           (_Vector*)conditionalTerminalNodeLikelihoodCaches(index),
+                                           classCount, posteriors, doLeaves, supportValues, threads);
+        delete [] posteriors;
+    } else {
+        hyFloat      *siteLikelihoods                = new hyFloat [2*patternCount],
+                     *siteLikelihoodsSpecState       = new hyFloat [2*patternCount];
+
+        _SimpleList     scalersBaseline,
+                        scalersSpecState,
+                        branchValues;
+
+        ComputeSiteLikelihoodsForABlock          (index, siteLikelihoods, scalersBaseline);
+        // establish a baseline likelihood for each site
+
+        if (doLeaves) {
+            for                             (long currentChar = 0; currentChar < alphabetDimension; currentChar++) {
+                branchValues.Populate           (patternCount,currentChar,0);
+                for (long branchID = 0; branchID < leafCount; branchID ++) {
+                    blockTree->AddBranchToForcedRecomputeList (branchID);
+                    long mappedBranchID = postToIn.list_data[branchID];
+                    ComputeSiteLikelihoodsForABlock (index, siteLikelihoodsSpecState, scalersSpecState,
+                                                     branchID+iNodeCount, &branchValues);
+                    for (long siteID = 0; siteID < patternCount; siteID++) {
+                        long scaleDiff = (scalersSpecState.list_data[siteID]-scalersBaseline.list_data[siteID]);
+                        hyFloat ratio = siteLikelihoodsSpecState[siteID]/siteLikelihoods[siteID];
+
+                        if (scaleDiff > 0) {
+                            ratio *= acquireScalerMultiplier(scaleDiff);
+                        }
+                        supportValues.theData[mappedBranchID*shiftForTheNode + siteID*alphabetDimension + currentChar] = ratio;
                     }
-                    supportValues.theData[mappedBranchID*shiftForTheNode + siteID*alphabetDimension + currentChar] = ratio;
+                    blockTree->AddBranchToForcedRecomputeList (branchID);
                 }
-                blockTree->AddBranchToForcedRecomputeList (branchID);
             }
         }
-    }
 
-    else
-        for                             (long currentChar = 0; currentChar < alphabetDimension-1; currentChar++)
-            // the prob for the last char is  (1 - sum (probs other chars))
-        {
-            branchValues.Populate           (patternCount,currentChar,0);
-            for (long branchID = 0; branchID < iNodeCount; branchID ++) {
-                long mappedBranchID = postToIn.list_data[branchID];
-                ComputeSiteLikelihoodsForABlock (index, siteLikelihoodsSpecState, scalersSpecState, branchID, &branchValues);
-                for (long siteID = 0; siteID < patternCount; siteID++) {
-                    long scaleDiff = (scalersSpecState.list_data[siteID]-scalersBaseline.list_data[siteID]);
-                    hyFloat ratio = siteLikelihoodsSpecState[siteID]/siteLikelihoods[siteID];
-                    if (scaleDiff > 0) {
-                        ratio *= acquireScalerMultiplier(scaleDiff);
+        else
+            for                             (long currentChar = 0; currentChar < alphabetDimension-1; currentChar++)
+                // the prob for the last char is  (1 - sum (probs other chars))
+            {
+                branchValues.Populate           (patternCount,currentChar,0);
+                for (long branchID = 0; branchID < iNodeCount; branchID ++) {
+                    long mappedBranchID = postToIn.list_data[branchID];
+                    ComputeSiteLikelihoodsForABlock (index, siteLikelihoodsSpecState, scalersSpecState, branchID, &branchValues);
+                    for (long siteID = 0; siteID < patternCount; siteID++) {
+                        long scaleDiff = (scalersSpecState.list_data[siteID]-scalersBaseline.list_data[siteID]);
+                        hyFloat ratio = siteLikelihoodsSpecState[siteID]/siteLikelihoods[siteID];
+                        if (scaleDiff > 0) {
+                            ratio *= acquireScalerMultiplier(scaleDiff);
+                        }
+                        supportValues.theData[mappedBranchID*shiftForTheNode + siteID*alphabetDimension + currentChar] = ratio;
                     }
-                    supportValues.theData[mappedBranchID*shiftForTheNode + siteID*alphabetDimension + currentChar] = ratio;
+                    blockTree->AddBranchToForcedRecomputeList (branchID+leafCount);
+                }
+            }
+
+        // normalize leaf support values, and fill in the last character for internal nodes
+
+        for (long nodeID = 0L; nodeID < matrixSize; nodeID++) {
+            for (long siteID = 0L; siteID < patternCount; siteID++) {
+                hyFloat  sum     = 0.,
+                        *scores  = supportValues.theData + shiftForTheNode*nodeID +  siteID*alphabetDimension;
+
+                for (long charID = 0; charID < alphabetDimension-(!doLeaves); charID ++) {
+                    sum+=scores[charID];
+                }
+
+                if (doLeaves) {
+                    sum = 1./sum;
+                    for (long charID = 0; charID < alphabetDimension; charID ++) {
+                        scores [charID] *= sum;
+                    }
+                } else {
+                    scores[alphabetDimension-1] = 1. - sum;
                 }
-                blockTree->AddBranchToForcedRecomputeList (branchID+leafCount);
             }
         }
 
-    _SimpleList  conversion;
-    _AVLListXL   conversionAVL (&conversion);
-    _String      codeBuffer    (unitLength);
+        delete [] siteLikelihoods;
+        delete [] siteLikelihoodsSpecState;
+    }
+
+    _StringBuffer letters ((alphabetDimension + 1L) * unitLength);
     _List        *result       = new _List;
 
+    for (long state = -1L; state < alphabetDimension; state++) {
+        letters << dsf->ConvertCodeToLetters (dsf->CorrectCode (state), unitLength);
+    }
+
     for (long k = 0L; k < matrixSize; k++) {
         (*result) < new _String((unsigned long)siteCount*unitLength);
     }
@@ -906,54 +1093,27 @@ _List*   _LikelihoodFunction::RecoverAncestralSequencesMarginal (long index, _Ma
         for  (long nodeID = 0; nodeID < matrixSize ; nodeID++) {
             long            mappedNodeID = postToIn.list_data[nodeID];
             hyFloat      max_lik     = 0.,
-                            sum         = 0.,
                             *scores       = supportValues.theData + shiftForTheNode*mappedNodeID +  siteID*alphabetDimension;
             long            max_idx     = 0;
 
-            for (long charID = 0; charID < alphabetDimension-(!doLeaves); charID ++) {
-                sum+=scores[charID];
+            for (long charID = 0; charID < alphabetDimension; charID ++) {
                 if (scores[charID] > max_lik) {
                     max_idx = charID;
                     max_lik = scores[charID];
-
                 }
             }
 
-            //if (fabs(scores[alphabetDimension-1]+sum-1.) > 0.1)
-            //  WarnError (_String("Bad monkey!") & scores[alphabetDimension-1] & ":" & (1.-sum) );
-
-            if (doLeaves) {
-                sum = 1./sum;
-                for (long charID = 0; charID < alphabetDimension; charID ++) {
-                    scores [charID] *= sum;
-                    /*if (siteID == 16)
-                        printf ("Site %ld Leaf %ld (%ld) Char %ld = %g\n", siteID, nodeID, mappedNodeID, charID,
-                                supportValues.theData[mappedNodeID*shiftForTheNode + siteID*alphabetDimension + charID]);
-                     */
-
-                }
-            } else {
-                scores[alphabetDimension-1] = 1. - sum;
-
-                if (scores[alphabetDimension-1] > max_lik) {
-                    max_idx = alphabetDimension-1;
-                }
-            }
-
-            dsf->ConvertCodeToLettersBuffered (dsf->CorrectCode(max_idx), unitLength, codeBuffer, &conversionAVL);
-            _String  *sequence   = (_String*) (*result)(mappedNodeID);
+            char const * code     = letters.get_str() + (max_idx + 1L) * unitLength;
+            _String    * sequence = (_String*) (*result)(mappedNodeID);
 
             for (unsigned long site = 0UL; site < patternMap->countitems(); site++) {
-                //char* storeHere = sequence->sData + patternMap->list_data[site]*unitLength;
                 for (unsigned long charS = 0UL; charS < unitLength; charS ++) {
-                    sequence->set_char (patternMap->get(site)*unitLength + charS, codeBuffer.char_at(charS));
+                    sequence->set_char (patternMap->get(site)*unitLength + charS, code[charS]);
                 }
             }
 
         }
     }
-    delete [] siteLikelihoods;
-    delete [] siteLikelihoodsSpecState;
     return result;
 }
 
@@ -1184,6 +1344,21 @@ hyFloat mapParameterToInverval (hyFloat in, char type, bool inverse)
     return in;
 }
 
+//_______________________________________________________________________________________________
+
+hyFloat mapParameterToIntervalDerivative (hyFloat in, char type)
+// the derivative of the inverse map (mapped -> original value) with respect to the mapped value,
+// expressed as a function of the original value 'in'; used to convert gradients
+{
+    switch (type) {
+    case _hyphyIntervalMapExpit:
+        return M_PI * (1. + in * in);
+    case _hyphyIntervalMapSqueeze:
+        return (1. + in) * (1. + in);
+    }
+    return 1.;
+}
+
 
 
 
@@ -44,6 +44,7 @@
 #include <float.h>
 #include <math.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "matrix.h"
 #include "polynoml.h"
@@ -4621,7 +4622,474 @@ _Matrix*    _Matrix::Exponentiate (hyFloat scale_to, bool check_transition) {
     }
     
     return new _Matrix;
-    
+
+}
+
+//_____________________________________________________________________________________________
+
+_EigenExponential::_EigenExponential (hyFloat const * dense_rates, long dim, hyFloat scale) {
+    dimension   = dim;
+    status      = 0;
+    left        = right = eigenvalues = nil;
+    rates       = new hyFloat [dimension*dimension];
+    max_rate    = 0.;
+
+    hyFloat     inv_scale = 1./scale;
+    for (long k = 0L; k < dimension*dimension; k++) {
+        rates[k] = dense_rates[k] * inv_scale;
+        StoreIfGreater(max_rate, fabs (rates[k]));
+    }
+}
+
+//_____________________________________________________________________________________________
+
+_EigenExponential::~_EigenExponential (void) {
+    delete [] rates;
+    if (left) {
+        delete [] left;
+        delete [] right;
+        delete [] eigenvalues;
+    }
+}
+
+//_____________________________________________________________________________________________
+
+hyFloat _EigenExponential::NormalizingScale (_Matrix const& rate_matrix, hyFloat* dense_rates) {
+    long        dim   = rate_matrix.GetHDim();
+    hyFloat     trace = 0.;
+
+    InitializeArray (dense_rates, dim*dim, 0.0);
+    rate_matrix.ForEachCellNumeric ([&] (hyFloat value, long index, long row, long column) -> void {
+        dense_rates[index] = value;
+        if (row == column) {
+            trace -= value;
+        }
+    });
+
+    return trace;
+}
+
+//_____________________________________________________________________________________________
+
+bool _EigenExponential::Matches (hyFloat const * dense_rates, hyFloat scale) const {
+    if (status < 0) {
+        return false;
+    }
+
+    hyFloat     inv_scale = 1./scale,
+                tolerance = max_rate * 1.e-12;
+
+    // the diagonal is the most likely place for a mismatch to show up first
+
+    for (long d = 0L; d < dimension*dimension; d += dimension+1) {
+        if (fabs (dense_rates[d] * inv_scale - rates[d]) > tolerance) {
+            return false;
+        }
+    }
+
+    for (long k = 0L; k < dimension*dimension; k++) {
+        if (fabs (dense_rates[k] * inv_scale - rates[k]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//_____________________________________________________________________________________________
+
+bool _EigenExponential::Decompose (void) {
+    if (status) {
+        return status > 0;
+    }
+
+    status = -1;
+
+    /*
+        recover the stationary distribution from detailed balance: pi_j = pi_i q_ij / q_ji
+        walking the graph of non-zero rates from state 0
+    */
+
+    hyFloat      * pi   = new hyFloat [dimension];
+    _SimpleList    queue,
+                   visited (dimension, 0, 0);
+
+    InitializeArray (pi, dimension, 0.0);
+    pi[0] = 1.;
+    visited.list_data[0] = 1;
+    queue << 0;
+
+    try {
+        for (unsigned long q = 0UL; q < queue.lLength; q++) {
+            long i = queue.list_data[q];
+            for (long j = 0L; j < dimension; j++) {
+                if (j != i) {
+                    hyFloat ij = rates[i*dimension+j],
+                            ji = rates[j*dimension+i];
+                    if ((ij > 0.) != (ji > 0.)) {
+                        throw (0);
+                    }
+                    if (ij > 0. && !visited.list_data[j]) {
+                        pi[j] = pi[i] * ij / ji;
+                        visited.list_data[j] = 1;
+                        queue << j;
+                    }
+                }
+            }
+        }
+
+        if (queue.lLength != dimension) {
+            throw (0);
+        }
+
+        hyFloat norm = 0.;
+        for (long i = 0L; i < dimension; i++) {
+            norm += pi[i];
+        }
+        for (long i = 0L; i < dimension; i++) {
+            pi[i] /= norm;
+        }
+
+        // check detailed balance and form S = D^{1/2} Q D^{-1/2}, which is symmetric
+
+        _Matrix   symmetric (dimension, dimension, false, true);
+
+        for (long i = 0L; i < dimension; i++) {
+            symmetric.theData[i*dimension+i] = rates[i*dimension+i];
+            for (long j = i+1L; j < dimension; j++) {
+                hyFloat flux_ij = pi[i] * rates[i*dimension+j],
+                        flux_ji = pi[j] * rates[j*dimension+i];
+
+                if (fabs (flux_ij - flux_ji) > 1.e-10 * MAX (flux_ij, flux_ji)) {
+                    throw (0);
+                }
+                hyFloat s = 0.5 * (flux_ij + flux_ji) / sqrt (pi[i]*pi[j]);
+                symmetric.theData[i*dimension+j] = symmetric.theData[j*dimension+i] = s;
+            }
+        }
+
+        _AssociativeList * eigen_system = (_AssociativeList *)symmetric.Eigensystem();
+        _Matrix          * values       = (_Matrix*)eigen_system->GetByKey (0, MATRIX),
+                         * vectors      = (_Matrix*)eigen_system->GetByKey (1, MATRIX);
+
+        if (!values || !vectors || values->GetHDim() != dimension || vectors->GetHDim() != dimension) {
+            DeleteObject (eigen_system);
+            throw (0);
+        }
+
+        left        = new hyFloat [dimension*dimension];
+        right       = new hyFloat [dimension*dimension];
+        eigenvalues = new hyFloat [dimension];
+
+        // U = D^{-1/2} V; U^{-1} = V^T D^{1/2}
+
+        for (long i = 0L; i < dimension; i++) {
+            eigenvalues[i] = values->theData[i];
+            hyFloat root_pi   = sqrt (pi[i]),
+                    i_root_pi = 1./root_pi;
+            for (long k = 0L; k < dimension; k++) {
+                hyFloat v = vectors->theData[i*dimension+k];
+                left  [i*dimension+k] = v * i_root_pi;
+                right [k*dimension+i] = v * root_pi;
+            }
+        }
+
+        DeleteObject (eigen_system);
+        status = 1;
+    } catch (int) {
+        // not reversible; status stays at -1
+    }
+
+    delete [] pi;
+    return status > 0;
+}
+
+//_____________________________________________________________________________________________
+
+_Matrix* _EigenExponential::Exponentiate (hyFloat scale) const {
+    _Matrix * result   = new _Matrix (dimension, dimension, false, true);
+    hyFloat * scaled_l = (hyFloat*)alloca (sizeof (hyFloat) * dimension),
+            * res      = result->theData;
+
+    for (long k = 0L; k < dimension; k++) {
+        scaled_l[k] = exp (scale * eigenvalues[k]);
+    }
+
+    // P = U diag (exp (scale*L)) U^{-1}, accumulated one row at a time
+
+    for (long i = 0L; i < dimension; i++) {
+        hyFloat       * res_row = res + i*dimension;
+        hyFloat const * u_row   = left + i*dimension;
+        for (long k = 0L; k < dimension; k++) {
+            hyFloat         w       = u_row[k] * scaled_l[k];
+            hyFloat const * r_row   = right + k*dimension;
+            for (long j = 0L; j < dimension; j++) {
+                res_row[j] += w * r_row[j];
+            }
+        }
+        
+        // round-off can produce tiny negative transition probabilities; these are set to 0 and the row is
+        // rescaled to sum to 1, unless the clamped mass is more than round-off (an ill-conditioned U),
+        // in which case the caller falls back on _Matrix::Exponentiate
+        
+        hyFloat clamped = 0.,
+                row_sum = 0.;
+        for (long j = 0L; j < dimension; j++) {
+            if (res_row[j] < 0.) {
+                clamped    -= res_row[j];
+                res_row[j]  = 0.;
+            } else {
+                row_sum    += res_row[j];
+            }
+        }
+        if (clamped > 1.e-10 || fabs (row_sum - 1.) > 1.e-8 || row_sum <= 0.) {
+            DeleteObject (result);
+            return nil;
+        }
+        if (clamped > 0.) {
+            hyFloat const inv_sum = 1. / row_sum;
+            for (long j = 0L; j < dimension; j++) {
+                res_row[j] *= inv_sum;
+            }
+        }
+    }
+
+    return result;
+}
+
+//_____________________________________________________________________________________________
+
+_TaylorExponential::_TaylorExponential (hyFloat const * dense_rates, long dim, hyFloat scale) {
+    dimension   = dim;
+    term_count  = 0L;
+    terms       = nil;
+    rates       = new hyFloat [dimension*dimension];
+    max_rate    = 0.;
+    norm        = 0.;
+
+    hyFloat     inv_scale = 1./scale;
+    for (long r = 0L; r < dimension; r++) {
+        hyFloat row_sum = 0.;
+        for (long c = 0L; c < dimension; c++) {
+            hyFloat value = dense_rates[r*dimension+c] * inv_scale;
+            rates[r*dimension+c] = value;
+            row_sum += fabs (value);
+            StoreIfGreater(max_rate, fabs (value));
+        }
+        StoreIfGreater(norm, row_sum);
+    }
+}
+
+//_____________________________________________________________________________________________
+
+_TaylorExponential::~_TaylorExponential (void) {
+    delete [] rates;
+    if (terms) {
+        delete [] terms;
+    }
+}
+
+//_____________________________________________________________________________________________
+
+bool _TaylorExponential::Matches (hyFloat const * dense_rates, hyFloat scale) const {
+    hyFloat     inv_scale = 1./scale,
+                tolerance = max_rate * 1.e-12;
+
+    for (long d = 0L; d < dimension*dimension; d += dimension+1) {
+        if (fabs (dense_rates[d] * inv_scale - rates[d]) > tolerance) {
+            return false;
+        }
+    }
+
+    for (long k = 0L; k < dimension*dimension; k++) {
+        if (fabs (dense_rates[k] * inv_scale - rates[k]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//_____________________________________________________________________________________________
+
+void _TaylorExponential::ComputeTerms (void) {
+    if (terms) {
+        return;
+    }
+
+    // Exponentiate scales c*Q to have norm at most 1/2; keep enough terms for (1/2)^k/k! to drop below round-off
+
+    hyFloat     bound = 1.;
+    term_count  = 0L;
+    do {
+        term_count ++;
+        bound *= 0.5 / term_count;
+    } while (bound > DBL_EPSILON * 0.01);
+
+    long        cells = dimension*dimension;
+    terms       = new hyFloat [cells * term_count];
+    memcpy (terms, rates, sizeof (hyFloat) * cells);
+
+    for (long k = 1L; k < term_count; k++) {
+        hyFloat const * previous = terms + (k-1)*cells;
+        hyFloat       * next     = terms + k*cells;
+        hyFloat         inv_k    = 1./(k+1);
+
+        InitializeArray (next, cells, 0.0);
+        for (long i = 0L; i < dimension; i++) {
+            hyFloat       * next_row = next + i*dimension;
+            hyFloat const * prev_row = previous + i*dimension;
+            for (long l = 0L; l < dimension; l++) {
+                hyFloat w = prev_row[l] * inv_k;
+                if (w != 0.) {
+                    hyFloat const * q_row = rates + l*dimension;
+                    for (long j = 0L; j < dimension; j++) {
+                        next_row[j] += w * q_row[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+//_____________________________________________________________________________________________
+
+_Matrix* _TaylorExponential::Exponentiate (hyFloat scale) const {
+    long        squarings = 0L,
+                cells     = dimension*dimension;
+    hyFloat     reduced   = scale;
+
+    while (fabs (reduced) * norm > 0.5) {
+        reduced *= 0.5;
+        squarings ++;
+    }
+
+    _Matrix * result   = new _Matrix (dimension, dimension, false, true);
+    hyFloat * res      = result->theData,
+              weight   = 1.;
+
+    for (long d = 0L; d < cells; d += dimension + 1) {
+        res[d] = 1.;
+    }
+
+    for (long k = 0L; k < term_count; k++) {
+        hyFloat const * term = terms + k*cells;
+        weight *= reduced;
+        for (long c = 0L; c < cells; c++) {
+            res[c] += weight * term[c];
+        }
+    }
+
+    hyFloat * stash = (hyFloat*)alloca(sizeof (hyFloat) * dimension * (1+dimension));
+    for (long s = 0L; s < squarings; s++) {
+#ifndef _OPENMP
+        squarings_count++;
+#endif
+        if (result->Sqr(stash) < DBL_EPSILON * 1.e3) {
+            break;
+        }
+    }
+
+    for (long d = 0L; d < cells; d += dimension + 1) {
+        if (res[d] > 1.) {
+            DeleteObject (result);
+            return nil;
+        }
+    }
+
+    return result;
+}
+
+//_____________________________________________________________________________________________
+
+void    _Matrix::ExponentiateBatch (hyFloat const * t, long n, _List& results) const {
+    if (!is_square() || !is_numeric()) {
+        HandleApplicationError ("ExponentiateBatch is only defined for square numeric matrices");
+        return;
+    }
+
+    long                dim     = GetHDim();
+    hyFloat           * dense   = new hyFloat [dim*dim];
+
+    InitializeArray (dense, dim*dim, 0.0);
+    ForEachCellNumeric ([dense] (hyFloat value, long index, long, long) -> void {
+        dense[index] = value;
+    });
+
+    _TaylorExponential  series (dense, dim, 1.);
+    series.ComputeTerms();
+
+    for (long i = 0L; i < n; i++) {
+        _Matrix * exponential = series.Exponentiate (t[i]);
+        if (!exponential) {
+            _Matrix scaled (*this);
+            scaled *= t[i];
+            exponential = scaled.Exponentiate (1., true);
+        }
+        results.AppendNewInstance (exponential);
+    }
+
+    delete [] dense;
+}
+
+//_____________________________________________________________________________________________
+
+_CachedExponential::_CachedExponential (hyFloat const * dense_rates, long dim, unsigned long h) {
+    dimension   = dim;
+    hash        = h;
+    exponential = nil;
+    rates       = new hyFloat [dimension*dimension];
+    memcpy (rates, dense_rates, sizeof (hyFloat) * dimension * dimension);
+}
+
+//_____________________________________________________________________________________________
+
+_CachedExponential::~_CachedExponential (void) {
+    delete [] rates;
+    if (exponential) {
+        DeleteObject (exponential);
+    }
+}
+
+//_____________________________________________________________________________________________
+
+unsigned long _CachedExponential::Hash (_Matrix const& rate_matrix, hyFloat* dense_rates) {
+    long        cells = rate_matrix.GetHDim() * rate_matrix.GetVDim();
+
+    InitializeArray (dense_rates, cells, 0.0);
+    rate_matrix.ForEachCellNumeric ([&] (hyFloat value, long index, long, long) -> void {
+        dense_rates[index] = value;
+    });
+
+    // FNV-1a over the bit patterns of the cells
+
+    uint64_t         h     = 14695981039346656037ULL;
+    uint64_t const * bits  = (uint64_t const*)dense_rates;
+    long             words = cells * sizeof (hyFloat) / sizeof (uint64_t);
+
+    for (long k = 0L; k < words; k++) {
+        h = (h ^ bits[k]) * 1099511628211ULL;
+    }
+
+    return (unsigned long)(h ^ (h >> 32));
+}
+
+//_____________________________________________________________________________________________
+
+bool _CachedExponential::Matches (hyFloat const * dense_rates, unsigned long h) const {
+    return h == hash && memcmp (dense_rates, rates, sizeof (hyFloat) * dimension * dimension) == 0;
+}
+
+//_____________________________________________________________________________________________
+
+void _CachedExponential::Store (_Matrix const& value) {
+    if (!exponential) {
+        exponential = new _Matrix (value);
+    }
+}
+
+//_____________________________________________________________________________________________
+
+_Matrix* _CachedExponential::Exponential (void) const {
+    return new _Matrix (*exponential);
 }
 
 //_____________________________________________________________________________________________
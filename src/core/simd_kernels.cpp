@@ -0,0 +1,388 @@
+/*
+
+HyPhy - Hypothesis Testing Using Phylogenies.
+
+Copyright (C) 1997-now
+Core Developers:
+  Sergei L Kosakovsky Pond (spond@ucsd.edu)
+  Art FY Poon    (apoon42@uwo.ca)
+  Steven Weaver (sweaver@ucsd.edu)
+  
+Module Developers:
+	Lance Hepler (nlhepler@gmail.com)
+	Martin Smith (martin.audacis@gmail.com)
+
+Significant contributions from:
+  Spencer V Muse (muse@stat.ncsu.edu)
+  Simon DW Frost (sdf22@cam.ac.uk)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "simd_kernels.h"
+
+#if defined (__x86_64__) && (defined (__GNUC__) || defined (__clang__))
+    #define _HY_SIMD_X86_DISPATCH
+    #include <immintrin.h>
+    #define _HY_TARGET_AVX2     __attribute__ ((target ("avx2,fma")))
+    #define _HY_TARGET_AVX512   __attribute__ ((target ("avx512f")))
+#endif
+
+//_______________________________________________________________________________________
+// portable kernels
+
+static inline hyFloat _row_dot_scalar (hyFloat const * row, hyFloat const * v, unsigned long D) {
+    unsigned long   c = 0UL;
+    hyFloat         accumulator = 0.;
+    
+    for (; c + 4UL <= D; c += 4UL) { // 4 - unroll the loop
+        hyFloat pr1 = row[c]     * v[c],
+                pr2 = row[c+1UL] * v[c+1UL],
+                pr3 = row[c+2UL] * v[c+2UL],
+                pr4 = row[c+3UL] * v[c+3UL];
+        pr1 += pr2;
+        pr3 += pr4;
+        accumulator += pr1+pr3;
+    }
+    for (; c < D; c++) {
+        accumulator += row[c] * v[c];
+    }
+    return accumulator;
+}
+
+static hyFloat _pruning_scalar (hyFloat const * tMatrix, hyFloat const * child, hyFloat * parent, unsigned long D) {
+    hyFloat sum = 0.;
+    for (unsigned long p = 0UL; p < D; p++, tMatrix += D) {
+        sum += (parent[p] *= _row_dot_scalar (tMatrix, child, D));
+    }
+    return sum;
+}
+
+static hyFloat _branch_ll_scalar (hyFloat const * tMatrix, hyFloat const * branch, hyFloat const * root, hyFloat const * freqs, unsigned long D) {
+    hyFloat accumulator = 0.;
+    for (unsigned long p = 0UL; p < D; p++, tMatrix += D) {
+        accumulator += root[p] * freqs[p] * _row_dot_scalar (tMatrix, branch, D);
+    }
+    return accumulator;
+}
+
+#ifdef _HY_SIMD_X86_DISPATCH
+
+//_______________________________________________________________________________________
+// AVX2 + FMA
+
+_HY_TARGET_AVX2 static inline hyFloat _hsum_avx2 (__m256d x) {
+    __m256d sum = _mm256_hadd_pd (x, x);
+    return _mm_cvtsd_f64 (_mm_add_pd (_mm256_extractf128_pd (sum, 1), _mm256_castpd256_pd128 (sum)));
+}
+
+_HY_TARGET_AVX2 static inline hyFloat _row_dot_avx2 (hyFloat const * row, hyFloat const * v, unsigned long D) {
+    __m256d         a0 = _mm256_setzero_pd (),
+                    a1 = _mm256_setzero_pd ();
+    unsigned long   c  = 0UL;
+    
+    for (; c + 8UL <= D; c += 8UL) {
+        a0 = _mm256_fmadd_pd (_mm256_loadu_pd (row + c),       _mm256_loadu_pd (v + c),       a0);
+        a1 = _mm256_fmadd_pd (_mm256_loadu_pd (row + c + 4UL), _mm256_loadu_pd (v + c + 4UL), a1);
+    }
+    if (c + 4UL <= D) {
+        a0 = _mm256_fmadd_pd (_mm256_loadu_pd (row + c), _mm256_loadu_pd (v + c), a0);
+        c += 4UL;
+    }
+    hyFloat accumulator = _hsum_avx2 (_mm256_add_pd (a0, a1));
+    for (; c < D; c++) {
+        accumulator += row[c] * v[c];
+    }
+    return accumulator;
+}
+
+/**
+    dot products of four consecutive matrix rows with v, returned as one vector;
+    v is loaded once per four rows
+*/
+
+_HY_TARGET_AVX2 static inline __m256d _rows4_dot_avx2 (hyFloat const * row, hyFloat const * v, unsigned long D) {
+    hyFloat const * r1 = row + D,
+                  * r2 = r1  + D,
+                  * r3 = r2  + D;
+    
+    __m256d a0 = _mm256_setzero_pd (),
+            a1 = _mm256_setzero_pd (),
+            a2 = _mm256_setzero_pd (),
+            a3 = _mm256_setzero_pd ();
+    
+    unsigned long c = 0UL;
+    
+    for (; c + 4UL <= D; c += 4UL) {
+        __m256d x = _mm256_loadu_pd (v + c);
+        a0 = _mm256_fmadd_pd (_mm256_loadu_pd (row + c), x, a0);
+        a1 = _mm256_fmadd_pd (_mm256_loadu_pd (r1 + c),  x, a1);
+        a2 = _mm256_fmadd_pd (_mm256_loadu_pd (r2 + c),  x, a2);
+        a3 = _mm256_fmadd_pd (_mm256_loadu_pd (r3 + c),  x, a3);
+    }
+    
+    // (a0[0]+a0[1], a1[0]+a1[1], a0[2]+a0[3], a1[2]+a1[3]) etc
+    __m256d s01 = _mm256_hadd_pd (a0, a1),
+            s23 = _mm256_hadd_pd (a2, a3),
+            res = _mm256_add_pd (_mm256_blend_pd (s01, s23, 0xC), _mm256_permute2f128_pd (s01, s23, 0x21));
+    
+    if (c < D) {
+        hyFloat tail [4] = {0., 0., 0., 0.};
+        for (; c < D; c++) {
+            tail[0] += row[c] * v[c];
+            tail[1] += r1[c]  * v[c];
+            tail[2] += r2[c]  * v[c];
+            tail[3] += r3[c]  * v[c];
+        }
+        res = _mm256_add_pd (res, _mm256_loadu_pd (tail));
+    }
+    
+    return res;
+}
+
+_HY_TARGET_AVX2 static inline hyFloat _pruning_avx2_body (hyFloat const * tMatrix, hyFloat const * child, hyFloat * parent, unsigned long D) {
+    __m256d       sum256 = _mm256_setzero_pd ();
+    unsigned long p      = 0UL;
+    
+    for (; p + 4UL <= D; p += 4UL, tMatrix += D << 2) {
+        __m256d updated = _mm256_mul_pd (_mm256_loadu_pd (parent + p), _rows4_dot_avx2 (tMatrix, child, D));
+        _mm256_storeu_pd (parent + p, updated);
+        sum256 = _mm256_add_pd (sum256, updated);
+    }
+    
+    hyFloat sum = _hsum_avx2 (sum256);
+    for (; p < D; p++, tMatrix += D) {
+        sum += (parent[p] *= _row_dot_avx2 (tMatrix, child, D));
+    }
+    return sum;
+}
+
+_HY_TARGET_AVX2 static inline hyFloat _branch_ll_avx2_body (hyFloat const * tMatrix, hyFloat const * branch, hyFloat const * root, hyFloat const * freqs, unsigned long D) {
+    __m256d       sum256 = _mm256_setzero_pd ();
+    unsigned long p      = 0UL;
+    
+    for (; p + 4UL <= D; p += 4UL, tMatrix += D << 2) {
+        sum256 = _mm256_fmadd_pd (_mm256_mul_pd (_mm256_loadu_pd (root + p), _mm256_loadu_pd (freqs + p)), _rows4_dot_avx2 (tMatrix, branch, D), sum256);
+    }
+    
+    hyFloat accumulator = _hsum_avx2 (sum256);
+    for (; p < D; p++, tMatrix += D) {
+        accumulator += root[p] * freqs[p] * _row_dot_avx2 (tMatrix, branch, D);
+    }
+    return accumulator;
+}
+
+// fixed dimension instances let the compiler fully unroll the inner loops
+
+_HY_TARGET_AVX2 static hyFloat _pruning_avx2    (hyFloat const * t, hyFloat const * c, hyFloat * p, unsigned long D) { return _pruning_avx2_body (t, c, p, D); }
+_HY_TARGET_AVX2 static hyFloat _pruning_avx2_20 (hyFloat const * t, hyFloat const * c, hyFloat * p, unsigned long)   { return _pruning_avx2_body (t, c, p, 20UL); }
+_HY_TARGET_AVX2 static hyFloat _pruning_avx2_61 (hyFloat const * t, hyFloat const * c, hyFloat * p, unsigned long)   { return _pruning_avx2_body (t, c, p, 61UL); }
+
+_HY_TARGET_AVX2 static hyFloat _branch_ll_avx2    (hyFloat const * t, hyFloat const * b, hyFloat const * r, hyFloat const * f, unsigned long D) { return _branch_ll_avx2_body (t, b, r, f, D); }
+_HY_TARGET_AVX2 static hyFloat _branch_ll_avx2_20 (hyFloat const * t, hyFloat const * b, hyFloat const * r, hyFloat const * f, unsigned long)   { return _branch_ll_avx2_body (t, b, r, f, 20UL); }
+_HY_TARGET_AVX2 static hyFloat _branch_ll_avx2_61 (hyFloat const * t, hyFloat const * b, hyFloat const * r, hyFloat const * f, unsigned long)   { return _branch_ll_avx2_body (t, b, r, f, 61UL); }
+
+//_______________________________________________________________________________________
+// AVX-512; the tail of each row is handled with a masked load, so no scalar clean-up is needed
+
+_HY_TARGET_AVX512 static inline hyFloat _row_dot_avx512 (hyFloat const * row, hyFloat const * v, unsigned long D) {
+    __m512d         a0 = _mm512_setzero_pd ();
+    unsigned long   c  = 0UL;
+    
+    for (; c + 8UL <= D; c += 8UL) {
+        a0 = _mm512_fmadd_pd (_mm512_loadu_pd (row + c), _mm512_loadu_pd (v + c), a0);
+    }
+    if (c < D) {
+        __mmask8 tail = (__mmask8) ((1U << (D - c)) - 1U);
+        a0 = _mm512_fmadd_pd (_mm512_maskz_loadu_pd (tail, row + c), _mm512_maskz_loadu_pd (tail, v + c), a0);
+    }
+    return _mm512_reduce_add_pd (a0);
+}
+
+_HY_TARGET_AVX512 static inline void _rows4_dot_avx512 (hyFloat const * row, hyFloat const * v, unsigned long D, hyFloat * result) {
+    hyFloat const * r1 = row + D,
+                  * r2 = r1  + D,
+                  * r3 = r2  + D;
+    
+    __m512d a0 = _mm512_setzero_pd (),
+            a1 = _mm512_setzero_pd (),
+            a2 = _mm512_setzero_pd (),
+            a3 = _mm512_setzero_pd ();
+    
+    unsigned long c = 0UL;
+    
+    for (; c + 8UL <= D; c += 8UL) {
+        __m512d x = _mm512_loadu_pd (v + c);
+        a0 = _mm512_fmadd_pd (_mm512_loadu_pd (row + c), x, a0);
+        a1 = _mm512_fmadd_pd (_mm512_loadu_pd (r1 + c),  x, a1);
+        a2 = _mm512_fmadd_pd (_mm512_loadu_pd (r2 + c),  x, a2);
+        a3 = _mm512_fmadd_pd (_mm512_loadu_pd (r3 + c),  x, a3);
+    }
+    if (c < D) {
+        __mmask8 tail = (__mmask8) ((1U << (D - c)) - 1U);
+        __m512d  x    = _mm512_maskz_loadu_pd (tail, v + c);
+        a0 = _mm512_fmadd_pd (_mm512_maskz_loadu_pd (tail, row + c), x, a0);
+        a1 = _mm512_fmadd_pd (_mm512_maskz_loadu_pd (tail, r1 + c),  x, a1);
+        a2 = _mm512_fmadd_pd (_mm512_maskz_loadu_pd (tail, r2 + c),  x, a2);
+        a3 = _mm512_fmadd_pd (_mm512_maskz_loadu_pd (tail, r3 + c),  x, a3);
+    }
+    
+    result[0] = _mm512_reduce_add_pd (a0);
+    result[1] = _mm512_reduce_add_pd (a1);
+    result[2] = _mm512_reduce_add_pd (a2);
+    result[3] = _mm512_reduce_add_pd (a3);
+}
+
+_HY_TARGET_AVX512 static inline hyFloat _pruning_avx512_body (hyFloat const * tMatrix, hyFloat const * child, hyFloat * parent, unsigned long D) {
+    hyFloat       sum = 0.,
+                  dots [4];
+    unsigned long p   = 0UL;
+    
+    for (; p + 4UL <= D; p += 4UL, tMatrix += D << 2) {
+        _rows4_dot_avx512 (tMatrix, child, D, dots);
+        sum += ((parent[p] *= dots[0]) + (parent[p+1UL] *= dots[1])) + ((parent[p+2UL] *= dots[2]) + (parent[p+3UL] *= dots[3]));
+    }
+    for (; p < D; p++, tMatrix += D) {
+        sum += (parent[p] *= _row_dot_avx512 (tMatrix, child, D));
+    }
+    return sum;
+}
+
+_HY_TARGET_AVX512 static inline hyFloat _branch_ll_avx512_body (hyFloat const * tMatrix, hyFloat const * branch, hyFloat const * root, hyFloat const * freqs, unsigned long D) {
+    hyFloat       accumulator = 0.,
+                  dots [4];
+    unsigned long p           = 0UL;
+    
+    for (; p + 4UL <= D; p += 4UL, tMatrix += D << 2) {
+        _rows4_dot_avx512 (tMatrix, branch, D, dots);
+        accumulator += (root[p] * freqs[p] * dots[0] + root[p+1UL] * freqs[p+1UL] * dots[1]) + (root[p+2UL] * freqs[p+2UL] * dots[2] + root[p+3UL] * freqs[p+3UL] * dots[3]);
+    }
+    for (; p < D; p++, tMatrix += D) {
+        accumulator += root[p] * freqs[p] * _row_dot_avx512 (tMatrix, branch, D);
+    }
+    return accumulator;
+}
+
+_HY_TARGET_AVX512 static hyFloat _pruning_avx512    (hyFloat const * t, hyFloat const * c, hyFloat * p, unsigned long D) { return _pruning_avx512_body (t, c, p, D); }
+_HY_TARGET_AVX512 static hyFloat _pruning_avx512_20 (hyFloat const * t, hyFloat const * c, hyFloat * p, unsigned long)   { return _pruning_avx512_body (t, c, p, 20UL); }
+_HY_TARGET_AVX512 static hyFloat _pruning_avx512_61 (hyFloat const * t, hyFloat const * c, hyFloat * p, unsigned long)   { return _pruning_avx512_body (t, c, p, 61UL); }
+
+_HY_TARGET_AVX512 static hyFloat _branch_ll_avx512    (hyFloat const * t, hyFloat const * b, hyFloat const * r, hyFloat const * f, unsigned long D) { return _branch_ll_avx512_body (t, b, r, f, D); }
+_HY_TARGET_AVX512 static hyFloat _branch_ll_avx512_20 (hyFloat const * t, hyFloat const * b, hyFloat const * r, hyFloat const * f, unsigned long)   { return _branch_ll_avx512_body (t, b, r, f, 20UL); }
+_HY_TARGET_AVX512 static hyFloat _branch_ll_avx512_61 (hyFloat const * t, hyFloat const * b, hyFloat const * r, hyFloat const * f, unsigned long)   { return _branch_ll_avx512_body (t, b, r, f, 61UL); }
+
+#endif // _HY_SIMD_X86_DISPATCH
+
+//_______________________________________________________________________________________
+
+static _hy_simd_level _hy_simd_detect_level (void) {
+    _hy_simd_level level = kSIMDScalar;
+    
+#ifdef _HY_SIMD_X86_DISPATCH
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma")) {
+        level = kSIMDAVX2;
+        if (__builtin_cpu_supports ("avx512f")) {
+            level = kSIMDAVX512;
+        }
+    }
+#endif
+    
+    const char * requested = getenv ("HYPHY_SIMD");
+    if (requested) {
+        _hy_simd_level cap = _hy_simd_level_from_name (requested, level);
+        if (cap < level) {
+            level = cap;
+        }
+    }
+    
+    return level;
+}
+
+//_______________________________________________________________________________________
+
+_hy_simd_level _hy_simd_level_from_name (const char * name, _hy_simd_level otherwise) {
+    if (strcmp (name, "scalar") == 0) {
+        return kSIMDScalar;
+    }
+    if (strcmp (name, "avx2") == 0) {
+        return kSIMDAVX2;
+    }
+    if (strcmp (name, "avx512") == 0) {
+        return kSIMDAVX512;
+    }
+    return otherwise;
+}
+
+//_______________________________________________________________________________________
+
+_hy_simd_level _hy_simd_get_level (void) {
+    static const _hy_simd_level level = _hy_simd_detect_level ();
+    return level;
+}
+
+//_______________________________________________________________________________________
+
+const char * _hy_simd_level_name (_hy_simd_level level) {
+    switch (level) {
+        case kSIMDAVX512:
+            return "avx512";
+        case kSIMDAVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+//_______________________________________________________________________________________
+
+_hy_pruning_kernel _hy_select_pruning_kernel (unsigned long D, _hy_simd_level cap) {
+#ifdef _HY_SIMD_X86_DISPATCH
+    switch (cap < _hy_simd_get_level () ? cap : _hy_simd_get_level ()) {
+        case kSIMDAVX512:
+            return D == 20UL ? _pruning_avx512_20 : (D == 61UL ? _pruning_avx512_61 : _pruning_avx512);
+        case kSIMDAVX2:
+            return D == 20UL ? _pruning_avx2_20   : (D == 61UL ? _pruning_avx2_61   : _pruning_avx2);
+        default:
+            break;
+    }
+#endif
+    return _pruning_scalar;
+}
+
+//_______________________________________________________________________________________
+
+_hy_branch_ll_kernel _hy_select_branch_ll_kernel (unsigned long D, _hy_simd_level cap) {
+#ifdef _HY_SIMD_X86_DISPATCH
+    switch (cap < _hy_simd_get_level () ? cap : _hy_simd_get_level ()) {
+        case kSIMDAVX512:
+            return D == 20UL ? _branch_ll_avx512_20 : (D == 61UL ? _branch_ll_avx512_61 : _branch_ll_avx512);
+        case kSIMDAVX2:
+            return D == 20UL ? _branch_ll_avx2_20   : (D == 61UL ? _branch_ll_avx2_61   : _branch_ll_avx2);
+        default:
+            break;
+    }
+#endif
+    return _branch_ll_scalar;
+}
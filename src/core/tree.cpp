@@ -49,6 +49,18 @@
 #include "hbl_env.h"
 #include "category.h"
 #include "likefunc.h"
+#include "simd_kernels.h"
+#include "random_stream.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+    // _hy_wait_until_set: spin-wait hint
+    #include <immintrin.h>
+#endif
+
+#ifdef __UNIX__
+    // _hy_wait_until_set: give the core away while the producer works
+    #include <sched.h>
+#endif
 
 const _String kTreeErrorMessageEmptyTree ("Cannot construct empty trees");
 
@@ -99,7 +111,11 @@ extern  long likeFuncEvalCallCount,
 hyFloat          _lfScalerPower            = 100.,
 _lfScalerUpwards          = pow(2.,_lfScalerPower),
 _lfScalingFactorThreshold = 1./_lfScalerUpwards,
-_logLFScaler              = _lfScalerPower *log(2.);
+_logLFScaler              = _lfScalerPower *log(2.),
+// single precision conditional caches are rescaled (by the same _lfScalerUpwards factor) as soon as
+// a site vector sum leaves [2^-50, 2^50], to keep the stored values well inside the float range
+_lfSinglePrecisionUpper   = pow(2.,50.),
+_lfSinglePrecisionLower   = 1./_lfSinglePrecisionUpper;
 
 
 
@@ -286,6 +302,11 @@ hyFloat  acquireScalerMultiplier (long s) {
 _TheTree::_TheTree () {
     categoryCount           = 1L;
     aCache                  = nil;
+    useEigenExponentials    = false;
+    paddedConditionals      = false;
+    batchExponentials       = false;
+    transitionMatrixCacheSize = 0UL;
+    simdLevel               = kSIMDAVX512;
 }       // default constructor - doesn't do much
 
 
@@ -368,6 +389,11 @@ void    _TheTree::PreTreeConstructor (bool) {
     rooted                  = UNROOTED;
     categoryCount           = 1;
     aCache                  = new _AVLListXL (new _SimpleList);
+    useEigenExponentials    = false;
+    paddedConditionals      = false;
+    batchExponentials       = false;
+    transitionMatrixCacheSize = 0UL;
+    simdLevel               = kSIMDAVX512;
 }
 
 //_______________________________________________________________________________________________
@@ -780,6 +806,108 @@ void _TheTree::SetUp (void) {
 
 //__________________________________________________________________________________
 
+void _TheTree::ApplyTopologyMove (bool spr, node<long>* subtree, node<long>* target, _SimpleList& leaf_map, _SimpleList& node_map, _SimpleList& dirty) {
+    /*
+        20261018: SLKP
+        NNI: swap 'subtree' (a child of v) with 'target' (another child of the parent of v)
+        SPR: prune 'subtree' together with its parent p (which must be a binary non-root node),
+             put the sibling of 'subtree' in place of p, and insert p on the branch above 'target'
+
+        both moves reuse existing nodes and child slots, so NNI (x,y) is undone by NNI (y,x), and
+        SPR (x,y) by SPR (x,s), where s is the sibling of x before the move
+
+        on return, leaf_map and node_map hold the new post-order index of every leaf and internal node
+        (indexed by the old post-order index), and dirty -- the (new, sorted) indices of internal nodes whose
+        subtrees have changed
+    */
+
+    node<long> * parent = subtree ? subtree->get_parent() : nil,
+               * lowest [2] = {nil, nil};
+
+    if (!parent || !target || !target->get_parent() || target == subtree) {
+        throw _String ("Topology moves require two distinct non-root nodes");
+    }
+
+    for (node<long>* ancestor = target; ancestor; ancestor = ancestor->get_parent()) {
+        if (ancestor == subtree) {
+            throw _String ("The target of a topology move can't be inside the moved subtree");
+        }
+    }
+
+    if (spr) {
+        if (parent->is_root() || parent->get_num_nodes() != 2 || target == parent) {
+            throw _String ("SPR moves require the parent of the pruned subtree to be a bifurcating non-root node other than the target");
+        }
+        node<long> * sibling     = parent->go_down (subtree->get_child_num() == 1 ? 2 : 1),
+                   * grandparent = parent->get_parent();
+
+        if (target == sibling) {
+            throw _String ("Regrafting the subtree onto the branch of its sibling does not change the tree");
+        }
+
+        grandparent->replace_node (parent, sibling);
+        sibling->set_parent       (*grandparent);
+
+        node<long> * attach_to = target->get_parent();
+        attach_to->replace_node   (target, parent);
+        parent->set_parent        (*attach_to);
+        parent->replace_node      (sibling, target);
+        target->set_parent        (*parent);
+
+        lowest[0] = parent;
+        lowest[1] = grandparent;
+    } else {
+        node<long> * grandparent = parent->get_parent();
+        if (!grandparent || target->get_parent() != grandparent || target == parent) {
+            throw _String ("NNI moves require the target to be a sibling of the parent of the subtree");
+        }
+        grandparent->replace_node (target, subtree);
+        subtree->set_parent       (*grandparent);
+        parent->replace_node      (subtree, target);
+        target->set_parent        (*parent);
+
+        lowest[0] = parent;
+    }
+
+    _SimpleList old_leaves (flatLeaves),
+                old_nodes  (flatNodes);
+
+    SetUp ();
+
+    auto map_nodes = [] (_SimpleList const& old_order, _SimpleList const& new_order, _SimpleList& map) -> void {
+        _SimpleList sorted  (new_order),
+                    indexer (new_order.lLength, 0, 1);
+        SortLists   (&sorted, &indexer);
+        map.Clear ();
+        old_order.Each ([&] (long value, unsigned long) -> void {
+            map << indexer.get (sorted.BinaryFind (value));
+        });
+    };
+
+    map_nodes (old_leaves, flatLeaves, leaf_map);
+    map_nodes (old_nodes,  flatNodes,  node_map);
+
+    _SimpleList changed (flatNodes.lLength, 0, 0),
+                sorted  (flatNodes),
+                indexer (flatNodes.lLength, 0, 1);
+    SortLists   (&sorted, &indexer);
+
+    for (node<long>* start : lowest) {
+        for (node<long>* ancestor = start; ancestor; ancestor = ancestor->get_parent()) {
+            changed [indexer.get (sorted.BinaryFind ((long)ancestor))] = 1L;
+        }
+    }
+
+    dirty.Clear();
+    changed.Each ([&] (long value, unsigned long index) -> void {
+        if (value) {
+            dirty << index;
+        }
+    });
+}
+
+//__________________________________________________________________________________
+
 bool _TheTree::AllBranchesHaveModels (long matchSize) const {
   // TODO SLKP 20180313: possible deprecation
 
@@ -2681,6 +2809,112 @@ long    _TheTree::ComputeReleafingCost (_DataSetFilter const* dsf, long firstInd
 
 }
 
+//_______________________________________________________________________________________________
+
+inline uint64_t _hy_mix_hash (uint64_t h) {
+    // splitmix64 finalizer
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+//_______________________________________________________________________________________________
+
+inline uint64_t _hy_leaf_column_hash (_DataSetFilter const* dsf, long pattern, unsigned long leaf, long sequence, long unit) {
+    uint64_t h = (leaf + 1UL) * 0x9e3779b97f4a7c15ULL;
+    pattern *= unit;
+    for (long k = 0L; k < unit; k++) {
+        h = _hy_mix_hash (h ^ (unsigned char)dsf->GetColumn (pattern + k)[sequence]);
+    }
+    return h;
+}
+
+//_______________________________________________________________________________________________
+
+class _LeafColumnOrder : public _SimpleList {
+    // pattern indices ordered lexicographically by rows of leaf column hashes
+    public:
+        _LeafColumnOrder (uint64_t const* h, long w) : _SimpleList (), hashes (h), width (w) {}
+
+        virtual hyComparisonType Compare (long i, long j) const {
+            uint64_t const * row1 = hashes + list_data[i] * width,
+                           * row2 = hashes + list_data[j] * width;
+            for (long k = 0L; k < width; k++) {
+                if (row1[k] != row2[k]) {
+                    return row1[k] < row2[k] ? kCompareLess : kCompareGreater;
+                }
+            }
+            return list_data[i] < list_data[j] ? kCompareLess : (list_data[i] > list_data[j] ? kCompareGreater : kCompareEqual);
+        }
+
+    private:
+        uint64_t    const*  hashes;
+        long                width;
+};
+
+//_______________________________________________________________________________________________
+
+void    _TheTree::ClusterPatternsByLeafColumns (_DataSetFilter const* dsf, _SimpleList& order) const {
+
+    long const patterns = dsf->GetPatternCount(),
+               leaves   = flatLeaves.countitems(),
+               unit     = dsf->GetUnitLength();
+
+    // leaves are in post-order, so two patterns that agree on the first k leaves also agree
+    // on every subtree spanned by these leaves, and the sort places them next to each other
+
+    uint64_t * hashes = new uint64_t [patterns * leaves];
+
+#ifdef _OPENMP
+    #pragma omp parallel for default(shared) schedule(static) proc_bind(spread) if (patterns > 1024L)
+#endif
+    for (long p = 0L; p < patterns; p++) {
+        uint64_t * row = hashes + p * leaves;
+        for (long l = 0L; l < leaves; l++) {
+            row[l] = _hy_leaf_column_hash (dsf, p, l, dsf->theNodeMap.get (l), unit);
+        }
+    }
+
+    _LeafColumnOrder sorter (hashes, leaves);
+    sorter.Populate (patterns, 0, 1);
+    sorter.Sort ();
+
+    order.Clear();
+    order << sorter;
+    delete [] hashes;
+}
+
+//_______________________________________________________________________________________________
+
+uint64_t    _TheTree::PatternContentHash (_DataSetFilter const* dsf) const {
+    long const patterns = dsf->GetPatternCount(),
+               leaves   = flatLeaves.countitems(),
+               unit     = dsf->GetUnitLength();
+
+    uint64_t topology = _hy_mix_hash (leaves * 0x9e3779b97f4a7c15ULL + unit),
+             content  = 0ULL;
+
+    for (unsigned long k = 0UL; k < flatParents.countitems(); k++) {
+        topology = _hy_mix_hash (topology ^ (flatParents.get (k) + 2UL));
+    }
+
+    // patterns are hashed independently and combined with their position; the sum is order-independent,
+    // so it can be reduced in parallel
+
+#ifdef _OPENMP
+    #pragma omp parallel for default(shared) schedule(static) proc_bind(spread) reduction(+:content) if (patterns > 1024L)
+#endif
+    for (long p = 0L; p < patterns; p++) {
+        uint64_t h = _hy_mix_hash (p + 1UL);
+        for (long l = 0L; l < leaves; l++) {
+            h = _hy_mix_hash (h ^ _hy_leaf_column_hash (dsf, p, l, dsf->theNodeMap.get (l), unit));
+        }
+        content += h;
+    }
+
+    return _hy_mix_hash (topology ^ content);
+}
+
 
 //_______________________________________________________________________________________________
 
@@ -2740,11 +2974,21 @@ void     _TheTree::AddNodeNamesToDS (_DataSet* ds, bool doTips, bool doInternals
 
 /*----------------------------------------------------------------------------------------------------------*/
 void        _TheTree::ExponentiateMatrices  (_List& expNodes, long tc, long catID) {
-    _List           matrixQueue, nodesToDo;
+    _ExponentialQueue queue;
+    QueueExponentials (expNodes, catID, queue);
+    ExponentiateQueue (queue, tc);
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+void        _TheTree::QueueExponentials  (_List& expNodes, long catID, _ExponentialQueue& queue, bool track_nodes) {
+    _List           &matrixQueue = queue.matrices,
+                    &nodesToDo   = queue.nodes;
     
-    _SimpleList     isExplicitForm;
+    _SimpleList     &isExplicitForm = queue.isExplicitForm;
     bool            hasExpForm = false;
     
+    queue.catID = catID;
+    
     for (unsigned long nodeID = 0; nodeID < expNodes.lLength; nodeID++) {
         long didIncrease = matrixQueue.lLength;
         _CalcNode* thisNode = (_CalcNode*) expNodes(nodeID);
@@ -2764,13 +3008,189 @@ void        _TheTree::ExponentiateMatrices  (_List& expNodes, long tc, long catI
     
     //printf ("%ld %d\n", nodesToDo.lLength, hasExpForm);
     
-    unsigned long matrixID;
+    queue.hasExplicitForm = hasExpForm;
+    
+    if (hasExpForm) {
+        queue.computed.Populate (matrixQueue.lLength, 0, 0);
+    }
+    
+    unsigned long   to_exponentiate = matrixQueue.lLength;
+    
+    if (transitionMatrixCacheSize && to_exponentiate) {
+        to_exponentiate = MapToCachedExponentials (queue);
+    }
+    
+    /*
+        for reversible models, match each rate matrix (up to a scalar multiple) against
+        cached spectral decompositions; this is done serially, so that the parallel loop
+        below only reads from the decompositions
+    */
+    
+    if (useEigenExponentials && matrixQueue.lLength) {
+        queue.eigenScales = new hyFloat [matrixQueue.lLength];
+        hyFloat * buffer = new hyFloat [cBase*cBase];
+        for (unsigned long matrixID = 0; matrixID < matrixQueue.lLength; matrixID++) {
+            _EigenExponential * source = nil;
+            if ((isExplicitForm.list_data[matrixID] == 0 || !hasExpForm) && (!queue.cacheReady || queue.duplicateOf.list_data[matrixID] == -1L)) {
+                source = MapToEigenExponential (*(_Matrix*)matrixQueue(matrixID), queue.eigenScales[matrixID], buffer, queue.eigenInUse);
+            }
+            queue.eigenSources << (long)source;
+        }
+        delete [] buffer;
+    }
+    
+    if (batchExponentials && to_exponentiate > 1UL) {
+        MapToTaylorExponentials (queue);
+    }
+    
+    // explicit form matrices are assembled by FinishExponentials, so node tracking only applies without them
+    
+    if (track_nodes && !hasExpForm) {
+        long         nodeCount = flatLeaves.lLength + flatTree.lLength;
+        _SimpleList  queuedNodes,
+                     queueOrder (nodesToDo.lLength, 0, 1);
+        
+        queue.ready = new char [nodeCount];
+        InitializeArray (queue.ready, nodeCount, (char)1);
+        queue.flatIndices.Populate (nodesToDo.lLength, -1, 0);
+        
+        nodesToDo.ForEach ([&queuedNodes] (BaseRef node, unsigned long) -> void {
+            queuedNodes << (long)node;
+        });
+        SortLists (&queuedNodes, &queueOrder);
+        
+        for (long nodeCode = 0L; nodeCode + 1L < nodeCount; nodeCode++) {
+            long f = queuedNodes.BinaryFind ((long)GetNodeFromFlatIndex (nodeCode));
+            if (f >= 0L) {
+                queue.ready [nodeCode] = 0;
+                queue.flatIndices.list_data [queueOrder.list_data[f]] = nodeCode;
+            }
+        }
+    }
+    
+#ifdef _OPENMP
+    hy_global::matrix_exp_count += to_exponentiate;
+#endif
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+static void _hy_wait_until_set (char const * flag) {
+    /*
+        20261018: SLKP
+        wait for another thread to set *flag; after a short spin (with a pause hint),
+        yield the core, so that a waiting thread does not starve the one it is waiting on
+        when there are more threads than cores
+    */
+    unsigned long spins = 0UL;
+    while (true) {
+        char is_ready;
+#ifdef _OPENMP
+  #pragma omp atomic read
+#endif
+        is_ready = *flag;
+        if (is_ready) {
+            break;
+        }
+        if (++spins < 256UL) {
+#if defined (__x86_64__) || defined (__i386__)
+            _mm_pause ();
+#endif
+        } else {
+#ifdef __UNIX__
+            sched_yield ();
+#endif
+        }
+    }
+#ifdef _OPENMP
+  #pragma omp flush
+#endif
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+void        _TheTree::ExponentiateQueued  (_ExponentialQueue& queue, unsigned long matrixID) const {
+    _CachedExponential * cached = queue.cacheReady ? (_CachedExponential*)queue.cacheEntries.list_data[matrixID] : nil;
+    _Matrix            * result = nil;
+    
+    if (cached) {
+        long source = queue.duplicateOf.list_data[matrixID];
+        if (source >= 0L) {
+            // the same matrix appears earlier in this queue; it has been claimed by this or another thread already
+            _hy_wait_until_set (queue.cacheReady + source);
+        }
+        if (source != -1L) {
+            result = cached->Exponential();
+        }
+    }
+    
+    if (!result && queue.taylorScales && queue.taylorSources.list_data[matrixID]) {
+        _TaylorExponential * series = (_TaylorExponential*)queue.taylorSources.list_data[matrixID];
+        long                 leader = queue.taylorLeaders.list_data[matrixID];
+        if (leader == matrixID) {
+            series->ComputeTerms();
+#ifdef _OPENMP
+  #pragma omp flush
+  #pragma omp atomic write
+#endif
+            queue.taylorReady [matrixID] = 1;
+        } else {
+            _hy_wait_until_set (queue.taylorReady + leader);
+        }
+        result = series->Exponentiate (queue.taylorScales[matrixID]);
+        // nil if the batched result failed the transition matrix check; recompute it directly below
+    }
+    
+    if (!result) {
+        if (queue.isExplicitForm.list_data[matrixID] == 0 || !queue.hasExplicitForm) { // normal matrix to exponentiate
+            _EigenExponential * source = queue.eigenScales ? (_EigenExponential*)queue.eigenSources.list_data[matrixID] : nil;
+            result = source ? source->Exponentiate (queue.eigenScales[matrixID]) : nil;
+            if (!result) {
+                result = ((_Matrix*)queue.matrices(matrixID))->Exponentiate(1., true);
+            }
+        } else {
+            result = ((_Matrix*)queue.matrices(matrixID))->Exponentiate(1., true);
+        }
+    }
+    
+    if (cached && !cached->IsStored()) {
+        cached->Store (*result);
+#ifdef _OPENMP
+  #pragma omp flush
+  #pragma omp atomic write
+#endif
+        queue.cacheReady [matrixID] = 1;
+    }
+    
+    if (queue.isExplicitForm.list_data[matrixID] == 0 || !queue.hasExplicitForm) {
+        ((_CalcNode*) queue.nodes(matrixID))->SetCompExp (result, queue.catID);
+    } else {
+        queue.computed.list_data [matrixID] = (long)result;
+    }
     
-    _List * computedExponentials = hasExpForm? new _List (matrixQueue.lLength) : nil;
+    if (queue.ready) {
+        long nodeCode = queue.flatIndices.list_data[matrixID];
+        if (nodeCode >= 0L) {
+#ifdef _OPENMP
+  #pragma omp flush
+  #pragma omp atomic write
+#endif
+            queue.ready [nodeCode] = 1;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+void        _ExponentialQueue::WaitFor  (long nodeCode) const {
+    if (ready) {
+        _hy_wait_until_set (ready + nodeCode);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+void        _TheTree::ExponentiateQueue  (_ExponentialQueue& queue, long tc) {
+    unsigned long matrixID;
     
 #ifdef _OPENMP
-    unsigned long nt = cBase<20?1:(MIN(tc, matrixQueue.lLength / 3 + 1));
-    hy_global::matrix_exp_count += matrixQueue.lLength;
+    unsigned long nt = cBase<20?1:(MIN(tc, queue.countitems() / 3 + 1));
 #endif
 
 #ifdef _OPENMP
@@ -2782,21 +3202,39 @@ void        _TheTree::ExponentiateMatrices  (_List& expNodes, long tc, long catI
   #endif
 #endif
 #endif
-    for  (matrixID = 0; matrixID < matrixQueue.lLength; matrixID++) {
-        if (isExplicitForm.list_data[matrixID] == 0 || !hasExpForm) { // normal matrix to exponentiate
-            ((_CalcNode*) nodesToDo(matrixID))->SetCompExp (((_Matrix*)matrixQueue(matrixID))->Exponentiate(1., true), catID);
-        } else {
-            (*computedExponentials) [matrixID] = ((_Matrix*)matrixQueue(matrixID))->Exponentiate(1., true);
+    for  (matrixID = 0; matrixID < queue.countitems(); matrixID++) {
+        ExponentiateQueued (queue, matrixID);
+    }
+    
+    FinishExponentials (queue);
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+void        _TheTree::FinishExponentials  (_ExponentialQueue& queue) {
+    
+    if (queue.cacheReady) {
+        // register the matrices computed for this queue, most recent first
+        for (unsigned long matrixID = 0UL; matrixID < queue.cacheEntries.lLength; matrixID++) {
+            _CachedExponential * cached = (_CachedExponential*)queue.cacheEntries.list_data[matrixID];
+            if (cached && queue.duplicateOf.list_data[matrixID] == -1L && cached->IsStored()) {
+                cached->AddAReference();
+                transitionMatrixCache.InsertElement (cached, 0, false, false);
+            }
+        }
+        while (transitionMatrixCache.lLength > transitionMatrixCacheSize) {
+            transitionMatrixCache.Delete (transitionMatrixCache.lLength - 1);
         }
+        queue.cacheInUse.Clear();
     }
- 
-    if (computedExponentials) {
+    
+    if (queue.hasExplicitForm) {
         _CalcNode * current_node         = nil;
         _List       buffered_exponentials;
+        long        catID                = queue.catID;
         
-        for (unsigned long mx_index = 0; mx_index < nodesToDo.lLength; mx_index++) {
-            if (isExplicitForm.list_data[mx_index]) {
-                _CalcNode *next_node = (_CalcNode*) nodesToDo (mx_index);
+        for (unsigned long mx_index = 0; mx_index < queue.nodes.lLength; mx_index++) {
+            if (queue.isExplicitForm.list_data[mx_index]) {
+                _CalcNode *next_node = (_CalcNode*) queue.nodes (mx_index);
                 //printf ("%x %x\n", current_node, next_node);
                 if (next_node != current_node) {
                     if (current_node) {
@@ -2804,10 +3242,10 @@ void        _TheTree::ExponentiateMatrices  (_List& expNodes, long tc, long catI
                     }
                     current_node = next_node;
                     buffered_exponentials.Clear(true);
-                    buffered_exponentials.AppendNewInstance((*computedExponentials)(mx_index));
+                    buffered_exponentials.AppendNewInstance((BaseRef)queue.computed.list_data[mx_index]);
                 }
                 else {
-                    buffered_exponentials.AppendNewInstance((*computedExponentials)(mx_index));
+                    buffered_exponentials.AppendNewInstance((BaseRef)queue.computed.list_data[mx_index]);
                 }
             } else {
                 if (current_node) {
@@ -2819,7 +3257,7 @@ void        _TheTree::ExponentiateMatrices  (_List& expNodes, long tc, long catI
         if (current_node) {
             current_node->RecomputeMatrix (catID, categoryCount, nil, nil, nil, &buffered_exponentials);
         }
-        DeleteObject(computedExponentials);
+        queue.computed.Clear();
 #ifdef _UBER_VERBOSE_DUMP_MATRICES
         if (likeFuncEvalCallCount == _UBER_VERBOSE_DUMP) {
             fprintf (stderr, "\n T_MATRIX = {");
@@ -2844,6 +3282,210 @@ void        _TheTree::ExponentiateMatrices  (_List& expNodes, long tc, long catI
 
 /*----------------------------------------------------------------------------------------------------------*/
 
+unsigned long  _TheTree::MapToCachedExponentials (_ExponentialQueue& queue) {
+    /*
+        look up every queued matrix in the transition matrix cache (moving hits to the
+        front of the most-recently-used list), and find matrices that repeat earlier
+        ones in the same queue; the new matrices are added to the cache by
+        FinishExponentials once they have been exponentiated
+
+        returns the number of matrices that will actually be exponentiated
+    */
+    
+    unsigned long   count      = queue.matrices.lLength,
+                    to_compute = 0UL,
+                    hits       = 0UL;
+    
+    hyFloat       * buffer     = new hyFloat [cBase*cBase];
+    _SimpleList     new_entries;
+    
+    queue.cacheReady = new char [count];
+    InitializeArray (queue.cacheReady, count, (char)0);
+    queue.cacheEntries.Populate (count, 0L, 0L);
+    queue.duplicateOf.Populate  (count, -1L, 0L);
+    
+    for (unsigned long matrixID = 0UL; matrixID < count; matrixID++) {
+        _Matrix const * rate_matrix = (_Matrix const*)queue.matrices.GetItem (matrixID);
+        
+        if (!rate_matrix->is_numeric() || rate_matrix->GetHDim() != cBase || rate_matrix->GetVDim() != cBase) {
+            to_compute ++;
+            continue;
+        }
+        
+        unsigned long        hash   = _CachedExponential::Hash (*rate_matrix, buffer);
+        _CachedExponential * cached = nil;
+        
+        for (unsigned long k = 0UL; k < transitionMatrixCache.lLength; k++) {
+            cached = (_CachedExponential*)transitionMatrixCache.GetItem(k);
+            if (cached->Matches (buffer, hash)) {
+                for (unsigned long j = k; j > 0UL; j--) {
+                    transitionMatrixCache.list_data[j] = transitionMatrixCache.list_data[j-1];
+                }
+                transitionMatrixCache.list_data[0] = (long)cached;
+                queue.duplicateOf.list_data[matrixID] = -2L;
+                break;
+            }
+            cached = nil;
+        }
+        
+        if (!cached) {
+            for (unsigned long k = 0UL; k < new_entries.lLength; k++) {
+                _CachedExponential * pending = (_CachedExponential*)queue.cacheEntries.list_data[new_entries.list_data[k]];
+                if (pending->Matches (buffer, hash)) {
+                    cached = pending;
+                    queue.duplicateOf.list_data[matrixID] = new_entries.list_data[k];
+                    break;
+                }
+            }
+        }
+        
+        if (cached) {
+            hits ++;
+            queue.cacheInUse << cached;
+        } else {
+            cached = new _CachedExponential (buffer, cBase, hash);
+            queue.cacheInUse < cached;
+            new_entries << matrixID;
+            to_compute ++;
+        }
+        queue.cacheEntries.list_data[matrixID] = (long)cached;
+    }
+    
+    delete [] buffer;
+    
+    hy_global::matrix_exp_cache_hits   += hits;
+    hy_global::matrix_exp_cache_misses += new_entries.lLength;
+    
+    return to_compute;
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+
+void  _TheTree::MapToTaylorExponentials (_ExponentialQueue& queue) {
+    /*
+        group the queued matrices that will be exponentiated directly (i.e. not served
+        from the transition matrix cache or a spectral decomposition) by their rate
+        matrix normalized to unit trace; groups with at least two members share the
+        Taylor series terms of that matrix
+    */
+    
+    unsigned long   count      = queue.matrices.lLength;
+    hyFloat       * buffer     = new hyFloat [cBase*cBase];
+    _SimpleList     group_sizes;
+    
+    queue.taylorScales = new hyFloat [count];
+    queue.taylorReady  = new char    [count];
+    InitializeArray (queue.taylorReady, count, (char)0);
+    queue.taylorSources.Populate (count, 0L, 0L);
+    queue.taylorLeaders.Populate (count, -1L, 0L);
+    
+    for (unsigned long matrixID = 0UL; matrixID < count; matrixID++) {
+        if (queue.cacheReady && queue.duplicateOf.list_data[matrixID] != -1L) {
+            continue;
+        }
+        if (queue.eigenScales && queue.eigenSources.list_data[matrixID]) {
+            continue;
+        }
+        
+        _Matrix const * rate_matrix = (_Matrix const*)queue.matrices.GetItem (matrixID);
+        if (!rate_matrix->is_numeric() || rate_matrix->GetHDim() != cBase || rate_matrix->GetVDim() != cBase || cBase < 2L) {
+            continue;
+        }
+        
+        hyFloat scale = _EigenExponential::NormalizingScale (*rate_matrix, buffer);
+        if (scale <= 0.) {
+            continue;
+        }
+        
+        long group = -1L;
+        for (unsigned long k = 0UL; k < queue.taylorInUse.lLength; k++) {
+            if (((_TaylorExponential*)queue.taylorInUse.GetItem(k))->Matches (buffer, scale)) {
+                group = k;
+                break;
+            }
+        }
+        
+        if (group < 0L) {
+            group = queue.taylorInUse.lLength;
+            queue.taylorInUse < new _TaylorExponential (buffer, cBase, scale);
+            group_sizes << 0L;
+        }
+        
+        group_sizes.list_data[group] ++;
+        queue.taylorSources.list_data[matrixID] = group;
+        queue.taylorLeaders.list_data[matrixID] = matrixID;
+        queue.taylorScales[matrixID]            = scale;
+    }
+    
+    delete [] buffer;
+    
+    // replace group indices with pointers, and point every member at the first matrix in its group
+    
+    _SimpleList     leaders (queue.taylorInUse.lLength, -1L, 0L);
+    
+    for (unsigned long matrixID = 0UL; matrixID < count; matrixID++) {
+        if (queue.taylorLeaders.list_data[matrixID] >= 0L) {
+            long group = queue.taylorSources.list_data[matrixID];
+            if (group_sizes.list_data[group] > 1L) {
+                if (leaders.list_data[group] < 0L) {
+                    leaders.list_data[group] = matrixID;
+                }
+                queue.taylorLeaders.list_data[matrixID] = leaders.list_data[group];
+                queue.taylorSources.list_data[matrixID] = (long)queue.taylorInUse.GetItem(group);
+            } else {
+                queue.taylorLeaders.list_data[matrixID] = -1L;
+                queue.taylorSources.list_data[matrixID] = 0L;
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+
+_EigenExponential*  _TheTree::MapToEigenExponential (_Matrix const& rate_matrix, hyFloat& scale, hyFloat* buffer, _List& in_use) {
+    /*
+        find the decomposition of the rate matrix (normalized to unit trace) in the
+        most-recently-used list, registering it if this is the first time it has been seen;
+        returns nil if the matrix should be exponentiated directly
+    */
+    
+    if (!rate_matrix.is_numeric() || rate_matrix.GetHDim() != cBase || cBase < 2L) {
+        return nil;
+    }
+    
+    scale = _EigenExponential::NormalizingScale (rate_matrix, buffer);
+    
+    if (scale <= 0.) {
+        return nil;
+    }
+    
+    for (unsigned long k = 0UL; k < eigenExponentials.lLength; k++) {
+        _EigenExponential * cached = (_EigenExponential*)eigenExponentials.GetItem(k);
+        if (cached->Matches (buffer, scale)) {
+            for (unsigned long j = k; j > 0UL; j--) {
+                eigenExponentials.list_data[j] = eigenExponentials.list_data[j-1];
+            }
+            eigenExponentials.list_data[0] = (long)cached;
+            if (cached->Decompose()) {
+                in_use << cached;
+                return cached;
+            }
+            return nil;
+        }
+    }
+    
+    eigenExponentials.InsertElement (new _EigenExponential (buffer, cBase, scale), 0, false, false);
+    
+    unsigned long cache_limit = MAX (16L, 2L * (flatLeaves.lLength + flatTree.lLength));
+    while (eigenExponentials.lLength > cache_limit) {
+        eigenExponentials.Delete (eigenExponentials.lLength - 1);
+    }
+    
+    return nil;
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+
 long        _TheTree::DetermineNodesForUpdate   (_SimpleList& updateNodes, _List* expNodes, long catID, long addOne, bool canClear) {
   nodesToUpdate.Populate (flatLeaves.lLength + flatTree.lLength, 0, 0);
   _CalcNode       *currentTreeNode;
@@ -2916,7 +3558,8 @@ long        _TheTree::DetermineNodesForUpdate   (_SimpleList& updateNodes, _List
 
 /*----------------------------------------------------------------------------------------------------------*/
 
-void        _TheTree::FillInConditionals        (_DataSetFilter const*        theFilter, hyFloat*  iNodeCache,  _SimpleList*   tcc)
+template <typename CACHE_TYPE>
+void        _TheTree::FillInConditionals        (_DataSetFilter const*        theFilter, CACHE_TYPE*  iNodeCache,  _SimpleList*   tcc)
 // this utility function will simply fill in all the conditional probability vectors for internal nodes,
 // including those that were skipped due to column sorting optimization
 // this is useful to avoid code duplication for other functions (e.g. ancestral sampling) that
@@ -2927,18 +3570,19 @@ void        _TheTree::FillInConditionals        (_DataSetFilter const*        th
     }
     
     long            alphabetDimension     =         theFilter->GetDimension(),
+    stride              =         GetConditionalStride (alphabetDimension),
     siteCount           =         theFilter->GetPatternCount();
     
     for  (long nodeID = 0; nodeID < flatTree.lLength; nodeID++) {
-        hyFloat * conditionals       = iNodeCache +(nodeID  * siteCount) * alphabetDimension;
+        CACHE_TYPE * conditionals    = iNodeCache +(nodeID  * siteCount) * stride;
         long        currentTCCIndex     = siteCount * nodeID,
         currentTCCBit        = currentTCCIndex % _HY_BITMASK_WIDTH_;
         
         currentTCCIndex /= _HY_BITMASK_WIDTH_;
-        for (long siteID = 0; siteID < siteCount; siteID++, conditionals += alphabetDimension) {
+        for (long siteID = 0; siteID < siteCount; siteID++, conditionals += stride) {
             if (siteID  && (tcc->list_data[currentTCCIndex] & bitMaskArray.masks[currentTCCBit]) > 0) {
                 for (long k = 0; k < alphabetDimension; k++) {
-                    conditionals[k] = conditionals[k-alphabetDimension];
+                    conditionals[k] = conditionals[k-stride];
                 }
             }
             if (++currentTCCBit == _HY_BITMASK_WIDTH_) {
@@ -2950,14 +3594,45 @@ void        _TheTree::FillInConditionals        (_DataSetFilter const*        th
     }
 }
 
+template void _TheTree::FillInConditionals<hyFloat> (_DataSetFilter const*, hyFloat*, _SimpleList*);
+template void _TheTree::FillInConditionals<float>   (_DataSetFilter const*, float*,   _SimpleList*);
+
 
 /*----------------------------------------------------------------------------------------------------------*/
 
-hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList&        siteOrdering,
-                                                  _SimpleList&        updateNodes,
+// 20261018: SLKP
+// single precision conditional caches (see _LikelihoodFunction::singlePrecisionConditionals) are only used
+// for storage: a site vector is widened into a double buffer, updated and rescaled there, and narrowed back
+// only after rescaling, so that it is never stored outside the float range; for double caches these are no-ops
+
+inline hyFloat * _hy_widen_conditionals (hyFloat * conditionals, hyFloat *, unsigned long) {
+    return conditionals;
+}
+
+inline hyFloat * _hy_widen_conditionals (float * conditionals, hyFloat * buffer, unsigned long dimension) {
+    for (unsigned long k = 0UL; k < dimension; k++) {
+        buffer[k] = conditionals[k];
+    }
+    return buffer;
+}
+
+inline void _hy_narrow_conditionals (hyFloat *, hyFloat const *, unsigned long) {
+}
+
+inline void _hy_narrow_conditionals (float * conditionals, hyFloat const * buffer, unsigned long dimension) {
+    for (unsigned long k = 0UL; k < dimension; k++) {
+        conditionals[k] = buffer[k];
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+
+template <typename CACHE_TYPE>
+hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList&        siteOrdering,
+                                                  _SimpleList&        updateNodes,
                                                   _SimpleList*        tcc,
                                                   _DataSetFilter const*     theFilter,
-                                                  hyFloat*         iNodeCache,
+                                                  CACHE_TYPE*         iNodeCache,
                                                   long      *         lNodeFlags,
                                                   hyFloat*         scalingAdjustments,
                                                   _Vector*     lNodeResolutions,
@@ -2968,17 +3643,34 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
                                                   hyFloat*         storageVec,
                                                   long*               siteCorrectionCounts,
                                                   long                setBranch,
-                                                  long*               setBranchTo
+                                                  long*               setBranchTo,
+                                                  _ExponentialQueue const* pendingMatrices
                                                   )
 // the updateNodes flags the nodes (leaves followed by inodes in the same order as flatLeaves and flatNodes)
 // that must be recomputed
+// if pendingMatrices is provided, transition matrices for some of the nodes may still be in the process of
+// being computed (by other threads); each node will wait for its matrix before it is used
+// CACHE_TYPE is hyFloat, or float for single precision caches; in the latter case every update
+// (including leaves with resolved states) is checked for scaling, and the scaling thresholds are tighter
 {
     // process the leaves first
     
     _SimpleList     taggedInternals                 (flatNodes.lLength, 0, 0);
     unsigned long   const alphabetDimension     =         theFilter->GetDimension(),
     siteCount           =         theFilter->GetPatternCount(),
-    alphabetDimensionmod4  =      (alphabetDimension >> 2) << 2;
+    alphabetDimensionmod4  =      (alphabetDimension >> 2) << 2,
+    stride              =         GetConditionalStride (alphabetDimension);
+    
+    _hy_pruning_kernel const pruning_kernel = _hy_select_pruning_kernel (alphabetDimension, (_hy_simd_level)simdLevel);
+    
+    bool      const single_precision = sizeof (CACHE_TYPE) < sizeof (hyFloat);
+    hyFloat   const scale_up_below   = single_precision ? _lfSinglePrecisionLower : _lfScalingFactorThreshold,
+                    scale_down_above = single_precision ? _lfSinglePrecisionUpper : _lfScalerUpwards,
+                    scaler_ceiling   = single_precision ? FLT_MAX : HUGE_VAL,
+                    scaler_floor     = single_precision ? FLT_MIN : 0.0;
+    
+    hyFloat       * widened_parent   = single_precision ? new hyFloat [stride << 1] : nil,
+                  * widened_child    = single_precision ? widened_parent + stride : nil;
     
     _CalcNode       *currentTreeNode;
     long            localScalerChange     =         0;
@@ -2997,7 +3689,7 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
             nodeCode -=  flatLeaves.lLength;
         }
         
-        hyFloat * parentConditionals = iNodeCache +            (siteFrom + parentCode  * siteCount) * alphabetDimension;
+        CACHE_TYPE * parentConditionals = iNodeCache +            (siteFrom + parentCode  * siteCount) * stride;
         if (taggedInternals.list_data[parentCode] == 0)
             // mark the parent for update and clear its conditionals if needed
         {
@@ -3028,15 +3720,15 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
                     }
                 }
             } else {
-                hyFloat * pp = parentConditionals;
+                CACHE_TYPE * pp = parentConditionals;
                 if (matchSet) {
-                    memset (parentConditionals, 0, (siteTo-siteFrom) * sizeof (hyFloat));
-                    for (long k = siteFrom; k < siteTo; k++, pp +=   alphabetDimension) {
+                    memset (parentConditionals, 0, (siteTo-siteFrom) * stride * sizeof (CACHE_TYPE));
+                    for (long k = siteFrom; k < siteTo; k++, pp +=   stride) {
                          pp[setBranchTo[siteOrdering.list_data[k]]] = localScalingFactor[k];
                     }
                 } else {
-                    for (long k = siteFrom; k < siteTo; k++, pp += alphabetDimension) {
-                        InitializeArray(pp, alphabetDimension, (hyFloat)localScalingFactor[k]);
+                    for (long k = siteFrom; k < siteTo; k++, pp += stride) {
+                        InitializeArray(pp, alphabetDimension, (CACHE_TYPE)localScalingFactor[k]);
                     }
                 }
             }
@@ -3045,11 +3737,15 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
         currentTreeNode = isLeaf? ((_CalcNode*) flatCLeaves (nodeCode)):
         ((_CalcNode*) flatTree    (nodeCode));
         
+        if (pendingMatrices) {
+            pendingMatrices->WaitFor (updateNodes.list_data [nodeID]);
+        }
+        
         hyFloat  const * transitionMatrix = currentTreeNode->GetCompExp(catID)->theData;
         
         
-        hyFloat  *       childVector,
-        *       lastUpdatedSite;
+        CACHE_TYPE  *       childVector,
+                    *       lastUpdatedSite;
         
 #ifdef _SLKP_USE_AVX_INTRINSICS
         __m256d tmatrix_transpose [4] = {
@@ -3061,7 +3757,7 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
 #endif
         
         if (!isLeaf) {
-            childVector = iNodeCache + (siteFrom + nodeCode * siteCount) * alphabetDimension;
+            childVector = iNodeCache + (siteFrom + nodeCode * siteCount) * stride;
         }
         
         long currentTCCIndex        ,
@@ -3082,7 +3778,7 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
         
         //long successiveSkips = 0;
         
-        for (long siteID = siteFrom; siteID < siteTo; siteID++, parentConditionals += alphabetDimension) {
+        for (long siteID = siteFrom; siteID < siteTo; siteID++, parentConditionals += stride) {
             if (tcc) {
                 if (parentTCCIBit == _HY_BITMASK_WIDTH_) {
                     parentTCCIBit   = 0;
@@ -3091,7 +3787,7 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
                 
                 if (siteID > siteFrom && (tcc->list_data[parentTCCIIndex] & bitMaskArray.masks[parentTCCIBit]) > 0) {
                     if (!isLeaf) {
-                        childVector     += alphabetDimension;
+                        childVector     += stride;
                         if (++currentTCCBit == _HY_BITMASK_WIDTH_) {
                             currentTCCBit   = 0;
                             currentTCCIndex ++;
@@ -3112,6 +3808,9 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
             
             char        didScale = 0;
             
+            hyFloat       * work  = _hy_widen_conditionals (parentConditionals, widened_parent, alphabetDimension);
+            hyFloat const * child = nil;
+            
             if (isLeaf) {
                 long siteState;
                 
@@ -3124,27 +3823,32 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
                     // a single character state; sweep down the appropriate column
                 {
                     if (alphabetDimension == 4UL) {
-                        parentConditionals[0] *= tMatrix[siteState];
-                        parentConditionals[1] *= tMatrix[siteState+4UL];
-                        parentConditionals[2] *= tMatrix[siteState+8UL];
-                        parentConditionals[3] *= tMatrix[siteState+12UL];
+                        work[0] *= tMatrix[siteState];
+                        work[1] *= tMatrix[siteState+4UL];
+                        work[2] *= tMatrix[siteState+8UL];
+                        work[3] *= tMatrix[siteState+12UL];
                     } else {
                         unsigned long k = 0UL;
                         unsigned long target_index = siteState;
                         unsigned long shifter = alphabetDimension << 2;
                         for (; k < alphabetDimensionmod4; k+=4UL, target_index += shifter) {
-                            parentConditionals[k]    *= tMatrix[target_index];
-                            parentConditionals[k+1L] *= tMatrix[target_index + alphabetDimension];
-                            parentConditionals[k+2L] *= tMatrix[target_index + alphabetDimension + alphabetDimension];
-                            parentConditionals[k+3L] *= tMatrix[target_index + alphabetDimension + alphabetDimension + alphabetDimension];
+                            work[k]    *= tMatrix[target_index];
+                            work[k+1L] *= tMatrix[target_index + alphabetDimension];
+                            work[k+2L] *= tMatrix[target_index + alphabetDimension + alphabetDimension];
+                            work[k+3L] *= tMatrix[target_index + alphabetDimension + alphabetDimension + alphabetDimension];
                         }
                         for (; k < alphabetDimension; k++, target_index += alphabetDimension) {
-                            parentConditionals[k] *= tMatrix[target_index];
+                            work[k] *= tMatrix[target_index];
                         }
                     }
-                    continue;
+                    if (!single_precision) {
+                        continue;
+                    }
+                    for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                        sum += work[k];
+                    }
                 } else {
-                    childVector = lNodeResolutions->theData + (-siteState-1) * alphabetDimension;
+                    child = lNodeResolutions->theData + (-siteState-1) * alphabetDimension;
                 }
             } else {
                 if (tcc) {
@@ -3159,6 +3863,8 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
                     }
                     lastUpdatedSite = childVector;
                 }
+                child        = _hy_widen_conditionals (childVector, widened_child, alphabetDimension);
+                childVector += stride;
             }
 /*
  #ifdef _SLKP_USE_AVX_INTRINSICS
@@ -3185,250 +3891,48 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
 #endif
  */
 
-            if (alphabetDimension == 4L) { // special case for nuc data
-                
+            if (child) {
+                if (alphabetDimension == 4L) { // special case for nuc data
+                    
 #ifdef _SLKP_USE_AVX_INTRINSICS
-                _handle4x4_pruning_case (childVector, tMatrix, parentConditionals, tmatrix_transpose);
+                    _handle4x4_pruning_case (child, tMatrix, work, tmatrix_transpose);
 #else
-                _handle4x4_pruning_case (childVector, tMatrix, parentConditionals, nil);
+                    _handle4x4_pruning_case (child, tMatrix, work, nil);
 #endif
-                // handle scaling if necessary
-                // the check for sum > 0.0 is necessary for 'inadmissible' log-L functions (-infinity)
-                // for example if a change must happen on a zero-branch length
-                
-                sum     = (parentConditionals [0] + parentConditionals [1]) + (parentConditionals [2] + parentConditionals [3]);
-                if (sum < _lfScalingFactorThreshold && sum > 0.0) {
-                    hyFloat tryScale                                 = scalingAdjustments [parentCode*siteCount + siteID] * _lfScalerUpwards;
-                    if (tryScale < HUGE_VAL) {
-                        parentConditionals [0]                             *= _lfScalerUpwards;
-                        parentConditionals [1]                             *= _lfScalerUpwards;
-                        parentConditionals [2]                             *= _lfScalerUpwards;
-                        parentConditionals [3]                             *= _lfScalerUpwards;
-                        localScalerChange                                  += theFilter->theFrequencies.get (siteOrdering.list_data[siteID]);
-                        scalingAdjustments [parentCode*siteCount + siteID]  = tryScale;
-                        didScale                                            = 1;
-                    }
+                    sum     = (work [0] + work [1]) + (work [2] + work [3]);
                 } else {
-                    if (sum > _lfScalerUpwards) {
-                        scalingAdjustments [parentCode*siteCount + siteID] *= _lfScalingFactorThreshold;
-                        parentConditionals [0]                             *= _lfScalingFactorThreshold;
-                        parentConditionals [1]                             *= _lfScalingFactorThreshold;
-                        parentConditionals [2]                             *= _lfScalingFactorThreshold;
-                        parentConditionals [3]                             *= _lfScalingFactorThreshold;
-                        localScalerChange                                  -= theFilter->theFrequencies.get (siteOrdering.list_data[siteID]);
-                        didScale                                            = -1;
-                    }
+                    sum     = pruning_kernel (tMatrix, child, work, alphabetDimension);
                 }
-                
-                childVector += 4;
-            } else {
-                hyFloat sum = 0.0;
-                
-                if (alphabetDimension > alphabetDimensionmod4){
-                    
-                    
-                    for (long p = 0L; p < alphabetDimension; p++) {
-                        hyFloat      accumulator = 0.0;
-                        
-                        
-#ifdef _SLKP_USE_SSE_INTRINSICS
-                        
-                        __m128d buffer1,
-                        buffer2,
-                        buffer3 = _mm_setzero_pd(),
-                        buffer4 = _mm_setzero_pd(),
-                        load1,
-                        load2,
-                        load3,
-                        load4;
-                        
-                        
-                        if (((long int)tMatrix & 0b1111) == 0 && ((long int)childVector & 0b1111) == 0){
-                            for (long c = 0; c < alphabetDimensionmod4; c+=4) {
-                                load1 = _mm_load_pd (tMatrix+c);
-                                load2 = _mm_load_pd (tMatrix+c+2);
-                                load3 = _mm_load_pd (childVector+c);
-                                load4 = _mm_load_pd (childVector+c+2);
-                                buffer1 = _mm_mul_pd (load1, load3);
-                                buffer2 = _mm_mul_pd (load2, load4);
-                                buffer3 = _mm_add_pd (buffer1,buffer3);
-                                buffer4 = _mm_add_pd (buffer2,buffer4);
-                            }
-                        } else {
-                            for (long c = 0; c < alphabetDimensionmod4; c+=4) {
-                                load1 = _mm_loadu_pd (tMatrix+c);
-                                load2 = _mm_loadu_pd (tMatrix+c+2);
-                                load3 = _mm_loadu_pd (childVector+c);
-                                load4 = _mm_loadu_pd (childVector+c+2);
-                                buffer1 = _mm_mul_pd (load1, load3);
-                                buffer2 = _mm_mul_pd (load2, load4);
-                                buffer3 = _mm_add_pd (buffer1,buffer3);
-                                buffer4 = _mm_add_pd (buffer2,buffer4);
-                            }
-                            
-                        }
-                        
-                        buffer3 = _mm_add_pd (buffer3, buffer4);
-                        double buffer[2] __attribute__ ((aligned (16)));
-                        _mm_store_pd (buffer, buffer3);
-                        accumulator = buffer[0] + buffer[1];
-                        
-#elif defined _SLKP_USE_AVX_INTRINSICS // end _SLKP_USE_SSE_INTRINSICS
-                        if (alphabetDimensionmod4 == 60) {
-                            __m256d matrix_quad1 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix),_mm256_loadu_pd (childVector));
-                            __m256d matrix_quad2 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+4),_mm256_loadu_pd (childVector+4));
-                            __m256d matrix_quad3 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+8),_mm256_loadu_pd (childVector+8));
-                            __m256d matrix_quad4 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+12),_mm256_loadu_pd (childVector+12));
-                            __m256d matrix_quad5 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+16),_mm256_loadu_pd (childVector+16));
-                            __m256d matrix_quad6 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+20),_mm256_loadu_pd (childVector+20));
-                            __m256d matrix_quad7 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+24),_mm256_loadu_pd (childVector+24));
-                            __m256d matrix_quad8 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+28),_mm256_loadu_pd (childVector+28));
-                            __m256d matrix_quad9 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+32),_mm256_loadu_pd (childVector+32));
-                            __m256d matrix_quad10 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+36),_mm256_loadu_pd (childVector+36));
-                            __m256d matrix_quad11 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+40),_mm256_loadu_pd (childVector+40));
-                            __m256d matrix_quad12 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+44),_mm256_loadu_pd (childVector+44));
-                            __m256d matrix_quad13 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+48),_mm256_loadu_pd (childVector+48));
-                            __m256d matrix_quad14 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+52),_mm256_loadu_pd (childVector+52));
-                            __m256d matrix_quad15 = _mm256_mul_pd(_mm256_loadu_pd (tMatrix+56),_mm256_loadu_pd (childVector+56));
-
-                            matrix_quad1 = _mm256_add_pd (matrix_quad1,matrix_quad2);
-                            matrix_quad3 = _mm256_add_pd (matrix_quad3,matrix_quad4);
-                            matrix_quad5 = _mm256_add_pd (matrix_quad5,matrix_quad6);
-                            matrix_quad7 = _mm256_add_pd (matrix_quad7,matrix_quad8);
-                            matrix_quad9 = _mm256_add_pd (matrix_quad9,matrix_quad10);
-                            matrix_quad11 = _mm256_add_pd (matrix_quad11,matrix_quad12);
-                            matrix_quad13 = _mm256_add_pd (matrix_quad13,matrix_quad14);
-
-                            matrix_quad2 = _mm256_add_pd (matrix_quad1,matrix_quad3);
-                            matrix_quad4 = _mm256_add_pd (matrix_quad5,matrix_quad7);
-                            matrix_quad6 = _mm256_add_pd (matrix_quad9,matrix_quad11);
-                            matrix_quad8 = _mm256_add_pd (matrix_quad13,matrix_quad15);
-
-                            accumulator = _avx_sum_4(_mm256_add_pd (_mm256_add_pd(matrix_quad2,matrix_quad4), _mm256_add_pd(matrix_quad6,matrix_quad8)));
- 
-                        } else {
-                        
-                        __m256d sum256 = _mm256_setzero_pd();
-                            for (long c = 0L; c < alphabetDimensionmod4; c+=4L) {
-                                __m256d matrix_quad = _mm256_loadu_pd (tMatrix+c),
-                                child_quad = _mm256_loadu_pd (childVector+c);
-    #ifdef _SLKP_USE_FMA3_INTRINSICS
-                                sum256 = _mm256_fmadd_pd (matrix_quad,child_quad, sum256);
-    #else
-                                __m256d prod = _mm256_mul_pd (matrix_quad, child_quad);
-                                sum256 = _mm256_add_pd (sum256,prod);
-    #endif
+            }
             
-                           }
-                           accumulator = _avx_sum_4(sum256);
-                      }
-                        
-                         //NOT sure why copy to doubles and add is faster
-                        // that AVX istructions
-#else // _SLKP_USE_AVX_INTRINSICS
-                        for (unsigned long c = 0UL; c < alphabetDimensionmod4; c+=4UL) {
-                            // 4 - unroll the loop
-                            hyFloat pr1 =    tMatrix[c]   * childVector[c],
-                            pr2 =    tMatrix[c+1L] * childVector[c+1L],
-                            pr3 =    tMatrix[c+2L] * childVector[c+2L],
-                            pr4 =    tMatrix[c+3L] * childVector[c+3L];
-                            pr1 += pr2;
-                            pr3 += pr4;
-                            accumulator += pr1+pr3;
-                        }
-#endif // regular code
-                        
-                        if (alphabetDimension == 61) {
-                            sum += (parentConditionals[p] *= accumulator + tMatrix[alphabetDimensionmod4] * childVector[alphabetDimensionmod4]);
-                        } else {
-                            for (long c = alphabetDimensionmod4; c < alphabetDimension; c++) {
-                                accumulator +=  tMatrix[c] * childVector[c];
-                            }
-                            sum += (parentConditionals[p] *= accumulator);
-                        }
-                        tMatrix               += alphabetDimension;
+            // handle scaling if necessary
+            // the check for sum > 0.0 is necessary for 'inadmissible' log-L functions (-infinity)
+            // for example if a change must happen on a zero-branch length
+            
+            if (sum < scale_up_below && sum > 0.0) {
+                hyFloat tryScale                                 = scalingAdjustments [parentCode*siteCount + siteID] * _lfScalerUpwards;
+                if (tryScale < scaler_ceiling) {
+                    scalingAdjustments [parentCode*siteCount + siteID] = tryScale;
+                    for (long c = 0; c < alphabetDimension; c++) {
+                        work [c] *= _lfScalerUpwards;
                     }
+                    
+                    localScalerChange                                      += theFilter->theFrequencies.get(siteOrdering.list_data[siteID]);
+                    didScale                                                = 1;
                 }
-                else {
-#ifdef _SLKP_USE_AVX_INTRINSICS
-                    if (alphabetDimension == 20UL) {
-                        for (long p = 0; p < alphabetDimension; p++) {
-                            __m256d t_matrix[5] = {_mm256_loadu_pd(tMatrix),
-                                _mm256_loadu_pd(tMatrix+4UL),
-                                _mm256_loadu_pd(tMatrix+8UL),
-                                _mm256_loadu_pd(tMatrix+12UL),
-                                _mm256_loadu_pd(tMatrix+16UL)},
-                            
-                            c_vector[5] = {_mm256_loadu_pd(childVector),
-                                _mm256_loadu_pd(childVector+4UL),
-                                _mm256_loadu_pd(childVector+8UL),
-                                _mm256_loadu_pd(childVector+12UL),
-                                _mm256_loadu_pd(childVector+16UL)};
-#ifdef _SLKP_USE_FMA3_INTRINSICS
-                            t_matrix[0] = _mm256_fmadd_pd(t_matrix[0], c_vector[0], _mm256_mul_pd(t_matrix[1], c_vector[1]));
-                            t_matrix[2] = _mm256_fmadd_pd(t_matrix[2], c_vector[2],
-                                                            _mm256_fmadd_pd (t_matrix[3], c_vector[3], _mm256_mul_pd(t_matrix[4], c_vector[4])));
-                            
-                            tMatrix               += 20UL;
-                            sum += (parentConditionals[p] *= _avx_sum_4(_mm256_add_pd (t_matrix[0],t_matrix[2])));
-#else
-                            t_matrix[0] = _mm256_mul_pd(t_matrix[0], c_vector[0]);
-                            t_matrix[1] = _mm256_mul_pd(t_matrix[1], c_vector[1]);
-                            t_matrix[2] = _mm256_mul_pd(t_matrix[2], c_vector[2]);
-                            t_matrix[3] = _mm256_mul_pd(t_matrix[3], c_vector[3]);
-                            t_matrix[4] = _mm256_mul_pd(t_matrix[4], c_vector[4]);
-                            
-                            t_matrix[0] = _mm256_add_pd (t_matrix[0],t_matrix[1]);
-                            t_matrix[2] = _mm256_add_pd (t_matrix[2],t_matrix[3]);
-                            t_matrix[0] = _mm256_add_pd (t_matrix[0],t_matrix[2]);
-                            
-                            tMatrix               += 20UL;
-                            sum += (parentConditionals[p] *= _avx_sum_4(_mm256_add_pd (t_matrix[0],t_matrix[4])));
-#endif
-                        }
-                    } else
-#endif // _SLKP_USE_AVX_INTRINSICS
-                        
-                        for (long p = 0; p < alphabetDimension; p++) {
-                            hyFloat      accumulator = 0.0;
-                            
-                            for (long c = 0; c < alphabetDimensionmod4; c+=4) // 4 - unroll the loop
-                                accumulator +=  tMatrix[c]   * childVector[c] +
-                                tMatrix[c+1] * childVector[c+1] +
-                                tMatrix[c+2] * childVector[c+2] +
-                                tMatrix[c+3] * childVector[c+3];
-                            
-                            tMatrix               += alphabetDimension;
-                            sum += (parentConditionals[p] *= accumulator);
-                        }
-                }
-                
-                
-                
-                if (sum < _lfScalingFactorThreshold && sum > 0.0) {
-                    hyFloat tryScale                                 = scalingAdjustments [parentCode*siteCount + siteID] * _lfScalerUpwards;
-                    if (tryScale < HUGE_VAL) {
-                        scalingAdjustments [parentCode*siteCount + siteID] = tryScale;
-                        for (long c = 0; c < alphabetDimension; c++) {
-                            parentConditionals [c] *= _lfScalerUpwards;
-                        }
-                        
-                        localScalerChange                                      += theFilter->theFrequencies.get(siteOrdering.list_data[siteID]);
-                        didScale                                                = 1;
-                    }
-                } else {
-                    if (sum > _lfScalerUpwards) {
-                        scalingAdjustments [parentCode*siteCount + siteID] *= _lfScalingFactorThreshold;
-                        for (long c = 0; c < alphabetDimension; c++) {
-                            parentConditionals [c] *= _lfScalingFactorThreshold;
-                        }
-                        localScalerChange                                  -= theFilter->theFrequencies.get (siteOrdering.list_data[siteID]);
-                        didScale                                            = -1;
+            } else {
+                if (sum > scale_down_above && scalingAdjustments [parentCode*siteCount + siteID] * _lfScalingFactorThreshold >= scaler_floor) {
+                    scalingAdjustments [parentCode*siteCount + siteID] *= _lfScalingFactorThreshold;
+                    for (long c = 0; c < alphabetDimension; c++) {
+                        work [c] *= _lfScalingFactorThreshold;
                     }
+                    localScalerChange                                  -= theFilter->theFrequencies.get (siteOrdering.list_data[siteID]);
+                    didScale                                            = -1;
                 }
-                childVector    += alphabetDimension;
             }
             
+            _hy_narrow_conditionals (parentConditionals, work, alphabetDimension);
+            
             if (didScale) {
                 if (siteCorrectionCounts) {
                     siteCorrectionCounts [siteOrdering.list_data[siteID]] += didScale;
@@ -3472,21 +3976,20 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
     
     // assemble the entire likelihood
     
-    hyFloat * _hprestrict_ rootConditionals = iNodeCache + alphabetDimension * (siteFrom + (flatTree.lLength-1)  * siteCount);
+    CACHE_TYPE * _hprestrict_ rootConditionals = iNodeCache + stride * (siteFrom + (flatTree.lLength-1)  * siteCount);
     hyFloat                result = 0.0,
     correction = 0.0;
     
     
-    for (long siteID = siteFrom, rootIndex = 0L; siteID < siteTo; siteID++) {
+    for (long siteID = siteFrom; siteID < siteTo; siteID++, rootConditionals += stride) {
         hyFloat accumulator = 0.;
         
         if (setBranch == flatTree.lLength-1) {
             long                rootState = setBranchTo[siteOrdering.list_data[siteID]];
-            accumulator         = rootConditionals[rootIndex + rootState] * theProbs[rootState];
-            rootIndex           += alphabetDimension;
+            accumulator         = rootConditionals[rootState] * theProbs[rootState];
         } else
-            for (long p = 0; p < alphabetDimension; p++,rootIndex++) {
-                accumulator += rootConditionals[rootIndex] * theProbs[p];
+            for (long p = 0; p < alphabetDimension; p++) {
+                accumulator += rootConditionals[p] * theProbs[p];
             }
                 
         /*#pragma omp critical
@@ -3534,9 +4037,13 @@ hyFloat      _TheTree::ComputeTreeBlockByBranch  (                   _SimpleList
         overallScaler += localScalerChange;
     }
     
+    delete [] widened_parent;
+    
     return result;
 }
 
+template hyFloat _TheTree::ComputeTreeBlockByBranch<hyFloat> (_SimpleList&, _SimpleList&, _SimpleList*, _DataSetFilter const*, hyFloat*, long*, hyFloat*, _Vector*, long&, long, long, long, hyFloat*, long*, long, long*, _ExponentialQueue const*);
+template hyFloat _TheTree::ComputeTreeBlockByBranch<float>   (_SimpleList&, _SimpleList&, _SimpleList*, _DataSetFilter const*, float*,   long*, hyFloat*, _Vector*, long&, long, long, long, hyFloat*, long*, long, long*, _ExponentialQueue const*);
 
 
 /*----------------------------------------------------------------------------------------------------------*/
@@ -3561,7 +4068,7 @@ void            _TheTree::ComputeBranchCache    (
 {
     
     /*
-     the cache matrix (linearized into a vector) will have TWO rows with siteCount blocks of alphabetDimension doubles, storing the conditional likelihoods of individual sites at a given branch
+     the cache matrix (linearized into a vector) will have TWO rows with siteCount blocks of alphabetDimension doubles (padded to GetConditionalStride), storing the conditional likelihoods of individual sites at a given branch
      in the virtually rerooted tree
      
      cache ->
@@ -3578,8 +4085,11 @@ void            _TheTree::ComputeBranchCache    (
     
     const long  alphabetDimension     =            theFilter->GetDimension(),
     alphabetDimensionmod4  =         alphabetDimension - alphabetDimension % 4,
+    stride                  =            GetConditionalStride (alphabetDimension),
     siteCount               =            theFilter->GetPatternCount();
     
+    _hy_pruning_kernel const pruning_kernel = _hy_select_pruning_kernel (alphabetDimension, (_hy_simd_level)simdLevel);
+    
     if (siteTo  > siteCount)    {
         siteTo = siteCount;
     }
@@ -3610,7 +4120,7 @@ void            _TheTree::ComputeBranchCache    (
      echoNodeList (nodesToProcess,flatLeaves,flatNodes);
      */
     
-    hyFloat * state = cache + alphabetDimension * siteFrom,
+    hyFloat * state = cache + stride * siteFrom,
     * childVector;
     
     long        localScalerChange = 0;
@@ -3618,7 +4128,7 @@ void            _TheTree::ComputeBranchCache    (
     // first populate the downward looking vector of conditionals
     
     if (brID < flatLeaves.lLength) { // a leaf
-        for (long siteID = siteFrom; siteID < siteTo; siteID ++, state += alphabetDimension) {
+        for (long siteID = siteFrom; siteID < siteTo; siteID ++, state += stride) {
             long siteState = lNodeFlags[brID*siteCount + siteOrdering.list_data[siteID]] ;
             if (siteState >= 0) {
                 // a single character state; sweep down the appropriate column
@@ -3635,7 +4145,7 @@ void            _TheTree::ComputeBranchCache    (
         }
     } else { // an internal branch
         long        nodeCode = brID - flatLeaves.lLength;
-        hyFloat *lastUpdated = iNodeCache + (nodeCode * siteCount + siteFrom) * alphabetDimension;
+        hyFloat *lastUpdated = iNodeCache + (nodeCode * siteCount + siteFrom) * stride;
         
         long currentTCCIndex        ,
         currentTCCBit            ;
@@ -3646,10 +4156,10 @@ void            _TheTree::ComputeBranchCache    (
             currentTCCIndex /= _HY_BITMASK_WIDTH_;
         }
         
-        for (long siteID = siteFrom; siteID < siteTo; siteID ++, state += alphabetDimension) {
+        for (long siteID = siteFrom; siteID < siteTo; siteID ++, state += stride) {
             if (tcc) {
                 if ((tcc->list_data[currentTCCIndex] & bitMaskArray.masks[currentTCCBit]) == 0) {
-                    lastUpdated = iNodeCache + (nodeCode * siteCount + siteID) * alphabetDimension;
+                    lastUpdated = iNodeCache + (nodeCode * siteCount + siteID) * stride;
                 }
             }
             
@@ -3663,7 +4173,7 @@ void            _TheTree::ComputeBranchCache    (
                     currentTCCIndex ++;
                 }
             } else {
-                lastUpdated += alphabetDimension;
+                lastUpdated += stride;
             }
         }
     }
@@ -3686,7 +4196,7 @@ void            _TheTree::ComputeBranchCache    (
             nodeCode -=  flatLeaves.lLength;
         }
         
-        hyFloat * parentConditionals = iNodeCache +            (siteFrom + parentCode  * siteCount) * alphabetDimension;
+        hyFloat * parentConditionals = iNodeCache +            (siteFrom + parentCode  * siteCount) * stride;
         if (taggedNodes.list_data[parentCode] == 0L)
             // mark the parent for update and clear its conditionals if needed
         {
@@ -3703,12 +4213,9 @@ void            _TheTree::ComputeBranchCache    (
                     parentConditionals [k3+3UL] = scaler;
                 }
             } else {
-                unsigned long k3     = 0UL;
-                for (unsigned long k = siteFrom; k < siteTo; k++) {
-                    hyFloat scaler = localScalingFactor[k];
-                    for (unsigned long k2 = 0UL; k2 < alphabetDimension; k2++, k3++) {
-                        parentConditionals [k3] = scaler;
-                    }
+                hyFloat * pp = parentConditionals;
+                for (unsigned long k = siteFrom; k < siteTo; k++, pp += stride) {
+                    InitializeArray(pp, alphabetDimension, (hyFloat)localScalingFactor[k]);
                 }
             }
         }
@@ -3733,7 +4240,7 @@ void            _TheTree::ComputeBranchCache    (
         *     lastUpdatedSite;
         
         if (!isLeaf) {
-            lastUpdatedSite = childVector = iNodeCache + (siteFrom + nodeCode * siteCount) * alphabetDimension;
+            lastUpdatedSite = childVector = iNodeCache + (siteFrom + nodeCode * siteCount) * stride;
         }
         
         
@@ -3753,7 +4260,7 @@ void            _TheTree::ComputeBranchCache    (
             }
         }
         
-        for (long siteID = siteFrom; siteID < siteTo; siteID++, parentConditionals += alphabetDimension) {
+        for (long siteID = siteFrom; siteID < siteTo; siteID++, parentConditionals += stride) {
             hyFloat  const *tMatrix = transitionMatrix;
             
             char canScale = !notPassedRoot;
@@ -3846,77 +4353,9 @@ void            _TheTree::ComputeBranchCache    (
                 }
                 childVector += 4L;
             } else {
-                for (long p = 0L; p < alphabetDimension; p++) {
-                    hyFloat      accumulator = 0.0;
-#ifdef _SLKP_USE_SSE_INTRINSICS
-                    __m128d buffer1,
-                    buffer2,
-                    buffer3 = _mm_setzero_pd(),
-                    buffer4 = _mm_setzero_pd(),
-                    load1,
-                    load2,
-                    load3,
-                    load4;
-                    if (((long int)tMatrix & 0b1111) == 0 && ((long int)childVector & 0b1111) == 0) {
-                        for (long c = 0L; c < alphabetDimensionmod4; c+=4) {
-                            load1 = _mm_load_pd (tMatrix+c);
-                            load2 = _mm_load_pd (tMatrix+c+2);
-                            load3 = _mm_load_pd (childVector+c);
-                            load4 = _mm_load_pd (childVector+c+2);
-                            buffer1 = _mm_mul_pd (load1, load3);
-                            buffer2 = _mm_mul_pd (load2, load4);
-                            buffer3 = _mm_add_pd (buffer1,buffer3);
-                            buffer4 = _mm_add_pd (buffer2,buffer4);
-                        }
-                    } else {
-                        for (long c = 0L; c < alphabetDimensionmod4; c+=4) {
-                            load1 = _mm_loadu_pd (tMatrix+c);
-                            load2 = _mm_loadu_pd (tMatrix+c+2);
-                            load3 = _mm_loadu_pd (childVector+c);
-                            load4 = _mm_loadu_pd (childVector+c+2);
-                            buffer1 = _mm_mul_pd (load1, load3);
-                            buffer2 = _mm_mul_pd (load2, load4);
-                            buffer3 = _mm_add_pd (buffer1,buffer3);
-                            buffer4 = _mm_add_pd (buffer2,buffer4);
-                        }
-                    }
-                    buffer3 = _mm_add_pd (buffer3, buffer4);
-                    double buffer[2] __attribute__ ((aligned (16)));
-                    _mm_store_pd (buffer, buffer3);
-                    accumulator = buffer[0] + buffer[1];
-                    
-#elif defined _SLKP_USE_AVX_INTRINSICS
-                    __m256d sum256 = _mm256_setzero_pd();
-                    for (long c = 0; c < alphabetDimensionmod4; c+=4L) {
-                        __m256d matrix_quad = _mm256_loadu_pd (tMatrix+c),
-                        child_quad = _mm256_loadu_pd (childVector+c),
-                        prod = _mm256_mul_pd (matrix_quad, child_quad);
-                        sum256 = _mm256_add_pd (sum256,prod);
-                    }
-                    accumulator = _avx_sum_4(sum256);
-#else
-                    for (unsigned long c = 0UL; c < alphabetDimensionmod4; c+=4UL) { // 4 - unroll the loop
-                        hyFloat pr1 =    tMatrix[c]   * childVector[c],
-                        pr2 =    tMatrix[c+1] * childVector[c+1],
-                        pr3 =    tMatrix[c+2] * childVector[c+2],
-                        pr4 =    tMatrix[c+3] * childVector[c+3];
-                        
-                        pr1 += pr2;
-                        pr3 += pr4;
-                        accumulator += pr1+pr3;
-                    }
-#endif
-                    
-                    for (long c = alphabetDimensionmod4; c < alphabetDimension; c++) {
-                        accumulator +=  tMatrix[c] * childVector[c];
-                    }
-                    
-                    tMatrix               += alphabetDimension;
-                    //printf ("%ld %g %g\n", p, parentConditionals[p], accumulator);
-                    sum += (parentConditionals[p] *= accumulator);
-                }
+                sum = pruning_kernel (tMatrix, childVector, parentConditionals, alphabetDimension);
                 
-                childVector    += alphabetDimension;
+                childVector    += stride;
                 
                 if (canScale) {
                     if (sum < _lfScalingFactorThreshold && sum > 0.0) {
@@ -3955,11 +4394,11 @@ void            _TheTree::ComputeBranchCache    (
     
     //printf ("root name %s\n", ((_CalcNode    *)flatTree(rootPath.list_data[rootPath.lLength-2] - flatLeaves.lLength))->GetName()->sData);
     
-    hyFloat const *rootConditionals   = iNodeCache +  (rootPath.list_data[rootPath.lLength-2] - flatLeaves.lLength)  * siteCount * alphabetDimension;
+    hyFloat const *rootConditionals   = iNodeCache +  (rootPath.list_data[rootPath.lLength-2] - flatLeaves.lLength)  * siteCount * stride;
     
-    state = cache + alphabetDimension * siteCount;
-    const unsigned long site_bound = alphabetDimension*siteTo;
-    for (unsigned long ii = siteFrom * alphabetDimension; ii < site_bound; ii++) {
+    state = cache + stride * siteCount;
+    const unsigned long site_bound = stride*siteTo;
+    for (unsigned long ii = siteFrom * stride; ii < site_bound; ii++) {
         state[ii] = rootConditionals[ii];
         //printf ("Root conditional [%ld] = %g, node state [%ld] = %g\n", ii, state[ii], ii, cache[ii]);
     }
@@ -4019,14 +4458,15 @@ hyFloat          _TheTree::ComputeLLWithBranchCache (
     };
     
     const unsigned long          alphabetDimension      = theFilter->GetDimension(),
+    stride                 =  GetConditionalStride (alphabetDimension),
     siteCount              =  theFilter->GetPatternCount();
     
     if (siteTo  > siteCount)    {
         siteTo = siteCount;
     }
     
-    hyFloat const * branchConditionals = cache              + siteFrom * alphabetDimension;
-    hyFloat const * rootConditionals   = branchConditionals + siteCount * alphabetDimension;
+    hyFloat const * branchConditionals = cache              + siteFrom * stride;
+    hyFloat const * rootConditionals   = branchConditionals + siteCount * stride;
     hyFloat  result = 0.0,
     correction = 0.0;
     
@@ -4088,176 +4528,19 @@ hyFloat          _TheTree::ComputeLLWithBranchCache (
                 break;
                 /****
                  
-                 AMINOACIDS
+                 AMINOACIDS, CODONS and everything else
                  
                  ****/
-            case 20UL: {
-                for (unsigned long siteID = siteFrom; siteID < siteTo; siteID++) {
-                    hyFloat accumulator = 0.;
-#ifdef _SLKP_USE_AVX_INTRINSICS
-                    __m256d bc_vector[5] = {_mm256_loadu_pd(branchConditionals),
-                        _mm256_loadu_pd(branchConditionals+4UL),
-                        _mm256_loadu_pd(branchConditionals+8UL),
-                        _mm256_loadu_pd(branchConditionals+12UL),
-                        _mm256_loadu_pd(branchConditionals+16UL)};
-                    
-                    
-                    hyFloat const * tm = transitionMatrix;
-                    
-                    for (unsigned long p = 0UL; p < 20UL; p++, rootConditionals++) {
-                        
-                        __m256d t_matrix[5] = { _mm256_loadu_pd(tm),
-                            _mm256_loadu_pd(tm+4UL),
-                            _mm256_loadu_pd(tm+8UL),
-                            _mm256_loadu_pd(tm+12UL),
-                            _mm256_loadu_pd(tm+16UL)};
-                        
-                        
-                        t_matrix[0] = _mm256_mul_pd(t_matrix[0], bc_vector[0]);
-                        t_matrix[1] = _mm256_mul_pd(t_matrix[1], bc_vector[1]);
-                        t_matrix[2] = _mm256_mul_pd(t_matrix[2], bc_vector[2]);
-                        t_matrix[3] = _mm256_mul_pd(t_matrix[3], bc_vector[3]);
-                        t_matrix[4] = _mm256_mul_pd(t_matrix[4], bc_vector[4]);
-                        
-                        t_matrix[0] = _mm256_add_pd (t_matrix[0],t_matrix[1]);
-                        t_matrix[1] = _mm256_add_pd (t_matrix[2],t_matrix[3]);
-                        t_matrix[3] = _mm256_add_pd (t_matrix[0],t_matrix[1]);
-                        
-                        tm += 20UL;
-                        
-                        accumulator += *rootConditionals * theProbs[p] * _avx_sum_4(_mm256_add_pd (t_matrix[3],t_matrix[4]));
-                    }
-#else // _SLKP_USE_AVX_INTRINSICS
-                    unsigned long rmx = 0UL;
-                    for (unsigned long p = 0UL; p < 20UL; p++,rootConditionals++) {
-                        hyFloat     r2 = 0.;
-                        
-                        for (unsigned long c = 0UL; c < 20UL; c+=4UL, rmx +=4UL) {
-                            r2 += (branchConditionals[c]   *  transitionMatrix[rmx] +
-                                   branchConditionals[c+1] *  transitionMatrix[rmx+1]) +
-                            (branchConditionals[c+2] *  transitionMatrix[rmx+2] +
-                             branchConditionals[c+3] *  transitionMatrix[rmx+3]);
-                        }
-                        
-                        accumulator += *rootConditionals * theProbs[p] * r2;
-                    }
-#endif  // _SLKP_USE_AVX_INTRINSICS
-                    branchConditionals += 20UL;
-                    bookkeeping (siteID, accumulator, correction, result);
-                    
-                } // siteID
+            default: {
+                _hy_branch_ll_kernel const branch_ll_kernel = _hy_select_branch_ll_kernel (alphabetDimension, (_hy_simd_level)simdLevel);
                 
-            } // case 20
-                break;
-                /****
-                 
-                 CODONS
-                 
-                 ****/
-            case 60UL:
-            case 61UL:
-            case 62UL:
-            case 63UL: {
                 for (unsigned long siteID = siteFrom; siteID < siteTo; siteID++) {
-                    hyFloat accumulator = 0.;
-                    
-                    unsigned long rmx = 0UL;
-                    for (unsigned long p = 0UL; p < alphabetDimension; p++,rootConditionals++) {
-                        hyFloat     r2 = 0.;
-                        unsigned       long c = 0UL;
-                        
-#ifdef _SLKP_USE_AVX_INTRINSICS
-                        
-                        __m256d sum256 = _mm256_setzero_pd ();
-                        
-                        for (; c < 60UL; c+=12UL, rmx +=12UL) {
-                            
-                            __m256d branches0 = _mm256_loadu_pd (branchConditionals+c),
-                            branches1 = _mm256_loadu_pd (branchConditionals+c+4),
-                            branches2 = _mm256_loadu_pd (branchConditionals+c+8),
-                            matrix0   = _mm256_loadu_pd (transitionMatrix+rmx),
-                            matrix1   = _mm256_loadu_pd (transitionMatrix+rmx+4),
-                            matrix2   = _mm256_loadu_pd (transitionMatrix+rmx+8);
-                            
-                            branches0 = _mm256_mul_pd(branches0, matrix0);
-                            branches1 = _mm256_mul_pd(branches1, matrix1);
-                            branches2 = _mm256_mul_pd(branches2, matrix2);
-                            
-                            branches0 = _mm256_add_pd (branches0,branches2);
-                            sum256 = _mm256_add_pd (branches0,_mm256_add_pd (sum256, branches1));
-                        }
-                        
-                        r2 = _avx_sum_4(sum256);
-                        
-#else // _SLKP_USE_AVX_INTRINSICS
-                        for (; c < 60UL; c+=4UL, rmx +=4UL) {
-                            r2 += (branchConditionals[c]   *  transitionMatrix[rmx] +
-                                   branchConditionals[c+1] *  transitionMatrix[rmx+1]) +
-                            (branchConditionals[c+2] *  transitionMatrix[rmx+2] +
-                             branchConditionals[c+3] *  transitionMatrix[rmx+3]);
-                        }
-#endif
-                        
-                        for (; c < alphabetDimension; c++, rmx ++) {
-                            r2 += branchConditionals[c]   *  transitionMatrix[rmx];
-                        }
-                        
-                        accumulator += *rootConditionals * theProbs[p] * r2;
-                    }
+                    hyFloat accumulator = branch_ll_kernel (transitionMatrix, branchConditionals, rootConditionals, theProbs, alphabetDimension);
                     
-                    branchConditionals += alphabetDimension;
+                    rootConditionals   += stride;
+                    branchConditionals += stride;
                     bookkeeping (siteID, accumulator, correction, result);
-                    
-                }
-            } // cases 60-63
-                break;
-            default: { // valid alphabetDimension >= 2
-                
-                if (alphabetDimension % 2) { // odd
-                    unsigned long alphabetDimension_minus1 = alphabetDimension-1;
-                    for (unsigned long siteID = siteFrom; siteID < siteTo; siteID++) {
-                        hyFloat accumulator = 0.;
-                        
-                        unsigned long rmx = 0UL;
-                        for (unsigned long p = 0UL; p < alphabetDimension; p++,rootConditionals++) {
-                            hyFloat     r2 = 0.;
-                            
-                            for (unsigned long c = 0UL; c < alphabetDimension_minus1; c+=2UL, rmx +=2UL) {
-                                r2 +=  branchConditionals[c]   *  transitionMatrix[rmx] +
-                                branchConditionals[c+1] *  transitionMatrix[rmx+1];
-                            }
-                            
-                            r2 += branchConditionals[alphabetDimension_minus1]   *  transitionMatrix[rmx++];
-                            
-                            accumulator += *rootConditionals * theProbs[p] * r2;
-                        }
-                        
-                        branchConditionals += alphabetDimension;
-                        bookkeeping (siteID, accumulator, correction, result);
-                        
-                    }
-                } else {
-                    for (unsigned long siteID = siteFrom; siteID < siteTo; siteID++) {
-                        hyFloat accumulator = 0.;
-                        
-                        unsigned long rmx = 0UL;
-                        for (unsigned long p = 0UL; p < alphabetDimension; p++,rootConditionals++) {
-                            hyFloat     r2 = 0.;
-                            
-                            for (unsigned long c = 0UL; c < alphabetDimension; c+=2UL, rmx +=2UL) {
-                                r2 +=  branchConditionals[c]   *  transitionMatrix[rmx] +
-                                branchConditionals[c+1] *  transitionMatrix[rmx+1];
-                            }
-                            
-                            accumulator += *rootConditionals * theProbs[p] * r2;
-                        }
-                        
-                        branchConditionals += alphabetDimension;
-                        bookkeeping (siteID, accumulator, correction, result);
-                        
-                    }
                 }
-                
             } // default
         } // switch (alphabetDimension)
     } catch (long site) {
@@ -4272,45 +4555,377 @@ hyFloat          _TheTree::ComputeLLWithBranchCache (
 
 /*----------------------------------------------------------------------------------------------------------*/
 
-hyFloat      _TheTree::ComputeTwoSequenceLikelihood
-(
- _SimpleList   & siteOrdering,
- _DataSetFilter const* theFilter,
- long      *         lNodeFlags,
- _Vector* lNodeResolutions,
- long                siteFrom,
- long                siteTo,
- long                catID,
- hyFloat*     storageVec
- )
-// the updateNodes flags the nodes (leaves followed by inodes in the same order as flatLeaves and flatNodes)
-// that must be recomputed
+unsigned long   _TheTree::ChildrenInCSR (_SimpleList& childOffsets, _SimpleList& childCodes) const {
+/*
+    20261018: SLKP
+ 
+    the children of internal node k (flat indices, leaves followed by inodes, as in flatParents)
+    are childCodes [childOffsets[k] .. childOffsets[k+1]), in increasing order (which is also
+    the left to right order of the children); returns the largest number of children of a node
+*/
+    unsigned long   const iNodeCount  = flatTree.lLength,
+                          nodeCount   = flatLeaves.lLength + iNodeCount;
+    unsigned long         maxChildren = 0UL;
+    
+    childOffsets.Populate (iNodeCount + 1UL, 0, 0);
+    childCodes.Populate   (nodeCount, 0, 0);
+    
+    for (unsigned long nodeCode = 0UL; nodeCode + 1UL < nodeCount; nodeCode++) {
+        childOffsets.list_data[flatParents.list_data[nodeCode] + 1L] ++;
+    }
+    for (unsigned long k = 0UL; k < iNodeCount; k++) {
+        StoreIfGreater (maxChildren, (unsigned long)childOffsets.list_data[k+1UL]);
+        childOffsets.list_data[k+1UL] += childOffsets.list_data[k];
+    }
+    
+    _SimpleList fill (childOffsets);
+    for (unsigned long nodeCode = 0UL; nodeCode + 1UL < nodeCount; nodeCode++) {
+        childCodes.list_data [fill.list_data[flatParents.list_data[nodeCode]]++] = nodeCode;
+    }
+    
+    return maxChildren;
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+
+bool            _TheTree::ComputeBranchGradients (
+                                                 _DataSetFilter const*   theFilter,
+                                                 long           *        lNodeFlags,
+                                                 _Vector const*          lNodeResolutions,
+                                                 _SimpleList const&      branches,
+                                                 _List const&            derivatives,
+                                                 hyFloat*                gradients,
+                                                 long                    catID,
+                                                 long                    threads,
+                                                 bool                    logRatios,
+                                                 hyFloat const*          siteWeights,
+                                                 long                    siteWeightStride
+                                                 )
+/*
+    20261018: SLKP
+    
+    compute d log L / d x for parameters x which enter only one branch matrix, given
+    dP/dx for each such branch; 'branches' holds flat node indices (leaves followed by inodes,
+    same as flatParents) and 'derivatives' the corresponding dP/dx matrices
+ 
+    each site is processed with one post-order (inside) and one pre-order (outside) pass;
+    for branch b connecting parent p to node c, L = A_b . P_b . in_c, where A_b
+    is the 'outside' vector at the parent end of b, so that
+ 
+        d log L / d x = (A_b . dP/dx . in_c) / (A_b . P_b . in_c)
+ 
+    because the ratio is invariant to the scaling of A_b and in_c, all conditional vectors
+    are simply normalized to unit max, and no scaling factors need to be tracked
+ 
+    if 'logRatios' is set, the matrices are differences D = P' - P between a replacement matrix for
+    the branch and its current matrix, and the change in log L caused by the replacement,
+ 
+        sum_sites log (A_b . P' . in_c / A_b . P_b . in_c) = sum_sites log1p (A_b . D . in_c / A_b . P_b . in_c)
+ 
+    is accumulated instead
+ 
+    if 'siteWeights' is given, the contribution of site pattern s is also multiplied by
+    siteWeights [s * siteWeightStride] (and patterns with weight 0 are skipped); with catID = c and the
+    posterior probabilities of rate class c as weights, summing the results over c gives d log L / d x
+    for a mixture over rate classes
+ 
+    returns false if some site has 0 probability
+*/
 {
-    // process the leaves first
+    unsigned long   const alphabetDimension = theFilter->GetDimension(),
+                          siteCount         = theFilter->GetPatternCount(),
+                          leafCount         = flatLeaves.lLength,
+                          iNodeCount        = flatTree.lLength,
+                          nodeCount         = leafCount + iNodeCount,
+                          requestCount      = branches.lLength;
     
-    long            alphabetDimension      =            theFilter->GetDimension(),
-    siteCount            =            theFilter->GetPatternCount(),
-    alphabetDimensionmod4  =          alphabetDimension-alphabetDimension%4;
+    InitializeArray (gradients, requestCount, 0.);
     
-    _CalcNode       *theNode               =            ((_CalcNode*) flatCLeaves (0));
-    hyFloat  *   _hprestrict_ transitionMatrix
-    =           theNode->GetCompExp(catID)->theData,
-    result                 =            0.;
+    if (requestCount == 0UL) {
+        return true;
+    }
     
-    if (siteTo  > siteCount)    {
-        siteTo = siteCount;
+    // children of each internal node, and requests for each node, in CSR form
+    
+    _SimpleList     childOffsets,
+                    childCodes,
+                    requestOffsets(nodeCount + 1UL, 0, 0),
+                    requestCodes  (requestCount, 0, 0);
+    
+    unsigned long   const maxChildren = ChildrenInCSR (childOffsets, childCodes);
+    
+    branches.Each ([&] (long nodeCode, unsigned long) -> void {
+        requestOffsets.list_data[nodeCode+1L] ++;
+    });
+    for (unsigned long k = 0UL; k < nodeCount; k++) {
+        requestOffsets.list_data[k+1UL] += requestOffsets.list_data[k];
+    }
+    {
+        _SimpleList fill (requestOffsets);
+        branches.Each ([&] (long nodeCode, unsigned long r) -> void {
+            requestCodes.list_data [fill.list_data[nodeCode]++] = r;
+        });
     }
     
-    for (long siteID = siteFrom; siteID < siteTo; siteID++) {
-        hyFloat  *tMatrix = transitionMatrix,
-        sum     = 0.;
+    hyFloat const ** transitionMatrices = new hyFloat const* [nodeCount];
+    hyFloat const ** derivativeMatrices = new hyFloat const* [requestCount];
+    
+    for (unsigned long nodeCode = 0UL; nodeCode + 1UL < nodeCount; nodeCode++) {
+        transitionMatrices[nodeCode] = GetNodeFromFlatIndex (nodeCode)->GetCompExp(catID)->theData;
+    }
+    for (unsigned long r = 0UL; r < requestCount; r++) {
+        derivativeMatrices[r] = ((_Matrix const*)derivatives.GetItem(r))->theData;
+    }
+    
+    long            np           = MAX (1L, threads);
+    unsigned long   sitesPerP    = siteCount / np + 1UL,
+                    perThread    = alphabetDimension * (2UL * iNodeCount + nodeCount + maxChildren + 2UL);
+    
+    hyFloat       * workspace       = new hyFloat [perThread * np],
+                  * threadGradients = new hyFloat [requestCount * np];
+    
+    InitializeArray (threadGradients, requestCount * np, 0.);
+    
+    bool            allSitesPositive = true;
+    
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static,1) num_threads (np) if (np>1)
+#endif
+    for (long blockID = 0L; blockID < np; blockID++) {
+        hyFloat * inside    = workspace + blockID * perThread,                    // iNodeCount x dim
+                * outside   = inside  + iNodeCount * alphabetDimension,          // iNodeCount x dim
+                * branchTop = outside + iNodeCount * alphabetDimension,          // nodeCount x dim, P_c . in_c
+                * suffix    = branchTop + nodeCount * alphabetDimension,         // (maxChildren + 1) x dim
+                * prefix    = suffix + (maxChildren + 1UL) * alphabetDimension,  // dim
+                * result    = threadGradients + blockID * requestCount;
         
-        long siteState1 = lNodeFlags[siteOrdering.list_data[siteID]],
-        siteState2 = lNodeFlags[siteCount + siteOrdering.list_data[siteID]];
+        unsigned long siteTo = MIN (siteCount, (blockID + 1UL) * sitesPerP);
         
-        if (siteState1 >= 0)
-            // a single character state; sweep down the appropriate column
-        {
+        for (unsigned long siteID = blockID * sitesPerP; siteID < siteTo; siteID++) {
+            
+            hyFloat const siteWeight = theFilter->theFrequencies.get (siteID) * (siteWeights ? siteWeights[siteID * siteWeightStride] : 1.);
+            
+            if (siteWeight == 0.) {
+                continue;
+            }
+            
+            auto child_vector = [&] (unsigned long nodeCode, long& state) -> hyFloat const* {
+                state = -1L;
+                if (nodeCode < leafCount) {
+                    state = lNodeFlags[nodeCode*siteCount + siteID];
+                    return state >= 0L ? nil : lNodeResolutions->theData + (-state-1L) * alphabetDimension;
+                }
+                return inside + (nodeCode - leafCount) * alphabetDimension;
+            };
+            
+            // inside pass
+            
+            InitializeArray (inside, iNodeCount * alphabetDimension, 1.);
+            
+            for (unsigned long nodeCode = 0UL; nodeCode + 1UL < nodeCount; nodeCode++) {
+                long                  state;
+                hyFloat const       * child  = child_vector (nodeCode, state),
+                                    * tMatrix = transitionMatrices[nodeCode];
+                hyFloat             * top     = branchTop + nodeCode * alphabetDimension,
+                                    * parent  = inside + flatParents.list_data[nodeCode] * alphabetDimension;
+                
+                if (nodeCode >= leafCount) {
+                    hyFloat * mutable_child = inside + (nodeCode - leafCount) * alphabetDimension,
+                              max_value     = 0.;
+                    for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                        StoreIfGreater (max_value, mutable_child[k]);
+                    }
+                    if (max_value > 0.) {
+                        max_value = 1. / max_value;
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            mutable_child[k] *= max_value;
+                        }
+                    }
+                }
+                
+                for (unsigned long i = 0UL; i < alphabetDimension; i++, tMatrix += alphabetDimension) {
+                    hyFloat sum = 0.;
+                    if (state >= 0L) {
+                        sum = tMatrix[state];
+                    } else {
+                        for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                            sum += tMatrix[j] * child[j];
+                        }
+                    }
+                    top[i]     = sum;
+                    parent[i] *= sum;
+                }
+            }
+            
+            // outside pass, root to tips
+            
+            for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                outside [(iNodeCount-1UL) * alphabetDimension + k] = theProbs[k];
+            }
+            
+            for (long iNode = (long)iNodeCount - 1L; iNode >= 0L; iNode--) {
+                long const  from     = childOffsets.list_data[iNode],
+                            children = childOffsets.list_data[iNode+1L] - from;
+                
+                hyFloat const * up = outside + iNode * alphabetDimension;
+                
+                // suffix [c] = up * prod_{c' >= c} top [c']
+                
+                for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                    suffix[children * alphabetDimension + k] = up[k];
+                }
+                for (long c = children - 1L; c >= 0L; c--) {
+                    hyFloat const * top = branchTop + childCodes.list_data[from + c] * alphabetDimension;
+                    for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                        suffix[c * alphabetDimension + k] = suffix[(c+1L) * alphabetDimension + k] * top[k];
+                    }
+                }
+                
+                InitializeArray (prefix, alphabetDimension, 1.);
+                
+                for (long c = 0L; c < children; c++) {
+                    unsigned long const nodeCode = childCodes.list_data[from + c];
+                    hyFloat   const *   top      = branchTop + nodeCode * alphabetDimension,
+                              *         tail     = suffix + (c+1L) * alphabetDimension;
+                    long      const     requestsFrom = requestOffsets.list_data[nodeCode],
+                                        requestsTo   = requestOffsets.list_data[nodeCode+1UL];
+                    
+                    // the outside vector at the parent end of this branch is stored in suffix [c]
+                    
+                    hyFloat * branchOutside = suffix + c * alphabetDimension,
+                              max_value     = 0.;
+                    
+                    for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                        branchOutside[k] = prefix[k] * tail[k];
+                        StoreIfGreater (max_value, branchOutside[k]);
+                        prefix[k] *= top[k];
+                    }
+                    
+                    if (max_value > 0.) {
+                        max_value = 1. / max_value;
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            branchOutside[k] *= max_value;
+                        }
+                    }
+                    
+                    if (requestsTo > requestsFrom) {
+                        long            state;
+                        hyFloat const * child = child_vector (nodeCode, state);
+                        hyFloat         site_likelihood = 0.;
+                        
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            site_likelihood += branchOutside[k] * top[k];
+                        }
+                        
+                        if (site_likelihood <= 0.) {
+                            allSitesPositive = false;
+                        } else {
+                            for (long r = requestsFrom; r < requestsTo; r++) {
+                                long            const request = requestCodes.list_data[r];
+                                hyFloat const * dMatrix       = derivativeMatrices[request];
+                                hyFloat         d_likelihood  = 0.;
+                                
+                                for (unsigned long i = 0UL; i < alphabetDimension; i++, dMatrix += alphabetDimension) {
+                                    hyFloat sum = 0.;
+                                    if (state >= 0L) {
+                                        sum = dMatrix[state];
+                                    } else {
+                                        for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                                            sum += dMatrix[j] * child[j];
+                                        }
+                                    }
+                                    d_likelihood += branchOutside[i] * sum;
+                                }
+                                hyFloat const ratio = d_likelihood / site_likelihood;
+                                if (logRatios) {
+                                    if (ratio <= -1.) {
+                                        allSitesPositive = false;
+                                    } else {
+                                        result[request] += siteWeight * log1p (ratio);
+                                    }
+                                } else {
+                                    result[request] += siteWeight * ratio;
+                                }
+                            }
+                        }
+                    }
+                    
+                    if (nodeCode >= leafCount) {
+                        // propagate the outside vector across the branch
+                        hyFloat       * down    = outside + (nodeCode - leafCount) * alphabetDimension;
+                        hyFloat const * tMatrix = transitionMatrices[nodeCode];
+                        InitializeArray (down, alphabetDimension, 0.);
+                        for (unsigned long i = 0UL; i < alphabetDimension; i++, tMatrix += alphabetDimension) {
+                            hyFloat const weight = branchOutside[i];
+                            if (weight != 0.) {
+                                for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                                    down[j] += weight * tMatrix[j];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    // reduce in thread order, so that the result does not depend on scheduling
+    
+    for (long blockID = 0L; blockID < np; blockID++) {
+        for (unsigned long r = 0UL; r < requestCount; r++) {
+            gradients[r] += threadGradients[blockID * requestCount + r];
+        }
+    }
+    
+    delete [] workspace;
+    delete [] threadGradients;
+    delete [] transitionMatrices;
+    delete [] derivativeMatrices;
+    
+    return allSitesPositive;
+}
+
+/*----------------------------------------------------------------------------------------------------------*/
+
+hyFloat      _TheTree::ComputeTwoSequenceLikelihood
+(
+ _SimpleList   & siteOrdering,
+ _DataSetFilter const* theFilter,
+ long      *         lNodeFlags,
+ _Vector* lNodeResolutions,
+ long                siteFrom,
+ long                siteTo,
+ long                catID,
+ hyFloat*     storageVec
+ )
+// the updateNodes flags the nodes (leaves followed by inodes in the same order as flatLeaves and flatNodes)
+// that must be recomputed
+{
+    // process the leaves first
+    
+    long            alphabetDimension      =            theFilter->GetDimension(),
+    siteCount            =            theFilter->GetPatternCount(),
+    alphabetDimensionmod4  =          alphabetDimension-alphabetDimension%4;
+    
+    _CalcNode       *theNode               =            ((_CalcNode*) flatCLeaves (0));
+    hyFloat  *   _hprestrict_ transitionMatrix
+    =           theNode->GetCompExp(catID)->theData,
+    result                 =            0.;
+    
+    if (siteTo  > siteCount)    {
+        siteTo = siteCount;
+    }
+    
+    for (long siteID = siteFrom; siteID < siteTo; siteID++) {
+        hyFloat  *tMatrix = transitionMatrix,
+        sum     = 0.;
+        
+        long siteState1 = lNodeFlags[siteOrdering.list_data[siteID]],
+        siteState2 = lNodeFlags[siteCount + siteOrdering.list_data[siteID]];
+        
+        if (siteState1 >= 0)
+            // a single character state; sweep down the appropriate column
+        {
             if (siteState2 >= 0) { // both completely resolved;
                 sum = tMatrix[siteState1*alphabetDimension + siteState2];
             } else { // first resolved, second is not
@@ -4408,245 +5023,573 @@ hyFloat      _TheTree::ComputeTwoSequenceLikelihood
 
 //_______________________________________________________________________________________________
 
-void     _TheTree::SampleAncestorsBySequence (_DataSetFilter const* dsf, _SimpleList const& siteOrdering, node<long>* currentNode, _AVLListX const* nodeToIndex, hyFloat const* iNodeCache,
-                                              _List& result, _SimpleList* parentStates, _List& expandedSiteMap, hyFloat const* catAssignments, long catCount)
+static void _hy_ancestral_state_letters (_DataSetFilter const* dsf, _StringBuffer& letters) {
+    // the letters for state codes -1 (unresolved) to dimension - 1, unitLength characters per code,
+    // so that reconstruction threads can write characters without the (unsynchronized) conversion cache
+    long const alphabetDimension = dsf->GetDimension(),
+               unitLength        = dsf->GetUnitLength();
+
+    for (long state = -1L; state < alphabetDimension; state++) {
+        letters << dsf->ConvertCodeToLetters (dsf->CorrectCode (state), unitLength);
+    }
+}
 
-// must be called initially with the root node
+//_______________________________________________________________________________________________
 
+_List*   _TheTree::SampleAncestralStates (_DataSetFilter const* dsf,
+                                          _SimpleList const& siteOrdering,
+                                          hyFloat const* iNodeCache,
+                                          long classCount,
+                                          hyFloat const* classPosteriors,
+                                          hyFloat const* siteClasses,
+                                          unsigned long samples,
+                                          uint64_t seed,
+                                          long threads)
 
 // dsf:                         the filter to sample from
 // siteOrdering:                the map from cache ordering to actual pattern ordering
-// currentNode:                 the node index to sample for
-// nodeToIndex:                 an AVL that maps the address of an internal node pointed to by node<long> to its order in the tree postorder traversal
-// iNodeCache:                  internal node likelihood caches
-// results:                     the list that will store sampled strings
-// parentStates:                sampled states for the parent of the current node
-// expandedSiteMap:             a list of simple lists giving site indices for each unique column pattern in the alignment
-// catAssignments:              a vector assigning a (partition specific) rate category to each site (nil if no rate variation)
-// catCount:                    the number of rate classes
+// iNodeCache:                  internal node likelihood caches (all rate classes, class 0 first), up-to-date
+// classCount:                  the number of rate classes
+// classPosteriors:             patterns x classes posterior probabilities of rate classes (nil if there is no rate variation)
+// siteClasses:                 a rate class for each site (HMM or constant-on-partition variables, where the classes
+//                              are not independent across sites); nil if classes are drawn from classPosteriors
+// samples:                     how many ancestral histories to draw; sample k occupies sites [k*siteCount, (k+1)*siteCount)
+//                              of each result string
+// seed:                        random streams are keyed on (seed, block of sites), so results do not depend on 'threads'
+
+// returns one string per internal node, in pre-order (root first)
+
+/*
+    20261018: SLKP
 
-// this needs to be updated to deal with traversal caches!
+    the conditional likelihoods (a single post-order pass, shared by all samples)
+    are taken from the live caches; each sample then costs a single root-to-tips
+    pass per site, with states drawn from P (parent -> child) x conditionals (child)
+*/
 {
-    long                      childrenCount     = currentNode->get_num_nodes();
-    
-    if (childrenCount) {
-        long              siteCount                       = dsf->GetPatternCount  (),
-        alphabetDimension              = dsf->GetDimension         (),
-        nodeIndex                       = nodeToIndex->GetXtra (nodeToIndex->Find ((BaseRef)currentNode)),
-        unitLength                     = dsf->GetUnitLength(),
-        catBlockShifter                    = catAssignments?(dsf->GetPatternCount()*GetINodeCount()):0;
-        
-        
-        _CalcNode *     currentTreeNode = ((_CalcNode*) flatTree (nodeIndex));
-        _SimpleList     sampledStates     (dsf->GetSiteCountInUnits (), 0, 0);
-        
-        hyFloat  const *  transitionMatrix = (catAssignments|| !parentStates)?nil:currentTreeNode->GetCompExp()->theData;
-        hyFloat  const *  conditionals     = catAssignments?nil:(iNodeCache + nodeIndex  * siteCount * alphabetDimension);
-        hyFloat        *  cache            = new hyFloat [alphabetDimension];
-        
-        for (long           pattern = 0; pattern < siteCount; pattern++) {
-            _SimpleList*    patternMap = (_SimpleList*) expandedSiteMap (siteOrdering.list_data[pattern]);
-            if (catAssignments) {
-                long localCatID = catAssignments[siteOrdering.list_data[pattern]];
-                if (parentStates) {
-                    transitionMatrix = currentTreeNode->GetCompExp(localCatID)->theData;
+    unsigned long const   patternCount      = dsf->GetPatternCount(),
+                          alphabetDimension = dsf->GetDimension(),
+                          unitLength        = dsf->GetUnitLength(),
+                          siteCount         = dsf->GetSiteCountInUnits(),
+                          stride            = GetConditionalStride (alphabetDimension),
+                          leafCount         = flatLeaves.lLength,
+                          iNodeCount        = flatTree.lLength,
+                          classBlock        = stride * patternCount * iNodeCount,
+                          sitesPerBlock     = 256UL,
+                          blockCount        = (siteCount + sitesPerBlock - 1UL) / sitesPerBlock;
+
+    bool          const   byClass           = classPosteriors || siteClasses;
+
+    _SimpleList const *   duplicateMap      = (_SimpleList const*)dsf->GetDuplicateSiteMap();
+    _SimpleList           cachePosition     (patternCount, 0, 0),
+                          preOrder,
+                          childOffsets,
+                          childCodes;
+
+    siteOrdering.Each ([&] (long pattern, unsigned long position) -> void {
+        cachePosition.list_data[pattern] = position;
+    });
+
+    ChildrenInCSR (childOffsets, childCodes);
+
+    {
+        // internal nodes in pre-order, children left to right
+        _SimpleList stack;
+        stack << (iNodeCount - 1UL);
+        while (stack.nonempty()) {
+            long const iNode = stack.Pop();
+            preOrder << iNode;
+            for (long c = childOffsets.list_data[iNode+1L] - 1L; c >= childOffsets.list_data[iNode]; c--) {
+                if (childCodes.list_data[c] >= (long)leafCount) {
+                    stack << childCodes.list_data[c] - leafCount;
                 }
-                
-                conditionals     = iNodeCache + localCatID*alphabetDimension*catBlockShifter + (pattern + nodeIndex  * siteCount) * alphabetDimension;
             }
-            
-            for (long site = 0; site < patternMap->lLength; site++) {
-                long        siteID =   patternMap->list_data[site];
-                
-                hyFloat  randVal  = genrand_real2(),
-                totalSum = 0.;
-                
-                hyFloat  const *   matrixRow;
-                
-                if  (parentStates == nil) {
-                    matrixRow = theProbs;
-                } else {
-                    matrixRow = transitionMatrix + parentStates->list_data[siteID] * alphabetDimension;
+        }
+    }
+
+    hyFloat const ** transitionMatrices = new hyFloat const* [classCount * iNodeCount];
+
+    for (long r = 0L; r < classCount; r++) {
+        for (unsigned long iNode = 0UL; iNode + 1UL < iNodeCount; iNode++) {
+            transitionMatrices[r * iNodeCount + iNode] = ((_CalcNode*) flatTree (iNode))->GetCompExp(byClass ? r : -1L)->theData;
+        }
+    }
+
+    _StringBuffer letters ((alphabetDimension + 1UL) * unitLength);
+    _hy_ancestral_state_letters (dsf, letters);
+
+    _List      *result = new _List;
+    for (unsigned long k = 0UL; k < iNodeCount; k++) {
+        result->AppendNewInstance (new _String((unsigned long)(samples * siteCount * unitLength)));
+    }
+
+    long            np        = MAX (1L, threads);
+    long    const   taskCount = samples * blockCount;
+
+    hyFloat       * workspace = new hyFloat [alphabetDimension * np];
+    long          * stateSpace = new long [iNodeCount * np];
+
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static,1) num_threads (np) if (np>1)
+#endif
+    for (long blockID = 0L; blockID < np; blockID++) {
+        hyFloat   * weights = workspace  + blockID * alphabetDimension;
+        long      * states  = stateSpace + blockID * iNodeCount;
+
+        for (long task = blockID; task < taskCount; task += np) {
+
+            _hyRandomStream stream (seed, task);
+
+            auto draw = [&] (hyFloat total) -> long {
+                // states with cumulative weight above a uniform draw; -1 if all weights are 0
+                if (total <= 0.) {
+                    return -1L;
                 }
-                
-                for (long i = 0; i<alphabetDimension; i++) {
-                    totalSum += (cache[i] = matrixRow[i]*conditionals[i]);
+                hyFloat const threshold = stream.Uniform () * total;
+                hyFloat       sum       = 0.;
+                for (unsigned long k = 0UL; k + 1UL < alphabetDimension; k++) {
+                    sum += weights[k];
+                    if (sum > threshold) {
+                        return k;
+                    }
                 }
-                
-                randVal *= totalSum;
-                totalSum    = 0.0;
-                long        sampledChar = -1;
-                while       (totalSum < randVal) {
-                    sampledChar ++;
-                    totalSum += cache[sampledChar];
+                return alphabetDimension - 1UL;
+            };
+
+            unsigned long const sample   = task / blockCount,
+                                siteFrom = (task % blockCount) * sitesPerBlock,
+                                siteTo   = MIN (siteCount, siteFrom + sitesPerBlock);
+
+            for (unsigned long siteID = siteFrom; siteID < siteTo; siteID++) {
+                long const  pattern  = duplicateMap->list_data[siteID],
+                            position = cachePosition.list_data[pattern];
+                long        classID  = 0L;
+
+                if (siteClasses) {
+                    classID = siteClasses[siteID];
+                } else if (classPosteriors && classCount > 1L) {
+                    hyFloat const * posterior = classPosteriors + pattern * classCount,
+                                    threshold = stream.Uniform ();
+                    hyFloat         sum       = 0.;
+                    for (classID = 0L; classID + 1L < classCount; classID ++) {
+                        sum += posterior[classID];
+                        if (sum > threshold) {
+                            break;
+                        }
+                    }
+                }
+
+                hyFloat const * conditionals = iNodeCache + classID * classBlock + position * stride,
+                             ** matrices     = transitionMatrices + classID * iNodeCount;
+
+                for (unsigned long k = 0UL; k < iNodeCount; k++) {
+                    long      const iNode = preOrder.list_data[k];
+                    hyFloat const * nodeConditionals = conditionals + iNode * patternCount * stride;
+                    hyFloat         total = 0.;
+
+                    if (k == 0UL) {
+                        for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                            total += (weights[j] = theProbs[j] * nodeConditionals[j]);
+                        }
+                        states[iNode] = draw (total);
+                    } else {
+                        long const parentState = states[flatParents.list_data[iNode + leafCount]];
+                        if (parentState < 0L) {
+                            states[iNode] = -1L;
+                        } else {
+                            hyFloat const * row = matrices[iNode] + parentState * alphabetDimension;
+                            for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                                total += (weights[j] = row[j] * nodeConditionals[j]);
+                            }
+                            states[iNode] = draw (total);
+                        }
+                    }
+
+                    _String       * sequence = (_String*)result->GetItem (k);
+                    unsigned long   offset   = (sample * siteCount + siteID) * unitLength;
+                    for (unsigned long charS = 0UL; charS < unitLength; charS++) {
+                        sequence->set_char (offset + charS, letters.char_at ((states[iNode] + 1L) * unitLength + charS));
+                    }
                 }
-                
-                sampledStates.list_data[siteID] = sampledChar;
-            }
-            
-            if (catAssignments == nil) {
-                conditionals += alphabetDimension;
             }
         }
-        
-        delete [] cache;
-        
-        _SimpleList  conversion;
-        _AVLListXL   conversionAVL (&conversion);
-        
-        _StringBuffer * sampledSequence = new _StringBuffer (siteCount*unitLength);
-        _String  letterValue ((unsigned long) unitLength);
-        for (long charIndexer = 0; charIndexer < sampledStates.countitems(); charIndexer++) {
-            dsf->ConvertCodeToLettersBuffered (dsf->CorrectCode(sampledStates.list_data[charIndexer]), unitLength, letterValue, &conversionAVL);
-            (*sampledSequence) << letterValue;
+    }
+
+    delete [] workspace;
+    delete [] stateSpace;
+    delete [] transitionMatrices;
+
+    return result;
+}
+
+//_______________________________________________________________________________________________
+
+void   _TheTree::ComputeMarginalSupport (_DataSetFilter const* dsf,
+                                         _SimpleList const& siteOrdering,
+                                         hyFloat const* iNodeCache,
+                                         long* lNodeFlags,
+                                         _Vector const* lNodeResolutions,
+                                         long classCount,
+                                         hyFloat const* classPosteriors,
+                                         bool doLeaves,
+                                         _Matrix& supportValues,
+                                         long threads)
+
+// dsf:                         the filter to reconstruct
+// siteOrdering:                the map from cache ordering to actual pattern ordering
+// iNodeCache:                  internal node likelihood caches (all rate classes, class 0 first), up-to-date
+// classCount:                  the number of rate classes
+// classPosteriors:             patterns x classes posterior probabilities of rate classes (nil if there is no rate variation)
+// doLeaves:                    compute support values for leaves instead of internal nodes
+// supportValues:               a zero-filled (internal nodes or leaves) x (patterns x alphabetDimension) matrix; rows are indexed
+//                              by the in-order index of the node (see MapPostOrderToInOrderTraversal)
+
+/*
+    20261018: SLKP
+
+    for an internal node n and rate class r, the posterior probability of state k is
+    in_n (k) out_n (k) / sum_j in_n (j) out_n (j), where in_n are the (cached) conditional likelihoods
+    and out_n is the 'outside' vector, obtained with one pre-order pass per site, using the same
+    prefix/suffix products of the children's P . in vectors as ComputeBranchGradients;
+    these are mixed over rate classes using their posterior probabilities
+
+    for a leaf l, the support for state k is proportional to the likelihood of the site with the leaf
+    set to k, i.e. sum_r Pr (r | data) out_l (k) / (out_l . observed_l)
+
+    this replaces (dimension x nodes) likelihood evaluations, each with a node forced to a given state,
+    with a single pass over the tree
+*/
+{
+    unsigned long   const alphabetDimension = dsf->GetDimension(),
+                          patternCount      = dsf->GetPatternCount(),
+                          stride            = GetConditionalStride (alphabetDimension),
+                          leafCount         = flatLeaves.lLength,
+                          iNodeCount        = flatTree.lLength,
+                          nodeCount         = leafCount + iNodeCount,
+                          classBlock        = stride * patternCount * iNodeCount,
+                          shiftForTheNode   = patternCount * alphabetDimension;
+
+    _SimpleList     childOffsets,
+                    childCodes,
+                    postToIn;
+
+    unsigned long   const maxChildren = ChildrenInCSR (childOffsets, childCodes);
+
+    MapPostOrderToInOrderTraversal (postToIn, !doLeaves);
+
+    hyFloat const ** transitionMatrices = new hyFloat const* [classCount * nodeCount];
+
+    for (long r = 0L; r < classCount; r++) {
+        for (unsigned long nodeCode = 0UL; nodeCode + 1UL < nodeCount; nodeCode++) {
+            transitionMatrices[r * nodeCount + nodeCode] = GetNodeFromFlatIndex (nodeCode)->GetCompExp(classPosteriors ? r : -1L)->theData;
         }
-        sampledSequence->TrimSpace();
-        result.AppendNewInstance(sampledSequence);
-        //printf ("%d: %s\n", nodeIndex, sampledSequence->sData);
-        
-        for (long child = 1L; child <= childrenCount; child ++) {
-            SampleAncestorsBySequence (dsf, siteOrdering, currentNode->go_down(child), nodeToIndex, iNodeCache, result, &sampledStates, expandedSiteMap, catAssignments, catCount);
+    }
+
+    long            np           = MAX (1L, threads);
+    unsigned long   sitesPerP    = patternCount / np + 1UL,
+                    perThread    = alphabetDimension * (iNodeCount + nodeCount + maxChildren + 3UL);
+
+    hyFloat       * workspace    = new hyFloat [perThread * np];
+
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static,1) num_threads (np) if (np>1)
+#endif
+    for (long blockID = 0L; blockID < np; blockID++) {
+        hyFloat * outside   = workspace + blockID * perThread,                    // iNodeCount x dim
+                * branchTop = outside + iNodeCount * alphabetDimension,          // nodeCount x dim, P_c . in_c
+                * suffix    = branchTop + nodeCount * alphabetDimension,         // (maxChildren + 1) x dim
+                * prefix    = suffix + (maxChildren + 1UL) * alphabetDimension,  // dim
+                * leafOut   = prefix + alphabetDimension;                        // dim
+
+        unsigned long siteTo = MIN (patternCount, (blockID + 1UL) * sitesPerP);
+
+        for (unsigned long siteID = blockID * sitesPerP; siteID < siteTo; siteID++) {
+            long const pattern = siteOrdering.list_data[siteID];
+
+            for (long r = 0L; r < classCount; r++) {
+                hyFloat const classWeight = classPosteriors ? classPosteriors[pattern * classCount + r] : 1.;
+                if (classWeight <= 0.) {
+                    continue;
+                }
+
+                hyFloat const *  conditionals = iNodeCache + r * classBlock + siteID * stride,
+                              ** matrices     = transitionMatrices + r * nodeCount;
+
+                auto child_vector = [&] (unsigned long nodeCode, long& state) -> hyFloat const* {
+                    state = -1L;
+                    if (nodeCode < leafCount) {
+                        state = lNodeFlags[nodeCode*patternCount + pattern];
+                        return state >= 0L ? nil : lNodeResolutions->theData + (-state-1L) * alphabetDimension;
+                    }
+                    return conditionals + (nodeCode - leafCount) * patternCount * stride;
+                };
+
+                for (unsigned long nodeCode = 0UL; nodeCode + 1UL < nodeCount; nodeCode++) {
+                    long                  state;
+                    hyFloat const       * child   = child_vector (nodeCode, state),
+                                        * tMatrix = matrices[nodeCode];
+                    hyFloat             * top     = branchTop + nodeCode * alphabetDimension;
+
+                    for (unsigned long i = 0UL; i < alphabetDimension; i++, tMatrix += alphabetDimension) {
+                        hyFloat sum = 0.;
+                        if (state >= 0L) {
+                            sum = tMatrix[state];
+                        } else {
+                            for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                                sum += tMatrix[j] * child[j];
+                            }
+                        }
+                        top[i] = sum;
+                    }
+                }
+
+                for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                    outside [(iNodeCount-1UL) * alphabetDimension + k] = theProbs[k];
+                }
+
+                for (long iNode = (long)iNodeCount - 1L; iNode >= 0L; iNode--) {
+                    long const  from     = childOffsets.list_data[iNode],
+                                children = childOffsets.list_data[iNode+1L] - from;
+
+                    hyFloat const * up = outside + iNode * alphabetDimension;
+
+                    if (!doLeaves) {
+                        hyFloat const * inside = conditionals + iNode * patternCount * stride;
+                        hyFloat       * target = supportValues.theData + postToIn.list_data[iNode] * shiftForTheNode + pattern * alphabetDimension,
+                                        sum    = 0.;
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            sum += inside[k] * up[k];
+                        }
+                        if (sum > 0.) {
+                            sum = classWeight / sum;
+                            for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                                target[k] += inside[k] * up[k] * sum;
+                            }
+                        }
+                    }
+
+                    // suffix [c] = up * prod_{c' >= c} top [c']
+
+                    for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                        suffix[children * alphabetDimension + k] = up[k];
+                    }
+                    for (long c = children - 1L; c >= 0L; c--) {
+                        hyFloat const * top = branchTop + childCodes.list_data[from + c] * alphabetDimension;
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            suffix[c * alphabetDimension + k] = suffix[(c+1L) * alphabetDimension + k] * top[k];
+                        }
+                    }
+
+                    InitializeArray (prefix, alphabetDimension, 1.);
+
+                    for (long c = 0L; c < children; c++) {
+                        unsigned long const nodeCode = childCodes.list_data[from + c];
+                        hyFloat   const *   top      = branchTop + nodeCode * alphabetDimension,
+                                  *         tail     = suffix + (c+1L) * alphabetDimension;
+
+                        hyFloat * branchOutside = suffix + c * alphabetDimension,
+                                  max_value     = 0.;
+
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            branchOutside[k] = prefix[k] * tail[k];
+                            StoreIfGreater (max_value, branchOutside[k]);
+                            prefix[k] *= top[k];
+                        }
+
+                        if (max_value > 0.) {
+                            max_value = 1. / max_value;
+                            for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                                branchOutside[k] *= max_value;
+                            }
+                        }
+
+                        if (nodeCode < leafCount && !doLeaves) {
+                            continue;
+                        }
+
+                        // propagate the outside vector across the branch
+
+                        hyFloat       * down    = nodeCode >= leafCount ? outside + (nodeCode - leafCount) * alphabetDimension : leafOut;
+                        hyFloat const * tMatrix = matrices[nodeCode];
+                        InitializeArray (down, alphabetDimension, 0.);
+                        for (unsigned long i = 0UL; i < alphabetDimension; i++, tMatrix += alphabetDimension) {
+                            hyFloat const weight = branchOutside[i];
+                            if (weight != 0.) {
+                                for (unsigned long j = 0UL; j < alphabetDimension; j++) {
+                                    down[j] += weight * tMatrix[j];
+                                }
+                            }
+                        }
+
+                        if (nodeCode < leafCount) {
+                            long            state;
+                            hyFloat const * observed = child_vector (nodeCode, state);
+                            hyFloat         site_likelihood = 0.;
+
+                            if (state >= 0L) {
+                                site_likelihood = leafOut[state];
+                            } else {
+                                for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                                    site_likelihood += leafOut[k] * observed[k];
+                                }
+                            }
+
+                            if (site_likelihood > 0.) {
+                                hyFloat * target = supportValues.theData + postToIn.list_data[nodeCode] * shiftForTheNode + pattern * alphabetDimension;
+                                site_likelihood  = classWeight / site_likelihood;
+                                for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                                    target[k] += leafOut[k] * site_likelihood;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (doLeaves) {
+                for (unsigned long leaf = 0UL; leaf < leafCount; leaf++) {
+                    hyFloat * target = supportValues.theData + postToIn.list_data[leaf] * shiftForTheNode + pattern * alphabetDimension,
+                              sum    = 0.;
+                    for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                        sum += target[k];
+                    }
+                    if (sum > 0.) {
+                        sum = 1. / sum;
+                        for (unsigned long k = 0UL; k < alphabetDimension; k++) {
+                            target[k] *= sum;
+                        }
+                    }
+                }
+            }
         }
     }
+
+    delete [] workspace;
+    delete [] transitionMatrices;
 }
 
 //_______________________________________________________________________________________________
 
 _List*   _TheTree::RecoverAncestralSequences (_DataSetFilter const* dsf,
-                                              _SimpleList const& siteOrdering,
                                               _List const& expandedSiteMap,
-                                              hyFloat * iNodeCache,
                                               hyFloat const* catAssignments,
-                                              long catCount,
                                               long* lNodeFlags,
-                                              _Vector * lNodeResolutions,
-                                              bool              alsoDoLeaves
+                                              _Vector const* lNodeResolutions,
+                                              bool              alsoDoLeaves,
+                                              long              threads
                                               )
 
 
-// dsf:                         the filter to sample from
-// siteOrdering:                the map from cache ordering to actual pattern ordering
+// dsf:                         the filter to reconstruct
 // expandedSiteMap:             a list of simple lists giving site indices for each unique column pattern in the alignment
-// iNodeCache:                  internal node likelihood caches
-// catAssignments:              a vector assigning a (partition specific) rate category to each site
-// catCount:                    the number of rate classes
+// catAssignments:              a vector assigning a (partition specific) rate category to each site pattern (nil if no rate variation)
 // alsoDoLeaves:                if true, also return ML reconstruction of observed (or partially observed) sequences
+
+/*
+    20261018: SLKP
+
+    the joint (Pupko et al) reconstruction is carried out independently for each site pattern,
+    so patterns are split into blocks (one per thread), each with its own dynamic programming tables;
+    the likelihood caches of the LF are no longer used as scratch space (and need not be recomputed
+    afterwards)
+*/
 {
     long            patternCount                     = dsf->GetPatternCount  (),
-    alphabetDimension                = dsf->GetDimension         (),
-    unitLength                       = dsf->GetUnitLength        (),
-    iNodeCount                       = GetINodeCount             (),
-    leafCount                        = GetLeafCount              (),
-    siteCount                        = dsf->GetSiteCountInUnits    (),
-    allNodeCount                     = 0,
-    stateCacheDim                    = (alsoDoLeaves? (iNodeCount + leafCount): (iNodeCount));
-    
-    long            *stateCache                     = new long [patternCount*(iNodeCount-1)*alphabetDimension],
-    *leafBuffer                     = new long [(alsoDoLeaves?leafCount*patternCount:1)*alphabetDimension];
-    
-    // a Patterns x Int-Nodes x CharStates integer table
-    // with the best character assignment for node i given that its parent state is j for a given site
-    
-    hyFloat          *buffer                         = new hyFloat [alphabetDimension];
-    // iNodeCache will be OVERWRITTEN with conditional pair (i,j) conditional likelihoods
-    
-    
-    _SimpleList     taggedInternals (iNodeCount, 0, 0),
-    postToIn;
-    
+                    alphabetDimension                = dsf->GetDimension         (),
+                    unitLength                       = dsf->GetUnitLength        (),
+                    iNodeCount                       = GetINodeCount             (),
+                    leafCount                        = GetLeafCount              (),
+                    siteCount                        = dsf->GetSiteCountInUnits    (),
+                    allNodeCount                     = iNodeCount + leafCount - 1, // all nodes except the root
+                    stateCacheDim                    = (alsoDoLeaves? (iNodeCount + leafCount): (iNodeCount));
+
+    _SimpleList     postToIn;
     MapPostOrderToInOrderTraversal (postToIn);
-    // all nodes except the root
-    
-    allNodeCount = iNodeCount + leafCount - 1;
-    
-    for  (long nodeID = 0; nodeID < allNodeCount; nodeID++) {
-        long    parent_index = flatParents.get (nodeID),
-                node_index   = nodeID;
-        
-        bool    is_leaf     = nodeID < flatLeaves.countitems();
-        
-        
-        if (!is_leaf) {
-            node_index -=  flatLeaves.countitems();
-            AddBranchToForcedRecomputeList (node_index);
-        }
-        
-        hyFloat * parentConditionals = iNodeCache + parent_index * alphabetDimension * patternCount;
-        
-        if (taggedInternals.get(parent_index) == 0L) {
-            // mark the parent for update and clear its conditionals if needed
-            taggedInternals[parent_index]     = 1L;
-            InitializeArray(parentConditionals, patternCount*alphabetDimension, 1.);
-        }
-        
-        _CalcNode *          tree_node_object = is_leaf? ((_CalcNode*) flatCLeaves (node_index)):((_CalcNode*) flatTree    (node_index));
-        hyFloat  const*      transition_matrix = nil;
-        
-        if (!catAssignments) {
-            _Matrix* comp_exp = tree_node_object->GetCompExp();
-            if (!comp_exp) {
+
+    if (!catAssignments) {
+        for (long nodeID = 0; nodeID < allNodeCount; nodeID++) {
+            _CalcNode * tree_node_object = nodeID < leafCount ? ((_CalcNode*) flatCLeaves (nodeID)) : ((_CalcNode*) flatTree (nodeID - leafCount));
+            if (!tree_node_object->GetCompExp()) {
                 hy_global::HandleApplicationError(_String ("Internal error in ") & __PRETTY_FUNCTION__ & ". Transition matrix not computed for " & *tree_node_object->GetName());
                 return nil;
             }
-            transition_matrix = comp_exp->theData;
         }
-        
-        // this will need to be toggled on a per site basis
-        hyFloat  *       childVector;
-        
-        if (!is_leaf) {
-            childVector = iNodeCache + (node_index * patternCount) * alphabetDimension;
-        }
-        
-        for (long siteID = 0; siteID < patternCount; siteID++, parentConditionals += alphabetDimension) {
-            if (catAssignments) {
-                transition_matrix = tree_node_object->GetCompExp(catAssignments[siteOrdering.list_data[siteID]])->theData;
-            }
-            
-            hyFloat  const *tMatrix = transition_matrix;
-            if (is_leaf) {
-                long siteState = lNodeFlags[node_index*patternCount + siteOrdering.list_data[siteID]] ;
-                if (siteState >= 0L) { // a fully resolved leaf
-                    tMatrix  +=  siteState;
-                    for (long k = 0; k < alphabetDimension; k++, tMatrix += alphabetDimension) {
-                        parentConditionals[k] *= *tMatrix;
-                    }
-                    if (alsoDoLeaves) {
-                        InitializeArray (leafBuffer, alphabetDimension, (const long)siteState);
-                        leafBuffer += alphabetDimension;
+    }
+
+    _StringBuffer letters ((alphabetDimension + 1L) * unitLength);
+    _hy_ancestral_state_letters (dsf, letters);
+
+    _List      *result = new _List;
+    for (long k = 0; k < stateCacheDim; k++) {
+        result->AppendNewInstance (new _String((unsigned long)siteCount*unitLength));
+    }
+
+    long            np           = MAX (1L, threads),
+                    sitesPerP    = patternCount / np + 1L,
+                    perThread    = alphabetDimension * (iNodeCount + 1L);
+
+    hyFloat       * workspace    = new hyFloat [perThread * np];
+    long          * stateSpace   = new long [(allNodeCount * alphabetDimension + stateCacheDim) * np];
+
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) schedule(static,1) num_threads (np) if (np>1)
+#endif
+    for (long blockID = 0L; blockID < np; blockID++) {
+        hyFloat * conditionals = workspace + blockID * perThread, // iNodeCount x dim: the likelihood of the best assignment below a node, given its state
+                * buffer       = conditionals + iNodeCount * alphabetDimension;
+        long    * stateCache   = stateSpace + blockID * (allNodeCount * alphabetDimension + stateCacheDim),
+                                 // (all nodes but the root) x dim: the best state of a node given that of its parent
+                * parentStates = stateCache + allNodeCount * alphabetDimension;
+
+        long siteTo = MIN (patternCount, (blockID + 1L) * sitesPerP);
+
+        for (long siteID = blockID * sitesPerP; siteID < siteTo; siteID++) {
+
+            InitializeArray (conditionals, iNodeCount * alphabetDimension, 1.);
+
+            for (long nodeID = 0; nodeID < allNodeCount; nodeID++) {
+                bool              is_leaf            = nodeID < leafCount;
+                hyFloat         * parentConditionals = conditionals + flatParents.list_data[nodeID] * alphabetDimension;
+                long            * stateBuffer        = stateCache + nodeID * alphabetDimension;
+                _CalcNode const * tree_node_object   = is_leaf ? ((_CalcNode*) flatCLeaves (nodeID)) : ((_CalcNode*) flatTree (nodeID - leafCount));
+                hyFloat const   * tMatrix            = (catAssignments ? tree_node_object->GetCompExp(catAssignments[siteID]) : tree_node_object->GetCompExp())->theData,
+                                * childVector;
+
+                if (is_leaf) {
+                    long siteState = lNodeFlags[nodeID*patternCount + siteID];
+                    if (siteState >= 0L) { // a fully resolved leaf
+                        tMatrix  +=  siteState;
+                        for (long k = 0; k < alphabetDimension; k++, tMatrix += alphabetDimension) {
+                            parentConditionals[k] *= *tMatrix;
+                        }
+                        InitializeArray (stateBuffer, alphabetDimension, (const long)siteState);
+                        continue;
                     }
-                    
-                    continue;
-                } else {// an ambiguous leaf
+                    // an ambiguous leaf
                     childVector = lNodeResolutions->theData + (-siteState-1L) * alphabetDimension;
+                } else {
+                    childVector = conditionals + (nodeID - leafCount) * alphabetDimension;
                 }
-                
-            }
-            
-            // now repopulate this vector as necessary -- if we are here this means
-            // that the subtree below has been completely processed,
-            // the i-th cell of childVector contains the likelihood of the _optimal_
-            // assignment in the subtree below given that the character at the current
-            // node is i.
-            
-            // hence, given parent state 'p', we optimize
-            // max_i pr (p->i) childVector [i] and store it in the p cell of vector childVector
-            
-            hyFloat overallMax                     = 0.0;
-            
-            long       *stateBuffer                   = is_leaf?leafBuffer:stateCache;
-            
-            // check for degeneracy
-            
-            bool completely_unresolved = ArrayAll (childVector, alphabetDimension, [] (hyFloat x, unsigned long) {return x == 1.;});
-            
-            if (completely_unresolved) {
-                InitializeArray(stateBuffer, alphabetDimension, -1L);
-            } else {
+
+                // the i-th cell of childVector contains the likelihood of the _optimal_
+                // assignment in the subtree below given that the character at the current
+                // node is i.
+
+                // hence, given parent state 'p', we optimize
+                // max_i pr (p->i) childVector [i] and store it in the p cell of vector childVector
+
+                if (ArrayAll (childVector, alphabetDimension, [] (hyFloat x, unsigned long) {return x == 1.;})) {
+                    // check for degeneracy
+                    InitializeArray(stateBuffer, alphabetDimension, -1L);
+                    continue;
+                }
+
+                hyFloat overallMax = 0.0;
+
                 for (long p = 0L; p < alphabetDimension; p++) {
                     hyFloat max_lik = 0.;
-                    long       max_idx = 0L;
-                    
+                    long    max_idx = 0L;
+
                     for (long c = 0L; c < alphabetDimension; c++) {
                         hyFloat thisV = tMatrix[c] * childVector[c];
                         if (thisV > max_lik) {
@@ -4654,123 +5597,83 @@ _List*   _TheTree::RecoverAncestralSequences (_DataSetFilter const* dsf,
                             max_idx = c;
                         }
                     }
-                    
+
                     stateBuffer [p] = max_idx;
                     buffer [p]      = max_lik;
-                    
+
                     if (max_lik > overallMax) {
                         overallMax = max_lik;
                     }
-                    
+
                     tMatrix += alphabetDimension;
                 }
-                
+
                 if (overallMax > 0.0 && overallMax < _lfScalingFactorThreshold) {
                     for (long k = 0L; k < alphabetDimension; k++) {
                         buffer[k] *= _lfScalerUpwards;
                     }
                 }
-                
+
                 // buffer[p] now contains the maximum likelihood of the tree
                 // from this point forward given that parent state is p
                 // and stateBuffer[p] stores the maximizing assignment
                 // for this node
-                
+
                 for (long k = 0; k < alphabetDimension; k++) {
-                    if (stateBuffer[k] >= 0L) {
-                        parentConditionals[k] *= buffer[k];
-                    }
+                    parentConditionals[k] *= buffer[k];
                 }
             }
-            
-            if (is_leaf) {
-                if (alsoDoLeaves) {
-                    leafBuffer += alphabetDimension;
-                }
+
+            hyFloat const * rootConditionals = conditionals + (iNodeCount-1) * alphabetDimension;
+
+            if (ArrayAll (rootConditionals, alphabetDimension, [] (hyFloat x, unsigned long) {return x == 1.;})) {
+                InitializeArray (parentStates, stateCacheDim, -1L);
             } else {
-                stateCache += alphabetDimension;
-            }
-            
-            childVector += alphabetDimension;
-        }
-    }
-    
-    _List      *result = new _List;
-    for (long k = 0; k < stateCacheDim; k++) {
-        result->AppendNewInstance (new _String((unsigned long)siteCount*unitLength));
-    }
-    
-    hyFloat * _hprestrict_ rootConditionals = iNodeCache + alphabetDimension * ((iNodeCount-1)  * patternCount);
-    _SimpleList  parentStates (stateCacheDim,0,0),
-    conversion;
-    
-    stateCache -= patternCount*(iNodeCount-1)*alphabetDimension;
-    if (alsoDoLeaves) {
-        leafBuffer -= patternCount*leafCount*alphabetDimension;
-    }
-    
-    _AVLListXL    conversionAVL (&conversion);
-    _String       codeBuffer    ((unsigned long)unitLength);
-    
-    for (long siteID = 0; siteID < patternCount; siteID++, rootConditionals += alphabetDimension) {
-        hyFloat max_lik = 0.;
-        long       max_idx = 0;
-        
-        long howManyOnes = 0;
-        for (long k = 0; k < alphabetDimension; k++) {
-            howManyOnes += rootConditionals[k]==1.;
-        }
-        
-        _SimpleList const*    patternMap = (_SimpleList const*) expandedSiteMap.GetItem(siteOrdering.list_data[siteID]);
-        
-        if (howManyOnes != alphabetDimension) {
-            for (long c = 0; c < alphabetDimension; c++) {
-                hyFloat thisV = theProbs[c] * rootConditionals[c];
-                if (thisV > max_lik) {
-                    max_lik = thisV;
-                    max_idx = c;
+                hyFloat max_lik = 0.;
+                long    max_idx = 0;
+
+                for (long c = 0; c < alphabetDimension; c++) {
+                    hyFloat thisV = theProbs[c] * rootConditionals[c];
+                    if (thisV > max_lik) {
+                        max_lik = thisV;
+                        max_idx = c;
+                    }
                 }
-            }
-            
-            parentStates.list_data[iNodeCount-1] = max_idx;
-            for  (long nodeID = iNodeCount-2; nodeID >=0 ; nodeID--) {
-                long parentState = parentStates.list_data[flatParents.list_data [nodeID+flatLeaves.lLength]];
-                if (parentState == -1) {
-                    parentStates.list_data[nodeID] = -1;
-                } else {
-                    parentStates.list_data[nodeID] = stateCache[(patternCount*nodeID+siteID)*alphabetDimension + parentState];
+
+                // parentStates: internal nodes (in post-order), then leaves
+
+                parentStates[iNodeCount-1] = max_idx;
+                for  (long nodeID = iNodeCount-2; nodeID >=0 ; nodeID--) {
+                    long parentState = parentStates[flatParents.list_data [nodeID+leafCount]];
+                    parentStates[nodeID] = parentState == -1L ? -1L : stateCache[(nodeID + leafCount)*alphabetDimension + parentState];
                 }
-            }
-            if (alsoDoLeaves)
-                for  (long nodeID = 0; nodeID <leafCount ; nodeID++) {
-                    long parentState = parentStates.list_data[flatParents.list_data [nodeID]];
-                    if (parentState == -1) {
-                        parentStates.list_data[nodeID+iNodeCount] = -1;
-                    } else {
-                        parentStates.list_data[nodeID+iNodeCount] = leafBuffer[(patternCount*nodeID+siteID)*alphabetDimension + parentState];
+                if (alsoDoLeaves) {
+                    for  (long nodeID = 0; nodeID <leafCount ; nodeID++) {
+                        long parentState = parentStates[flatParents.list_data [nodeID]];
+                        parentStates[nodeID+iNodeCount] = parentState == -1L ? -1L : stateCache[nodeID*alphabetDimension + parentState];
                     }
                 }
-        } else {
-            parentStates.Populate(stateCacheDim,-1,0);
-        }
-        
-        for  (long nodeID = 0; nodeID < stateCacheDim ; nodeID++) {
-            dsf->ConvertCodeToLettersBuffered (dsf->CorrectCode(parentStates.list_data[nodeID]), unitLength, codeBuffer, &conversionAVL);
-            _String  *sequence   = (_String*) (*result)(nodeID<iNodeCount?postToIn.list_data[nodeID]:nodeID);
-            
-            for (long site = 0; site < patternMap->lLength; site++) {
-                unsigned long offset = patternMap->list_data[site]*unitLength;
-                for (long charS = 0; charS < unitLength; charS ++) {
-                    sequence->set_char (offset + charS, codeBuffer.char_at(charS));
+            }
+
+            _SimpleList const*    patternMap = (_SimpleList const*) expandedSiteMap.GetItem(siteID);
+
+            for  (long nodeID = 0; nodeID < stateCacheDim ; nodeID++) {
+                char const * code     = letters.get_str() + (parentStates[nodeID] + 1L) * unitLength;
+                _String    * sequence = (_String*) (*result)(nodeID<iNodeCount?postToIn.list_data[nodeID]:nodeID);
+
+                for (unsigned long site = 0UL; site < patternMap->countitems(); site++) {
+                    unsigned long offset = patternMap->list_data[site]*unitLength;
+                    for (long charS = 0; charS < unitLength; charS ++) {
+                        sequence->set_char (offset + charS, code[charS]);
+                    }
                 }
             }
         }
     }
-    
-    delete [] stateCache;
-    delete [] leafBuffer;
-    delete [] buffer;
-    
+
+    delete [] workspace;
+    delete [] stateSpace;
+
     return result;
 }
 
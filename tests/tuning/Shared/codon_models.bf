@@ -0,0 +1,57 @@
+/*
+    shared by the tuning tests: the universal genetic code (codons in ACGT order) and an MG94xREV-style codon model
+*/
+
+genetic_code = "KNKNTTTTRSRSIIMIQHQHPPPPRRRRLLLLEDEDAAAAGGGGVVVV*Y*YSSSS*CWCLFLF";
+
+function define_mg94_model (position_freqs) {
+    /*
+        defines the global rate parameters omega (= 0.25), AC, AT, CG, CT and GT (= 1), the 61 x 61 rate matrix MG94
+        (with the local parameter synRate), its equilibrium frequencies freqs (from the 3 x 4 nucleotide frequencies by
+        codon position), and Model MG94model = (MG94, freqs, 0); returns the number of sense codons
+    */
+    codon_index = {64,1}["-1"];
+    sense       = 0;
+
+    for (k = 0; k < 64; k += 1) {
+        if (genetic_code[k] != "*") {
+            codon_index[k] = sense;
+            sense         += 1;
+        }
+    }
+
+    nuc_rates  = {{"", "AC*", "", "AT*"}{"", "", "CG*", "CT*"}{"", "", "", "GT*"}{"", "", "", ""}};
+    codon_freqs = {sense, 1};
+    ExecuteCommands ("global omega = 0.25; global AC = 1; global AT = 1; global CG = 1; global CT = 1; global GT = 1; MG94 = {" + sense + "," + sense + "}; freqs = {};");
+
+    for (from = 0; from < 64; from += 1) {
+        if (codon_index[from] >= 0) {
+            codon_freqs [codon_index[from]] = position_freqs[from $ 16][0] * position_freqs[(from % 16) $ 4][1] * position_freqs[from % 4][2];
+            for (to = 0; to < 64; to += 1) {
+                if (codon_index[to] >= 0 && to != from) {
+                    diff = from $ 16 != to $ 16 + ((from % 16) $ 4 != (to % 16) $ 4) + (from % 4 != to % 4);
+                    if (diff == 1) {
+                        if (from $ 16 != to $ 16) {
+                            position = 0; n1 = from $ 16; n2 = to $ 16;
+                        } else {
+                            if ((from % 16) $ 4 != (to % 16) $ 4) {
+                                position = 1; n1 = (from % 16) $ 4; n2 = (to % 16) $ 4;
+                            } else {
+                                position = 2; n1 = from % 4; n2 = to % 4;
+                            }
+                        }
+                        rate = nuc_rates[Min (n1, n2)][Max (n1, n2)] + "synRate*" + position_freqs[n2][position];
+                        if (genetic_code[from] != genetic_code[to]) {
+                            rate = "omega*" + rate;
+                        }
+                        ExecuteCommands ("MG94[" + codon_index[from] + "][" + codon_index[to] + "] := " + rate + ";");
+                    }
+                }
+            }
+        }
+    }
+
+    ^"freqs" = codon_freqs * (1 / (+codon_freqs));
+    ExecuteCommands ("Model MG94model = (MG94, freqs, 0);");
+    return sense;
+}
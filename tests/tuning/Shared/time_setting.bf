@@ -0,0 +1,89 @@
+/*
+    shared by the tuning tests: time a likelihood function defined with one value of a setting (an HBL variable
+    such as BATCH_EXPONENTIALS), so that tests can compare the log-likelihoods and the times of several values
+*/
+
+time_setting.runs = 0;
+
+function time_setting (setting, value, filter, options) {
+    /*
+        sets the variable named 'setting' to 'value', defines Tree T_<id> = DATAFILE_TREE (or the Newick string in the
+        variable named options["tree"]) and, with the model in use, LikelihoodFunction lf_<id> = (filter, T_<id>), and times (CPU, or wall clock with options["wall clock"])
+            options["evaluations"] (N) evaluations of lf_<id>, each one preceded by
+                Call (options["perturb"], "T_<id>", branches, k) (k = 0..N-1, branches = BranchName (T_<id>, -1)), or
+            Optimize (lf_<id>) with options["optimize"], or
+            the definition of lf_<id> (followed by one evaluation) with options["setup"];
+        every branch length (t) is set to options["branch length"] first if that is given, and 'setting' is set to
+        options["reset"] once lf_<id> is defined if that is given; prints
+            'setting' = 'value'options["label"] : the time, log L = the last log-likelihood
+        and returns {"id" : id, "logL" : the last log-likelihood, "values" : the N x 1 log-likelihoods, "time" : the time}
+    */
+    time_setting.runs += 1;
+    time_setting.value = value;
+    time_setting.id    = "" + time_setting.runs;
+    time_setting.tree  = "T_" + time_setting.id;
+    time_setting.lf    = "lf_" + time_setting.id;
+    time_setting.N     = options["evaluations"];
+    time_setting.clock = options["wall clock"] != 0;
+
+    ExecuteCommands (setting + " = time_setting.value;");
+    time_setting.newick = "DATAFILE_TREE";
+    if (options / "tree") {
+        time_setting.newick = options["tree"];
+    }
+    ExecuteCommands ("Tree " + time_setting.tree + " = " + time_setting.newick + ";");
+    time_setting.branches = BranchName (^time_setting.tree, -1);
+    if (options / "branch length") {
+        for (time_setting.b = 0; time_setting.b < Columns (time_setting.branches) - 1; time_setting.b += 1) {
+            ExecuteCommands (time_setting.tree + "." + time_setting.branches[time_setting.b] + ".t = " + options["branch length"] + ";");
+        }
+    }
+
+    time_setting.start = Time (time_setting.clock);
+    ExecuteCommands ("LikelihoodFunction " + time_setting.lf + " = (" + filter + ", " + time_setting.tree + ");");
+    time_setting.setup = Time (time_setting.clock) - time_setting.start;
+    if (options / "reset") {
+        time_setting.value = options["reset"];
+        ExecuteCommands (setting + " = time_setting.value;");
+    }
+
+    time_setting.rows   = Max (time_setting.N, 1);
+    time_setting.values = {time_setting.rows, 1};
+
+    if (options["optimize"]) {
+        time_setting.start = Time (time_setting.clock);
+        Optimize (time_setting.mles, ^time_setting.lf);
+        time_setting.time  = Time (time_setting.clock) - time_setting.start;
+        time_setting.values[0] = time_setting.mles[1][0];
+        time_setting.report    = Format (time_setting.time, 8, 3) + " s";
+    } else {
+        LFCompute (^time_setting.lf, LF_START_COMPUTE);
+        time_setting.start = Time (time_setting.clock);
+        for (time_setting.k = 0; time_setting.k < time_setting.N; time_setting.k += 1) {
+            if (options / "perturb") {
+                Call (options["perturb"], time_setting.tree, time_setting.branches, time_setting.k);
+            }
+            LFCompute (^time_setting.lf, time_setting.logL);
+            time_setting.values[time_setting.k] = time_setting.logL;
+        }
+        time_setting.time = Time (time_setting.clock) - time_setting.start;
+        if (options["setup"]) {
+            LFCompute (^time_setting.lf, time_setting.logL);
+            time_setting.values[0] = time_setting.logL;
+            time_setting.time      = time_setting.setup;
+            time_setting.report    = Format (time_setting.time, 8, 3) + " s setup";
+        } else {
+            time_setting.report    = Format (time_setting.time / time_setting.rows * 1000, 8, 3) + " ms/evaluation";
+        }
+        LFCompute (^time_setting.lf, LF_DONE_COMPUTE);
+    }
+
+    time_setting.logL  = time_setting.values[time_setting.rows - 1];
+    time_setting.label = "";
+    if (options / "label") {
+        time_setting.label = options["label"];
+    }
+    fprintf (stdout, setting, " = ", value, time_setting.label, " : ", time_setting.report, ", log L = ", Format (time_setting.logL, 20, 10), "\n");
+
+    return {"id" : time_setting.id, "logL" : time_setting.logL, "values" : time_setting.values, "time" : time_setting.time};
+}
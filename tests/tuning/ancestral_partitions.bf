@@ -0,0 +1,56 @@
+/*
+    joint ancestral reconstructions of a likelihood function with two partitions (the first and the second 300
+    sites of a nucleotide alignment, HKY85+G4 with shared parameters) are conditioned on the ML rate class of every
+    site pattern of each partition; the states reconstructed for each partition must be the same as those for a
+    likelihood function with that partition alone
+*/
+
+DataSet       ds    = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter part1 = CreateFilter (ds, 1, siteIndex < 300);
+DataSetFilter part2 = CreateFilter (ds, 1, siteIndex >= 300 && siteIndex < 600);
+HarvestFrequencies (nuc_freqs, ds, 1, 1, 1);
+
+global kappa = 4;
+global alpha = 0.5;
+alpha :> 0.01;
+alpha :< 100;
+
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+
+HKY85     = {{*, t*c, kappa*t*c, t*c}{t*c, *, t*c, kappa*t*c}{kappa*t*c, t*c, *, t*c}{t*c, kappa*t*c, t*c, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+assert (part1.sites == 300 && part2.sites == 300, "The partitions have " + part1.sites + " and " + part2.sites + " sites instead of 300");
+
+Tree T1 = DATAFILE_TREE;
+Tree T2 = DATAFILE_TREE;
+LikelihoodFunction lf_both = (part1, T1, part2, T2);
+DataSet both = ReconstructAncestors (lf_both);
+
+function reconstruct_alone (filter) {
+    ExecuteCommands ("Tree T_" + filter + " = DATAFILE_TREE; LikelihoodFunction lf_" + filter + " = (" + filter + ", T_" + filter + ");
+                      DataSet alone_" + filter + " = ReconstructAncestors (lf_" + filter + ");");
+    return 0;
+}
+
+reconstruct_alone ("part1");
+reconstruct_alone ("part2");
+
+DataSetFilter both_all  = CreateFilter (both, 1);
+DataSetFilter part1_all = CreateFilter (alone_part1, 1);
+DataSetFilter part2_all = CreateFilter (alone_part2, 1);
+GetString (names, both, -1);
+GetString (names1, alone_part1, -1);
+GetString (names2, alone_part2, -1);
+
+assert (both.species == alone_part1.species && both.species == alone_part2.species && both.sites == 600,
+        "The two-partition reconstruction has " + both.species + " sequences and " + both.sites + " sites");
+
+for (s = 0; s < both.species; s += 1) {
+    assert (names[s] == names1[s] && names[s] == names2[s], "Reconstructed sequence " + s + " is for " + names[s] + " instead of " + names1[s]);
+    GetDataInfo (sequence, both_all, s);
+    GetDataInfo (sequence1, part1_all, s);
+    GetDataInfo (sequence2, part2_all, s);
+    assert (sequence[0][299] == sequence1, "The states reconstructed for " + names[s] + " in the first partition depend on the other partition");
+    assert (sequence[300][599] == sequence2, "The states reconstructed for " + names[s] + " in the second partition depend on the other partition");
+}
@@ -0,0 +1,115 @@
+/*
+    ancestral states for an HKY85+G4 model (38 sequences, 300 sites), reconstructed from the conditional caches of the
+    optimized likelihood function: the reconstructions must leave the log-likelihood unchanged, the joint one must be
+    the same, byte for byte, as that of HyPhy before the caches were reused (data/yokoyama_joint_ancestors.fas), and
+    the states drawn by SampleAncestors with {"SAMPLES" : N} must agree with the marginal posterior support (and be
+    reproducible from RANDOM_SEED, including when they are spooled to a FILE, a fixed scratch path that every run overwrites);
+    the (CPU) time of one call for N samples is reported next to that of N calls for one sample each
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1, siteIndex < 300);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+global kappa = 4;
+global alpha = 0.5;
+alpha :> 0.01;
+alpha :< 100;
+
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+
+HKY85     = {{*, t*c, kappa*t*c, t*c}{t*c, *, t*c, kappa*t*c}{kappa*t*c, t*c, *, t*c}{t*c, kappa*t*c, t*c, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+Tree T = DATAFILE_TREE;
+LikelihoodFunction lf = (nucs, T);
+Optimize (mle, lf);
+
+start = Time (0);
+DataSet joint = ReconstructAncestors (lf);
+joint_time = Time (0) - start;
+
+start = Time (0);
+DataSet marginal = ReconstructAncestors (lf, MARGINAL);
+marginal_time = Time (0) - start;
+
+LFCompute (lf, LF_START_COMPUTE);
+LFCompute (lf, after_logL);
+LFCompute (lf, LF_DONE_COMPUTE);
+assert (Abs (after_logL - mle[1][0]) < 1e-8, "Ancestral reconstruction changed the log-likelihood of the likelihood function");
+
+DataSet       reference     = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama_joint_ancestors.fas");
+DataSetFilter reference_all = CreateFilter (reference, 1);
+DataSetFilter joint_all     = CreateFilter (joint, 1);
+GetString (joint_names, joint, -1);
+GetString (reference_names, reference, -1);
+assert (joint.species == reference.species && joint.sites == reference.sites,
+        "The joint reconstruction has " + joint.species + " sequences and " + joint.sites + " sites instead of " + reference.species + " and " + reference.sites);
+for (s = 0; s < joint.species; s += 1) {
+    GetDataInfo (sequence, joint_all, s);
+    GetDataInfo (sequence_again, reference_all, s);
+    assert (joint_names[s] == reference_names[s] && sequence == sequence_again, "The joint reconstruction of " + joint_names[s] + " differs from the reference");
+}
+
+sites   = nucs.sites;
+samples = 100;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+start = Time (0);
+DataSet sampled = SampleAncestors (lf, {"SAMPLES" : samples});
+sampled_time = Time (0) - start;
+
+assert (sampled.species == joint.species && sampled.sites == samples * sites,
+        "SampleAncestors returned " + sampled.species + " sequences and " + sampled.sites + " sites instead of " + joint.species + " and " + samples * sites);
+
+spool_file = "/tmp/hyphy_tuning_ancestral_samples.fas";
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet spooled = SampleAncestors (lf, {"SAMPLES" : samples, "FILE" : spool_file});
+DataSet spooled = ReadDataFile (spool_file);
+
+DataSetFilter marginal_all = CreateFilter (marginal, 1);
+DataSetFilter sampled_all  = CreateFilter (sampled, 1);
+DataSetFilter spooled_all  = CreateFilter (spooled, 1);
+GetString (names, marginal, -1);
+GetString (sampled_names, sampled, -1);
+assert (spooled.species == sampled.species && spooled.sites == sampled.sites, "The spooled samples have the wrong dimensions");
+
+// the number of draws of the state with the largest marginal support, and its expectation and variance
+
+support   = marginal.marginal_support_matrix;
+GetDataInfo (site_to_pattern, nucs);
+hits      = 0;
+expected  = 0;
+variance  = 0;
+
+for (s = 0; s < sampled.species; s += 1) {
+    assert (names[s] == sampled_names[s], "Sampled sequence " + s + " is for " + sampled_names[s] + " instead of " + names[s]);
+    GetDataInfo (sequence, sampled_all, s);
+    GetDataInfo (sequence_again, spooled_all, s);
+    assert (sequence == sequence_again, "The spooled samples for " + names[s] + " differ from those returned with the same random seed");
+    GetDataInfo (best, marginal_all, s);
+    for (i = 0; i < sites; i += 1) {
+        p      = site_to_pattern[i];
+        p_best = Max (Max (support[s][4*p], support[s][4*p+1]), Max (support[s][4*p+2], support[s][4*p+3]));
+        expected += samples * p_best;
+        variance += samples * p_best * (1 - p_best);
+        for (k = 0; k < samples; k += 1) {
+            hits += sequence[k * sites + i] == best[i];
+        }
+    }
+}
+
+assert (Abs (hits - expected) < 4 * Sqrt (variance),
+        "The sampled states agree with the marginal reconstruction " + hits + " times, which is inconsistent with the expected " + expected);
+
+// the classic loop
+
+start = Time (0);
+for (k = 0; k < samples; k += 1) {
+    DataSet one_sample = SampleAncestors (lf);
+}
+classic_time = Time (0) - start;
+
+fprintf (stdout, "Joint: ", Format (joint_time, 8, 3), " s, marginal: ", Format (marginal_time, 8, 3), " s; ",
+                 samples, " samples: ", Format (sampled_time, 8, 3), " s (one call), ", Format (classic_time, 8, 3), " s (", samples, " calls); ",
+                 "draws of the marginal state: ", hits, " (expected ", Format (expected, 10, 1), ")\n");
@@ -0,0 +1,27 @@
+/*
+    time (CPU) repeated likelihood evaluations of a codon (MG94xREV-style, 61 states) model
+    when a global parameter (omega) changes, so that every branch needs a new transition
+    matrix and all of them are multiples of the same rate matrix, with individual and
+    batched (BATCH_EXPONENTIALS) exponentiation; the log-likelihoods must agree to round-off
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter codons    = CreateFilter (ds, 3, "", "", "TAA,TAG,TGA");
+HarvestFrequencies (position_freqs, codons, 3, 1, 1);
+
+N = 200;
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+define_mg94_model (position_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function change_omega (tree_id, branches, k) {
+    omega = 0.1 + 0.01 * k;
+    return 0;
+}
+
+individual_logL = (time_setting ("BATCH_EXPONENTIALS", 0, "codons", {"evaluations" : N, "perturb" : "change_omega"}))["logL"];
+batched_logL    = (time_setting ("BATCH_EXPONENTIALS", 1, "codons", {"evaluations" : N, "perturb" : "change_omega"}))["logL"];
+
+assert (Abs (individual_logL - batched_logL) < 1e-8, "Batched and individual exponentiation produced different log-likelihoods");
@@ -0,0 +1,80 @@
+/*
+    gradients of the log-likelihood with respect to branch parameters, from one inside/outside pass per partition
+    (ComputeBranchGradients, used by the optimizer unless USE_ANALYTIC_GRADIENTS = 0), must agree with the forward
+    finite differences of ComputeGradient (LFCompute (lf, LF_GRADIENT) reports both) for a nucleotide model with rate
+    classes (HKY85 + gamma, branch lengths t) and a codon model (MG94xREV-style, synRate), each with one branch at its
+    lower bound (0); every branch parameter must have an analytic gradient, and the global parameters must not
+*/
+
+DataSet       ds     = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+tree_string          = DATAFILE_TREE;
+DataSetFilter nucs   = CreateFilter (ds, 1, siteIndex < 300);
+DataSetFilter codons = CreateFilter (ds, 3, siteIndex < 300, "", "TAA,TAG,TGA");
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+HarvestFrequencies (position_freqs, codons, 3, 1, 1);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+define_mg94_model (position_freqs);
+
+global kappa = 4;
+global alpha = 0.5;
+alpha :> 0.01;
+alpha :< 100;
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+HKY85 = {{*, t*c, kappa*t*c, t*c}{t*c, *, t*c, kappa*t*c}{kappa*t*c, t*c, *, t*c}{t*c, kappa*t*c, t*c, *}};
+Model HKYG = (HKY85, nuc_freqs, 1);
+
+function compare_gradients (filter, model, parameter) {
+    /*
+        sets branch 'parameter's to varying values, and that of the first internal branch to 0, and compares
+        the gradients of (filter, a tree with model) reported by LF_GRADIENT
+    */
+    ExecuteCommands ("UseModel (" + model + "); Tree T_" + model + " = tree_string; LikelihoodFunction lf_" + model + " = (" + filter + ", T_" + model + ");");
+    branches = BranchName (^("T_" + model), -1);
+    at_bound = "";
+    for (b = 0; b < Columns (branches) - 1; b += 1) {
+        branch = "T_" + model + "." + branches[b] + "." + parameter;
+        value  = 0.02 + 0.02 * (b % 5);
+        if (at_bound == "" && (branches[b] $ "^Node")[0] == 0) {
+            at_bound = branch;
+            value    = 0;
+        }
+        ExecuteCommands (branch + " = " + value + ";");
+    }
+    assert (at_bound != "", model + ": the tree has no internal branches");
+
+    LFCompute (^("lf_" + model), LF_START_COMPUTE);
+    LFCompute (^("lf_" + model), LF_GRADIENT);
+    LFCompute (^("lf_" + model), LF_DONE_COMPUTE);
+    ExecuteCommands ("report = lf_" + model + ".gradient;");
+
+    names            = report["Parameters"];
+    has_analytic     = report["Has analytic"];
+    analytic         = report["Analytic"];
+    numeric          = report["Numeric"];
+    branch_count     = 0;
+    largest_error    = 0;
+    bound_checked    = FALSE;
+
+    for (p = 0; p < Columns (names); p += 1) {
+        is_branch = (names[p] $ ("\\." + parameter + "$"))[0] >= 0;
+        assert (has_analytic[p] == is_branch, model + ": " + names[p] + " has an analytic gradient flag of " + has_analytic[p]);
+        if (is_branch) {
+            branch_count  += 1;
+            error          = Abs (analytic[p] - numeric[p]) / Max (1, Abs (numeric[p]));
+            largest_error  = Max (largest_error, error);
+            assert (error < 1e-3, model + ": the analytic gradient for " + names[p] + " is " + analytic[p] + ", and the finite difference one " + numeric[p]);
+            if (names[p] == at_bound) {
+                bound_checked = TRUE;
+            }
+        }
+    }
+
+    assert (branch_count == Columns (branches) - 1, model + ": " + branch_count + " branch parameters had gradients instead of " + (Columns (branches) - 1));
+    assert (bound_checked, model + ": the branch at its lower bound (" + at_bound + ") was not compared");
+    fprintf (stdout, model, " : ", branch_count, " branch gradients, largest relative difference ", Format (largest_error, 10, 3), "\n");
+    return 0;
+}
+
+compare_gradients ("nucs", "HKYG", "t");
+compare_gradients ("codons", "MG94model", "synRate");
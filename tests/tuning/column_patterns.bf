@@ -0,0 +1,85 @@
+/*
+    unique site patterns of long alignments, which are deduplicated from the per-sequence strings by column hashes
+    (in parallel over column ranges): 200000 simulated sites (8 sequences), and the first 1000 of them tiled 150 times,
+    are read back from FASTA; the sequences must be reproduced exactly, and the number of unique patterns must agree
+    with that found by a data filter over the same columns; the (CPU) time to read each alignment is reported
+*/
+
+global kappa = 4;
+freqs       = {{0.1}{0.2}{0.3}{0.4}};
+HKY85       = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY   = (HKY85, freqs, 1);
+Tree T      = ((a:0.1,b:0.2)n1:0.05,(c:0.3,d:0.1)n2:0.02,e:0.5);
+nucleotides = {{"A","C","G","T"}{"1","","",""}};
+
+sites  = 200000;
+block  = 1000;
+copies = 150;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet       sim     = Simulate (T, freqs, nucleotides, sites, 1);
+DataSetFilter sim_all = CreateFilter (sim, 1);
+DataSetFilter sim_block = CreateFilter (sim, 1, siteIndex < block);
+GetString (names, sim, -1);
+
+sequences = {};
+fasta     = "";
+tiled     = "";
+fasta * 128;
+tiled * 128;
+
+for (s = 0; s < sim.species; s += 1) {
+    GetDataInfo (sequence, sim_all, s);
+    sequences[s] = sequence;
+    fasta * (">" + names[s] + "\n" + sequence + "\n");
+    tiled * (">" + names[s] + "\n");
+    for (k = 0; k < copies; k += 1) {
+        tiled * (sequence[0][block - 1]);
+    }
+    tiled * "\n";
+}
+fasta * 0;
+tiled * 0;
+
+function filter_patterns (filter_name) {
+    GetDataInfo (site_to_pattern, ^filter_name);
+    return Max (site_to_pattern, 0) + 1;
+}
+
+function check_alignment (alignment_name, filter_name, expected_sites, expected_patterns, tile) {
+    species  = ^(alignment_name + ".species");
+    columns  = ^(alignment_name + ".sites");
+    patterns = ^(alignment_name + ".unique_sites");
+    assert (species == sim.species && columns == expected_sites,
+            alignment_name + " has " + species + " sequences and " + columns + " sites instead of " + sim.species + " and " + expected_sites);
+    assert (patterns == expected_patterns, alignment_name + " has " + patterns + " unique site patterns instead of " + expected_patterns);
+    filtered = filter_patterns (filter_name);
+    assert (filtered == expected_patterns, "The filter over " + alignment_name + " has " + filtered + " unique site patterns instead of " + expected_patterns);
+    for (s = 0; s < sim.species; s += 1) {
+        GetDataInfo (sequence, ^filter_name, s);
+        if (tile) {
+            for (k = 0; k < copies; k += 1) {
+                assert (sequence[k * block][(k + 1) * block - 1] == (sequences[s])[0][block - 1],
+                        "Copy " + k + " of sequence " + names[s] + " in " + alignment_name + " was not reproduced");
+            }
+        } else {
+            assert (sequence == sequences[s], "Sequence " + names[s] + " in " + alignment_name + " was not reproduced");
+        }
+    }
+    return patterns;
+}
+
+start = Time (0);
+DataSet long_alignment = ReadFromString (fasta);
+long_time = Time (0) - start;
+DataSetFilter long_all = CreateFilter (long_alignment, 1);
+long_patterns = check_alignment ("long_alignment", "long_all", sites, filter_patterns ("sim_all"), FALSE);
+
+start = Time (0);
+DataSet tiled_alignment = ReadFromString (tiled);
+tiled_time = Time (0) - start;
+DataSetFilter tiled_all = CreateFilter (tiled_alignment, 1);
+tiled_patterns = check_alignment ("tiled_alignment", "tiled_all", block * copies, filter_patterns ("sim_block"), TRUE);
+
+fprintf (stdout, sites, " sites (", long_patterns, " patterns): ", Format (long_time, 8, 3), " s, ",
+                 block * copies, " sites (", tiled_patterns, " patterns): ", Format (tiled_time, 8, 3), " s\n");
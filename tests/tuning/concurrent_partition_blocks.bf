@@ -0,0 +1,73 @@
+/*
+    site blocks of all partitions (and of the rate classes of a partition with one gamma category variable) pruned in one
+    parallel region (CONCURRENT_PARTITION_BLOCKS = TRUE) must give the same log-likelihood, to the last bit, as
+    partitions and rate classes evaluated one at a time; compared for three codon position partitions of a nucleotide
+    alignment, one of them with gamma rates, at the starting point, after changes to shared and local parameters, and
+    after optimizing both likelihood functions from the same starting point
+*/
+
+DataSet       ds    = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter pos1  = CreateFilter (ds, 1, siteIndex % 3 == 0);
+DataSetFilter pos2  = CreateFilter (ds, 1, siteIndex % 3 == 1);
+DataSetFilter pos3  = CreateFilter (ds, 1, siteIndex % 3 == 2);
+HarvestFrequencies (freqs, ds, 1, 1, 1);
+
+// the two likelihood functions share no parameters, so that each sees every change made to its own
+
+function define_likelihood_function (id, concurrent) {
+    ExecuteCommands ("
+        global kappa_ID = 2;
+        global alpha_ID = 0.5;
+        alpha_ID :> 0.01;
+        alpha_ID :< 100;
+        category c_ID = (4, EQUAL, MEAN, GammaDist(_x_,alpha_ID,alpha_ID), CGammaDist(_x_,alpha_ID,alpha_ID), 0, 1e25, CGammaDist(_x_,alpha_ID+1,alpha_ID));
+        HKY_ID  = {{*, t, kappa_ID*t, t}{t, *, t, kappa_ID*t}{kappa_ID*t, t, *, t}{t, kappa_ID*t, t, *}};
+        HKYG_ID = {{*, t*c_ID, kappa_ID*t*c_ID, t*c_ID}{t*c_ID, *, t*c_ID, kappa_ID*t*c_ID}{kappa_ID*t*c_ID, t*c_ID, *, t*c_ID}{t*c_ID, kappa_ID*t*c_ID, t*c_ID, *}};
+        Model M_ID  = (HKY_ID, freqs, 1);
+        Model MG_ID = (HKYG_ID, freqs, 1);
+        UseModel (M_ID);
+        Tree T1_ID = DATAFILE_TREE;
+        Tree T2_ID = DATAFILE_TREE;
+        UseModel (MG_ID);
+        Tree T3_ID = DATAFILE_TREE;
+        CONCURRENT_PARTITION_BLOCKS = concurrent;
+        LikelihoodFunction lf_ID = (pos1, T1_ID, pos2, T2_ID, pos3, T3_ID);
+        CONCURRENT_PARTITION_BLOCKS = FALSE;
+    " ^ {{"_ID", "_" + id}});
+    return 0;
+}
+
+define_likelihood_function ("serial", FALSE);
+define_likelihood_function ("concurrent", TRUE);
+
+function set_both (parameter, value) {
+    ExecuteCommands (parameter ^ {{"ID", "serial"}} + " = value; " + parameter ^ {{"ID", "concurrent"}} + " = value;");
+    return 0;
+}
+
+function compare_modes (label) {
+    LFCompute (lf_serial, LF_START_COMPUTE);
+    LFCompute (lf_serial, serial_logL);
+    LFCompute (lf_serial, LF_DONE_COMPUTE);
+    LFCompute (lf_concurrent, LF_START_COMPUTE);
+    LFCompute (lf_concurrent, concurrent_logL);
+    LFCompute (lf_concurrent, LF_DONE_COMPUTE);
+    assert (serial_logL == concurrent_logL, label + ": the log-likelihood is " + Format (concurrent_logL, 25, 17) +
+            " with concurrent partition blocks and " + Format (serial_logL, 25, 17) + " without");
+    return serial_logL;
+}
+
+start_logL = compare_modes ("the starting point");
+set_both ("kappa_ID", 4);
+assert (compare_modes ("a new kappa") != start_logL, "Changing kappa did not change the log-likelihood");
+set_both ("alpha_ID", 2);
+compare_modes ("a new alpha");
+set_both ("T2_ID.HS_Rhodopsin.t", 0.05);
+set_both ("T3_ID.HS_Rhodopsin.t", 0.05);
+compare_modes ("new branch lengths");
+
+Optimize (serial_mles, lf_serial);
+Optimize (concurrent_mles, lf_concurrent);
+assert (serial_mles[1][0] == concurrent_mles[1][0], "Optimization reached " + Format (concurrent_mles[1][0], 25, 17) +
+        " with concurrent partition blocks and " + Format (serial_mles[1][0], 25, 17) + " without");
+compare_modes ("the MLE");
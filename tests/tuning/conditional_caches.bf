@@ -0,0 +1,27 @@
+/*
+    time (CPU) repeated likelihood evaluations of a codon (MG94xREV-style, 61 states) model
+    with the default and the padded (PAD_CONDITIONAL_CACHES) conditional cache layouts;
+    the two layouts must also agree on the log-likelihood
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter codons    = CreateFilter (ds, 3, "", "", "TAA,TAG,TGA");
+HarvestFrequencies (position_freqs, codons, 3, 1, 1);
+
+N = 1000;
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+define_mg94_model (position_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function change_branch (tree_id, branches, k) {
+    /* a single branch changes per evaluation, as during branch-by-branch optimization */
+    ExecuteCommands (tree_id + "." + branches[k % (Columns (branches) - 1)] + ".synRate = " + (0.01 + 0.001 * (k % 7)) + ";");
+    return 0;
+}
+
+default_logL = (time_setting ("PAD_CONDITIONAL_CACHES", 0, "codons", {"evaluations" : N, "perturb" : "change_branch"}))["logL"];
+padded_logL  = (time_setting ("PAD_CONDITIONAL_CACHES", 1, "codons", {"evaluations" : N, "perturb" : "change_branch"}))["logL"];
+
+assert (Abs (default_logL - padded_logL) < 1e-8, "Padded and default cache layouts produced different log-likelihoods");
@@ -0,0 +1,110 @@
+/*
+    the covariance matrix of an HKY85 model with a local rate ratio on one branch (38 sequences, 300 sites), from the
+    Hessian computed in batches (COVARIANCE_PROCESSES), with the displacements of single branches evaluated from the
+    branch caches and the rest shared between 1 or 3 processes, and from differences of analytic branch gradients
+    (COVARIANCE_USE_GRADIENTS); the results must not depend on the number of processes, the two Hessians must agree,
+    the diagonal of the classic Hessian (taken around parameters moved off their bounds) must agree with them, the
+    classic and batched Hessians must agree to round-off, profile likelihood intervals must not depend on the number
+    of processes either, and the (CPU) times of the classic and batched Hessians are reported
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1, siteIndex < 300);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+global kappa = 4;
+HKY85     = {{*, t*r, kappa*t, t}{t*r, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+Tree T = DATAFILE_TREE;
+ReplicateConstraint ("this1.?.r:=1", T);
+ClearConstraints (T.EELA.r);
+T.EELA.r = 1;
+T.EELA.r :< 10;
+
+LikelihoodFunction lf = (nucs, T);
+Optimize (mle, lf);
+
+function covariance (processes, use_gradients) {
+    COVARIANCE_PROCESSES     = processes;
+    COVARIANCE_USE_GRADIENTS = use_gradients;
+    start = Time (0);
+    CovarianceMatrix (result, lf);
+    elapsed = Time (0) - start;
+    return result;
+}
+
+COVARIANCE_PRECISION = 2;
+
+classic          = covariance (0, FALSE);
+classic_time     = elapsed;
+batched          = covariance (1, FALSE);
+batched_time     = elapsed;
+batched_pooled   = covariance (3, FALSE);
+gradients        = covariance (1, TRUE);
+gradients_time   = elapsed;
+gradients_pooled = covariance (3, TRUE);
+
+parameters = Rows (classic);
+assert (Rows (batched) == parameters && Columns (batched) == parameters && Rows (gradients) == parameters, "CovarianceMatrix returned matrices of different dimensions");
+assert (batched == batched_pooled, "The batched covariance matrix differs between 1 and 3 processes");
+assert (gradients == gradients_pooled, "The covariance matrix from analytic gradients differs between 1 and 3 processes");
+
+batched_hessian   = Inverse (batched);
+gradients_hessian = Inverse (gradients);
+scale             = 0;
+difference        = 0;
+for (i = 0; i < parameters; i += 1) {
+    assert (batched[i][i] > 0 && gradients[i][i] > 0, "Parameter " + i + " has a non-positive variance");
+    for (j = 0; j < parameters; j += 1) {
+        scale      = Max (scale, Abs (batched_hessian[i][j]));
+        difference = Max (difference, Abs (batched_hessian[i][j] - gradients_hessian[i][j]));
+    }
+}
+assert (difference < 1e-3 * scale, "The Hessians from function values and from analytic gradients differ by " + difference + " (the largest entry is " + scale + ")");
+
+// the classic Hessian, with some branch lengths at their lower bound: the parameters are moved off the bounds, and the
+// diagonal terms must be differences around log L at the moved point, in agreement with those from analytic gradients
+
+at_bounds = 0;
+for (i = 0; i < parameters; i += 1) {
+    GetString (parameter_name, lf, i);
+    at_bounds += Eval (parameter_name) < 1e-5;
+}
+assert (at_bounds > 0, "No parameter is at its lower bound");
+
+classic_hessian = Inverse (classic);
+for (i = 0; i < parameters; i += 1) {
+    assert (Abs (classic_hessian[i][i] - gradients_hessian[i][i]) < 1e-3 * Abs (gradients_hessian[i][i]),
+            "The classic Hessian has " + classic_hessian[i][i] + " instead of " + gradients_hessian[i][i] + " for parameter " + i);
+}
+
+// the classic and batched Hessians use the same points (including the shorter steps near bounds), and only differ
+// by round-off in how the displaced log-likelihoods are evaluated
+
+difference = 0;
+for (i = 0; i < parameters; i += 1) {
+    for (j = 0; j < parameters; j += 1) {
+        difference = Max (difference, Abs (classic_hessian[i][j] - batched_hessian[i][j]));
+    }
+}
+assert (difference < 1e-5 * scale, "The classic and batched Hessians differ by " + difference + " (the largest entry is " + scale + ")");
+
+// profile likelihood intervals
+
+COVARIANCE_PRECISION = 0.95;
+COVARIANCE_PARAMETER = {"kappa" : 1, "T.EELA.r" : 1, "T.EELA.t" : 1, "T.CONGERA.t" : 1};
+profiles        = covariance (0, FALSE);
+profiles_pooled = covariance (3, FALSE);
+assert (profiles == profiles_pooled, "Profile likelihood intervals differ between 1 and 3 processes");
+for (i = 0; i < Rows (profiles); i += 1) {
+    assert (profiles[i][0] <= profiles[i][1] && profiles[i][1] <= profiles[i][2], "The profile likelihood interval for parameter " + i + " does not contain the estimate");
+}
+
+LFCompute (lf, LF_START_COMPUTE);
+LFCompute (lf, after_logL);
+LFCompute (lf, LF_DONE_COMPUTE);
+assert (Abs (after_logL - mle[1][0]) < 1e-8, "CovarianceMatrix changed the log-likelihood of the likelihood function");
+
+fprintf (stdout, parameters, " parameters; classic Hessian: ", Format (classic_time, 8, 3), " s, batched: ", Format (batched_time, 8, 3),
+                 " s, from analytic gradients: ", Format (gradients_time, 8, 3), " s (1 process)\n");
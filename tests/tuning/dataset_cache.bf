@@ -0,0 +1,103 @@
+/*
+    binary data set caches (file name + .hyphy-dset): with DATA_FILE_CACHE = TRUE, ReadDataFile saves the data set
+    read from a FASTA file (50000 simulated sites and a tree) next to the file, and later reads (also with
+    DATA_FILE_CACHE = TRUE) load the cache instead; the cached data set must match the one read from the file
+    (names, sequences, site-to-pattern map, pattern counts, DATAFILE_TREE, and the alphabet of an amino-acid file),
+    a cache must be ignored once its file has changed, and NEXUS files must not be cached; the (CPU) times to read
+    from the file and from the cache are reported
+*/
+
+scratch_file = "/tmp/hyphy_tuning_dataset_cache.fas"; // a fixed scratch path; it and its cache are overwritten by every run
+cache_file   = scratch_file + ".hyphy-dset";
+
+global kappa = 4;
+freqs       = {{0.1}{0.2}{0.3}{0.4}};
+HKY85       = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY   = (HKY85, freqs, 1);
+Tree T      = ((a:0.1,b:0.2)n1:0.05,(c:0.3,d:0.1)n2:0.02,e:0.5);
+nucleotides = {{"A","C","G","T"}{"1","","",""}};
+sites       = 50000;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet       sim     = Simulate (T, freqs, nucleotides, sites, 1);
+DataSetFilter sim_all = CreateFilter (sim, 1);
+GetString (names, sim, -1);
+
+fasta = "";
+fasta * 128;
+for (s = 0; s < sim.species; s += 1) {
+    GetDataInfo (sequence, sim_all, s);
+    fasta * (">" + names[s] + "\n" + sequence + "\n");
+}
+fasta * 0;
+
+tree_string = "((a,b),(c,d),e)";
+
+function compare_data_sets (label) {
+    assert (current.species == reference.species && current.sites == reference.sites && current.unique_sites == reference.unique_sites,
+            label + ": " + current.species + " sequences, " + current.sites + " sites and " + current.unique_sites +
+            " patterns instead of " + reference.species + ", " + reference.sites + " and " + reference.unique_sites);
+    GetString (current_names, current, -1);
+    GetString (reference_names, reference, -1);
+    assert (current_names == reference_names, label + ": the sequence names differ");
+    DataSetFilter current_all   = CreateFilter (current, 1);
+    DataSetFilter reference_all = CreateFilter (reference, 1);
+    GetDataInfo (current_map, current_all);
+    GetDataInfo (reference_map, reference_all);
+    assert (current_map == reference_map, label + ": the site-to-pattern maps differ");
+    GetDataInfo (current_alphabet, current_all, "CHARACTERS");
+    GetDataInfo (reference_alphabet, reference_all, "CHARACTERS");
+    assert (current_alphabet == reference_alphabet, label + ": the alphabets differ");
+    for (s = 0; s < reference.species; s += 1) {
+        GetDataInfo (current_sequence, current_all, s);
+        GetDataInfo (reference_sequence, reference_all, s);
+        assert (current_sequence == reference_sequence, label + ": sequence " + reference_names[s] + " differs");
+    }
+    return 0;
+}
+
+// saved, then loaded
+
+fprintf (scratch_file, CLEAR_FILE, fasta, tree_string, "\n");
+fprintf (cache_file, CLEAR_FILE); // an empty file (not a cache) in place of whatever a previous run left
+
+DATA_FILE_CACHE = TRUE;
+start = Time (0);
+DataSet current = ReadDataFile (scratch_file);
+file_time = Time (0) - start;
+fscanf (cache_file, REWIND, "Raw", cache_contents);
+assert (Abs (cache_contents) > 0, "No cache was saved for the FASTA file");
+assert (IS_TREE_PRESENT_IN_DATA && DATAFILE_TREE == tree_string, "The tree was not read from the FASTA file");
+DataSet reference = ReadFromString (fasta + tree_string + "\n");
+
+DATAFILE_TREE = "";
+start = Time (0);
+DataSet current = ReadDataFile (scratch_file);
+cache_time = Time (0) - start;
+compare_data_sets ("the cached alignment");
+assert (IS_TREE_PRESENT_IN_DATA && DATAFILE_TREE == tree_string, "The tree was not restored from the cache");
+
+// a changed file is read again
+
+fprintf (scratch_file, CLEAR_FILE, fasta, ">extra\n", sequence[0][999], "\n");
+DataSet current = ReadDataFile (scratch_file);
+DataSet reference = ReadFromString (fasta + ">extra\n" + sequence[0][999] + "\n");
+compare_data_sets ("the changed alignment");
+assert (IS_TREE_PRESENT_IN_DATA == FALSE, "A tree was restored from a stale cache");
+
+// amino acids
+
+fprintf (scratch_file, CLEAR_FILE, ">a\nMKVLAAGIVGLLLAQ\n>b\nMKVLSAGIVGXLLAQ\n>c\nmrvlaag-vglllaq\n");
+DataSet current = ReadDataFile (scratch_file);
+DataSet current = ReadDataFile (scratch_file);
+DataSet reference = ReadFromString (">a\nMKVLAAGIVGLLLAQ\n>b\nMKVLSAGIVGXLLAQ\n>c\nmrvlaag-vglllaq\n");
+compare_data_sets ("the cached amino-acid alignment");
+
+// NEXUS files are not cached
+
+nexus_cache = PATH_TO_CURRENT_BF + "data/yokoyama.nex.hyphy-dset";
+DataSet nexus = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DATA_FILE_CACHE = FALSE;
+assert (!nexus_cache == 0, "A NEXUS file was cached");
+
+fprintf (stdout, sites, " sites: ", Format (file_time, 8, 3), " s (FASTA file), ", Format (cache_time, 8, 3), " s (cache)\n");
@@ -0,0 +1,37 @@
+/*
+    transition matrices of a reversible nucleotide (GTR) model computed from cached eigen-decompositions of the
+    normalized rate matrix (USE_EIGEN_EXPONENTIALS) must give the same log-likelihoods, to round-off, as the Taylor
+    series exponentials, over evaluations in which branch lengths change and a rate parameter cycles through a few
+    values (so that decompositions are reused); the (CPU) times of both are reported
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1);
+HarvestFrequencies (freqs, nucs, 1, 1, 1);
+
+N = 1000;
+
+global AC = 0.5;
+global AT = 0.4;
+global CG = 0.3;
+global CT = 2.5;
+global GT = 0.6;
+GTR       = {{*, AC*t, t, AT*t}{AC*t, *, CG*t, CT*t}{t, CG*t, *, GT*t}{AT*t, CT*t, GT*t, *}};
+Model GTRmodel = (GTR, freqs, 1);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function change_rates (tree_id, branches, k) {
+    CT = 2 + 0.5 * (k % 3);
+    ExecuteCommands (tree_id + "." + branches[k % (Columns (branches) - 1)] + ".t = " + (0.01 + 0.05 * (k % 7)) + ";");
+    return 0;
+}
+
+options     = {"evaluations" : N, "perturb" : "change_rates", "reset" : FALSE};
+taylor_logL = (time_setting ("USE_EIGEN_EXPONENTIALS", FALSE, "nucs", options))["values"];
+eigen_logL  = (time_setting ("USE_EIGEN_EXPONENTIALS", TRUE,  "nucs", options))["values"];
+
+for (k = 0; k < N; k += 1) {
+    assert (Abs (taylor_logL[k] - eigen_logL[k]) < 1e-10 * Abs (taylor_logL[k]), "Evaluation " + k + ": the log-likelihood is " + Format (eigen_logL[k], 20, 12) +
+            " with eigen-decompositions and " + Format (taylor_logL[k], 20, 12) + " with Taylor series exponentials");
+}
@@ -0,0 +1,44 @@
+/*
+    time (wall clock) the optimization of an HKY85 model on six partitions (with a shared kappa)
+    evaluated by this process and by a pool of three worker processes (LOCAL_PROCESS_POOL);
+    partition log-likelihoods computed by the workers agree with those computed locally to within
+    round-off, so the two optima must agree to within the optimization precision
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+
+global kappa = 4;
+HKY85     = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+
+P = 6;
+
+for (p = 0; p < P; p += 1) {
+    ExecuteCommands ("DataSetFilter part_" + p + " = CreateFilter (ds, 1, siteIndex % " + P + " == " + p + ");
+                      HarvestFrequencies (freqs_" + p + ", part_" + p + ", 1, 1, 1);
+                      Model HKY_" + p + " = (HKY85, freqs_" + p + ");");
+}
+
+function time_pool (workers) {
+    LOCAL_PROCESS_POOL = workers;
+    lf_spec = "";
+    for (p = 0; p < P; p += 1) {
+        ExecuteCommands ("UseModel (HKY_" + p + "); Tree T_" + workers + "_" + p + " = DATAFILE_TREE;");
+        if (p) {
+            lf_spec += ",";
+        }
+        lf_spec += "part_" + p + ",T_" + workers + "_" + p;
+    }
+    ExecuteCommands ("LikelihoodFunction lf_" + workers + " = (" + lf_spec + ");");
+
+    start = Time (1);
+    Optimize (res, ^("lf_" + workers));
+    elapsed = Time (1) - start;
+
+    fprintf (stdout, "LOCAL_PROCESS_POOL = ", workers, " : ", Format (elapsed, 8, 3), " s, log L = ", Format (res[1][0], 20, 10), "\n");
+    return res[1][0];
+}
+
+local_optimum = time_pool (0);
+pool_optimum  = time_pool (3);
+
+assert (Abs (local_optimum - pool_optimum) < 0.01, "Optimization with and without a local process pool converged to different log-likelihoods");
@@ -0,0 +1,98 @@
+/*
+    FASTA files read by ReadDataFile, which parses them from a memory map of the file (in parallel over sequences,
+    deduplicating site patterns a chunk of columns at a time), must give the same alignment as the line by line reader
+    (ReadFromString on the text of the file): names, sequences, site and pattern counts, and the site-to-pattern map;
+    covers CRLF line ends, lower case, wrapped lines, sequences of different lengths, ambiguities, blank lines and
+    missing names (data/edge_cases.fas), amino acids, files the memory-mapped reader leaves to the line reader (commands, trees,
+    '.' for repeated characters, names listed before the data), and a long simulated alignment whose (CPU) reading
+    times by the two readers are reported
+*/
+
+scratch_file = "/tmp/hyphy_tuning_mapped_fasta.fas"; // a fixed scratch path, overwritten (CLEAR_FILE) by every run
+
+function compare_readers (file_name, label) {
+    fscanf (file_name, REWIND, "Raw", text);
+    start = Time (0);
+    DataSet mapped = ReadDataFile (file_name);
+    mapped_time = Time (0) - start;
+    start = Time (0);
+    DataSet lines = ReadFromString (text);
+    lines_time = Time (0) - start;
+
+    assert (mapped.species == lines.species && mapped.sites == lines.sites && mapped.unique_sites == lines.unique_sites,
+            label + ": " + mapped.species + " sequences, " + mapped.sites + " sites and " + mapped.unique_sites +
+            " patterns instead of " + lines.species + ", " + lines.sites + " and " + lines.unique_sites);
+
+    GetString (mapped_names, mapped, -1);
+    GetString (line_names, lines, -1);
+    assert (mapped_names == line_names, label + ": the sequence names differ");
+
+    DataSetFilter mapped_all = CreateFilter (mapped, 1);
+    DataSetFilter lines_all  = CreateFilter (lines, 1);
+    GetDataInfo (mapped_map, mapped_all);
+    GetDataInfo (lines_map, lines_all);
+    assert (mapped_map == lines_map, label + ": the site-to-pattern maps differ");
+    for (s = 0; s < mapped.species; s += 1) {
+        GetDataInfo (mapped_sequence, mapped_all, s);
+        GetDataInfo (line_sequence, lines_all, s);
+        assert (mapped_sequence == line_sequence, label + ": sequence " + line_names[s] + " differs");
+    }
+    return mapped.sites;
+}
+
+assert (compare_readers (PATH_TO_CURRENT_BF + "data/edge_cases.fas", "edge_cases.fas") == 40, "edge_cases.fas was not read as 40 sites");
+
+fprintf (scratch_file, CLEAR_FILE, ">a\nMKVLAAGIVGLLLAQ\n>b\nMKVLSAGIVGXLLAQ\n>c\nmrvlaag-vglllaq\n");
+compare_readers (scratch_file, "amino acids");
+DataSet       amino_acids     = ReadDataFile (scratch_file);
+DataSetFilter amino_acids_all = CreateFilter (amino_acids, 1);
+GetDataInfo (alphabet, amino_acids_all, "CHARACTERS");
+assert (Columns (alphabet) == 20, "The amino-acid alignment was read with " + Columns (alphabet) + " characters");
+
+// files the memory-mapped reader leaves to the line reader
+
+fallbacks = {"0" : ">a\nACGTACGT\n>b\nAC..ACGT\n>c\nACGT.CG\n",
+             "1" : ">a\n>b\nACGTACGT\nACGAACGT\n",
+             "2" : "#a\nACGTACGT\n#b\nACGAACGT\n",
+             "3" : "// comment\n>a\nACGTACGT\n>b\nACGAACGT\n",
+             "4" : ">a\nACGTACGT\n$ skipped\n>b\nACGAACGT\n"};
+
+for (k = 0; k < Abs (fallbacks); k += 1) {
+    fprintf (scratch_file, CLEAR_FILE, fallbacks[k]);
+    compare_readers (scratch_file, "case " + k);
+}
+
+fprintf (scratch_file, CLEAR_FILE, ">a\nACGTACGT\n>b\nACGAACGT\n(a,b)\n");
+DataSet with_tree = ReadDataFile (scratch_file);
+assert (with_tree.species == 2 && with_tree.sites == 8 && DATAFILE_TREE == "(a,b)", "The alignment and tree were not read from a FASTA file with a tree");
+
+// a long simulated alignment, with wrapped lines
+
+global kappa = 4;
+freqs       = {{0.1}{0.2}{0.3}{0.4}};
+HKY85       = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY   = (HKY85, freqs, 1);
+Tree T      = ((a:0.1,b:0.2)n1:0.05,(c:0.3,d:0.1)n2:0.02,e:0.5);
+nucleotides = {{"A","C","G","T"}{"1","","",""}};
+sites       = 100000;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet       sim     = Simulate (T, freqs, nucleotides, sites, 1);
+DataSetFilter sim_all = CreateFilter (sim, 1);
+GetString (names, sim, -1);
+
+fasta = "";
+fasta * 128;
+for (s = 0; s < sim.species; s += 1) {
+    GetDataInfo (sequence, sim_all, s);
+    fasta * (">" + names[s] + "\n");
+    for (k = 0; k < sites; k += 60) {
+        fasta * (sequence[k][Min (k + 60, sites) - 1] + "\n");
+    }
+}
+fasta * 0;
+fprintf (scratch_file, CLEAR_FILE, fasta);
+
+assert (compare_readers (scratch_file, "the simulated alignment") == sites, "The simulated alignment was not read as " + sites + " sites");
+
+fprintf (stdout, sites, " sites: ", Format (mapped_time, 8, 3), " s (memory map), ", Format (lines_time, 8, 3), " s (line reader)\n");
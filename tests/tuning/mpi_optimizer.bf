@@ -0,0 +1,125 @@
+/*
+    the MPI optimizer modes (AUTO_PARALLELIZE_OPTIMIZE), which send compute nodes only the parameter values that
+    changed since their last evaluation and collect results in whatever order the nodes finish, must reach the
+    maximum found without MPI (log-likelihoods within 1e-3):
+        partitions (1)    : six codon position x half partitions of a nucleotide alignment (HKY85), handed out to nodes
+                            in chunks from a queue, optimized twice, the second time starting from the partition costs
+                            measured in the first run;
+        site template (2) : a mixture of three HKY85 trees on the first 300 sites (branch lengths shared, scaled by a rate
+                            for each tree, log-likelihoods within 1e-2, because the mixture surface is flat), whose
+                            site likelihoods are computed by the nodes from the same queue;
+        auto (4)          : one partition (HKY85 + gamma) split into site blocks;
+        REL (3)           : the same, with one node per rate class.
+    The modes need 2 (partitions, site template), 3 (auto) and 5 (REL) MPI processes, e.g. mpirun -np 5; with fewer (or without MPI)
+    the likelihood function is optimized locally and the test only checks that every mode still gets there. The
+    (wall clock) time of each run is reported
+*/
+
+DataSet       ds = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+tree_string      = DATAFILE_TREE;
+
+global kappa;
+global alpha;
+alpha :> 0.01;
+alpha :< 100;
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+HKY85  = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+HKY85G = {{*, t*c, kappa*t*c, t*c}{t*c, *, t*c, kappa*t*c}{kappa*t*c, t*c, *, t*c}{t*c, kappa*t*c, t*c, *}};
+
+partitions = 6;
+for (p = 0; p < partitions; p += 1) {
+    ExecuteCommands ("DataSetFilter f_" + p + " = CreateFilter (ds, 1, siteIndex % 3 == " + (p % 3) + " && (siteIndex < ds.sites / 2) == " + (p < 3) + ");
+                      HarvestFrequencies (freqs_" + p + ", f_" + p + ", 1, 1, 1);
+                      Model M_" + p + " = (HKY85, freqs_" + p + ", 1);");
+}
+DataSetFilter all_sites = CreateFilter (ds, 1);
+HarvestFrequencies (all_freqs, all_sites, 1, 1, 1);
+Model MG = (HKY85G, all_freqs, 1);
+
+function define_partitioned () {
+    // the same starting point for every mode
+    kappa = 2;
+    spec  = "";
+    for (p = 0; p < partitions; p += 1) {
+        ExecuteCommands ("UseModel (M_" + p + "); Tree T_" + p + " = tree_string;");
+        if (p) {
+            spec += ",";
+        }
+        spec += "f_" + p + ", T_" + p;
+    }
+    ExecuteCommands ("LikelihoodFunction lf_partitioned = (" + spec + ");");
+    return 0;
+}
+
+DataSetFilter mix_sites = CreateFilter (ds, 1, siteIndex < 300);
+HarvestFrequencies (mix_freqs, mix_sites, 1, 1, 1);
+global r_1;
+global r_2;
+global P_1;
+global P_2;
+P_1 :< 1;
+P_2 :< 1;
+for (k = 0; k < 3; k += 1) {
+    ExecuteCommands ("HKY85_" + k + " = {{*, t*r_" + k + ", kappa*t*r_" + k + ", t*r_" + k + "}{t*r_" + k + ", *, t*r_" + k + ", kappa*t*r_" + k + "}{kappa*t*r_" + k + ", t*r_" + k + ", *, t*r_" + k + "}{t*r_" + k + ", kappa*t*r_" + k + ", t*r_" + k + ", *}};
+                      Model MM_" + k + " = (HKY85_" + k + ", mix_freqs, 1);");
+}
+
+function define_mixture () {
+    kappa = 2;
+    r_0   = 1;
+    r_1   = 0.2;
+    r_2   = 3;
+    P_1   = 0.3;
+    P_2   = 0.5;
+    for (k = 0; k < 3; k += 1) {
+        ExecuteCommands ("UseModel (MM_" + k + "); Tree T_mix_" + k + " = tree_string;");
+    }
+    ReplicateConstraint ("this1.?.t := this2.?.t", T_mix_1, T_mix_0);
+    ReplicateConstraint ("this1.?.t := this2.?.t", T_mix_2, T_mix_0);
+    LikelihoodFunction lf_mixture = (mix_sites, T_mix_0, mix_sites, T_mix_1, mix_sites, T_mix_2,
+                                     "Log(P_1*SITE_LIKELIHOOD[0]+(1-P_1)*P_2*SITE_LIKELIHOOD[1]+(1-P_1)*(1-P_2)*SITE_LIKELIHOOD[2])");
+    return 0;
+}
+
+function define_gamma () {
+    kappa = 2;
+    alpha = 0.5;
+    UseModel (MG);
+    Tree T_gamma = tree_string;
+    LikelihoodFunction lf_gamma = (all_sites, T_gamma);
+    return 0;
+}
+
+function fit (lf_name, mode, label) {
+    AUTO_PARALLELIZE_OPTIMIZE = mode;
+    start_time = Time (1);
+    Optimize (mles, ^lf_name);
+    elapsed    = Time (1) - start_time;
+    AUTO_PARALLELIZE_OPTIMIZE = 0;
+    fprintf (stdout, label, ", AUTO_PARALLELIZE_OPTIMIZE = ", mode, " : ", Format (elapsed, 8, 3), " s, log L = ", Format (mles[1][0], 15, 6), "\n");
+    return mles[1][0];
+}
+
+fprintf (stdout, "MPI_NODE_COUNT = ", MPI_NODE_COUNT, "\n");
+
+define_partitioned ();
+local_logL = fit ("lf_partitioned", 0, "partitions");
+define_partitioned ();
+mpi_logL   = fit ("lf_partitioned", 1, "partitions");
+assert (Abs (local_logL - mpi_logL) < 1e-3, "The partition MPI optimizer reached log L = " + mpi_logL + " instead of " + local_logL);
+mpi_logL   = fit ("lf_partitioned", 1, "partitions (rebalanced)");
+assert (Abs (local_logL - mpi_logL) < 1e-3, "The rebalanced partition MPI optimizer reached log L = " + mpi_logL + " instead of " + local_logL);
+
+define_mixture ();
+local_logL = fit ("lf_mixture", 0, "mixture");
+define_mixture ();
+mpi_logL   = fit ("lf_mixture", 2, "mixture");
+assert (Abs (local_logL - mpi_logL) < 1e-2, "The site template MPI optimizer reached log L = " + mpi_logL + " instead of " + local_logL);
+
+define_gamma ();
+local_logL = fit ("lf_gamma", 0, "gamma");
+for (mode = 3; mode <= 4; mode += 1) {
+    define_gamma ();
+    mpi_logL = fit ("lf_gamma", mode, "gamma");
+    assert (Abs (local_logL - mpi_logL) < 1e-3, "The MPI optimizer (AUTO_PARALLELIZE_OPTIMIZE = " + mode + ") reached log L = " + mpi_logL + " instead of " + local_logL);
+}
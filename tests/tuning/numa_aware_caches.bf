@@ -0,0 +1,37 @@
+/*
+    time (wall clock) repeated likelihood evaluations of an HKY85 model on a 349 sequence alignment,
+    with site blocks claimed dynamically by threads (default) and with NUMA_AWARE_CACHES, where each
+    thread always computes (and first touched) the same site slices of the conditional caches; the remote
+    access ratio of the placement is written to messages.log; the site block layout is the same in both
+    modes, so the log-likelihoods must agree exactly
+
+    run with several threads, e.g. hyphy CPU=8 numa_aware_caches.bf
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/InfluenzaA.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+N = 1000;
+
+global kappa = 4;
+HKY85     = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function alternate_changes (tree_id, branches, k) {
+    /* global and branch-local changes alternate, so that both full and partial traversals are timed */
+    if (k % 2) {
+        kappa = 4 + 0.01 * (k % 7);
+    } else {
+        ExecuteCommands (tree_id + "." + branches[k % (Columns (branches) - 1)] + ".t = " + (0.01 + 0.001 * (k % 7)) + ";");
+    }
+    return 0;
+}
+
+options      = {"evaluations" : N, "perturb" : "alternate_changes", "branch length" : 0.02, "wall clock" : TRUE};
+dynamic_logL = (time_setting ("NUMA_AWARE_CACHES", 0, "nucs", options))["logL"];
+numa_logL    = (time_setting ("NUMA_AWARE_CACHES", 1, "nucs", options))["logL"];
+
+assert (dynamic_logL == numa_logL, "Static (NUMA aware) and dynamic site block scheduling produced different log-likelihoods");
@@ -0,0 +1,144 @@
+/*
+    leaf states of single character nucleotide and amino-acid filters, which likelihood functions take from the
+    packed (4 and 5 bit) state codes of the filter: nucleotide (38 sequences, 300 sites) and amino-acid (the same
+    sequences translated, 100 sites) alignments with ambiguous characters sprinkled in must give the log-likelihoods
+    computed from one character at a time, and gaps, '?' and 'N' / 'X' must be interchangeable; the (CPU) time to
+    set up each likelihood function is reported
+*/
+
+DataSet       ds   = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+tree_string        = DATAFILE_TREE;
+DataSetFilter nucs = CreateFilter (ds, 1, siteIndex < 300);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+
+nucleotide_ambiguities = "RYKMSWBDHVN-?";
+protein_ambiguities    = "BZX-?";
+nucleotide_index       = {"A" : 0, "C" : 1, "G" : 2, "T" : 3};
+
+GetString (names, ds, -1);
+nucleotide_fasta = ""; nucleotide_fasta * 128;
+protein_fasta    = ""; protein_fasta * 128;
+gapless_fasta    = ""; gapless_fasta * 128;
+protein_gapless  = ""; protein_gapless * 128;
+
+for (s = 0; s < nucs.species; s += 1) {
+    GetDataInfo (sequence, nucs, s);
+    nucleotides = ""; nucleotides * 300;
+    gapless     = ""; gapless * 300;
+    for (i = 0; i < 300; i += 1) {
+        c = sequence[i];
+        if ((s * 31 + i * 17) % 23 == 0) {
+            c = nucleotide_ambiguities[(s + i) % 13];
+        }
+        nucleotides * c;
+        if (c == "-" || c == "?") {
+            c = "N";
+        }
+        gapless * c;
+    }
+    nucleotides * 0;
+    gapless * 0;
+
+    amino_acids = ""; amino_acids * 100;
+    aa_gapless  = ""; aa_gapless * 100;
+    for (i = 0; i < 300; i += 3) {
+        codon = nucleotide_index[sequence[i]] * 16 + nucleotide_index[sequence[i + 1]] * 4 + nucleotide_index[sequence[i + 2]];
+        c     = genetic_code[codon];
+        if (c == "*" || (s * 7 + i) % 11 == 0) {
+            c = protein_ambiguities[(s + i) % 5];
+        }
+        amino_acids * c;
+        if (c == "-" || c == "?") {
+            c = "X";
+        }
+        aa_gapless * c;
+    }
+    amino_acids * 0;
+    aa_gapless * 0;
+
+    nucleotide_fasta * (">" + names[s] + "\n" + nucleotides + "\n");
+    gapless_fasta    * (">" + names[s] + "\n" + gapless + "\n");
+    protein_fasta    * (">" + names[s] + "\n" + amino_acids + "\n");
+    protein_gapless  * (">" + names[s] + "\n" + aa_gapless + "\n");
+}
+nucleotide_fasta * 0;
+gapless_fasta * 0;
+protein_fasta * 0;
+protein_gapless * 0;
+
+function set_branch_lengths (tree_name) {
+    branches = BranchName (^tree_name, -1);
+    for (k = 0; k < Columns (branches) - 1; k += 1) {
+        ExecuteCommands (tree_name + "." + branches[k] + ".t = " + (0.02 + 0.01 * (k % 7)));
+    }
+    return 0;
+}
+
+function log_likelihood (lf_name) {
+    LFCompute (^lf_name, LF_START_COMPUTE);
+    LFCompute (^lf_name, result);
+    LFCompute (^lf_name, LF_DONE_COMPUTE);
+    return result;
+}
+
+// nucleotides
+
+global kappa = 4;
+HKY85     = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+nuc_freqs = {{0.3}{0.2}{0.2}{0.3}};
+Model HKY = (HKY85, nuc_freqs, 1);
+
+DataSet       nucleotide_data   = ReadFromString (nucleotide_fasta);
+DataSetFilter nucleotide_filter = CreateFilter (nucleotide_data, 1);
+DataSet       gapless_data      = ReadFromString (gapless_fasta);
+DataSetFilter gapless_filter    = CreateFilter (gapless_data, 1);
+
+Tree T_nuc = tree_string;
+set_branch_lengths ("T_nuc");
+Tree T_gapless = tree_string;
+set_branch_lengths ("T_gapless");
+
+start = Time (0);
+LikelihoodFunction lf_nuc = (nucleotide_filter, T_nuc);
+nucleotide_time = Time (0) - start;
+LikelihoodFunction lf_gapless = (gapless_filter, T_gapless);
+
+nucleotide_logL = log_likelihood ("lf_nuc");
+assert (Abs (nucleotide_logL - (-5272.996768284554)) < 1e-8, "The nucleotide log-likelihood is " + nucleotide_logL + " instead of -5272.996768284554");
+assert (Abs (log_likelihood ("lf_gapless") - nucleotide_logL) < 1e-10, "Replacing gaps with 'N' changed the nucleotide log-likelihood");
+
+// amino acids
+
+aa_freqs = {20, 1}["0.05"];
+Poisson  = {20, 20};
+for (r = 0; r < 20; r += 1) {
+    for (c = 0; c < 20; c += 1) {
+        if (r != c) {
+            Poisson[r][c] := t;
+        }
+    }
+}
+Model AA = (Poisson, aa_freqs, 1);
+
+DataSet       protein_data   = ReadFromString (protein_fasta);
+DataSetFilter protein_filter = CreateFilter (protein_data, 1);
+DataSet       aa_gapless_data   = ReadFromString (protein_gapless);
+DataSetFilter aa_gapless_filter = CreateFilter (aa_gapless_data, 1);
+
+Tree T_aa = tree_string;
+set_branch_lengths ("T_aa");
+Tree T_aa_gapless = tree_string;
+set_branch_lengths ("T_aa_gapless");
+
+start = Time (0);
+LikelihoodFunction lf_aa = (protein_filter, T_aa);
+protein_time = Time (0) - start;
+LikelihoodFunction lf_aa_gapless = (aa_gapless_filter, T_aa_gapless);
+
+protein_logL = log_likelihood ("lf_aa");
+assert (Abs (protein_logL - (-2659.386934339359)) < 1e-8, "The amino-acid log-likelihood is " + protein_logL + " instead of -2659.386934339359");
+assert (Abs (log_likelihood ("lf_aa_gapless") - protein_logL) < 1e-10, "Replacing gaps with 'X' changed the amino-acid log-likelihood");
+
+fprintf (stdout, "log L (nucleotides) = ", nucleotide_logL, ", log L (amino acids) = ", protein_logL,
+                 "; set up in ", Format (nucleotide_time, 8, 3), " s and ", Format (protein_time, 8, 3), " s\n");
@@ -0,0 +1,131 @@
+/*
+    all pairwise distances computed natively from bit-packed sequences (GetDataInfo (..., filter, "P_DISTANCES" /
+    "K2P_DISTANCES" / "TN93_DISTANCES")): for a nucleotide alignment (38 sequences, 300 sites, with ambiguities
+    and gaps sprinkled in) and its amino-acid translation, the matrices must agree with the distances computed one pair
+    at a time from GetDataInfo (..., filter, s1, s2, SKIP_AMBIGUITIES) and the formulae of libv3/tasks/distances.bf;
+    the (CPU) times of both approaches are reported
+*/
+
+DataSet       ds   = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs = CreateFilter (ds, 1, siteIndex < 300);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+
+nucleotide_ambiguities = "RYKMSWBDHVN-?";
+protein_ambiguities    = "BZX-?";
+nucleotide_index       = {"A" : 0, "C" : 1, "G" : 2, "T" : 3};
+
+GetString (names, ds, -1);
+nucleotide_fasta = ""; nucleotide_fasta * 128;
+protein_fasta    = ""; protein_fasta * 128;
+
+for (s = 0; s < nucs.species; s += 1) {
+    GetDataInfo (sequence, nucs, s);
+    nucleotides = ""; nucleotides * 300;
+    for (i = 0; i < 300; i += 1) {
+        c = sequence[i];
+        if ((s * 31 + i * 17) % 23 == 0) {
+            c = nucleotide_ambiguities[(s + i) % 13];
+        }
+        nucleotides * c;
+    }
+    nucleotides * 0;
+
+    amino_acids = ""; amino_acids * 100;
+    for (i = 0; i < 300; i += 3) {
+        codon = nucleotide_index[sequence[i]] * 16 + nucleotide_index[sequence[i + 1]] * 4 + nucleotide_index[sequence[i + 2]];
+        c     = genetic_code[codon];
+        if (c == "*" || (s * 7 + i) % 11 == 0) {
+            c = protein_ambiguities[(s + i) % 5];
+        }
+        amino_acids * c;
+    }
+    amino_acids * 0;
+
+    nucleotide_fasta * (">" + names[s] + "\n" + nucleotides + "\n");
+    protein_fasta    * (">" + names[s] + "\n" + amino_acids + "\n");
+}
+nucleotide_fasta * 0;
+protein_fasta * 0;
+
+DataSet       nucleotide_data   = ReadFromString (nucleotide_fasta);
+DataSetFilter nucleotide_filter = CreateFilter (nucleotide_data, 1);
+DataSet       protein_data      = ReadFromString (protein_fasta);
+DataSetFilter protein_filter    = CreateFilter (protein_data, 1);
+
+HarvestFrequencies (freqs, nucleotide_filter, 1, 1, 0);
+fY = freqs[1] + freqs[3];
+fR = 1 - fY;
+K1 = 2*freqs[0]*freqs[2]/fR;
+K2 = 2*freqs[1]*freqs[3]/fY;
+K3 = 2*(fR*fY-freqs[0]*freqs[2]*fY/fR-freqs[1]*freqs[3]*fR/fY);
+
+function pairwise (filter_name, model) {
+    sequence_count = ^(filter_name + ".species");
+    distances      = {sequence_count, sequence_count};
+    for (s1 = 0; s1 < sequence_count; s1 += 1) {
+        for (s2 = s1 + 1; s2 < sequence_count; s2 += 1) {
+            GetDataInfo (count, ^filter_name, s1, s2, SKIP_AMBIGUITIES);
+            compared = +count;
+            d = 0;
+            if (compared > 0) {
+                count = count * (1/compared);
+                if (model == "P") {
+                    d = 1 - (+count[count["_MATRIX_ELEMENT_COLUMN_==_MATRIX_ELEMENT_ROW_"]]);
+                } else {
+                    d             = 1000;
+                    AG            = count[0][2] + count[2][0];
+                    CT            = count[1][3] + count[3][1];
+                    transversions = 1 - AG - CT - count[0][0] - count[1][1] - count[2][2] - count[3][3];
+                    if (model == "K2P") {
+                        d1 = 1-2*(AG+CT)-transversions;
+                        d2 = 1-2*transversions;
+                        if (d1 > 0 && d2 > 0) {
+                            d = -(0.5*Log(d1)+.25*Log(d2));
+                        }
+                    } else {
+                        d1 = 1-AG/K1-0.5*transversions/fR;
+                        d2 = 1-CT/K2-0.5*transversions/fY;
+                        d3 = 1-0.5*transversions/fR/fY;
+                        if (d1 > 0 && d2 > 0 && d3 > 0) {
+                            d = -K1*Log(d1)-K2*Log(d2)-K3*Log(d3);
+                        }
+                    }
+                }
+            }
+            distances[s1][s2] = d;
+            distances[s2][s1] = d;
+        }
+    }
+    return distances;
+}
+
+function check_distances (filter_name, model) {
+    start = Time (0);
+    ExecuteCommands ("GetDataInfo (native, ^filter_name, \"" + model + "_DISTANCES\")");
+    native_time = Time (0) - start;
+    start = Time (0);
+    reference = pairwise (filter_name, model);
+    reference_time = Time (0) - start;
+
+    sequence_count = ^(filter_name + ".species");
+    assert (Rows (native) == sequence_count && Columns (native) == sequence_count, model + " distances for " + filter_name + " have the wrong dimensions");
+    for (s1 = 0; s1 < sequence_count; s1 += 1) {
+        assert (native[s1][s1] == 0, "The " + model + " distance of sequence " + s1 + " in " + filter_name + " to itself is not 0");
+        for (s2 = 0; s2 < sequence_count; s2 += 1) {
+            assert (Abs (native[s1][s2] - reference[s1][s2]) < 1e-12, "The " + model + " distance between sequences " + s1 + " and " + s2 + " in " + filter_name +
+                    " is " + native[s1][s2] + " instead of " + reference[s1][s2]);
+        }
+    }
+    return native_time;
+}
+
+check_distances ("nucleotide_filter", "P");
+check_distances ("nucleotide_filter", "K2P");
+check_distances ("nucleotide_filter", "TN93");
+tn93_native    = native_time;
+tn93_reference = reference_time;
+check_distances ("protein_filter", "P");
+
+fprintf (stdout, "TN93 distances between ", nucleotide_filter.species, " sequences: ", Format (tn93_native, 8, 3), " s (native), ",
+                 Format (tn93_reference, 8, 3), " s (one pair at a time)\n");
@@ -0,0 +1,111 @@
+/*
+    a parametric bootstrap of an HKY85+G4 model against the same model with kappa = 1 (38 sequences, 300 sites):
+    replicates are simulated as site patterns and refit in place (ParametricBootstrap), and the results must not
+    depend on the number of processes; the distribution of maximized log-likelihoods is compared to that from the
+    classic loop (SimulateDataSet with discrete rate classes, a new filter and likelihood function, Optimize), and the
+    (wall clock) times are reported
+*/
+
+CATEGORY_SIMULATION_METHOD = 1;
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1, siteIndex < 300);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+global kappa = 4;
+global alpha = 0.5;
+alpha :> 0.01;
+alpha :< 100;
+
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+
+HKY85     = {{*, t*c, kappa*t*c, t*c}{t*c, *, t*c, kappa*t*c}{kappa*t*c, t*c, *, t*c}{t*c, kappa*t*c, t*c, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+Tree T = DATAFILE_TREE;
+LikelihoodFunction lf = (nucs, T);
+Optimize (mle, lf);
+kappa_mle = kappa;
+alpha_mle = alpha;
+branches  = BranchName (T, -1);
+
+global kappa_null = 1;
+kappa_null := 1;
+HKY85_null = {{*, t*c, kappa_null*t*c, t*c}{t*c, *, t*c, kappa_null*t*c}{kappa_null*t*c, t*c, *, t*c}{t*c, kappa_null*t*c, t*c, *}};
+Model HKY_null = (HKY85_null, nuc_freqs);
+Tree T_null = DATAFILE_TREE;
+LikelihoodFunction lf_null = (nucs, T_null);
+
+replicates = 12;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+start = Time (1);
+ParametricBootstrap (serial, lf, replicates, {"REFIT" : {"0" : "lf", "1" : "lf_null"}});
+serial_time = Time (1) - start;
+
+LFCompute (lf, LF_START_COMPUTE);
+LFCompute (lf, after_logL);
+LFCompute (lf, LF_DONE_COMPUTE);
+assert (Abs (after_logL - mle[1][0]) < 1e-8, "ParametricBootstrap changed the log-likelihood of the simulating likelihood function");
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+start = Time (1);
+ParametricBootstrap (pooled, lf, replicates, {"REFIT" : {"0" : "lf", "1" : "lf_null"}, "PROCESSES" : 3});
+pooled_time = Time (1) - start;
+
+assert (Rows (serial) == replicates && Columns (serial) == 2, "ParametricBootstrap returned a matrix of the wrong dimensions");
+for (r = 0; r < replicates; r += 1) {
+    assert (serial[r][0] < 0 && serial[r][0] >= serial[r][1] - 1e-3, "Replicate " + r + " : the alternative model fit is worse than the null model fit");
+    assert (serial[r][0] == pooled[r][0] && serial[r][1] == pooled[r][1], "Replicate " + r + " differs between 1 and 3 processes");
+}
+
+// the classic loop
+
+classic = {replicates, 1};
+start   = Time (1);
+for (r = 0; r < replicates; r += 1) {
+    // kappa and alpha are shared with the likelihood function of the previous replicate, and
+    // (like ParametricBootstrap) every fit starts from the maximum likelihood estimates
+    kappa = kappa_mle;
+    alpha = alpha_mle;
+    DataSet       sim      = SimulateDataSet (lf);
+    DataSetFilter sim_nucs = CreateFilter (sim, 1);
+    UseModel (HKY);
+    Tree sim_T = DATAFILE_TREE;
+    for (b = 0; b < Columns (branches) - 1; b += 1) {
+        ExecuteCommands ("sim_T." + branches[b] + ".t = T." + branches[b] + ".t;");
+    }
+    LikelihoodFunction sim_lf = (sim_nucs, sim_T);
+    Optimize (sim_mle, sim_lf);
+    classic[r] = sim_mle[1][0];
+    DeleteObject (sim_lf);
+}
+classic_time = Time (1) - start;
+
+function column_mean (m) {
+    s = 0;
+    for (k = 0; k < replicates; k += 1) {
+        s += m[k][0];
+    }
+    return s / replicates;
+}
+
+function column_variance (m, mean) {
+    s = 0;
+    for (k = 0; k < replicates; k += 1) {
+        s += (m[k][0] - mean)^2;
+    }
+    return s / (replicates - 1);
+}
+
+fast_mean        = column_mean (serial);
+fast_variance    = column_variance (serial, fast_mean);
+classic_mean     = column_mean (classic);
+classic_variance = column_variance (classic, classic_mean);
+
+assert (Abs (fast_mean - classic_mean) < 4 * Sqrt ((fast_variance + classic_variance) / replicates),
+        "The mean replicate log-likelihood (" + fast_mean + ") is inconsistent with that from SimulateDataSet (" + classic_mean + ")");
+
+fprintf (stdout, "Log L ", Format (mle[1][0], 12, 4), "; mean replicate log L ", Format (fast_mean, 12, 4), " (SimulateDataSet: ", Format (classic_mean, 12, 4), ")\n",
+                 replicates, " replicates x 2 fits: ", Format (serial_time, 8, 3), " s (1 process), ", Format (pooled_time, 8, 3), " s (3 processes); ",
+                 replicates, " x 1 fit with SimulateDataSet: ", Format (classic_time, 8, 3), " s\n");
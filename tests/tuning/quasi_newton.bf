@@ -0,0 +1,64 @@
+/*
+    bounded L-BFGS (OPTIMIZATION_METHOD = "l-bfgs") must reach the same maximum as the default optimizer for a
+    nucleotide (GTR + gamma) model with branch lengths, starting from the same point: log-likelihoods within 1e-3,
+    and the substitution rates and alpha within 1%; its optimization log (PRODUCE_OPTIMIZATION_LOG) must record a
+    phase only when the search switches between gradient and quasi-Newton steps; the (CPU) times of both optimizers
+    are reported
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1);
+HarvestFrequencies (freqs, nucs, 1, 1, 1);
+
+global AC;
+global AT;
+global CG;
+global CT;
+global GT;
+global alpha;
+alpha :> 0.01;
+alpha :< 100;
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+GTR        = {{*, AC*t*c, t*c, AT*t*c}{AC*t*c, *, CG*t*c, CT*t*c}{t*c, CG*t*c, *, GT*t*c}{AT*t*c, CT*t*c, GT*t*c, *}};
+Model GTRmodel = (GTR, freqs, 1);
+rates = {{"AC", "AT", "CG", "CT", "GT", "alpha"}};
+
+function fit (method) {
+    // the same starting point for both optimizers
+    AC = 1; AT = 1; CG = 1; CT = 1; GT = 1; alpha = 0.5;
+    Tree T = DATAFILE_TREE;
+    LikelihoodFunction lf = (nucs, T);
+    start_time = Time (0);
+    if (method == "") {
+        Optimize (mles, lf);
+    } else {
+        Optimize (mles, lf, {"OPTIMIZATION_METHOD" : method, "PRODUCE_OPTIMIZATION_LOG" : 1});
+    }
+    elapsed   = Time (0) - start_time;
+    estimates = {1, Columns (rates)};
+    for (k = 0; k < Columns (rates); k += 1) {
+        estimates[k] = Eval (rates[k]);
+    }
+    label = method;
+    if (label == "") {
+        label = "default";
+    }
+    fprintf (stdout, "OPTIMIZATION_METHOD = ", label, " : ", Format (elapsed, 8, 3), " s, ", mles[1][1], " parameters, log L = ", Format (mles[1][0], 15, 6), "\n");
+    return mles[1][0];
+}
+
+default_logL      = fit ("");
+default_rates     = estimates;
+quasi_newton_logL = fit ("l-bfgs");
+
+assert (Abs (default_logL - quasi_newton_logL) < 1e-3, "L-BFGS reached log L = " + quasi_newton_logL + " instead of " + default_logL);
+for (k = 0; k < Columns (rates); k += 1) {
+    assert (Abs (estimates[k] - default_rates[k]) < 0.01 * default_rates[k], "L-BFGS estimated " + rates[k] + " = " + estimates[k] + " instead of " + default_rates[k]);
+}
+
+phases = lf.trace["Phases"];
+steps  = Rows (lf.trace["LogL"]) $ 2; // (log L, phase) for every step
+assert (Abs (phases) > 0 && Abs (phases) < steps, "The L-BFGS log has " + Abs (phases) + " phases for " + steps + " log-likelihood entries");
+for (k = 1; k < Abs (phases); k += 1) {
+    assert (((phases[k])["memory"] == 0) != ((phases[k-1])["memory"] == 0), "Phases " + (k-1) + " and " + k + " use the same kind of step");
+}
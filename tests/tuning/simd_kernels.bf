@@ -0,0 +1,90 @@
+/*
+    pruning kernels capped at a SIMD level (SIMD_KERNELS = "scalar", "avx2" or "avx512", the default) must give the
+    same log-likelihoods, to round-off, for amino-acid (20 states, the yokoyama sequences translated) and codon
+    (MG94xREV-style, 61 states) models, over evaluations in which branch lengths change (levels the CPU lacks fall back to
+    the highest one it has); the (CPU) times of each level are reported
+*/
+
+DataSet       ds     = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+tree_string          = DATAFILE_TREE;
+DataSetFilter nucs   = CreateFilter (ds, 1);
+DataSetFilter codons = CreateFilter (ds, 3, "", "", "TAA,TAG,TGA");
+HarvestFrequencies (position_freqs, codons, 3, 1, 1);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+
+N      = 50;
+levels = {{"scalar", "avx2", "avx512"}};
+
+// amino acids
+
+nucleotide_index = {"A" : 0, "C" : 1, "G" : 2, "T" : 3};
+GetString (names, ds, -1);
+protein_fasta = ""; protein_fasta * 128;
+
+for (s = 0; s < nucs.species; s += 1) {
+    GetDataInfo (sequence, nucs, s);
+    amino_acids = ""; amino_acids * (nucs.sites $ 3);
+    for (i = 0; i + 2 < nucs.sites; i += 3) {
+        c = "-";
+        if (nucleotide_index / sequence[i] && nucleotide_index / sequence[i + 1] && nucleotide_index / sequence[i + 2]) {
+            c = genetic_code[nucleotide_index[sequence[i]] * 16 + nucleotide_index[sequence[i + 1]] * 4 + nucleotide_index[sequence[i + 2]]];
+            if (c == "*") {
+                c = "-";
+            }
+        }
+        amino_acids * c;
+    }
+    amino_acids * 0;
+    protein_fasta * (">" + names[s] + "\n" + amino_acids + "\n");
+}
+protein_fasta * 0;
+
+DataSet       protein_data   = ReadFromString (protein_fasta);
+DataSetFilter protein_filter = CreateFilter (protein_data, 1);
+HarvestFrequencies (aa_freqs, protein_filter, 1, 1, 1);
+
+EqualInput = {20, 20};
+for (r = 0; r < 20; r += 1) {
+    for (c = 0; c < 20; c += 1) {
+        if (r != c) {
+            ExecuteCommands ("EqualInput[" + r + "][" + c + "] := " + (1 + ((r + c) % 5) / 4) + "*t;");
+        }
+    }
+}
+Model AA = (EqualInput, aa_freqs, 1);
+
+// codons
+
+define_mg94_model (position_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function change_branch (tree_id, branches, k) {
+    ExecuteCommands (tree_id + "." + branches[k % (Columns (branches) - 1)] + ".t = " + (0.01 + 0.02 * (k % 7)) + ";");
+    return 0;
+}
+
+function evaluate (filter, model, level) {
+    /*
+        N evaluations of (filter, a tree with model) with the pruning kernels capped at 'level'; returns the
+        log-likelihoods
+    */
+    ExecuteCommands ("UseModel (" + model + ");");
+    return (time_setting ("SIMD_KERNELS", level, filter, {"evaluations" : N, "perturb" : "change_branch", "reset" : "", "tree" : "tree_string", "label" : " (" + model + ")"}))["values"];
+}
+
+function compare_levels (filter, model) {
+    reference = evaluate (filter, model, levels[0]);
+    for (l = 1; l < Columns (levels); l += 1) {
+        vector_logL = evaluate (filter, model, levels[l]);
+        for (k = 0; k < N; k += 1) {
+            assert (Abs (reference[k] - vector_logL[k]) < 1e-10 * Abs (reference[k]), model + ", evaluation " + k + ": the log-likelihood is " + Format (vector_logL[k], 20, 12) +
+                    " with SIMD_KERNELS = " + levels[l] + " and " + Format (reference[k], 20, 12) + " with scalar kernels");
+        }
+    }
+    return 0;
+}
+
+compare_levels ("protein_filter", "AA");
+compare_levels ("codons", "MG94model");
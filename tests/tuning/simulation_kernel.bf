@@ -0,0 +1,132 @@
+/*
+    sequence simulation with alias tables per branch and (rate class); 200000 sites are simulated along a small
+    tree with the ancestral sequences kept, and the draws must be reproducible from RANDOM_SEED and independent of
+    the number of threads (SIMULATION_THREADS = 1 and 4); the equilibrium frequencies and pairwise differences (leaf to leaf
+    and leaf to ancestor) must agree with those expected from the transition matrices, and a gamma rate model
+    simulated with SimulateDataSet must reproduce itself as well; the (CPU) time per site is reported
+*/
+
+global kappa = 4;
+freqs       = {{0.1}{0.2}{0.3}{0.4}};
+HKY85       = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY   = (HKY85, freqs, 1);
+Tree T      = ((a:0.1,b:0.2)n1:0.05,(c:0.3,d:0.1)n2:0.02,e:0.5);
+nucleotides = {{"A","C","G","T"}{"1","","",""}};
+
+sites = 200000;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+start = Time (0);
+DataSet sim = Simulate (T, freqs, nucleotides, sites, 1);
+sim_time = Time (0) - start;
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet sim_again = Simulate (T, freqs, nucleotides, sites, 1);
+
+SIMULATION_THREADS = 1;
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet sim_one_thread = Simulate (T, freqs, nucleotides, sites, 1);
+SIMULATION_THREADS = 4;
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet sim_four_threads = Simulate (T, freqs, nucleotides, sites, 1);
+SIMULATION_THREADS = 0;
+
+assert (sim.species == 8 && sim.sites == sites, "Simulate returned " + sim.species + " sequences and " + sim.sites + " sites instead of 8 and " + sites);
+
+DataSetFilter all       = CreateFilter (sim, 1);
+DataSetFilter all_again = CreateFilter (sim_again, 1);
+DataSetFilter all_one   = CreateFilter (sim_one_thread, 1);
+DataSetFilter all_four  = CreateFilter (sim_four_threads, 1);
+GetString (names, sim, -1);
+
+for (s = 0; s < sim.species; s += 1) {
+    GetDataInfo (sequence, all, s);
+    GetDataInfo (sequence_again, all_again, s);
+    assert (sequence == sequence_again, "Sequence " + names[s] + " differs between two simulations with the same random seed");
+    GetDataInfo (sequence_one, all_one, s);
+    GetDataInfo (sequence_four, all_four, s);
+    assert (sequence_one == sequence && sequence_four == sequence, "Sequence " + names[s] + " depends on the number of simulation threads");
+}
+
+HarvestFrequencies (observed_freqs, all, 1, 1, 1);
+for (k = 0; k < 4; k += 1) {
+    assert (Abs (observed_freqs[k] - freqs[k]) < 0.005, "Observed frequency of " + nucleotides[0][k] + " (" + observed_freqs[k] + ") is inconsistent with " + freqs[k]);
+}
+
+// the expected proportion of differences between two sequences separated by a path of the given length (in units of t)
+
+Q = {4, 4};
+for (i = 0; i < 4; i += 1) {
+    for (j = 0; j < 4; j += 1) {
+        if (i != j) {
+            Q[i][j] = freqs[j] * (1 + (kappa - 1) * (Abs (i - j) == 2));
+            Q[i][i] += -Q[i][j];
+        }
+    }
+}
+function expected_differences (length) {
+    P = Exp (Q * length);
+    same = 0;
+    for (i = 0; i < 4; i += 1) {
+        same += freqs[i] * P[i][i];
+    }
+    return 1 - same;
+}
+
+function observed_differences (name1, name2) {
+    for (s = 0; s < sim.species; s += 1) {
+        if (names[s] == name1) {
+            i1 = s;
+        }
+        if (names[s] == name2) {
+            i2 = s;
+        }
+    }
+    GetDataInfo (pair_counts, all, i1, i2, RESOLVE_AMBIGUITIES);
+    return 1 - (pair_counts[0][0] + pair_counts[1][1] + pair_counts[2][2] + pair_counts[3][3]) / sites;
+}
+
+pairs = {{"a", "b", "0.3"}{"a", "n1", "0.1"}{"c", "e", "0.82"}{"n1", "n2", "0.07"}{"d", "n2", "0.1"}};
+for (p = 0; p < Rows (pairs); p += 1) {
+    observed = observed_differences (pairs[p][0], pairs[p][1]);
+    expected = expected_differences (+pairs[p][2]);
+    assert (Abs (observed - expected) < 0.005, "The proportion of differences between " + pairs[p][0] + " and " + pairs[p][1] + " (" + observed + ") is inconsistent with " + expected);
+}
+
+// discrete gamma rate classes through SimulateDataSet
+
+CATEGORY_SIMULATION_METHOD = 1;
+global alpha = 0.5;
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+HKY85G    = {{*, t*c, kappa*t*c, t*c}{t*c, *, t*c, kappa*t*c}{kappa*t*c, t*c, *, t*c}{t*c, kappa*t*c, t*c, *}};
+Model HKYG = (HKY85G, freqs, 1);
+Tree TG = ((a:0.1,b:0.2)n1:0.05,(c:0.3,d:0.1)n2:0.02,e:0.5);
+
+DataSetFilter leaves = CreateFilter (sim, 1, siteIndex < 1000, speciesIndex < 5);
+LikelihoodFunction lf = (leaves, TG);
+
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet gamma_sim = SimulateDataSet (lf, "", gamma_rates, gamma_rate_names);
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet gamma_sim_again = SimulateDataSet (lf, "", gamma_rates_again);
+SIMULATION_THREADS = 1;
+SetParameter (RANDOM_SEED, 20261018, 0);
+DataSet gamma_sim_one_thread = SimulateDataSet (lf, "", gamma_rates_one_thread);
+SIMULATION_THREADS = 0;
+
+assert (gamma_sim.species == 5 && gamma_sim.sites == 1000, "SimulateDataSet returned the wrong dimensions");
+assert (gamma_rates == gamma_rates_again, "Rate classes differ between two simulations with the same random seed");
+assert (gamma_rates == gamma_rates_one_thread, "Rate classes depend on the number of simulation threads");
+
+DataSetFilter gamma_all       = CreateFilter (gamma_sim, 1);
+DataSetFilter gamma_all_again = CreateFilter (gamma_sim_again, 1);
+DataSetFilter gamma_all_one   = CreateFilter (gamma_sim_one_thread, 1);
+for (s = 0; s < gamma_sim.species; s += 1) {
+    GetDataInfo (sequence, gamma_all, s);
+    GetDataInfo (sequence_again, gamma_all_again, s);
+    assert (sequence == sequence_again, "Sequence " + s + " of the gamma simulation differs between two simulations with the same random seed");
+    GetDataInfo (sequence_one, gamma_all_one, s);
+    assert (sequence_one == sequence, "Sequence " + s + " of the gamma simulation depends on the number of simulation threads");
+}
+
+fprintf (stdout, sites, " sites x 8 sequences simulated in ", Format (sim_time, 8, 3), " s (", Format (sim_time / sites * 1e6, 8, 3), " microseconds per site)\n");
@@ -0,0 +1,26 @@
+/*
+    time (CPU) the optimization of an HKY85 model with double and with single precision
+    (USE_SINGLE_PRECISION_CONDITIONALS) conditional caches; the log-likelihood at the
+    single precision optimum is recomputed in double precision and must agree with the
+    single precision value to within the reported error bound
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+global kappa = 4;
+HKY85     = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+double_optimum = (time_setting ("USE_SINGLE_PRECISION_CONDITIONALS", 0, "nucs", {"optimize" : TRUE}))["logL"];
+single         =  time_setting ("USE_SINGLE_PRECISION_CONDITIONALS", 1, "nucs", {"optimize" : TRUE});
+single_optimum = single["logL"];
+
+ExecuteCommands ("report = lf_" + single["id"] + ".precision;");
+fprintf (stdout, report, "\n");
+
+assert (report["Error"] <= report["Error bound"], "Single precision log-likelihood error exceeds the a priori bound");
+assert (Abs (report["LogL"] - single_optimum) < 1e-10, "Optimize did not return the double precision log-likelihood");
@@ -0,0 +1,62 @@
+/*
+    site blocks handed out dynamically to the threads of a likelihood function, while the same threads exponentiate
+    the transition matrices the blocks wait for, must give the same log-likelihoods, to round-off, as serial evaluation
+    (LIKELIHOOD_FUNCTION_THREADS = 1); compared for a nucleotide (GTR + gamma) and a codon (MG94xREV-style) model over
+    evaluations in which single branch lengths (partial traversals) and global rates (all matrices) change; the (CPU)
+    times of both are reported. Concurrent evaluation needs more than one OpenMP thread (e.g. OMP_NUM_THREADS=4)
+*/
+
+DataSet       ds     = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+tree_string          = DATAFILE_TREE;
+DataSetFilter nucs   = CreateFilter (ds, 1);
+DataSetFilter codons = CreateFilter (ds, 3, "", "", "TAA,TAG,TGA");
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+HarvestFrequencies (position_freqs, codons, 3, 1, 1);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+define_mg94_model (position_freqs);
+
+N = 60;
+
+global alpha = 0.5;
+alpha :> 0.01;
+alpha :< 100;
+category c = (4, EQUAL, MEAN, GammaDist(_x_,alpha,alpha), CGammaDist(_x_,alpha,alpha), 0, 1e25, CGammaDist(_x_,alpha+1,alpha));
+GTR = {{*, AC*t*c, t*c, AT*t*c}{AC*t*c, *, CG*t*c, CT*t*c}{t*c, CG*t*c, *, GT*t*c}{AT*t*c, CT*t*c, GT*t*c, *}};
+Model GTRmodel = (GTR, nuc_freqs, 1);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function change_rates (tree_id, branches, k) {
+    // every fifth evaluation changes the global rate (all matrices), the others a branch length (partial traversals)
+    if (k % 5 == 4) {
+        ^changed_rate = 0.5 + 0.25 * (k % 4);
+    } else {
+        ExecuteCommands (tree_id + "." + branches[k % (Columns (branches) - 1)] + ".t = " + (0.01 + 0.02 * (k % 7)) + ";");
+    }
+    return 0;
+}
+
+function evaluate (filter, model, global_rate, threads) {
+    /*
+        N evaluations of (filter, a tree with model) on at most 'threads' threads (0 for the default); every fifth one
+        changes 'global_rate', the others a branch length; returns the log-likelihoods
+    */
+    changed_rate  = global_rate;
+    ^changed_rate = 1;
+    ExecuteCommands ("UseModel (" + model + ");");
+    return (time_setting ("LIKELIHOOD_FUNCTION_THREADS", threads, filter, {"evaluations" : N, "perturb" : "change_rates", "reset" : 0, "tree" : "tree_string", "label" : " (" + model + ")"}))["values"];
+}
+
+function compare_modes (filter, model, global_rate) {
+    serial_logL     = evaluate (filter, model, global_rate, 1);
+    concurrent_logL = evaluate (filter, model, global_rate, 0);
+    for (k = 0; k < N; k += 1) {
+        assert (Abs (serial_logL[k] - concurrent_logL[k]) < 1e-10 * Abs (serial_logL[k]), model + ", evaluation " + k + ": the log-likelihood is " + Format (concurrent_logL[k], 20, 12) +
+                " with concurrent site blocks and " + Format (serial_logL[k], 20, 12) + " with serial evaluation");
+    }
+    return 0;
+}
+
+compare_modes ("nucs", "GTRmodel", "CT");
+compare_modes ("codons", "MG94model", "omega");
@@ -0,0 +1,35 @@
+/*
+    time (CPU) likelihood function setup on a 349 sequence alignment with the greedy (default) and
+    the sorted by leaf columns (OPTIMIZE_SUMMATION_ORDER = 2) site pattern orders, and with the
+    sorted order saved to and read from a SUMMATION_ORDER_CACHE directory (a fixed scratch path,
+    created by the first save; an order left there by a previous run is the same one, so the first
+    cached run may load it instead); the order only changes round-off, so all log-likelihoods must
+    agree closely
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/InfluenzaA.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+global kappa = 4;
+HKY85     = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+cache_directory = "/tmp/hyphy_tuning_summation_order";
+
+function time_order (mode, cache) {
+    SUMMATION_ORDER_CACHE = cache;
+    return (time_setting ("OPTIMIZE_SUMMATION_ORDER", mode, "nucs", {"setup" : TRUE, "branch length" : 0.02, "label" : ", cache = '" + cache + "'"}))["logL"];
+}
+
+greedy_logL    = time_order (1, "");
+sorted_logL    = time_order (2, "");
+saved_logL     = time_order (2, cache_directory);
+loaded_logL    = time_order (2, cache_directory);
+
+assert (!cache_directory, "The summation order cache directory was not created");
+
+assert (Abs (greedy_logL - sorted_logL) < 1e-8, "Greedy and sorted site pattern orders produced different log-likelihoods");
+assert (saved_logL == sorted_logL && loaded_logL == sorted_logL, "The cached site pattern order produced a different log-likelihood");
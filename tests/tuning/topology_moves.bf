@@ -0,0 +1,131 @@
+/*
+    a simple hill-climbing search over NNI and SPR moves on a 349 sequence alignment, with moves applied
+    to the likelihood function in place (LF_TOPOLOGY_MOVE) and rejected moves undone (LF_UNDO_TOPOLOGY_MOVE);
+    the log-likelihood after a move must agree with that of a likelihood function built from scratch on the
+    rearranged tree, and undoing a move must give back the log-likelihood from before the move;
+    the (CPU) time per proposal is compared to the time it takes to build and evaluate a new likelihood function
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/InfluenzaA.nex");
+DataSetFilter nucs      = CreateFilter (ds, 1);
+HarvestFrequencies (nuc_freqs, nucs, 1, 1, 1);
+
+global kappa = 4;
+HKY85     = {{*, t, kappa*t, t}{t, *, t, kappa*t}{kappa*t, t, *, t}{t, kappa*t, t, *}};
+Model HKY = (HKY85, nuc_freqs);
+
+Tree T = DATAFILE_TREE;
+branches = BranchName (T, -1);
+for (b = 0; b < Columns (branches) - 1; b += 1) {
+    ExecuteCommands ("T." + branches[b] + ".t = " + (0.005 + 0.002 * (b % 7)) + ";");
+}
+
+LikelihoodFunction lf = (nucs, T);
+
+function fresh_logL () {
+    // build a new tree (with the same branch lengths) and likelihood function on the current topology of T
+    DataSetFilter fresh_nucs = CreateFilter (ds, 1);
+    UseModel (HKY);
+    ExecuteCommands ("Tree fresh_T = " + Format (T, 1, 0) + ";");
+    for (b = 0; b < Columns (branches) - 1; b += 1) {
+        ExecuteCommands ("fresh_T." + branches[b] + ".t = T." + branches[b] + ".t;");
+    }
+    fresh_start = Time (0);
+    LikelihoodFunction fresh_lf = (fresh_nucs, fresh_T);
+    LFCompute (fresh_lf, LF_START_COMPUTE);
+    LFCompute (fresh_lf, fresh);
+    LFCompute (fresh_lf, LF_DONE_COMPUTE);
+    fresh_time += Time (0) - fresh_start;
+    fresh_count += 1;
+    return fresh;
+}
+
+function propose (index) {
+    // a deterministic sequence of (valid) NNI and SPR moves
+    avl    = T^0;
+    nodes  = Abs (avl) - 1;
+    root   = (avl[0])["Root"];
+    if (index % 2) {
+        for (v = (index * 37) % nodes + 1; ; v = v % nodes + 1) {
+            u = (avl[v])["Parent"];
+            if (Abs ((avl[v])["Children"]) && u) {
+                siblings = (avl[u])["Children"];
+                for (s = 0; s < Abs (siblings); s += 1) {
+                    if (siblings[s] != v) {
+                        return {"TREE" : "T", "MOVE" : "NNI", "SUBTREE" : (avl[((avl[v])["Children"])[0]])["Name"], "TARGET" : (avl[siblings[s]])["Name"]};
+                    }
+                }
+            }
+        }
+    }
+    for (x = (index * 53) % nodes + 1; ; x = x % nodes + 1) {
+        p = (avl[x])["Parent"];
+        if (p != root && Abs ((avl[p])["Children"]) == 2) {
+            sibling = ((avl[p])["Children"])[((avl[p])["Children"])[0] == x];
+            y = (x + nodes / 2 + 0.5) $ 1;
+            for (k = 0; k < nodes; k += 1) {
+                y = y % nodes + 1;
+                if (y != x && y != p && y != sibling && y != root) {
+                    // y may not be inside the subtree of x
+                    for (a = y; a && a != x; a = (avl[a])["Parent"]) {}
+                    if (a != x) {
+                        return {"TREE" : "T", "MOVE" : "SPR", "SUBTREE" : (avl[x])["Name"], "TARGET" : (avl[y])["Name"]};
+                    }
+                }
+            }
+        }
+    }
+}
+
+LFCompute (lf, LF_START_COMPUTE);
+LFCompute (lf, current_logL);
+initial_logL = current_logL;
+
+assert (Abs (current_logL - fresh_logL ()) < 1e-6, "The log-likelihood of the initial tree differs from that of a newly built likelihood function");
+
+proposals   = 40;
+accepted    = 0;
+move_time   = 0;
+fresh_time  = 0;
+fresh_count = 0;
+
+for (m = 0; m < proposals; m += 1) {
+    move = propose (m);
+    start = Time (0);
+    SetParameter (lf, LF_TOPOLOGY_MOVE, move);
+    LFCompute (lf, proposed_logL);
+    move_time += Time (0) - start;
+
+    if (m % 8 == 0) {
+        assert (Abs (proposed_logL - fresh_logL ()) < 1e-6, "The log-likelihood after " + move["MOVE"] + " (" + move["SUBTREE"] + ", " + move["TARGET"] + ") differs from that of a newly built likelihood function");
+    }
+
+    if (proposed_logL > current_logL) {
+        current_logL = proposed_logL;
+        accepted += 1;
+    } else {
+        start = Time (0);
+        SetParameter (lf, LF_UNDO_TOPOLOGY_MOVE, 0);
+        LFCompute (lf, restored_logL);
+        move_time += Time (0) - start;
+        assert (Abs (restored_logL - current_logL) < 1e-8, "Undoing " + move["MOVE"] + " (" + move["SUBTREE"] + ", " + move["TARGET"] + ") did not restore the log-likelihood");
+    }
+}
+
+// undo after branch lengths have been changed (and changed back) since the move: the affected path is recomputed
+
+move = propose (proposals);
+SetParameter (lf, LF_TOPOLOGY_MOVE, move);
+LFCompute (lf, proposed_logL);
+ExecuteCommands ("saved_t = T." + move["SUBTREE"] + ".t; T." + move["SUBTREE"] + ".t = 2 * saved_t;");
+LFCompute (lf, changed_logL);
+ExecuteCommands ("T." + move["SUBTREE"] + ".t = saved_t;");
+SetParameter (lf, LF_UNDO_TOPOLOGY_MOVE, 0);
+LFCompute (lf, restored_logL);
+LFCompute (lf, LF_DONE_COMPUTE);
+
+assert (Abs (restored_logL - current_logL) < 1e-8, "Undoing a move after parameter changes did not restore the log-likelihood");
+assert (Abs (current_logL - fresh_logL ()) < 1e-6, "The log-likelihood of the final tree differs from that of a newly built likelihood function");
+
+fprintf (stdout, "Log L ", Format (initial_logL, 20, 8), " -> ", Format (current_logL, 20, 8), " (", accepted, "/", proposals, " moves accepted)\n",
+                 Format (move_time / proposals * 1000, 10, 3), " ms per proposal vs ", Format (fresh_time / fresh_count * 1000, 10, 3), " ms to build and evaluate a new likelihood function\n");
@@ -0,0 +1,27 @@
+/*
+    time (CPU) repeated likelihood evaluations of a codon (MG94xREV-style, 61 states) model
+    when branch lengths revisit a small set of values, as they do during line searches,
+    without and with a transition matrix cache (TRANSITION_MATRIX_CACHE); cached matrices
+    are bit-identical to recomputed ones, so the log-likelihoods must agree exactly
+*/
+
+DataSet       ds        = ReadDataFile (PATH_TO_CURRENT_BF + "data/yokoyama.nex");
+DataSetFilter codons    = CreateFilter (ds, 3, "", "", "TAA,TAG,TGA");
+HarvestFrequencies (position_freqs, codons, 3, 1, 1);
+
+N = 1000;
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/codon_models.bf");
+define_mg94_model (position_freqs);
+
+ExecuteAFile (PATH_TO_CURRENT_BF + "Shared/time_setting.bf");
+
+function revisit_branch_length (tree_id, branches, k) {
+    ExecuteCommands (tree_id + "." + branches[k % (Columns (branches) - 1)] + ".synRate = " + (0.01 + 0.001 * (k % 7)) + ";");
+    return 0;
+}
+
+uncached_logL = (time_setting ("TRANSITION_MATRIX_CACHE", 0,   "codons", {"evaluations" : N, "perturb" : "revisit_branch_length"}))["logL"];
+cached_logL   = (time_setting ("TRANSITION_MATRIX_CACHE", 128, "codons", {"evaluations" : N, "perturb" : "revisit_branch_length"}))["logL"];
+
+assert (uncached_logL == cached_logL, "Cached and recomputed transition matrices produced different log-likelihoods");